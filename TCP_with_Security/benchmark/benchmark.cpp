@@ -0,0 +1,860 @@
+#include "benchmark.h"
+#include "../common/copycount.h"
+
+
+/**
+ *  The main function of the program.
+ *  Returns error code, 1 if a regression against the baseline was found.
+ */
+int main(int argc, char *argv[]) {
+
+    printf("<<< CRYPTO AND ENCODING MICRO-BENCHMARKS, by Cai and Steve >>>\n");     // Output program title.
+    if (argc < 2) {                                                                 // If no arguments.
+        printf("\nUSAGE: benchmark.exe [results.json] [baseline.json] [name_filter]\n");   // Alert user.
+    }
+    const char *resultsPath = argc > 1 ? argv[1] : "benchmark.json";                // Where to write results.
+    const char *baselinePath = argc > 2 ? argv[2] : NULL;                           // The baseline to compare with, if any.
+    const char *filter = argc > 3 ? argv[3] : NULL;                                 // Only run benchmarks whose name contains this.
+
+    long keys[KEY_COUNT][3] = { { 3, 1595, 2491 }, { 4297, 4633, 7171 }, { 3, 16971, 25777 }, { 13, 6397, 41989 } };   // Keys swept: { e, d, n }.
+    int lengths[LENGTH_COUNT] = { 1, 8, 32, 100 };                                  // Message lengths swept.
+    BenchmarkResult *results = new BenchmarkResult[MAX_RESULTS];                    // The results.
+    int resultCount = 0;                                                            // Number of results.
+    BenchmarkInput *input = new BenchmarkInput;                                     // Inputs, too large for the stack.
+    for (int k = 0; k < KEY_COUNT; k++) {                                           // Loop through keys.
+        prepareInput(*input, keys[k], 1);                                           // Single symbol kernels do not depend on length.
+        runBenchmark("repeatsquare_e", benchRepeatsquareEncrypt, *input, 1, filter, results, resultCount);
+        runBenchmark("repeatsquare_d", benchRepeatsquareDecrypt, *input, 1, filter, results, resultCount);
+        if (k == 0) {                                                               // CBC does not depend on the key.
+            runBenchmark("cbc", benchCbc, *input, 1, filter, results, resultCount);
+        }
+        input->keyFrame = buildKeyFrame(input->keyCA, input->key);                  // Build the frame the server would send for the key.
+        runBenchmark("keyFrameBuild", benchKeyFrameBuild, *input, input->keyFrame->length, filter, results, resultCount);
+        runBenchmark("keyFrameShare", benchKeyFrameShare, *input, input->keyFrame->length, filter, results, resultCount);
+        releaseKeyFrame(input->keyFrame);                                           // Free the frame.
+        for (int l = 0; l < LENGTH_COUNT; l++) {                                    // Loop through lengths.
+            prepareInput(*input, keys[k], lengths[l]);                              // Prepare inputs.
+            runBenchmark("encrypt", benchEncrypt, *input, lengths[l], filter, results, resultCount);
+            runBenchmark("decrypt", benchDecrypt, *input, lengths[l], filter, results, resultCount);
+            runBenchmark("decryptRSA", benchDecryptRSA, *input, lengths[l], filter, results, resultCount);
+            runBenchmark("decryptCBC", benchDecryptCBC, *input, lengths[l], filter, results, resultCount);
+            runBenchmark("encryptCTR", benchEncryptCTR, *input, lengths[l], filter, results, resultCount);
+            runBenchmark("decryptCTR", benchDecryptCTR, *input, lengths[l], filter, results, resultCount);
+            runBenchmark("encryptCA", benchEncryptCA, *input, lengths[l], filter, results, resultCount);
+            runBenchmark("decryptCA", benchDecryptCA, *input, lengths[l], filter, results, resultCount);
+            runBenchmark("createStringToSend", benchCreateStringToSend, *input, lengths[l], filter, results, resultCount);
+            runBenchmark("parseEncryptedMessage", benchParseEncryptedMessage, *input, lengths[l], filter, results, resultCount);
+            if (k == 0) {                                                           // Compression does not depend on the key.
+                runBenchmark("compress", benchCompress, *input, lengths[l], filter, results, resultCount);
+                if (input->compressedLength > 0) {                                  // If the message compresses.
+                    runBenchmark("decompress", benchDecompress, *input, lengths[l], filter, results, resultCount);
+                }
+            }
+        }
+    }
+    int error = benchCTRScaling(keys[KEY_COUNT - 1], filter, results, resultCount); // Scale counter mode across threads with the largest key.
+    error = error ? error : checkCompression();                                     // Check the compressor the timings above ran.
+    initRsaTables();                                                                // Tables are only built from here, so the passes above were all computed.
+    for (int k = 0; k < KEY_COUNT; k++) {                                           // Loop through keys again, table driven.
+        double buildStart = currentNanoseconds();                                   // Time the tables.
+        loadRsaTable(keys[k][0], keys[k][2], RSA_TABLE_THREADS);                    // Build the encrypt table.
+        loadRsaTable(keys[k][1], keys[k][2], RSA_TABLE_THREADS);                    // Build the decrypt table.
+        printf("tables/n=%-35ld %12.3f ms to build\n", keys[k][2], (currentNanoseconds() - buildStart) / 1e6);  // Alert user.
+        for (int l = 0; l < LENGTH_COUNT; l++) {                                    // Loop through lengths.
+            prepareInput(*input, keys[k], lengths[l]);                              // Prepare inputs.
+            runBenchmark("encrypt_table", benchEncrypt, *input, lengths[l], filter, results, resultCount);
+            runBenchmark("decrypt_table", benchDecrypt, *input, lengths[l], filter, results, resultCount);
+            runBenchmark("decryptRSA_table", benchDecryptRSA, *input, lengths[l], filter, results, resultCount);
+            runBenchmark("encryptCTR_table", benchEncryptCTR, *input, lengths[l], filter, results, resultCount);
+            runBenchmark("decryptCTR_table", benchDecryptCTR, *input, lengths[l], filter, results, resultCount);
+            runBenchmark("encryptCA_table", benchEncryptCA, *input, lengths[l], filter, results, resultCount);
+            runBenchmark("decryptCA_table", benchDecryptCA, *input, lengths[l], filter, results, resultCount);
+        }
+    }
+    startLogger(LOG_ERROR);                                                         // Only log the client functions' failures.
+    error = error ? error : startWSA();                                             // The loopback server's handler opens a wakeup socket.
+    initTransport();                                                                // Prepare for loopback pairs.
+    initMetrics();                                                                  // Prepare the metrics registry the loopback server records to.
+    initCertCache();                                                                // Handshakes after the first find the server key in the cache, as the load generator's do.
+    for (int k = 0; !error && k < KEY_COUNT; k++) {                                 // Loop through keys, with their tables built above.
+        error = benchLoopback(keys[k], lengths, filter, results, resultCount);      // Time the protocol over loopback pairs.
+    }
+    error = error ? error : benchJournal(keys[0], filter, results, resultCount);    // Time the journal, which does not depend on the key.
+    delete input;                                                                   // Free memory.
+    error = error ? error : writeResults(resultsPath, results, resultCount);        // Save results.
+    if (!error && baselinePath != NULL) {                                           // If there is a baseline.
+        error = compareWithBaseline(baselinePath, results, resultCount);            // Compare with it.
+    }
+    delete[] results;                                                               // Free memory.
+    return error;                                                                   // Return error code if any.
+}
+
+
+/**
+ *  Fills the benchmark inputs for a key and message length.
+ *  The encrypted forms are made with the kernels themselves so every kernel sees realistic input.
+ */
+void prepareInput(BenchmarkInput &input, long *key, int messageLength) {
+
+    memset(&input, 0, sizeof(BenchmarkInput));                                      // Ensure blank.
+    memcpy(input.key, key, sizeof(input.key));                                      // Store key.
+    long keyCA[3] = { 4297, 4633, 7171 };                                           // The server's CA key.
+    memcpy(input.keyCA, keyCA, sizeof(input.keyCA));                                // Store CA key.
+    input.messageLength = messageLength;                                            // Store length.
+    for (int i = 0; i < messageLength; i++) {                                       // Loop through message.
+        input.message[i] = 'a' + i % 26;                                            // Fill with letters.
+    }
+    strcpy(input.encryptedText, input.message);                                     // Encrypt a copy of the message.
+    int length = messageLength;                                                     // Stores the length of the encrypted text.
+    encrypt(input.encryptedText, length, key[0], key[2], 23);                       // Encrypt message.
+    input.encryptedTextLength = length;                                             // Store length.
+    char display[BUFFER_SIZE + 1];                                                  // Unused display copy of the values.
+    parseEncryptedMessage(input.encryptedText, length, input.encryptedValues, length, display); // Parse the values back out.
+    for (int i = 0; i < messageLength; i++) {                                       // Loop through message.
+        input.caValues[i] = repeatsquare(input.message[i], key[1], key[2]);         // Encrypt as encryptCA() does.
+    }
+    input.compressedLength = compressBlock(input.message, messageLength, input.compressed, BUFFER_SIZE);  // Compress as the client does.
+}
+
+
+/**
+ *  One RSA encryption of a symbol.
+ */
+void benchRepeatsquareEncrypt(BenchmarkInput &input) {
+
+    input.sink += repeatsquare(input.message[0] + (input.index++ & 63), input.key[0], input.key[2]);
+}
+
+
+/**
+ *  One RSA decryption of a symbol.
+ */
+void benchRepeatsquareDecrypt(BenchmarkInput &input) {
+
+    input.sink += repeatsquare(input.encryptedValues[0] + (input.index++ & 63), input.key[1], input.key[2]);
+}
+
+
+/**
+ *  One CBC step.
+ */
+void benchCbc(BenchmarkInput &input) {
+
+    input.sink = cbc(input.message[0] + (input.index++ & 63), input.sink);
+}
+
+
+/**
+ *  Encrypts the message, including copying the message into the buffer encrypt() overwrites.
+ */
+void benchEncrypt(BenchmarkInput &input) {
+
+    memcpy(input.scratch, input.message, input.messageLength + 1);                  // Copy message, including null terminator.
+    int length = input.messageLength;                                               // Stores the encrypted length.
+    encrypt(input.scratch, length, input.key[0], input.key[2], 23);                 // Encrypt message.
+    input.sink += length;                                                           // Keep result.
+}
+
+
+/**
+ *  Decrypts the message.
+ */
+void benchDecrypt(BenchmarkInput &input) {
+
+    int length = input.messageLength;                                               // Stores the decrypted length.
+    decrypt(input.encryptedValues, input.scratch, length, input.key[1], input.key[2], 23);  // Decrypt message.
+    input.sink += input.scratch[0];                                                 // Keep result.
+}
+
+
+/**
+ *  Removes RSA from the message, the first pass of decrypt().
+ */
+void benchDecryptRSA(BenchmarkInput &input) {
+
+    decryptRSA(input.encryptedValues, input.scratchValues, input.messageLength, input.key[1], input.key[2]);    // Decrypt with RSA.
+    input.sink += input.scratchValues[0];                                           // Keep result.
+}
+
+
+/**
+ *  Removes CBC from the message, the second pass of decrypt().
+ */
+void benchDecryptCBC(BenchmarkInput &input) {
+
+    decryptCBC(input.encryptedValues, input.scratch, input.messageLength, 23);      // Decrypt with CBC, the values need not be RSA decrypted to time it.
+    input.sink += input.scratch[0];                                                 // Keep result.
+}
+
+
+/**
+ *  Encrypts the message with the CA method, including copying the message into the buffer encryptCA() overwrites.
+ */
+void benchEncryptCA(BenchmarkInput &input) {
+
+    memcpy(input.scratch, input.message, input.messageLength + 1);                  // Copy message, including null terminator.
+    int length = input.messageLength;                                               // Stores the encrypted length.
+    encryptCA(input.scratch, length, input.key[1], input.key[2]);                   // Encrypt message.
+    input.sink += length;                                                           // Keep result.
+}
+
+
+/**
+ *  Decrypts the message with the CA method.
+ */
+void benchDecryptCA(BenchmarkInput &input) {
+
+    int length = input.messageLength;                                               // Stores the decrypted length.
+    decryptCA(input.caValues, input.scratch, length, input.key[0], input.key[2]);   // Decrypt message.
+    input.sink += input.scratch[0];                                                 // Keep result.
+}
+
+
+/**
+ *  Formats the encrypted values for the wire.
+ */
+void benchCreateStringToSend(BenchmarkInput &input) {
+
+    int length = input.messageLength;                                               // Stores the formatted length.
+    createStringToSend(input.scratch, input.encryptedValues, length);               // Format values.
+    input.sink += length;                                                           // Keep result.
+}
+
+
+/**
+ *  Parses the encrypted values from the wire.
+ */
+void benchParseEncryptedMessage(BenchmarkInput &input) {
+
+    int length = 0;                                                                 // Stores the number of values.
+    parseEncryptedMessage(input.encryptedText, input.encryptedTextLength, input.scratchValues, length, input.scratch);    // Parse values.
+    input.sink += input.scratchValues[length - 1];                                  // Keep result.
+}
+
+
+/**
+ *  Compresses the message before encryption.
+ */
+void benchCompress(BenchmarkInput &input) {
+
+    input.sink += compressBlock(input.message, input.messageLength, input.scratch, BUFFER_SIZE);
+}
+
+
+/**
+ *  Decompresses the message after decryption.
+ */
+void benchDecompress(BenchmarkInput &input) {
+
+    input.sink += decompressBlock(input.compressed, input.compressedLength, input.scratch, BUFFER_SIZE);
+}
+
+
+/**
+ *  Checks compression on generated messages, from a fixed seed so a failure repeats.
+ *  Each message that compresses must decompress to exactly what was compressed, and be refused by a buffer one byte too small.
+ *  Copies with a byte changed or the end cut off must be refused or decompress within the output, never writing past it.
+ *  Returns error code, 1 if any check failed.
+ */
+int checkCompression() {
+
+    unsigned int state = 1;                                                         // The fixed seed.
+    int roundTrips = 0;                                                             // Messages that compressed and came back intact.
+    int failures = 0;                                                               // Checks failed.
+    for (int c = 0; c < COMPRESS_FUZZ_CASES; c++) {                                 // Loop through messages.
+        char message[BUFFER_SIZE / 2];                                              // The message, at most what the server decompresses.
+        int length = 1 + fuzzRandom(state) % (BUFFER_SIZE / 2);                     // Its length.
+        int alphabet = 1 + fuzzRandom(state) % 8;                                   // Distinct bytes used, few give long repeats.
+        for (int i = 0; i < length; i++) {                                          // Loop through message.
+            message[i] = (char)(fuzzRandom(state) % 32 == 0 ? fuzzRandom(state) : 'a' + fuzzRandom(state) % alphabet);   // Mostly from the alphabet, sometimes any byte.
+        }
+        char compressed[BUFFER_SIZE];                                               // The compressed block.
+        int compressedLength = compressBlock(message, length, compressed, BUFFER_SIZE); // Compress it.
+        if (compressedLength <= 0) {                                                // If it does not compress.
+            continue;                                                               // Sent uncompressed, nothing to check.
+        }
+        char output[BUFFER_SIZE / 2 + COMPRESS_FUZZ_GUARD];                         // The decompressed block and the guard bytes after it.
+        memset(output, 0x5A, sizeof(output));                                       // Fill guard.
+        int outputLength = decompressBlock(compressed, compressedLength, output, length);  // Decompress it.
+        if (outputLength != length || memcmp(output, message, length) != 0 || decompressBlock(compressed, compressedLength, output, length - 1) != -1) {  // If changed, or too large a result was accepted.
+            printf("Compression round trip failed for generated message %d of %d bytes\n", c, length);    // Alert user.
+            failures++;                                                             // Count failure.
+            continue;                                                               // Next message.
+        }
+        roundTrips++;                                                               // Count round trip.
+        for (int k = 0; k < COMPRESS_FUZZ_CORRUPTIONS; k++) {                       // Loop through corruptions.
+            char corrupt[BUFFER_SIZE];                                              // The corrupted block.
+            memcpy(corrupt, compressed, compressedLength);                          // Copy block.
+            int corruptLength = compressedLength;                                   // Its length.
+            if (k % 4 == 3) {                                                       // One in four.
+                corruptLength = fuzzRandom(state) % compressedLength;               // Cut off the end.
+            } else {                                                                // Else.
+                corrupt[fuzzRandom(state) % compressedLength] = (char)fuzzRandom(state);   // Change a byte.
+            }
+            memset(output, 0x5A, sizeof(output));                                   // Fill guard.
+            outputLength = decompressBlock(corrupt, corruptLength, output, length); // Decompress it.
+            bool guardKept = true;                                                  // True if nothing was written past the capacity.
+            for (int g = length; g < (int)sizeof(output); g++) {                    // Loop through guard.
+                guardKept = guardKept && output[g] == 0x5A;                         // Check byte.
+            }
+            if (outputLength < -1 || outputLength > length || !guardKept) {         // If out of range or overrun.
+                printf("Corrupt compressed block %d of generated message %d was not refused\n", k, c);   // Alert user.
+                failures++;                                                         // Count failure.
+            }
+        }
+    }
+    printf("%-44s %12d round trips %6d corruptions, %d failed\n", "compress_fuzz", roundTrips, roundTrips * COMPRESS_FUZZ_CORRUPTIONS, failures);  // Alert user.
+    return failures > 0 ? 1 : 0;                                                    // Return error code if any.
+}
+
+
+/**
+ *  Gets the next number of a fixed sequence, xorshift so the generated messages are the same on every run.
+ *  Returns the number.
+ */
+unsigned int fuzzRandom(unsigned int &state) {
+
+    state ^= state << 13;                                                           // Shift and mix.
+    state ^= state >> 17;                                                           // Shift and mix.
+    state ^= state << 5;                                                            // Shift and mix.
+    return state;                                                                   // Return number.
+}
+
+
+/**
+ *  Encrypts the message in counter mode, including copying the message into the buffer encryptCTR() overwrites.
+ */
+void benchEncryptCTR(BenchmarkInput &input) {
+
+    memcpy(input.scratch, input.message, input.messageLength + 1);                  // Copy message, including null terminator.
+    int length = input.messageLength;                                               // Stores the encrypted length.
+    long long counter = 0;                                                          // Pads from the start of a session.
+    encryptCTR(input.scratch, length, input.key[0], input.key[2], 23, counter);     // Encrypt message.
+    input.sink += length;                                                           // Keep result.
+}
+
+
+/**
+ *  Decrypts the message in counter mode, both passes as the server runs them.
+ */
+void benchDecryptCTR(BenchmarkInput &input) {
+
+    decryptRSA(input.encryptedValues, input.scratchValues, input.messageLength, input.key[1], input.key[2]);    // Decrypt with RSA.
+    long long counter = 0;                                                          // Pads from the start of a session.
+    decryptCTR(input.scratchValues, input.scratch, input.messageLength, 23, counter);   // Decrypt with counter mode, the values need not be counter mode encrypted to time it.
+    input.sink += input.scratch[0];                                                 // Keep result.
+}
+
+
+/**
+ *  Encrypts the bulk buffer in counter mode on the pool.
+ */
+void benchEncryptCTRBulk(BenchmarkInput &input) {
+
+    encryptCTRValues(input.bulkPlain, input.bulkValues, BULK_SYMBOLS, input.key[0], input.key[2], 23, input.pool);  // Encrypt buffer.
+    input.sink += input.bulkValues[BULK_SYMBOLS - 1];                               // Keep result.
+}
+
+
+/**
+ *  Decrypts the bulk buffer in counter mode on the pool.
+ */
+void benchDecryptCTRBulk(BenchmarkInput &input) {
+
+    decryptCTRValues(input.bulkValues, input.bulkDecrypted, BULK_SYMBOLS, input.key[1], input.key[2], 23, input.pool);  // Decrypt buffer.
+    input.sink += input.bulkDecrypted[BULK_SYMBOLS - 1];                            // Keep result.
+}
+
+
+/**
+ *  Times bulk counter mode against the number of threads, doubling from 1 up to the number of processors.
+ *  The buffer is decrypted after each run and compared with the original, so a chunking error fails the benchmark.
+ *  Returns error code.
+ */
+int benchCTRScaling(long *key, const char *filter, BenchmarkResult *results, int &resultCount) {
+
+    BenchmarkInput *input = new BenchmarkInput;                                     // Inputs, too large for the stack.
+    prepareInput(*input, key, 1);                                                   // Prepare key.
+    input->bulkPlain = new char[BULK_SYMBOLS];                                      // Plain text.
+    input->bulkValues = new long[BULK_SYMBOLS];                                     // Encrypted values.
+    input->bulkDecrypted = new char[BULK_SYMBOLS];                                  // Decrypted text.
+    for (long i = 0; i < BULK_SYMBOLS; i++) {                                       // Loop through buffer.
+        input->bulkPlain[i] = 'a' + i % 26;                                         // Fill with letters.
+    }
+    int error = 0;                                                                  // Error code.
+    int processors = processorCount();                                              // Most threads used.
+    for (int threads = 1; !error && threads <= processors; threads = threads * 2 > processors && threads < processors ? processors : threads * 2) {
+        input->pool = createThreadPool(threads - 1);                                // The caller is one of the threads.
+        char kernel[40];                                                            // Kernel name, including the thread count.
+        sprintf(kernel, "encryptCTR_threads=%d", threads);                          // Name kernel.
+        runBenchmark(kernel, benchEncryptCTRBulk, *input, BULK_SYMBOLS, filter, results, resultCount);
+        sprintf(kernel, "decryptCTR_threads=%d", threads);                          // Name kernel.
+        encryptCTRValues(input->bulkPlain, input->bulkValues, BULK_SYMBOLS, key[0], key[2], 23, input->pool);   // Encrypt the buffer for decryption, in case encryption was filtered out.
+        runBenchmark(kernel, benchDecryptCTRBulk, *input, BULK_SYMBOLS, filter, results, resultCount);
+        decryptCTRValues(input->bulkValues, input->bulkDecrypted, BULK_SYMBOLS, key[1], key[2], 23, input->pool);  // Decrypt once more to check.
+        if (memcmp(input->bulkPlain, input->bulkDecrypted, BULK_SYMBOLS) != 0) {    // If the round trip changed the text.
+            printf("Counter mode round trip failed with %d threads\n", threads);   // Alert user.
+            error = 1;                                                              // Fail the benchmarks.
+        }
+        destroyThreadPool(input->pool);                                             // Stop the pool.
+    }
+    delete[] input->bulkPlain;                                                      // Free memory.
+    delete[] input->bulkValues;                                                     // Free memory.
+    delete[] input->bulkDecrypted;                                                  // Free memory.
+    delete input;                                                                   // Free memory.
+    return error;                                                                   // Return error code if any.
+}
+
+
+/**
+ *  Builds a key frame for one handshake, as the server did for every client before frames were shared.
+ */
+void benchKeyFrameBuild(BenchmarkInput &input) {
+
+    KeyFrame *frame = buildKeyFrame(input.keyCA, input.key);                        // Encrypt the frame.
+    input.sink += frame->length;                                                    // Keep result.
+    releaseKeyFrame(frame);                                                         // Free the frame.
+}
+
+
+/**
+ *  Shares the built key frame with one handshake, the server's cost per client now the frame is built once.
+ */
+void benchKeyFrameShare(BenchmarkInput &input) {
+
+    KeyFrame *frame = acquireKeyFrame(input.keyFrame);                              // Hold the frame, as a client does.
+    input.sink += frame->length;                                                    // Keep result.
+    releaseKeyFrame(frame);                                                         // Release it, as a client does on disconnect.
+}
+
+
+/**
+ *  Runs a whole handshake over a new loopback pair, the client's own functions against the server's session code.
+ *  The server adds the client, sends the shared key frame and processes the ACK and the nOnce as runServer() does, then the client disconnects.
+ */
+void benchLoopbackHandshake(BenchmarkInput &input) {
+
+    SOCKET clientEnd = INVALID_SOCKET;                                              // The client end.
+    Session *session = connectLoopback(input, clientEnd);                           // Run the handshake.
+    if (session == NULL) {                                                          // If it failed.
+        input.errors++;                                                             // Count failure.
+        return;                                                                     // Nothing to close.
+    }
+    input.sink += session->nOnce;                                                   // Keep result.
+    closeLoopback(*input.server, session, clientEnd);                               // Disconnect, freeing the session as the server does.
+}
+
+
+/**
+ *  Sends one encrypted message over the loopback pair and has the server's session code echo it back, checking the client gets back what it sent.
+ *  Covers the client's encryption and the server's framing, fair scheduling, decryption, echo handler, metrics and reply, then the client's receive.
+ */
+void benchLoopbackRoundTrip(BenchmarkInput &input) {
+
+    if (input.session->state == SESSION_CLOSED) {                                   // If the server disconnected the client.
+        input.errors++;                                                             // Count failure.
+        return;                                                                     // No reply would come.
+    }
+    char sendBuffer[BUFFER_SIZE];                                                   // The message to send.
+    memcpy(sendBuffer, input.message, input.messageLength + 1);                     // Copy message, including the null terminator.
+    int messageLength = input.messageLength;                                        // Stores the length of the message.
+    encryptMessage(sendBuffer, messageLength, input.key[0], input.key[2], LOOPBACK_NONCE, input.clientCounter, CHAIN_CTR, false);  // Client encrypts the message.
+    transportSend(input.clientEnd, sendBuffer, messageLength);                      // Client sends it.
+    if (serveLoopback(*input.server, input.session)) {                              // If the server did not reply.
+        input.errors++;                                                             // Count failure.
+        return;                                                                     // No reply to receive.
+    }
+    int prefixLength = strlen(LOOPBACK_ECHO_PREFIX);                                // The message is quoted after the prefix.
+    if (receiveMessage(input.clientEnd, input.scratch, 0) || strncmp(input.scratch, LOOPBACK_ECHO_PREFIX, prefixLength) != 0
+        || strncmp(&input.scratch[prefixLength], input.message, input.messageLength) != 0 || input.scratch[prefixLength + input.messageLength] != '\'') {   // If the client did not get its message back.
+        input.errors++;                                                             // Count failure.
+    }
+}
+
+
+/**
+ *  Sets up the server's state to serve loopback clients with one key, as the server's main() does, with the echo handler and no sockets.
+ *  The echo handler answers on the event loop, so each pass of serveLoopback() sends its replies.
+ *  Returns the server, NULL if it could not be set up.
+ */
+Server *startLoopbackServer(long *key) {
+
+    static long keyCA[3] = { 4297, 4633, 7171 };                                    // The server's CA key, as prepareInput() gives the client.
+    Server *server = (Server *)allocateOnNode(sizeof(Server), -1);                  // The event loop state, zeroed, too large for the stack.
+    if (server == NULL) {                                                           // If it could not be allocated.
+        return NULL;                                                                // No server.
+    }
+    server->node = -1;                                                              // Not pinned.
+    server->s = INVALID_SOCKET;                                                     // Clients only come over loopback pairs.
+    server->unixSocket = INVALID_SOCKET;                                            // Not listening on AF_UNIX.
+    server->statsSocket = INVALID_SOCKET;                                           // Not serving metrics.
+    server->restartSocket = INVALID_SOCKET;                                         // Not listening for a successor.
+    server->successor = INVALID_SOCKET;                                             // Not handing off.
+    server->encryptKeyCA = keyCA;                                                   // Use the CA key.
+    server->serverKeys = (long (*)[3])key;                                          // Serve the key swept.
+    server->serverKeyCount = 1;                                                     // Never rotated.
+    initTimerWheel(server->timers, GetTickCount());                                 // Start the clock for client timeouts, never advanced so none expire.
+    rotateServerKey(*server, 0);                                                    // Build the handshake frame for the key.
+    RequestHandler *handler = createRequestHandler("echo");                         // Echo every decrypted message.
+    if (parseClassWeights(DEFAULT_CLASS_WEIGHTS, server->scheduler) || handler == NULL || startHandlerPool(server->handlers, handler, HANDLER_WORKERS, server->affinity)) {   // If the scheduler or the handler could not be started.
+        delete handler;                                                             // Free memory.
+        releaseKeyFrame(server->keyFrame);                                          // Free the handshake frame.
+        freeOnNode(server);                                                         // Free memory.
+        return NULL;                                                                // No server.
+    }
+    return server;                                                                  // Return the server.
+}
+
+
+/**
+ *  Stops the handler and frees the loopback server's state, once every client has been closed.
+ */
+void stopLoopbackServer(Server *server) {
+
+    stopHandlerPool(server->handlers);                                              // Stop the handler.
+    delete server->handlers.handler;                                                // Free memory.
+    releaseKeyFrame(server->keyFrame);                                              // Free the handshake frame.
+    freeOnNode(server);                                                             // Free memory.
+}
+
+
+/**
+ *  Connects a client to the loopback server over a new loopback pair, running the whole handshake through the server's session code.
+ *  Both ends block, so one thread runs both sides in a fixed order, each side reading only what the other has already written.
+ *  Returns the server's session for the client, NULL if the handshake failed.
+ */
+Session *connectLoopback(BenchmarkInput &input, SOCKET &clientEnd) {
+
+    SOCKET serverEnd = INVALID_SOCKET;                                              // The server end.
+    if (createLoopbackPair(clientEnd, serverEnd)) {                                 // If the pair could not be made.
+        return NULL;                                                                // No session.
+    }
+    Session *session = addSession(*input.server, serverEnd, "loopback", "loopback");   // Server adds the client, as it does once accepted.
+    if (session == NULL) {                                                          // If it could not be allocated.
+        closeTransport(serverEnd);                                                  // Close the server end.
+        closeTransport(clientEnd);                                                  // Close the client end.
+        return NULL;                                                                // No session.
+    }
+    int error = startHandshake(*input.server, session);                             // Server sends the shared key frame.
+    int serverKeyE = 0;                                                             // Stores the server's public key e.
+    int serverKeyN = 0;                                                             // Stores the server's public key n.
+    error = error ? error : receiveServerPublicKey(clientEnd, input.keyCA[0], input.keyCA[2], serverKeyE, serverKeyN);  // Client verifies the key and sends its ACK.
+    error = error ? error : serveLoopback(*input.server, session);                  // Server receives the ACK.
+    char buffer[BUFFER_SIZE + 1];                                                   // The nOnce sent, then the ACK received.
+    strcpy(buffer, LOOPBACK_NONCE_LINE);                                            // Create the nOnce, as sendNOnce() does without shared memory.
+    error = error ? error : sendMessage(clientEnd, buffer, strlen(buffer));         // Client sends the nOnce.
+    error = error ? error : serveLoopback(*input.server, session);                  // Server receives the nOnce and sends its ACK.
+    error = error ? error : receiveMessage(clientEnd, buffer, 0);                   // Client receives the ACK.
+    HandshakeOptions options;                                                       // The options asked for, then the options agreed.
+    initHandshakeOptions(options);                                                  // Start from the client's options.
+    options.chainMode = CHAIN_CTR;                                                  // Asks for counter mode.
+    options.compression = false;                                                    // Does not ask for compression.
+    options.batchMessages = 1;                                                      // Does not ask for batching.
+    options.sharedMemory = false;                                                   // Does not ask for shared memory.
+    error = error ? error : parseACK(buffer, options);                              // Client agrees the options the server named.
+    if (error || options.chainMode != CHAIN_CTR || serverKeyN != input.key[2] || session->state != SESSION_READY) {    // If the handshake failed or agreed the wrong things.
+        closeLoopback(*input.server, session, clientEnd);                           // Disconnect.
+        return NULL;                                                                // No session.
+    }
+    return session;                                                                 // Return the session.
+}
+
+
+/**
+ *  Disconnects a loopback client, the server releasing its session as removeClosedSessions() does, then the client closing its end.
+ */
+void closeLoopback(Server &server, Session *session, SOCKET clientEnd) {
+
+    closeSession(session);                                                          // Server disconnects the client.
+    removeClosedSessions(server);                                                   // Server frees the session and closes its end.
+    closeTransport(clientEnd);                                                      // Close the client end.
+}
+
+
+/**
+ *  Runs one pass of the server's event loop for a loopback client whose bytes are already written: receives them, processes its frames and sends the replies.
+ *  The server end blocks, so it must only be called once the client has written, or the pass waits for bytes that never come.
+ *  Returns error code, 1 if the server disconnected the client.
+ */
+int serveLoopback(Server &server, Session *session) {
+
+    readFromClient(server, session);                                                // Receive the client's bytes and queue its frames.
+    processClientFrames(server);                                                    // Process the frames and send the replies.
+    return session->state == SESSION_CLOSED ? 1 : 0;                                // Fail if the server disconnected the client.
+}
+
+
+/**
+ *  Times the protocol kernels over in-process loopback pairs for a key: a whole handshake, then a round trip at each message length.
+ *  Nothing goes through the kernel, and both sides run the code the client and the server run, so the results move with either.
+ *  Returns error code, 1 if any handshake or round trip failed.
+ */
+int benchLoopback(long *key, int *lengths, const char *filter, BenchmarkResult *results, int &resultCount) {
+
+    Server *server = startLoopbackServer(key);                                      // The server's state, with the key's handshake frame.
+    if (server == NULL) {                                                           // If it could not be set up.
+        printf("Loopback server could not be started with n=%ld\n", key[2]);        // Alert user.
+        return 1;                                                                   // Fail the benchmarks.
+    }
+    BenchmarkInput *input = new BenchmarkInput;                                     // Inputs, too large for the stack.
+    prepareInput(*input, key, 1);                                                   // Prepare key.
+    input->server = server;                                                         // Serve clients from it.
+    runBenchmark("loopbackHandshake", benchLoopbackHandshake, *input, server->keyFrame->length, filter, results, resultCount);
+    int allocating = countCopies("loopbackHandshake", benchLoopbackHandshake, *input, server->keyFrame->length, filter, false);   // A handshake allocates its pair and session.
+    long errors = input->errors;                                                    // Failed handshakes.
+    for (int l = 0; l < LENGTH_COUNT; l++) {                                        // Loop through lengths.
+        prepareInput(*input, key, lengths[l]);                                      // Prepare inputs.
+        input->server = server;                                                     // Serve clients from it.
+        input->session = connectLoopback(*input, input->clientEnd);                 // Connect the client round trips run over.
+        if (input->session == NULL) {                                               // If the handshake failed.
+            errors++;                                                               // Count failure.
+            continue;                                                               // Skip length.
+        }
+        runBenchmark("loopbackRoundTrip", benchLoopbackRoundTrip, *input, lengths[l], filter, results, resultCount);
+        allocating += countCopies("loopbackRoundTrip", benchLoopbackRoundTrip, *input, lengths[l], filter, true);    // A round trip must not allocate, on either side.
+        closeLoopback(*server, input->session, input->clientEnd);                   // Disconnect.
+        errors += input->errors;                                                    // Failed round trips.
+    }
+    stopLoopbackServer(server);                                                     // Free the server's state.
+    delete input;                                                                   // Free memory.
+    if (errors > 0) {                                                               // If any failed.
+        printf("%ld loopback handshakes or round trips failed with n=%ld\n", errors, key[2]);   // Alert user.
+        return 1;                                                                   // Fail the benchmarks.
+    }
+    if (allocating > 0) {                                                           // If the steady state allocated.
+        printf("%d loopback round trips allocated with n=%ld\n", allocating, key[2]);  // Alert user.
+        return 1;                                                                   // Fail the benchmarks.
+    }
+    return 0;                                                                       // Return no error.
+}
+
+
+/**
+ *  Journals the next client's message, first waiting for the client's last message to be durable as a client waits for its reply.
+ *  The clients take turns, so up to JOURNAL_BENCH_CLIENTS messages are waiting for a sync at once and the commit interval decides how many share one.
+ */
+void benchJournalMessage(BenchmarkInput &input) {
+
+    long long &position = input.journalPositions[input.journalClient];              // Where the client's last message is durable.
+    waitForJournal(position);                                                       // Wait for its reply.
+    position = journalAppend(input.journalClient + 1, input.message, input.messageLength);  // Journal the client's next message.
+    if (position < 0) {                                                             // If the journal failed.
+        input.errors++;                                                             // Count failure.
+        position = 0;                                                               // Nothing to wait for.
+    }
+    input.journalClient = (input.journalClient + 1) % JOURNAL_BENCH_CLIENTS;        // Next client.
+}
+
+
+/**
+ *  Times journaled messages against the commit interval, each interval with a new journal.
+ *  The time per message gives messages per second, and the commits show how many messages each sync carried.
+ *  Every journal is read back once its records are synced, so a torn or missing record fails the benchmark.
+ *  Returns error code.
+ */
+int benchJournal(long *key, const char *filter, BenchmarkResult *results, int &resultCount) {
+
+    int intervals[JOURNAL_INTERVAL_COUNT] = { 0, 1, 2, 5, 10 };                     // Commit intervals swept, in milliseconds.
+    BenchmarkInput *input = new BenchmarkInput;                                     // Inputs, too large for the stack.
+    prepareInput(*input, key, JOURNAL_BENCH_LENGTH);                                // Prepare message.
+    int error = 0;                                                                  // Error code.
+    for (int i = 0; !error && i < JOURNAL_INTERVAL_COUNT; i++) {                    // Loop through intervals.
+        DeleteFile(JOURNAL_BENCH_PATH);                                             // Start from an empty journal.
+        if (startJournal(JOURNAL_BENCH_PATH, intervals[i], DEFAULT_COMMIT_BYTES, INVALID_SOCKET)) {   // If it could not be opened.
+            error = 1;                                                              // Fail the benchmarks.
+            break;                                                                  // Stop sweeping.
+        }
+        memset(input->journalPositions, 0, sizeof(input->journalPositions));        // No message waiting.
+        input->journalClient = 0;                                                   // First client.
+        input->errors = 0;                                                          // No failures.
+        char kernel[40];                                                            // Kernel name, including the interval.
+        sprintf(kernel, "journal_commit=%dms", intervals[i]);                       // Name kernel.
+        int before = resultCount;                                                   // Results before this interval.
+        runBenchmark(kernel, benchJournalMessage, *input, JOURNAL_BENCH_LENGTH, filter, results, resultCount);
+        JournalStats stats;                                                         // Counts of the journal's work.
+        readJournalStats(stats);                                                    // Get counts.
+        error = stopJournal() || input->errors > 0;                                 // Sync the last messages, failing if any could not be.
+        if (resultCount > before) {                                                 // If timed.
+            printf("%-44s %12.0f messages/s %7.1f messages/sync\n", "", 1e9 / results[before].nsPerOp, stats.commits > 0 ? (double)stats.records / stats.commits : 0.0);  // Alert user.
+        }
+        char *data = NULL;                                                          // The journal read back.
+        long length = 0;                                                            // Number of bytes of records.
+        long long records = 0;                                                      // Records read back intact.
+        if (!error && readJournalFile(JOURNAL_BENCH_PATH, data, length) == 0) {     // If the journal could be read.
+            long offset = 0;                                                        // Position of the next record.
+            JournalRecord record;                                                   // The record's header.
+            const char *payload = NULL;                                             // The record's message.
+            while (nextJournalRecord(data, length, offset, record, payload)) {      // Loop through intact records.
+                records += record.length == JOURNAL_BENCH_LENGTH && memcmp(payload, input->message, JOURNAL_BENCH_LENGTH) == 0;   // Count record if it holds the message.
+            }
+            delete[] data;                                                          // Free memory.
+            if (records != stats.records || offset != length) {                     // If any record was lost, torn or changed.
+                printf("Journal held %lld of %lld messages with commit=%dms\n", records, stats.records, intervals[i]);   // Alert user.
+                error = 1;                                                          // Fail the benchmarks.
+            }
+        } else {                                                                    // Else not synced or not readable.
+            printf("Journal could not be synced or read with commit=%dms\n", intervals[i]);   // Alert user.
+            error = 1;                                                              // Fail the benchmarks.
+        }
+        DeleteFile(JOURNAL_BENCH_PATH);                                             // Remove the journal.
+    }
+    delete input;                                                                   // Free memory.
+    return error;                                                                   // Return error code if any.
+}
+
+
+/**
+ *  Counts the heap allocations, copies and zeroing of one operation of a kernel, when built with -DCOUNT_COPIES.
+ *  One operation is run first, so anything allocated once and kept, such as a cache entry, is not counted.
+ *  Returns 1 if the kernel is the steady state and allocated, else 0.
+ */
+int countCopies(const char *kernel, BenchmarkFunction function, BenchmarkInput &input, int bytesPerOp, const char *filter, bool steadyState) {
+
+    if (!COPY_COUNTING) {                                                           // If not built to count.
+        return 0;                                                                   // Nothing to count.
+    }
+    char name[80];                                                                  // The benchmark's name.
+    sprintf(name, "%s/n=%ld/len=%d", kernel, input.key[2], bytesPerOp);             // Name benchmark.
+    if (filter != NULL && strstr(name, filter) == NULL) {                           // If not selected.
+        return 0;                                                                   // Skip benchmark.
+    }
+    function(input);                                                                // Warm up.
+    CopyCounts counts;                                                              // Counts for one operation.
+    CopyCounts before;                                                              // Counts before it.
+    readCopyCounts(before);                                                         // Read counts.
+    function(input);                                                                // Run operation.
+    readCopyCounts(counts);                                                         // Read counts.
+    subtractCopyCounts(counts, before);                                             // Leave the operation's counts.
+    printf("%-44s %4lld allocs %6lld B %4lld copies %6lld B %4lld zeroings %6lld B\n", name, counts.allocations, counts.allocatedBytes, counts.copies, counts.copiedBytes, counts.zeroings, counts.zeroedBytes);    // Alert user.
+    return steadyState && counts.allocations > 0 ? 1 : 0;                           // Return whether the steady state allocated.
+}
+
+
+/**
+ *  Gets the time from the high resolution counter.
+ *  Returns nanoseconds.
+ */
+double currentNanoseconds() {
+
+    static LARGE_INTEGER frequency = { { 0, 0 } };                                  // Counter ticks per second.
+    if (frequency.QuadPart == 0) {                                                  // If not yet known.
+        QueryPerformanceFrequency(&frequency);                                      // Get frequency.
+    }
+    LARGE_INTEGER counter;                                                          // Counter value.
+    QueryPerformanceCounter(&counter);                                              // Get counter.
+    return counter.QuadPart * (1000000000.0 / frequency.QuadPart);                  // Return nanoseconds.
+}
+
+
+/**
+ *  Times a number of operations.
+ *  Returns nanoseconds taken.
+ */
+double timeIterations(BenchmarkFunction function, BenchmarkInput &input, long long iterations) {
+
+    double start = currentNanoseconds();                                            // Start time.
+    for (long long i = 0; i < iterations; i++) {                                    // Loop through operations.
+        function(input);                                                            // Run operation.
+    }
+    return currentNanoseconds() - start;                                            // Return time taken.
+}
+
+
+/**
+ *  Measures a kernel and stores the result.
+ *  The number of iterations doubles until a run takes MIN_BENCHMARK_MS, then the fastest of BENCHMARK_REPEATS runs is kept.
+ */
+void runBenchmark(const char *kernel, BenchmarkFunction function, BenchmarkInput &input, int bytesPerOp, const char *filter, BenchmarkResult *results, int &resultCount) {
+
+    if (resultCount == MAX_RESULTS) {                                               // If no room for result.
+        return;                                                                     // Skip benchmark.
+    }
+    BenchmarkResult &result = results[resultCount];                                 // The result to fill.
+    sprintf(result.name, "%s/n=%ld/len=%d", kernel, input.key[2], bytesPerOp);      // Name benchmark.
+    if (filter != NULL && strstr(result.name, filter) == NULL) {                    // If not selected.
+        return;                                                                     // Skip benchmark.
+    }
+    long long iterations = 1;                                                       // Operations per run.
+    while (timeIterations(function, input, iterations) < MIN_BENCHMARK_MS * 1000000.0) {   // Until a run is long enough to time.
+        iterations *= 2;                                                            // Double operations.
+    }
+    double best = 0;                                                                // Fastest run.
+    for (int r = 0; r < BENCHMARK_REPEATS; r++) {                                   // Loop through runs.
+        double elapsed = timeIterations(function, input, iterations);               // Time run.
+        if (r == 0 || elapsed < best) {                                             // If fastest yet.
+            best = elapsed;                                                         // Store fastest.
+        }
+    }
+    result.iterations = iterations;                                                 // Store operations per run.
+    result.nsPerOp = best / iterations;                                             // Store time per operation.
+    result.mbPerSec = bytesPerOp / result.nsPerOp * 1000.0;                         // Bytes per nanosecond to MB per second.
+    printf("%-44s %12.1f ns/op %10.3f MB/s\n", result.name, result.nsPerOp, result.mbPerSec);  // Alert user.
+    resultCount++;                                                                  // Keep result.
+}
+
+
+/**
+ *  Writes results as JSON, one benchmark per line so baselines can be read back without a JSON library.
+ *  Returns error code.
+ */
+int writeResults(const char *path, BenchmarkResult *results, int resultCount) {
+
+    FILE *file = fopen(path, "w");                                                  // Open results file.
+    if (file == NULL) {                                                             // If file could not be opened.
+        printf("Could not write %s\n", path);                                       // Alert user.
+        return 2;                                                                   // Return error code.
+    }
+    fprintf(file, "{\n  \"benchmarks\": [\n");
+    for (int i = 0; i < resultCount; i++) {                                         // Loop through results.
+        fprintf(file, "    {\"name\": \"%s\", \"iterations\": %lld, \"ns_per_op\": %.3f, \"mb_per_sec\": %.3f}%s\n",
+                results[i].name, results[i].iterations, results[i].nsPerOp, results[i].mbPerSec, i + 1 < resultCount ? "," : "");
+    }
+    fprintf(file, "  ]\n}\n");
+    fclose(file);                                                                   // Close results file.
+    printf("\nResults written to %s\n", path);                                      // Alert user.
+    return 0;                                                                       // Return no error.
+}
+
+
+/**
+ *  Compares results with a stored baseline and reports regressions.
+ *  Benchmarks missing from either side are skipped.
+ *  Returns error code, 1 if any benchmark is more than REGRESSION_THRESHOLD percent slower.
+ */
+int compareWithBaseline(const char *path, BenchmarkResult *results, int resultCount) {
+
+    FILE *file = fopen(path, "r");                                                  // Open baseline file.
+    if (file == NULL) {                                                             // If there is no baseline.
+        printf("No baseline at %s, copy the results there to create one.\n", path); // Alert user.
+        return 0;                                                                   // Nothing to compare.
+    }
+    printf("\n------ COMPARED WITH %s ------\n", path);
+    int regressions = 0;                                                            // Number of regressions found.
+    char line[BUFFER_SIZE];                                                         // One line of the baseline.
+    while (fgets(line, BUFFER_SIZE, file) != NULL) {                                // Loop through baseline.
+        char *nameStart = strstr(line, "\"name\": \"");                             // Find name.
+        char *timeStart = strstr(line, "\"ns_per_op\": ");                          // Find time.
+        if (nameStart == NULL || timeStart == NULL) {                               // If not a benchmark line.
+            continue;                                                               // Skip line.
+        }
+        char name[80];                                                              // The benchmark name.
+        double baselineNs = 0;                                                      // The baseline time.
+        if (sscanf(nameStart + 9, "%79[^\"]", name) != 1 || sscanf(timeStart + 13, "%lf", &baselineNs) != 1 || baselineNs <= 0) {
+            continue;                                                               // Skip malformed line.
+        }
+        for (int i = 0; i < resultCount; i++) {                                     // Loop through results.
+            if (strcmp(results[i].name, name) != 0) {                               // If not the same benchmark.
+                continue;                                                           // Try next result.
+            }
+            double change = (results[i].nsPerOp - baselineNs) / baselineNs * 100.0; // Percentage slower.
+            bool regressed = change > REGRESSION_THRESHOLD;                         // True if too much slower.
+            printf("%-44s %12.1f -> %12.1f ns/op %+7.1f%%%s\n", name, baselineNs, results[i].nsPerOp, change, regressed ? "  REGRESSION" : "");
+            if (regressed) {                                                        // If too much slower.
+                regressions++;                                                      // Count regression.
+            }
+        }
+    }
+    fclose(file);                                                                   // Close baseline file.
+    printf("%d regression%s over %.0f%%\n", regressions, regressions == 1 ? "" : "s", REGRESSION_THRESHOLD);
+    return regressions > 0 ? 1 : 0;                                                 // Return error code if any regressions.
+}
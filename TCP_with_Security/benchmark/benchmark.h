@@ -0,0 +1,117 @@
+#define _WIN32_WINNT 0x501
+#include "../server/session.h"
+#include "../client/client.h"
+#include <windows.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "../common/cipher.h"
+#include "../common/keyframe.h"
+#include "../common/compress.h"
+#include "../common/rsatable.h"
+#include "../common/threadpool.h"
+#include "../common/journal.h"
+
+#define MIN_BENCHMARK_MS 50                                                         // Minimum time each measurement runs for.
+#define BENCHMARK_REPEATS 3                                                         // Number of measurements of each benchmark, the fastest is reported.
+#define REGRESSION_THRESHOLD 10.0                                                   // Percentage slowdown against the baseline that counts as a regression.
+#define MAX_RESULTS 256                                                             // Maximum number of benchmark results.
+#define KEY_COUNT 4                                                                 // Number of keys swept.
+#define LENGTH_COUNT 4                                                              // Number of message lengths swept.
+#define BULK_SYMBOLS 1048576                                                        // Symbols in the bulk counter mode buffer split across threads.
+#define COMPRESS_FUZZ_CASES 2000                                                    // Generated messages checked for compression round trips and corrupt blocks.
+#define COMPRESS_FUZZ_CORRUPTIONS 16                                                // Corrupted copies decompressed for each message that compresses.
+#define COMPRESS_FUZZ_GUARD 64                                                      // Bytes after the output capacity checked for overruns.
+#define LOOPBACK_NONCE 23                                                           // The nOnce agreed over the loopback pair.
+#define LOOPBACK_NONCE_LINE "NONCE 23 CTR\r\n"                                      // The loopback client's nOnce, LOOPBACK_NONCE asking for counter mode only.
+#define LOOPBACK_ECHO_PREFIX "The client typed '"                                   // The start of the echo handler's reply, the message sent is quoted after it.
+#define JOURNAL_BENCH_PATH "benchmark_journal.bin"                                  // The journal written by the commit interval sweep, deleted after each interval.
+#define JOURNAL_BENCH_CLIENTS 64                                                    // Clients journaling at once, each with one message waiting for its sync as a server's clients have.
+#define JOURNAL_BENCH_LENGTH 32                                                     // Bytes in each journaled message.
+#define JOURNAL_INTERVAL_COUNT 5                                                    // Number of commit intervals swept.
+
+
+/**
+ *  Structures.
+ */
+struct BenchmarkInput {                                                             // Inputs prepared before timing starts, shared by every kernel.
+    long  key[3];                                                                   // The key: { e, d, n }.
+    int   messageLength;                                                            // Number of bytes in message.
+    char  message[BUFFER_SIZE];                                                     // The plain text message.
+    char  encryptedText[BUFFER_SIZE];                                               // The message encrypted into its wire form.
+    int   encryptedTextLength;                                                      // Number of bytes in encryptedText.
+    long  encryptedValues[BUFFER_SIZE];                                             // The long values of the encrypted message.
+    long  caValues[BUFFER_SIZE];                                                    // The long values of the message encrypted with encryptCA().
+    char  compressed[BUFFER_SIZE];                                                  // The message compressed with compressBlock().
+    int   compressedLength;                                                         // Number of bytes in compressed, 0 if the message does not compress.
+    char  scratch[BUFFER_SIZE + 1];                                                 // Output buffer for kernels.
+    long  scratchValues[BUFFER_SIZE];                                               // Output values for kernels.
+    int   index;                                                                    // Position in message of the next single symbol kernel call.
+    long  keyCA[3];                                                                 // The CA key the key frame is encrypted with: { e, d, n }.
+    KeyFrame *keyFrame;                                                             // The key frame for key, built once as the server does.
+    ThreadPool *pool;                                                               // The pool bulk counter mode kernels run on.
+    char *bulkPlain;                                                                // BULK_SYMBOLS of plain text.
+    long *bulkValues;                                                               // bulkPlain encrypted in counter mode.
+    char *bulkDecrypted;                                                            // Output of the bulk decryption.
+    SOCKET clientEnd;                                                               // The client end of the loopback pair round trips run over.
+    long long clientCounter;                                                        // Symbols the client has sent in counter mode over the pair.
+    Server *server;                                                                 // The server state loopback clients are served from, by the server's own session code.
+    Session *session;                                                               // The server's session for the client end round trips run over.
+    long long journalPositions[JOURNAL_BENCH_CLIENTS];                              // Journal position each client's last message is durable at, 0 if it has none.
+    int   journalClient;                                                            // The client whose message is journaled next.
+    long  errors;                                                                   // Protocol kernel operations that failed, checked once they have run.
+    volatile long sink;                                                             // Stores kernel results so they cannot be optimised away.
+};
+
+typedef void (*BenchmarkFunction)(BenchmarkInput &input);                           // Runs one operation of a kernel.
+
+struct BenchmarkResult {                                                            // The measurement of one kernel with one key and message length.
+    char      name[80];                                                             // Unique name, "kernel/n=N/len=L".
+    long long iterations;                                                           // Number of operations per measurement.
+    double    nsPerOp;                                                              // Fastest time per operation in nanoseconds.
+    double    mbPerSec;                                                             // Message bytes processed per second, in MB.
+};
+
+
+/**
+ *  Function declarations.
+ */
+void   prepareInput(BenchmarkInput &input, long *key, int messageLength);           // Fills the benchmark inputs for a key and message length.
+void   benchRepeatsquareEncrypt(BenchmarkInput &input);                             // One RSA encryption of a symbol.
+void   benchRepeatsquareDecrypt(BenchmarkInput &input);                             // One RSA decryption of a symbol.
+void   benchCbc(BenchmarkInput &input);                                             // One CBC step.
+void   benchEncrypt(BenchmarkInput &input);                                         // Encrypts the message.
+void   benchDecrypt(BenchmarkInput &input);                                         // Decrypts the message.
+void   benchDecryptRSA(BenchmarkInput &input);                                      // Removes RSA from the message, the first pass of decrypt().
+void   benchDecryptCBC(BenchmarkInput &input);                                      // Removes CBC from the message, the second pass of decrypt().
+void   benchEncryptCA(BenchmarkInput &input);                                       // Encrypts the message with the CA method.
+void   benchDecryptCA(BenchmarkInput &input);                                       // Decrypts the message with the CA method.
+void   benchCreateStringToSend(BenchmarkInput &input);                              // Formats the encrypted values for the wire.
+void   benchParseEncryptedMessage(BenchmarkInput &input);                           // Parses the encrypted values from the wire.
+void   benchCompress(BenchmarkInput &input);                                        // Compresses the message before encryption.
+void   benchDecompress(BenchmarkInput &input);                                      // Decompresses the message after decryption.
+int    checkCompression();                                                          // Checks compression round trips and corrupt blocks on generated messages.
+unsigned int fuzzRandom(unsigned int &state);                                       // Gets the next number of a fixed sequence.
+void   benchEncryptCTR(BenchmarkInput &input);                                      // Encrypts the message in counter mode.
+void   benchDecryptCTR(BenchmarkInput &input);                                      // Decrypts the message in counter mode.
+void   benchEncryptCTRBulk(BenchmarkInput &input);                                  // Encrypts the bulk buffer in counter mode on the pool.
+void   benchDecryptCTRBulk(BenchmarkInput &input);                                  // Decrypts the bulk buffer in counter mode on the pool.
+int    benchCTRScaling(long *key, const char *filter, BenchmarkResult *results, int &resultCount);  // Times bulk counter mode against the number of threads.
+void   benchKeyFrameBuild(BenchmarkInput &input);                                   // Builds a key frame for one handshake, as the server did for every client.
+void   benchKeyFrameShare(BenchmarkInput &input);                                   // Shares the built key frame with one handshake.
+void   benchLoopbackHandshake(BenchmarkInput &input);                               // Runs a whole handshake, the client against the server's session code, over a new loopback pair.
+void   benchLoopbackRoundTrip(BenchmarkInput &input);                               // Sends an encrypted message over the loopback pair and has the server echo it back.
+Server *startLoopbackServer(long *key);                                             // Sets up the server's state to serve loopback clients with one key.
+void   stopLoopbackServer(Server *server);                                          // Stops the handler and frees the loopback server's state.
+Session *connectLoopback(BenchmarkInput &input, SOCKET &clientEnd);                 // Connects a client to the loopback server over a new loopback pair.
+void   closeLoopback(Server &server, Session *session, SOCKET clientEnd);           // Disconnects a loopback client from both ends.
+int    serveLoopback(Server &server, Session *session);                             // Runs one pass of the server's event loop for a loopback client.
+int    benchLoopback(long *key, int *lengths, const char *filter, BenchmarkResult *results, int &resultCount);  // Times the protocol kernels over loopback pairs for a key.
+void   benchJournalMessage(BenchmarkInput &input);                                  // Journals the next client's message once its last one is durable.
+int    benchJournal(long *key, const char *filter, BenchmarkResult *results, int &resultCount);   // Times journaled messages against the commit interval.
+int    countCopies(const char *kernel, BenchmarkFunction function, BenchmarkInput &input, int bytesPerOp, const char *filter, bool steadyState);   // Counts the allocations, copies and zeroing of one operation of a kernel.
+double currentNanoseconds();                                                        // Gets the time from the high resolution counter.
+double timeIterations(BenchmarkFunction function, BenchmarkInput &input, long long iterations);  // Times a number of operations.
+void   runBenchmark(const char *kernel, BenchmarkFunction function, BenchmarkInput &input, int bytesPerOp, const char *filter, BenchmarkResult *results, int &resultCount);   // Measures a kernel and stores the result.
+int    writeResults(const char *path, BenchmarkResult *results, int resultCount);   // Writes results as JSON.
+int    compareWithBaseline(const char *path, BenchmarkResult *results, int resultCount);    // Compares results with a stored baseline and reports regressions.
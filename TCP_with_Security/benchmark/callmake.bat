@@ -0,0 +1,4 @@
+del *.o
+del *.exe
+MAKE
+pause
\ No newline at end of file
@@ -0,0 +1,158 @@
+#define _WIN32_WINNT 0x501
+#include <windows.h>
+#include <string.h>
+#include "certcache.h"
+#include "../common/copycount.h"
+
+static CRITICAL_SECTION cacheLock;                                                  // Guards entries, sessions on different threads share the cache.
+static bool             ready = false;                                              // True once the cache is prepared, the cache is skipped until then.
+static CertCacheEntry   entries[CERT_CACHE_ENTRIES];                                // The cached server keys.
+static unsigned long    useCounter = 0;                                             // Counts stores and hits, orders entries by last use.
+static volatile LONG    hits = 0;                                                   // Lookups that found a key.
+static volatile LONG    misses = 0;                                                 // Lookups that did not find a key.
+
+static unsigned long long hashCertificate(long *blob, int length, int caKeyE, int caKeyN);  // Hashes a CA blob and the key it is decrypted with.
+static CertCacheEntry    *findCertificate(long *blob, int length, int caKeyE, int caKeyN);   // Finds the entry holding a CA blob.
+
+
+/**
+ *  Prepares the cache, call once before any thread connects.
+ *  Returns error code.
+ */
+int initCertCache() {
+
+    if (ready) {                                                                    // If already prepared.
+        return 0;                                                                   // Nothing to do.
+    }
+    InitializeCriticalSection(&cacheLock);                                          // Prepare lock.
+    memset(entries, 0, sizeof(entries));                                            // Ensure blank.
+    ready = true;                                                                   // Use the cache from now on.
+    return 0;                                                                       // Return no error.
+}
+
+
+/**
+ *  Finds the server key verified for a CA blob.
+ *  The blob is compared in full, so a hit returns exactly the key decryptCA() gave for these values.
+ *  Returns true if found, with the key in serverKeyE and serverKeyN.
+ */
+bool lookupCertificate(long *blob, int length, int caKeyE, int caKeyN, int &serverKeyE, int &serverKeyN) {
+
+    if (!ready || length > CERT_BLOB_VALUES) {                                      // If not caching or blob too long to cache.
+        return false;                                                               // Not found.
+    }
+    EnterCriticalSection(&cacheLock);                                               // Lock cache.
+    CertCacheEntry *entry = findCertificate(blob, length, caKeyE, caKeyN);          // Find blob.
+    if (entry != NULL) {                                                            // If found.
+        serverKeyE = entry->serverKeyE;                                             // Return key e.
+        serverKeyN = entry->serverKeyN;                                             // Return key n.
+        entry->lastUsed = ++useCounter;                                             // Mark as recently used.
+    }
+    LeaveCriticalSection(&cacheLock);                                               // Unlock cache.
+    InterlockedIncrement(entry != NULL ? &hits : &misses);                          // Count lookup.
+    return entry != NULL;                                                           // Return whether found.
+}
+
+
+/**
+ *  Remembers the server key verified for a CA blob, replacing the least recently used entry when full.
+ */
+void storeCertificate(long *blob, int length, int caKeyE, int caKeyN, int serverKeyE, int serverKeyN) {
+
+    if (!ready || length > CERT_BLOB_VALUES) {                                      // If not caching or blob too long to cache.
+        return;                                                                     // Nothing to do.
+    }
+    EnterCriticalSection(&cacheLock);                                               // Lock cache.
+    CertCacheEntry *entry = findCertificate(blob, length, caKeyE, caKeyN);          // Another thread may have stored it already.
+    for (int i = 0; entry == NULL && i < CERT_CACHE_ENTRIES; i++) {                 // If not, loop through entries.
+        if (!entries[i].used) {                                                     // If entry is free.
+            entry = &entries[i];                                                    // Use it.
+        }
+    }
+    if (entry == NULL) {                                                            // If cache is full.
+        entry = &entries[0];                                                        // Find the least recently used entry.
+        for (int i = 1; i < CERT_CACHE_ENTRIES; i++) {                              // Loop through entries.
+            if (entries[i].lastUsed < entry->lastUsed) {                            // If used less recently.
+                entry = &entries[i];                                                // Replace it instead.
+            }
+        }
+    }
+    entry->used = true;                                                             // Entry holds a key.
+    entry->hash = hashCertificate(blob, length, caKeyE, caKeyN);                    // Store hash.
+    entry->caKeyE = caKeyE;                                                         // Store CA key.
+    entry->caKeyN = caKeyN;                                                         // Store CA key.
+    entry->length = length;                                                         // Store length.
+    memcpy(entry->blob, blob, length * sizeof(long));                               // Store blob.
+    entry->serverKeyE = serverKeyE;                                                 // Store key e.
+    entry->serverKeyN = serverKeyN;                                                 // Store key n.
+    entry->lastUsed = ++useCounter;                                                 // Mark as recently used.
+    LeaveCriticalSection(&cacheLock);                                               // Unlock cache.
+}
+
+
+/**
+ *  Forgets every CA blob cached as holding a server key.
+ *  Called when the nOnce exchange with that key fails, so a wrong cached key cannot fail every later handshake, the next connection decrypts the blob again.
+ */
+void invalidateCertificate(int caKeyE, int caKeyN, int serverKeyE, int serverKeyN) {
+
+    if (!ready) {                                                                   // If not caching.
+        return;                                                                     // Nothing to do.
+    }
+    EnterCriticalSection(&cacheLock);                                               // Lock cache.
+    for (int i = 0; i < CERT_CACHE_ENTRIES; i++) {                                  // Loop through entries.
+        CertCacheEntry *entry = &entries[i];                                        // The entry.
+        if (entry->used && entry->caKeyE == caKeyE && entry->caKeyN == caKeyN && entry->serverKeyE == serverKeyE && entry->serverKeyN == serverKeyN) { // If it holds the key.
+            memset(entry, 0, sizeof(CertCacheEntry));                               // Free entry.
+        }
+    }
+    LeaveCriticalSection(&cacheLock);                                               // Unlock cache.
+}
+
+
+/**
+ *  Gets the number of lookups that found and did not find a key.
+ */
+void certCacheCounts(long &hitCount, long &missCount) {
+
+    hitCount = hits;                                                                // Return hits.
+    missCount = misses;                                                             // Return misses.
+}
+
+
+/**
+ *  Hashes a CA blob and the key it is decrypted with, using 64 bit FNV-1a.
+ *  Returns the hash.
+ */
+static unsigned long long hashCertificate(long *blob, int length, int caKeyE, int caKeyN) {
+
+    unsigned long long hash = 14695981039346656037ULL;                              // FNV offset basis.
+    long key[2] = { caKeyE, caKeyN };                                               // The CA key, hashed first.
+    const unsigned char *bytes = (const unsigned char *)key;                        // The bytes being hashed.
+    for (unsigned int i = 0; i < sizeof(key); i++) {                                // Loop through CA key bytes.
+        hash = (hash ^ bytes[i]) * 1099511628211ULL;                                // Mix in byte.
+    }
+    bytes = (const unsigned char *)blob;                                            // Hash the blob next.
+    for (unsigned int i = 0; i < length * sizeof(long); i++) {                      // Loop through blob bytes.
+        hash = (hash ^ bytes[i]) * 1099511628211ULL;                                // Mix in byte.
+    }
+    return hash;                                                                    // Return hash.
+}
+
+
+/**
+ *  Finds the entry holding a CA blob, the caller holds the lock.
+ *  Returns the entry, or NULL if not cached.
+ */
+static CertCacheEntry *findCertificate(long *blob, int length, int caKeyE, int caKeyN) {
+
+    unsigned long long hash = hashCertificate(blob, length, caKeyE, caKeyN);        // Hash of the blob.
+    for (int i = 0; i < CERT_CACHE_ENTRIES; i++) {                                  // Loop through entries.
+        CertCacheEntry *entry = &entries[i];                                        // The entry.
+        if (entry->used && entry->hash == hash && entry->length == length && entry->caKeyE == caKeyE && entry->caKeyN == caKeyN
+                && memcmp(entry->blob, blob, length * sizeof(long)) == 0) {         // If the same blob from the same CA.
+            return entry;                                                           // Return entry.
+        }
+    }
+    return NULL;                                                                    // Not cached.
+}
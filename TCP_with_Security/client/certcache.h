@@ -0,0 +1,33 @@
+#ifndef CERTCACHE_H
+#define CERTCACHE_H
+
+#define CERT_CACHE_ENTRIES 16                                                       // Number of verified server keys remembered, the least recently used is replaced.
+#define CERT_BLOB_VALUES 128                                                        // Longest CA blob cached, in encrypted values, longer blobs are always decrypted.
+
+
+/**
+ *  Structures.
+ */
+struct CertCacheEntry {                                                             // A CA blob and the server key it was verified to hold.
+    bool               used;                                                        // True if the entry holds a key.
+    unsigned long long hash;                                                        // Hash of the blob and CA key, checked before comparing the blob.
+    int                caKeyE;                                                      // The CA key e the blob was decrypted with.
+    int                caKeyN;                                                      // The CA key n the blob was decrypted with.
+    int                length;                                                      // Number of values in blob.
+    long               blob[CERT_BLOB_VALUES];                                      // The encrypted values received, compared in full so a hash collision never returns the wrong key.
+    int                serverKeyE;                                                  // The server's public key e.
+    int                serverKeyN;                                                  // The server's public key n.
+    unsigned long      lastUsed;                                                    // Value of the use counter when last stored or found.
+};
+
+
+/**
+ *  Function declarations.
+ */
+int  initCertCache();                                                               // Prepares the cache, call once before any thread connects.
+bool lookupCertificate(long *blob, int length, int caKeyE, int caKeyN, int &serverKeyE, int &serverKeyN);   // Finds the server key verified for a CA blob.
+void storeCertificate(long *blob, int length, int caKeyE, int caKeyN, int serverKeyE, int serverKeyN);      // Remembers the server key verified for a CA blob.
+void invalidateCertificate(int caKeyE, int caKeyN, int serverKeyE, int serverKeyN);   // Forgets every CA blob cached as holding a server key.
+void certCacheCounts(long &hits, long &misses);                                     // Gets the number of lookups that found and did not find a key.
+
+#endif
@@ -1,6 +1,21 @@
 #include "client.h"
+#include "../common/copycount.h"
 
+struct InputLine {                                                                  // A line read by the input thread.
+    char text[SEGMENT_SIZE];                                                        // The line, without its '\n'.
+    int  length;                                                                    // Number of characters in text, -1 if the input ended or failed.
+};
 
+static InputLine        inputQueue[INPUT_QUEUE_LINES];                              // Lines typed but not yet taken by getInput().
+static int              inputHead = 0;                                              // Position of the next line taken.
+static int              inputCount = 0;                                             // Number of lines queued.
+static CRITICAL_SECTION inputLock;                                                  // Guards the queue.
+static HANDLE           inputReady = NULL;                                          // Manual reset event, set while a line is queued.
+static HANDLE           inputSpace = NULL;                                          // Auto reset event, set when a line is taken from a full queue.
+static HANDLE           inputThread = NULL;                                         // Reads the user's lines into the queue.
+
+
+#ifndef CLIENT_LIBRARY                                                              // Other programs, such as loadgen, link the client without its main function.
 /**
  *  The main function of the program.
  *  Returns error code.
@@ -8,6 +23,10 @@
 int main(int argc, char *argv[]) {
 
     cout << "<<< TCP (CROSS-PLATFORM, IPv6-ready) CLIENT, by Cai and Steve >>>" << endl;    // Output program title.
+    startLogger(argc > 3 ? parseLogLevel(argv[3]) : LOG_INFO);                      // Write console output from a background thread.
+    initCertCache();                                                                // Remember verified server keys.
+    initRsaTables();                                                                // Give small keys lookup tables.
+    initTransport();                                                                // Prepare for shared-memory connections.
 
     SOCKET s = INVALID_SOCKET;                                                      // Initialise socket to connect to the server.
     int error = tcpConnect(s, argc, argv);                                          // Connect to server using TCP.
@@ -25,26 +44,31 @@ int main(int argc, char *argv[]) {
     }
 
     long nOnce = 23;                                                                // Used as the first random number in CBC encryption.
-    error = sendNOnce(s, nOnce);                                                    // Send the nOnce to the server.
+    HandshakeOptions options;                                                       // The options asked for, then the options agreed.
+    initHandshakeOptions(options);                                                  // Ask for the client's options.
+    error = sendNOnce(s, nOnce, options);                                           // Send the nOnce to the server.
     if (error) {                                                                    // If error occurred.
+        invalidateCertificate(caKeyE, caKeyN, serverKeyE, serverKeyN);              // Decrypt the CA blob again next time, in case the cached key is wrong.
         return error;                                                               // Return error code.
     }
 
-    error = sendUserMessages(s, serverKeyE, serverKeyN, nOnce);                     // Encrypts user inputted messages and sends them to the server.
+    error = sendUserMessages(s, serverKeyE, serverKeyN, nOnce, options);            // Encrypts user inputted messages and sends them to the server.
     if (error) {                                                                    // If error occurred.
         return error;                                                               // Return error code.
     }
 
-    cout << "\n--------------------------------------------" << endl;               // Alert user.
-    cout << "Client is shutting down..." << endl;                                   // Alert user.
-    closesocket(s);                                                                 // Close the socket.
+    LOG(LOG_INFO) << "\n--------------------------------------------" << endl;      // Alert user.
+    LOG(LOG_INFO) << "Client is shutting down..." << endl;                          // Alert user.
+    closeTransport(s);                                                              // Close the socket, and its shared memory.
     WSACleanup();                                                                   // Cleanup winsock.
     return 0;                                                                       // Return no error.
 }
+#endif
 
 
 /**
  *  Setup TCP connection with server.
+ *  A server address of "unix:" followed by a path connects to the server's AF_UNIX socket instead, for clients on the same host.
  *  Returns error code.
  */
 int tcpConnect(SOCKET &s, int argc, char *argv[]) {
@@ -53,8 +77,10 @@ int tcpConnect(SOCKET &s, int argc, char *argv[]) {
     if (error) {                                                                    // If error occurred.
         return error;                                                               // Return error code.
     }
-    struct addrinfo *result;                                                        // Stores address info of server.
-    memset(&result, 0, sizeof(struct addrinfo));                                    // Ensure blank.
+    if (argc >= 2 && isUnixAddress(argv[1])) {                                      // If the server is on this host.
+        return connectUnixSocket(s, &argv[1][strlen(UNIX_ADDRESS_PREFIX)]);         // Connect to its AF_UNIX socket.
+    }
+    struct addrinfo *result = NULL;                                                 // Stores address info of server.
     char portNum[NI_MAXSERV];                                                       // Stores the port number of the server.
     error = getServerAddressInfo(argc, argv, result, portNum);                      // Get address info of server.
     if (error) {                                                                    // If error occurred.
@@ -82,16 +108,16 @@ int startWSA() {
     WSADATA wsadata;                                                                // Stores WSA data.
     int error = WSAStartup(WSVERS, &wsadata);                                       // Start winsock.
     if (error != 0) {                                                               // Check for error.
-        cout << "WSAStartup failed with error: " << error << endl;                  // Alert user.
+        LOG(LOG_ERROR) << "WSAStartup failed with error: " << error << endl;        // Alert user.
         WSACleanup();                                                               // Cleanup winsock.
         return 1;                                                                   // Return error code.
     }
     if (LOBYTE(wsadata.wVersion) != 2 || HIBYTE(wsadata.wVersion) != 2) {           // If not using correct version of winsock.
-        cout << "Could not find a usable version of Winsock.dll" << endl;           // Alert user.
+        LOG(LOG_ERROR) << "Could not find a usable version of Winsock.dll" << endl; // Alert user.
         WSACleanup();                                                               // Cleanup winsock.
         return 2;                                                                   // Return error code.
     }
-    cout << "\nThe Winsock 2.2 dll was initialised." << endl;                       // Alert user.
+    LOG(LOG_INFO) << "\nThe Winsock 2.2 dll was initialised." << endl;              // Alert user.
     return 0;                                                                       // Return no error.
 }
 
@@ -112,18 +138,18 @@ int getServerAddressInfo(int argc, char *argv[], struct addrinfo *&result, char
     hints.ai_socktype = SOCK_STREAM;                                                // Use sock stream.
     hints.ai_protocol = IPPROTO_TCP;                                                // Use TCP.
     int iResult;                                                                    // Stores result of getaddrinfo().
-    if (argc == 3) {                                                                // If 3 arguments.
+    if (argc >= 3) {                                                                // If IP address and port number given.
         sprintf(portNum, "%s", argv[2]);                                            // Argument 3 is port number.
         iResult = getaddrinfo(argv[1], portNum, &hints, &result);                   // Get address info of server.
-        cout << "\nUsing port number argv[1] = " << portNum << endl;                // Alert user.
+        LOG(LOG_INFO) << "\nUsing port number argv[1] = " << portNum << endl;       // Alert user.
     } else {                                                                        // Not 3 arguments.
-        cout << "\nUSAGE: client.exe [IP_address] [port_number]" << endl;           // Alert user.
+        LOG(LOG_INFO) << "\nUSAGE: client.exe [IP_address] [port_number] [error|info|debug|trace]" << endl;  // Alert user.
         sprintf(portNum, "%s", DEFAULT_PORT);                                       // Set port number to default.
-        cout << "Using default settings, IP: localhost, Port: " << DEFAULT_PORT << endl;    // Alert user.
+        LOG(LOG_INFO) << "Using default settings, IP: localhost, Port: " << DEFAULT_PORT << endl; // Alert user.
         iResult = getaddrinfo(NULL, portNum, &hints, &result);               // Get address info of server.
     }
     if (iResult != 0) {                                                             // If getaddrinfo executed incorrectly.
-        cout << "getaddrinfo failed: " << iResult << endl;                          // Alert user.
+        LOG(LOG_ERROR) << "getaddrinfo failed: " << iResult << endl;                // Alert user.
         freeaddrinfo(result);                                                       // Free memory.
         WSACleanup();                                                               // Cleanup winsock.
         return 3;                                                                   // Return error code.
@@ -140,7 +166,7 @@ int createSocket(SOCKET &s, struct addrinfo *result) {
 
     s = socket(result->ai_family, result->ai_socktype, result->ai_protocol);        // Create socket using result of getaddrinfo().
     if (s == INVALID_SOCKET) {                                                      // If socket is still invalid.
-        cout << "Error at socket(): " << WSAGetLastError() << endl;                 // Alert user.
+        LOG(LOG_ERROR) << "Error at socket(): " << WSAGetLastError() << endl;       // Alert user.
         freeaddrinfo(result);                                                       // Free memory.
         WSACleanup();                                                               // Cleanup winsock.
         return 4;                                                                   // Return error code.
@@ -170,13 +196,13 @@ int getServerNameInfo(struct addrinfo *result, char *portNum) {
                               serverHost, sizeof(serverHost),
                               serverService, sizeof(serverService), NI_NUMERICHOST);    // Get name info of server.
     if (returnValue != 0) {                                                         // If getnameinfo executed incorrectly.
-        cout << "\nError detected: getnameinfo() failed with error# " << WSAGetLastError() << endl; // Alert user.
+        LOG(LOG_ERROR) << "\nError detected: getnameinfo() failed with error# " << WSAGetLastError() << endl; // Alert user.
         freeaddrinfo(result);                                                       // Free memory.
         WSACleanup();                                                               // Cleanup winsock.
         return 6;                                                                   // Return error code.
     } else {                                                                        // Else getnameinfo executed correctly.
-        cout << "Connected to server with IP address: " << serverHost;              // Alert user.
-        cout << ", " << ipVer << " at port: " << portNum << endl;                   // Alert user.
+        LOG(LOG_INFO) << "Connected to server with IP address: " << serverHost;     // Alert user.
+        LOG(LOG_INFO) << ", " << ipVer << " at port: " << portNum << endl;          // Alert user.
     }
     return 0;                                                                       // Return no error.
 }
@@ -188,9 +214,9 @@ int getServerNameInfo(struct addrinfo *result, char *portNum) {
  */
 int connectToServer(SOCKET &s, struct addrinfo *result, char *portNum) {
     
-    cout << "\nConnecting to server..." << endl;                                    // Alert user.
+    LOG(LOG_INFO) << "\nConnecting to server..." << endl;                           // Alert user.
     if (connect(s, result->ai_addr, result->ai_addrlen) != 0) {                     // Connect socket to server and check if it executed incorrectly.
-        cout << "connect failed" << endl;                                           // Alert user.
+        LOG(LOG_ERROR) << "connect failed" << endl;                                 // Alert user.
         freeaddrinfo(result);                                                       // Free memory.
         closesocket(s);                                                             // Close socket.
         WSACleanup();                                                               // Cleanup winsock.
@@ -210,13 +236,15 @@ int connectToServer(SOCKET &s, struct addrinfo *result, char *portNum) {
  */
 int receiveServerPublicKey(SOCKET &s, int caKeyE, int caKeyN, int &serverKeyE, int &serverKeyN) {
 
+    loadRsaTable(caKeyE, caKeyN, RSA_TABLE_THREADS);                                // Decrypt the CA blob with one table load per symbol, built by the first handshake.
     int error = receiveKey(s, caKeyE, caKeyN, serverKeyE, serverKeyN);              // Receive the server's public key information.
     if (error) {                                                                    // If error occurred.
         return error;                                                               // Return error code.
     }
+    loadRsaTable(serverKeyE, serverKeyN, RSA_TABLE_THREADS);                        // Encrypt with one table load per symbol if the key is small enough.
     char sendBuffer[BUFFER_SIZE];                                                   // The buffer to store characters to send.
     strcpy(sendBuffer, "ACK 226 public key received\r\n");                          // Copy ACK message to send buffer.
-    cout << "\nSending ACK..." << endl;                                             // Alert user.
+    LOG(LOG_DEBUG) << "\nSending ACK..." << endl;                                   // Alert user.
     error = sendMessage(s, sendBuffer, strlen(sendBuffer));                         // Send ACK.
     if (error) {                                                                    // If error occurred.
         return error;                                                               // Return error code.
@@ -234,16 +262,22 @@ int receiveKey(SOCKET s, int caKeyE, int caKeyN, int &serverKeyE, int &serverKey
     long encryptedBuffer[BUFFER_SIZE];                                              // The buffer to store received encrypted message.
     memset(&encryptedBuffer, 0, BUFFER_SIZE);                                       // Ensure blank.
     int messageLength = 0;                                                          // Unused variable, stores message length of received message.
-    cout << "\nReceiving server's public key from \"CA\"..." << endl;               // Alert user.
+    LOG(LOG_DEBUG) << "\nReceiving server's public key from \"CA\"..." << endl;     // Alert user.
     int error = receiveEncryptedMessage(s, encryptedBuffer, messageLength);         // Receive message.
     if (error) {                                                                    // If error occurred.
         return error;                                                               // Return error code.
     }
+    if (lookupCertificate(encryptedBuffer, messageLength, caKeyE, caKeyN, serverKeyE, serverKeyN)) { // If this blob was verified before.
+        LOG(LOG_DEBUG) << dec << "\nKeys for encryption found in cache:\n\te = " << serverKeyE << "\n\tn = " << serverKeyN << endl;    // Alert user.
+        return 0;                                                                   // Return no error, skipping the CA decryption.
+    }
     char receiveBuffer[BUFFER_SIZE];                                                // The buffer to store received characters.
     memset(&receiveBuffer, 0, BUFFER_SIZE);                                         // Ensure blank.
     decryptCA(encryptedBuffer, receiveBuffer, messageLength, caKeyE, caKeyN);       // Decrypt message.
-    sscanf(receiveBuffer, "KEYS %d %d", &serverKeyE, &serverKeyN);                  // Extract public key values from receive buffer.
-    cout << dec << "\nKeys for encryption received:\n\te = " << serverKeyE << "\n\tn = " << serverKeyN << endl; // Alert user.
+    if (sscanf(receiveBuffer, "KEYS %d %d", &serverKeyE, &serverKeyN) == 2) {       // Extract public key values from receive buffer, if it holds them.
+        storeCertificate(encryptedBuffer, messageLength, caKeyE, caKeyN, serverKeyE, serverKeyN);   // Skip the CA decryption next time this blob is received.
+    }
+    LOG(LOG_DEBUG) << dec << "\nKeys for encryption received:\n\te = " << serverKeyE << "\n\tn = " << serverKeyN << endl; // Alert user.
     return 0;                                                                       // Return no error.
 }
 
@@ -254,96 +288,57 @@ int receiveKey(SOCKET s, int caKeyE, int caKeyN, int &serverKeyE, int &serverKey
  */
 int receiveEncryptedMessage(SOCKET s, long *encryptedBuffer, int &messageLength) {
 
-    char receiveBuffer[BUFFER_SIZE];                                                // The buffer to store received characters.
+    char receiveBuffer[BUFFER_SIZE + 1];                                            // The buffer to store received characters.
     char receivedMessage[BUFFER_SIZE];                                              // Buffer to store incoming message.
     memset(receiveBuffer, 0, BUFFER_SIZE);                                          // Ensure blank.
     memset(receivedMessage, 0, BUFFER_SIZE);                                        // Ensure blank.
     memset(encryptedBuffer, 0, BUFFER_SIZE);                                        // Ensure blank.
-    int bytes = 0;                                                                  // Stores the result of recv().
     int i = 0;                                                                      // The index of receivedMessage.
     bool messageReceived = false;                                                   // True when full message received.
-    messageLength = 0;                                                              // The length of the encrypted buffer.
     while (!messageReceived) {                                                      // Loop through message.
-        bytes = recv(s, &receivedMessage[i], 1, 0);                                 // Receive a char.
+        int bytes = transportRecv(s, &receivedMessage[i], 1);                       // Receive a char.
         if ((bytes == SOCKET_ERROR) || (bytes == 0)) {                              // If socket error or connection ended.
-            cout << "recv failed" << endl;                                          // Alert user.
+            LOG(LOG_ERROR) << "recv failed" << endl;                                // Alert user.
             return 7;                                                               // Return error code.
         } else if (receivedMessage[i] == '\n') {                                    // If received character is new line.
-            strcat(receiveBuffer, "\r\n");                                          // Concatenate message end onto receive buffer.
             messageReceived = true;                                                 // Full message has been received.
-        } else if (receivedMessage[i] == ' ') {                                     // If received character is space.
-            receivedMessage[i] = '\0';                                              // Terminate string.
-            sscanf(receivedMessage, "%ld ", &encryptedBuffer[messageLength]);       // Get long value from string.
-            messageLength++;                                                        // Increment encrypted buffer length.
-            strcat(receiveBuffer, receivedMessage);                                 // Copy received message to receive buffer (for display).
-            strcat(receiveBuffer, " ");                                             // Add space.
-            memset(receivedMessage, 0, BUFFER_SIZE);                                // Make received message blank again.
-            i = 0;                                                                  // Reset i.
-        } else if (messageLength == BUFFER_SIZE || i == BUFFER_SIZE) {              // If at buffer limit.
-            cout << "Full message not received: receiveBuffer overloaded" << endl;  // Alert user.
+        } else if (i == BUFFER_SIZE - 1) {                                          // If at buffer limit.
+            LOG(LOG_ERROR) << "Full message not received: receiveBuffer overloaded" << endl; // Alert user.
             return 8;                                                               // Return error code.
-        } else {                                                                    // Normal character.
-            i++;                                                                    // Increment i.
         }
+        i++;                                                                        // Increment i.
+    }
+    if (parseEncryptedMessage(receivedMessage, i, encryptedBuffer, messageLength, receiveBuffer)) {  // Parse long values, check if too many.
+        LOG(LOG_ERROR) << "Full message not received: receiveBuffer overloaded" << endl; // Alert user.
+        return 8;                                                                   // Return error code.
+    }
+    if (LOG_ENABLED(LOG_DEBUG)) {                                                   // If messages are logged.
+        logStream() << "<---";                                                      // Alert user.
+        displayCharBuffer(receiveBuffer, (int) strlen(receiveBuffer));              // Alert user
+    }
+    if (LOG_ENABLED(LOG_TRACE)) {                                                   // If every byte is logged.
+        printBuffer("RECEIVE BUFFER", receiveBuffer, strlen(receiveBuffer));        // Alert user.
     }
-    cout << "<---";                                                                 // Alert user.
-    displayCharBuffer(receiveBuffer, (int) strlen(receiveBuffer));                  // Alert user
-    // printBuffer("RECEIVE BUFFER", receiveBuffer, strlen(receiveBuffer));            // DEBUG.
     return 0;                                                                       // Return no error.
 }
 
 
 /**
  *  Displays character buffer in human readable format to user.
+ *  Writes to the log, callers check the level first so the buffer is only formatted when it will be shown.
  */
 void displayCharBuffer(char *charBuffer, int messageLength) {
 
     for (int i = 0; i < messageLength; i++) {                                       // Loop through buffer.
         if (charBuffer[i] == '\r') {                                                // If carriage return character.
-            cout << "\\r";                                                          // Output literal value.
+            logStream() << "\\r";                                                   // Output literal value.
         } else if (charBuffer[i] == '\n') {                                         // If new line character.
-            cout << "\\n";                                                          // Output literal value.
+            logStream() << "\\n";                                                   // Output literal value.
         } else {                                                                    // Else normal character.
-            cout << charBuffer[i];                                                  // Output character.
+            logStream() << charBuffer[i];                                           // Output character.
         }
     }
-    cout << endl;                                                                   // End line.
-}
-
-
-/**
- *  Decrypt method used to decrypt received encrypted messages.
- */
-void decryptCA(long *encryptedBuffer, char *receiveBuffer, int &messageLength, int e, int n) {
-
-    char tempBuffer[BUFFER_SIZE];                                                   // Temporary buffer to store decrypted characters.
-    memset(&tempBuffer, 0, BUFFER_SIZE);                                            // Ensure blank.
-    for (int i = 0; i < messageLength; i++) {                                       // Loop through message.
-        tempBuffer[i] = repeatsquare(encryptedBuffer[i], e, n);                     // Decrypt with RSA.
-    }
-    tempBuffer[messageLength] = '\0';                                               // Terminate string.
-    strcpy(receiveBuffer, tempBuffer);                                              // Copy to receive buffer.
-}
-
-
-/**
- *  Repeat Square method as found in Assignment guide.
- *  Returns encrypted long value.
- *  Magic maths occurs here.
- */
-long repeatsquare(long x, long eORd, long n) {
-
-    long y = 1;
-    while (eORd > 0) {
-        if ((eORd % 2) == 0) {
-            x = (x * x) % n;
-            eORd = eORd / 2;
-        } else {
-            y = (x * y) % n;
-            eORd = eORd - 1;
-        }
-    }
-    return y;
+    logStream() << endl;                                                            // End line.
 }
 
 
@@ -353,14 +348,16 @@ long repeatsquare(long x, long eORd, long n) {
  */
 int sendMessage(SOCKET s, char *sendBuffer, int strlen) {
 
-    int bytes = send(s, sendBuffer, strlen, 0);                                     // Send message to server.
+    int bytes = transportSend(s, sendBuffer, strlen);                               // Send message to server.
     if (bytes == SOCKET_ERROR) {                                                    // If connection ended.
-        cout << "send failed" << endl;                                              // Alert user.
+        LOG(LOG_ERROR) << "send failed" << endl;                                    // Alert user.
         WSACleanup();                                                               // Cleanup winsock.
         return 9;                                                                   // Return error code.
     }
-    cout << "--->";                                                                 // Show that sent message with direction of arrow.
-    displayCharBuffer(sendBuffer, strlen);                                          // Alert user.
+    if (LOG_ENABLED(LOG_DEBUG)) {                                                   // If messages are logged.
+        logStream() << "--->";                                                      // Show that sent message with direction of arrow.
+        displayCharBuffer(sendBuffer, strlen);                                      // Alert user.
+    }
     return 0;                                                                       // Return no error.
 }
 
@@ -371,7 +368,7 @@ int sendMessage(SOCKET s, char *sendBuffer, int strlen) {
  */
 int receiveACK(SOCKET s, char *expectedACK) {
 
-    cout << "\nReceiving ACK..." << endl;                                           // Alert user.
+    LOG(LOG_DEBUG) << "\nReceiving ACK..." << endl;                                 // Alert user.
     char receiveBuffer[BUFFER_SIZE];                                                // The buffer to store received characters.
     memset(&receiveBuffer, 0, BUFFER_SIZE);                                         // Ensure blank.
     int messageLength = 0;                                                          // Stores the length of the message, unused.
@@ -380,7 +377,7 @@ int receiveACK(SOCKET s, char *expectedACK) {
         return error;                                                               // Return error code.
     }
     if (strcmp(receiveBuffer, expectedACK)) {                                       // Ensure expected ACK was received.
-        cout << "Something went wrong, expected ACK not received." << endl;         // Alert user.
+        LOG(LOG_ERROR) << "Something went wrong, expected ACK not received." << endl; // Alert user.
         return 10;                                                                  // Return error code.
     }
     return 0;                                                                       // Return no error.
@@ -396,21 +393,23 @@ int receiveMessage(SOCKET s, char *receiveBuffer, int messageLength) {
     int i = 0;                                                                      // Index of receive buffer.
     bool messageReceived = false;                                                   // True when full message received.
     while (!messageReceived) {                                                      // Loop while message not entirely received.
-        int bytes = recv(s, &receiveBuffer[i], 1, 0);                               // Receive one byte of data from the server.
+        int bytes = transportRecv(s, &receiveBuffer[i], 1);                         // Receive one byte of data from the server.
         if ((bytes == SOCKET_ERROR) || (bytes == 0)) {                              // If socket error or connection ended.
-            cout << "recv failed" << endl;                                          // Alert user.
+            LOG(LOG_ERROR) << "recv failed" << endl;                                // Alert user.
             return 7;                                                               // Return error code.
         } else if (receiveBuffer[i] == '\n') {                                      // If received character is new line.
             messageReceived = true;                                                 // Full message has been received.
         } else if (i == BUFFER_SIZE) {                                              // If at buffer limit.
-            cout << "Full message not received: receiveBuffer overloaded" << endl;  // Alert user.
+            LOG(LOG_ERROR) << "Full message not received: receiveBuffer overloaded" << endl; // Alert user.
             return 8;                                                               // Return error code.
         }
         i++;                                                                        // Increment i.
     }
     receiveBuffer[i] = '\0';                                                        // Add null terminator.
-    cout << "<---";                                                                 // Show that received message with direction of arrow.
-    displayCharBuffer(receiveBuffer, i);                                            // Display received message.
+    if (LOG_ENABLED(LOG_INFO)) {                                                    // If replies are logged.
+        logStream() << "<---";                                                      // Show that received message with direction of arrow.
+        displayCharBuffer(receiveBuffer, i);                                        // Display received message.
+    }
     removeTerminatingCharacters(receiveBuffer, i);                                  // Remove terminating characters from received message.
     messageLength = i;                                                              // Store message length.
     return 0;                                                                       // Return no error.
@@ -428,46 +427,294 @@ void removeTerminatingCharacters(char *charBuffer, int &messageLength) {
 
 
 /**
- *  Sends the nOnce to the server and waits for ACK.
+ *  Sets the options the interactive client asks for, from the settings in client.h, other programs change what they need after.
+ *  Streams are not asked for, as the user types one conversation at a time.
+ */
+void initHandshakeOptions(HandshakeOptions &options) {
+
+    options.chainMode = CHAIN_MODE;                                                 // The chaining asked for.
+    options.compression = COMPRESSION;                                              // Whether compression is asked for.
+    options.batchMessages = BATCH_MESSAGES;                                         // The most lines batched.
+    options.batchBytes = BATCH_MAX_BYTES;                                           // The most bytes in a batch.
+    options.streamCredits = 0;                                                      // Streams are not asked for.
+    options.connectionCredits = 0;                                                  // Unused without streams.
+    options.sharedMemory = SHARED_MEMORY;                                           // Whether shared memory is asked for.
+}
+
+
+/**
+ *  Sends the nOnce to the server and waits for ACK, asking for the options given and leaving the options agreed.
+ *  Asks for counter mode if chainMode is CHAIN_CTR, the server names it in the ACK if it agrees, a server that does not know it sends the plain ACK and CBC is used.
+ *  Asks for compression if compression is true, it stays true only if the server names it in the ACK.
+ *  Asks for batching if batchMessages is above 1, the server names it in the ACK with the most messages and bytes it accepts in a batch, and both are lowered to them, otherwise batchMessages is set to 1 and batchBytes to 0.
+ *  Asks for streams if streamCredits is above 0, the server names them in the ACK with the credits of each stream and of the connection, otherwise both credits are set to 0.
+ *  Asks for shared memory if sharedMemory is true and the server is on this host, naming a region created for the connection.
+ *  If the server names it in the ACK, frames and replies go through the region from then on and sharedMemory stays true.
  *  Returns error code.
  */
-int sendNOnce(SOCKET s, long nOnce) {
+int sendNOnce(SOCKET s, long nOnce, HandshakeOptions &options) {
 
     char sendBuffer[BUFFER_SIZE];                                                   // The buffer to store characters to send.
     memset(&sendBuffer, 0, BUFFER_SIZE);                                            // Ensure blank.
     sprintf(sendBuffer, "NONCE %ld", nOnce);                                        // Add nOnce to send buffer.
+    if (options.chainMode == CHAIN_CTR) {                                           // If asking for counter mode.
+        strcat(sendBuffer, " CTR");                                                 // Add mode to send buffer.
+    }
+    if (options.compression) {                                                      // If asking for compression.
+        strcat(sendBuffer, " LZ");                                                  // Add option to send buffer.
+    }
+    if (options.batchMessages > 1) {                                                // If asking for batching.
+        strcat(sendBuffer, " BATCH");                                               // Add option to send buffer.
+    }
+    if (options.streamCredits > 0) {                                                // If asking for streams.
+        strcat(sendBuffer, " MUX");                                                 // Add option to send buffer.
+    }
+    HANDLE mapping = NULL;                                                          // The region's file mapping, if asking for shared memory.
+    SharedRegion *region = NULL;                                                    // The region, if asking for shared memory.
+    char regionName[SHM_NAME_SIZE];                                                 // The region's name.
+    bool askedForSharedMemory = options.sharedMemory && isLocalPeer(s) && createSharedRegion(regionName, mapping, region) == 0;    // True if asking for shared memory.
+    options.sharedMemory = askedForSharedMemory;                                    // Only asked for if the region was created.
+    if (askedForSharedMemory) {                                                     // If asking for shared memory.
+        strcat(sendBuffer, " SHM ");                                                // Add option to send buffer.
+        strcat(sendBuffer, regionName);                                             // Add region name to send buffer.
+    }
     strcat(sendBuffer, "\r\n");                                                     // Add terminating characters to message.
-    cout << "\nSending nOnce..." << endl;                                           // Alert user.
+    LOG(LOG_DEBUG) << "\nSending nOnce..." << endl;                                 // Alert user.
     int error = sendMessage(s, sendBuffer, strlen(sendBuffer));                     // Send nOnce to server.
+    char receiveBuffer[BUFFER_SIZE + 1];                                            // The buffer to store received characters.
+    memset(&receiveBuffer, 0, BUFFER_SIZE);                                         // Ensure blank.
+    if (!error) {                                                                   // If sent.
+        LOG(LOG_DEBUG) << "\nReceiving ACK..." << endl;                             // Alert user.
+        error = receiveMessage(s, receiveBuffer, 0);                                // Receive ACK from server.
+    }
+    if (!error) {                                                                   // If received.
+        error = parseACK(receiveBuffer, options);                                   // Agree the options the server named.
+    }
+    bool agreedSHM = !error && options.sharedMemory;                                // True if the server named shared memory.
+    if (agreedSHM) {                                                                // If the server opened the region.
+        registerSharedChannel(openSharedChannel(s, mapping, region, SHARED_CLIENT, true));    // Send and receive through it from now on.
+    } else if (askedForSharedMemory) {                                              // Else the region is not used.
+        UnmapViewOfFile(region);                                                    // Unmap region.
+        CloseHandle(mapping);                                                       // Free mapping.
+    }
+    options.sharedMemory = agreedSHM;                                               // Whether frames go through shared memory.
+    return error;                                                                   // Return error code.
+}
+
+
+/**
+ *  Agrees the options the server named in its ACK to the nOnce, see sendNOnce().
+ *  options holds the options asked for, sharedMemory only if a region was named, and is left holding the options agreed.
+ *  Returns error code, options are left as asked for if the ACK is not understood.
+ */
+int parseACK(char *receiveBuffer, HandshakeOptions &options) {
+
+    bool askedForBatching = options.batchMessages > 1;                              // True if asked for batching.
+    bool askedForStreams = options.streamCredits > 0;                               // True if asked for streams.
+    const char *expectedACK = "ACK 220 nOnce received";                             // The ACK, followed by the options agreed.
+    int offset = strlen(expectedACK);                                               // Index of the options agreed.
+    if (strncmp(receiveBuffer, expectedACK, offset) != 0) {                         // Ensure expected ACK was received.
+        LOG(LOG_ERROR) << "Something went wrong, expected ACK not received." << endl; // Alert user.
+        return 10;                                                                  // Return error code.
+    }
+    bool agreedCTR = false;                                                         // True if the server named counter mode.
+    bool agreedLZ = false;                                                          // True if the server named compression.
+    bool agreedRegion = false;                                                      // True if the server named shared memory.
+    int maxMessages = 1;                                                            // The most messages the server accepts in a batch, 1 unless it names batching.
+    int maxBytes = 0;                                                               // The most bytes the server accepts in a batch.
+    int streamCredits = 0;                                                          // No streams unless the server names them.
+    int connectionCredits = 0;                                                      // No streams unless the server names them.
+    char option[BUFFER_SIZE + 1];                                                   // An option named by the server.
+    int length = 0;                                                                 // Length of the option read.
+    while (sscanf(&receiveBuffer[offset], "%s%n", option, &length) == 1) {          // Loop through options.
+        offset += length;                                                           // Move past option.
+        if (strcmp(option, "CTR") == 0 && options.chainMode == CHAIN_CTR) {         // If counter mode was agreed.
+            agreedCTR = true;                                                       // Use counter mode.
+        } else if (strcmp(option, "LZ") == 0 && options.compression) {              // If compression was agreed.
+            agreedLZ = true;                                                        // Compress messages.
+        } else if (strcmp(option, "MUX") == 0 && askedForStreams && sscanf(&receiveBuffer[offset], "%d %d%n", &streamCredits, &connectionCredits, &length) == 2 && streamCredits > 0 && connectionCredits > 0) {  // If streams were agreed with their credits.
+            offset += length;                                                       // Move past credits.
+        } else if (strcmp(option, "SHM") == 0 && options.sharedMemory) {            // If shared memory was agreed.
+            agreedRegion = true;                                                    // Use the region.
+        } else if (strcmp(option, "BATCH") == 0 && askedForBatching && sscanf(&receiveBuffer[offset], "%d %d%n", &maxMessages, &maxBytes, &length) == 2 && maxMessages > 1 && maxBytes > 0) { // If batching was agreed with its limits.
+            offset += length;                                                       // Move past limits.
+        } else {                                                                    // Else an option that was not asked for.
+            LOG(LOG_ERROR) << "Something went wrong, expected ACK not received." << endl; // Alert user.
+            return 10;                                                              // Return error code.
+        }
+    }
+    if (!agreedCTR) {                                                               // If the server did not name counter mode.
+        options.chainMode = CHAIN_CBC;                                              // Server uses CBC.
+    }
+    options.compression = agreedLZ;                                                 // Compress only if the server can decompress.
+    options.batchMessages = maxMessages < options.batchMessages ? maxMessages : options.batchMessages;  // Batch no more messages than the server accepts, 1 if it does not batch.
+    options.batchBytes = maxBytes < options.batchBytes ? maxBytes : options.batchBytes; // Batch no more bytes than the server accepts, 0 if it does not batch.
+    options.streamCredits = streamCredits;                                          // Credits of each stream, 0 without streams.
+    options.connectionCredits = connectionCredits;                                  // Credits of the connection, 0 without streams.
+    options.sharedMemory = agreedRegion;                                            // Use the region only if the whole ACK was understood.
+    return 0;                                                                       // Return no error.
+}
+
+
+/**
+ *  Encrypts a message with the agreed chaining mode.
+ *  If compression was agreed, messages of COMPRESS_MIN_BYTES or more are compressed first when that makes them smaller, so fewer symbols are encrypted and sent.
+ *  A compressed message's values start with a header giving its length before compression.
+ *  ctrCounter is the session's count of symbols sent in counter mode, moved past the message so no two messages share pads.
+ */
+void encryptMessage(char *sendBuffer, int &messageLength, int e, int n, long nOnce, long long &ctrCounter, ChainMode chainMode, bool compression) {
+
+    int originalLength = 0;                                                         // The length before compression, 0 if not compressed.
+    if (compression && messageLength >= COMPRESS_MIN_BYTES) {                       // If worth compressing.
+        char compressedBuffer[BUFFER_SIZE];                                         // The compressed message.
+        int compressedLength = compressBlock(sendBuffer, messageLength, compressedBuffer, BUFFER_SIZE);    // Compress message.
+        if (compressedLength > 0) {                                                 // If smaller.
+            originalLength = messageLength;                                         // Remember the length for the header.
+            memcpy(sendBuffer, compressedBuffer, compressedLength);                 // Encrypt the compressed bytes instead.
+            messageLength = compressedLength;                                       // Update message length.
+        }
+    }
+    if (chainMode == CHAIN_CTR) {                                                   // If counter mode was agreed.
+        encryptCTR(sendBuffer, messageLength, e, n, nOnce, ctrCounter);             // Encrypt in counter mode, after the session's earlier symbols.
+    } else {                                                                        // Else chained.
+        encrypt(sendBuffer, messageLength, e, n, nOnce);                            // Encrypt with CBC.
+    }
+    if (originalLength > 0) {                                                       // If compressed.
+        char header[BUFFER_SIZE];                                                   // The compression header.
+        int headerLength = writeCompressionHeader(header, originalLength);          // Write header.
+        memmove(&sendBuffer[headerLength], sendBuffer, messageLength + 1);          // Make room, including the null terminator.
+        memcpy(sendBuffer, header, headerLength);                                   // Start with the header.
+        messageLength += headerLength;                                              // Include header.
+    }
+}
+
+
+/**
+ *  Encrypts a packed batch of messages, built with appendToBatch(), with the agreed chaining mode and compression.
+ *  The batch is encrypted as one message, so its messages share one pass of the cipher and one frame, and it starts with a header giving their number.
+ */
+void encryptBatch(char *sendBuffer, int &messageLength, int batchCount, int e, int n, long nOnce, long long &ctrCounter, ChainMode chainMode, bool compression) {
+
+    encryptMessage(sendBuffer, messageLength, e, n, nOnce, ctrCounter, chainMode, compression); // Encrypt the batch as one message.
+    char header[BUFFER_SIZE];                                                       // The batch header.
+    int headerLength = writeBatchHeader(header, batchCount);                        // Write header.
+    memmove(&sendBuffer[headerLength], sendBuffer, messageLength + 1);              // Make room, including the null terminator.
+    memcpy(sendBuffer, header, headerLength);                                       // Start with the header.
+    messageLength += headerLength;                                                  // Include header.
+}
+
+
+/**
+ *  Receives the one reply to a batch, the batch header is removed from receiveBuffer, leaving the replies packed in the order the messages were.
+ *  Returns error code.
+ */
+int receiveBatchReply(SOCKET s, char *receiveBuffer, int batchCount, int &messageLength) {
+
+    int error = receiveMessage(s, receiveBuffer, 0);                                // Receive reply from server.
     if (error) {                                                                    // If error occurred.
         return error;                                                               // Return error code.
     }
-    char expectedACK[BUFFER_SIZE] = "ACK 220 nOnce received";                       // Create the expected ACK.
-    error = receiveACK(s, expectedACK);                                             // Receive ACK from server.
-    return error;                                                                   // Return any error code, 0 if no error.
+    messageLength = strlen(receiveBuffer);                                          // Length of the reply without "\r\n".
+    int count = 0;                                                                  // Number of replies named by the header.
+    int headerLength = parseBatchHeader(receiveBuffer, messageLength, count);       // Read the batch header.
+    messageLength -= headerLength;                                                  // Remove header.
+    memmove(receiveBuffer, &receiveBuffer[headerLength], messageLength + 1);        // Move replies and null terminator to the start.
+    int offset = 0;                                                                 // Index of the next reply.
+    const char *reply = NULL;                                                       // The reply read.
+    int replyLength = 0;                                                            // Length of the reply read.
+    int replies = 0;                                                                // Number of replies read.
+    int result = 0;                                                                 // Result of reading a reply.
+    while ((result = readBatchMessage(receiveBuffer, messageLength, offset, reply, replyLength)) == 1) {  // Loop through replies.
+        replies++;                                                                  // Count reply.
+    }
+    if (headerLength == 0 || count != batchCount || result < 0 || replies != batchCount) {  // If not a reply to every message.
+        LOG(LOG_ERROR) << "Batched reply does not match the batch sent" << endl;    // Alert user.
+        return 13;                                                                  // Return error code.
+    }
+    return 0;                                                                       // Return no error.
+}
+
+
+/**
+ *  Sends an encrypted message on a stream of a multiplexed connection, messageLength is updated to include the stream header.
+ *  Returns error code.
+ */
+int sendStreamMessage(SOCKET s, int stream, char *sendBuffer, int &messageLength) {
+
+    char frameBuffer[BUFFER_SIZE];                                                  // The message with its stream header.
+    int headerLength = writeStreamHeader(frameBuffer, stream);                      // Start with the stream header.
+    if (headerLength + messageLength > BUFFER_SIZE) {                               // If the header does not fit.
+        LOG(LOG_ERROR) << "Message too long for its stream header" << endl;         // Alert user.
+        return 11;                                                                  // Return error code.
+    }
+    memcpy(&frameBuffer[headerLength], sendBuffer, messageLength);                  // Follow with the encrypted message.
+    messageLength += headerLength;                                                  // Include header.
+    return sendMessage(s, frameBuffer, messageLength);                              // Send message to server.
+}
+
+
+/**
+ *  Receives a reply on any stream of a multiplexed connection, the stream header is removed from receiveBuffer.
+ *  Returns error code.
+ */
+int receiveStreamMessage(SOCKET s, int &stream, char *receiveBuffer, int &messageLength) {
+
+    int error = receiveMessage(s, receiveBuffer, 0);                                // Receive reply from server.
+    if (error) {                                                                    // If error occurred.
+        return error;                                                               // Return error code.
+    }
+    messageLength = strlen(receiveBuffer);                                          // Length of the reply without "\r\n".
+    int headerLength = parseStreamHeader(receiveBuffer, messageLength, stream);     // Read the stream header.
+    if (headerLength == 0) {                                                        // If no stream header.
+        LOG(LOG_ERROR) << "Reply received without a stream header" << endl;         // Alert user.
+        return 12;                                                                  // Return error code.
+    }
+    messageLength -= headerLength;                                                  // Remove header.
+    memmove(receiveBuffer, &receiveBuffer[headerLength], messageLength + 1);        // Move reply and null terminator to the start.
+    return 0;                                                                       // Return no error.
 }
 
 
 /**
  *  Gets input from user and sends as encrypted message to server.
+ *  If batching was agreed, lines typed within BATCH_MAX_DELAY_MS of each other are sent as one message, and answered with one reply.
  *  Returns error code.
  */
-int sendUserMessages(SOCKET s, int serverKeyE, int serverKeyN, long nOnce) {
+int sendUserMessages(SOCKET s, int serverKeyE, int serverKeyN, long nOnce, const HandshakeOptions &options) {
 
+    flushLog();                                                                     // Show queued lines before the prompt.
     cout << "\n--------------------------------------------" << endl;               // Alert user.
     cout << "You may now start sending commands to the server\n\nType here:";       // Alert user.
-    char sendBuffer[BUFFER_SIZE];                                                   // The buffer to store characters inputted by the user.
-    memset(&sendBuffer, 0, BUFFER_SIZE);                                            // Ensure blank.
-    int messageLength = 0;                                                          // Stores the length of the message.
-    int error = getInput(sendBuffer, messageLength);                                // Get input from user.
+    char inputBuffer[BUFFER_SIZE];                                                  // The buffer to store characters inputted by the user.
+    memset(&inputBuffer, 0, BUFFER_SIZE);                                           // Ensure blank.
+    int inputLength = 0;                                                            // Stores the length of the input.
+    long long ctrCounter = 0;                                                       // Symbols sent in counter mode, every message gets new pads.
+    int error = getInput(inputBuffer, inputLength);                                 // Get input from user.
     if (error) {                                                                    // If error occurred.
         return error;                                                               // Return error code.
     }
-    while ((strncmp(sendBuffer, ".", 1) != 0)) {                                    // While user has not typed '.' (to exit client).
-        cout << "\nEncrypting message..." << endl;                                  // Alert user.
-        encrypt(sendBuffer, messageLength, serverKeyE, serverKeyN, nOnce);          // Encrypt user message.
-        printBuffer("SEND BUFFER", sendBuffer, messageLength);                      // Alert user.
-        cout << "\nSending encrypted message..." << endl;                           // Alert user.
+    while ((strncmp(inputBuffer, ".", 1) != 0)) {                                   // While user has not typed '.' (to exit client).
+        char sendBuffer[BUFFER_SIZE];                                               // The buffer to store the message to send.
+        memcpy(sendBuffer, inputBuffer, inputLength + 1);                           // Send the input, including the null terminator.
+        int messageLength = inputLength;                                            // Stores the length of the message.
+        int batchCount = 1;                                                         // Number of lines in the message.
+        bool inputPending = false;                                                  // True if a line typed was left for the next message.
+        if (options.batchMessages > 1) {                                            // If batching was agreed.
+            error = batchUserInput(sendBuffer, messageLength, batchCount, options.batchMessages, options.batchBytes, inputBuffer, inputLength, inputPending); // Add any lines typed meanwhile.
+            if (error) {                                                            // If error occurred.
+                return error;                                                       // Return error code.
+            }
+        }
+        LOG(LOG_DEBUG) << "\nEncrypting message..." << endl;                        // Alert user.
+        if (batchCount > 1) {                                                       // If several lines were batched.
+            encryptBatch(sendBuffer, messageLength, batchCount, serverKeyE, serverKeyN, nOnce, ctrCounter, options.chainMode, options.compression);    // Encrypt the batch.
+        } else {                                                                    // Else one line.
+            encryptMessage(sendBuffer, messageLength, serverKeyE, serverKeyN, nOnce, ctrCounter, options.chainMode, options.compression);   // Encrypt user message.
+        }
+        if (LOG_ENABLED(LOG_TRACE)) {                                               // If every byte is logged.
+            printBuffer("SEND BUFFER", sendBuffer, messageLength);                  // Alert user.
+        }
+        LOG(LOG_DEBUG) << "\nSending encrypted message..." << endl;                 // Alert user.
         error = sendMessage(s, sendBuffer, messageLength);                          // Send message to server.
         if (error) {                                                                // If error occurred.
             return error;                                                           // Return error code.
@@ -475,107 +722,191 @@ int sendUserMessages(SOCKET s, int serverKeyE, int serverKeyN, long nOnce) {
 
         char receiveBuffer[BUFFER_SIZE];                                            // The buffer to store received characters.
         memset(&receiveBuffer, 0, BUFFER_SIZE);                                     // Ensure blank.
-        cout << "\nReceiving reply from server..." << endl;                         // Alert user.
-        error = receiveMessage(s, receiveBuffer, messageLength);                    // Receive reply from server.
+        LOG(LOG_DEBUG) << "\nReceiving reply from server..." << endl;               // Alert user.
+        if (batchCount > 1) {                                                       // If several lines were batched.
+            error = receiveBatchReply(s, receiveBuffer, batchCount, messageLength); // Receive the reply to every line.
+        } else {                                                                    // Else one line.
+            error = receiveMessage(s, receiveBuffer, messageLength);                // Receive reply from server.
+        }
         if (error) {                                                                // If error occurred.
             return error;                                                           // Return error code.
         }
 
-        memset(&sendBuffer, 0, BUFFER_SIZE);                                        // Ensure blank.
-        cout << "\nReady to send another message" << endl;                          // Alert user.
-        cout << "\nType here:";                                                     // Alert user.
-        error = getInput(sendBuffer, messageLength);                                // Get input from user.
+        if (!inputPending) {                                                        // If every line typed has been sent.
+            memset(&inputBuffer, 0, BUFFER_SIZE);                                   // Ensure blank.
+            flushLog();                                                             // Show queued lines before the prompt.
+            cout << "\nReady to send another message" << endl;                      // Alert user.
+            cout << "\nType here:";                                                 // Alert user.
+            error = getInput(inputBuffer, inputLength);                             // Get input from user.
+            if (error) {                                                            // If error occurred.
+                return error;                                                       // Return error code.
+            }
+        }
+    }
+    return 0;                                                                       // Return no error.
+}
+
+
+/**
+ *  Packs further lines typed within BATCH_MAX_DELAY_MS of the first into one batch with it, so a burst of lines costs one message and one reply.
+ *  Stops at batchMessages lines or batchBytes bytes, when the delay runs out, or when the user types '.'.
+ *  A line that ends the batch without joining it is left in inputBuffer, with inputPending set, to be sent next.
+ *  If only the first line is batched, sendBuffer is left as it is and batchCount is 1.
+ *  Returns error code.
+ */
+int batchUserInput(char *sendBuffer, int &messageLength, int &batchCount, int batchMessages, int batchBytes, char *inputBuffer, int &inputLength, bool &inputPending) {
+
+    char batchBuffer[BUFFER_SIZE];                                                  // The packed batch.
+    int batchLength = appendToBatch(batchBuffer, 0, batchBytes, sendBuffer, messageLength); // Start with the first line.
+    batchCount = 1;                                                                 // Number of lines packed.
+    inputPending = false;                                                           // No line left over yet.
+    DWORD start = GetTickCount();                                                   // When the first line was typed.
+    while (batchLength >= 0 && batchCount < batchMessages) {                        // While the batch has room.
+        DWORD waited = GetTickCount() - start;                                      // Time the first line has waited.
+        if (waited >= BATCH_MAX_DELAY_MS || !waitForInput(BATCH_MAX_DELAY_MS - waited)) {   // If no line is typed before the delay runs out.
+            break;                                                                  // Send the batch.
+        }
+        int error = getInput(inputBuffer, inputLength);                             // Get the next line.
         if (error) {                                                                // If error occurred.
             return error;                                                           // Return error code.
         }
+        inputPending = true;                                                        // The line is left over unless it joins the batch.
+        if (strncmp(inputBuffer, ".", 1) == 0) {                                    // If the user typed '.' (to exit client).
+            break;                                                                  // Send the batch, then exit.
+        }
+        int length = appendToBatch(batchBuffer, batchLength, batchBytes, inputBuffer, inputLength);   // Pack the line.
+        if (length < 0) {                                                           // If it does not fit.
+            break;                                                                  // Send it next.
+        }
+        batchLength = length;                                                       // The line joined the batch.
+        batchCount++;                                                               // Count line.
+        inputPending = false;                                                       // Nothing left over.
+    }
+    if (batchCount > 1) {                                                           // If lines were batched.
+        memcpy(sendBuffer, batchBuffer, batchLength);                               // Send the batch instead.
+        sendBuffer[batchLength] = '\0';                                             // Terminate string.
+        messageLength = batchLength;                                                // Update message length.
     }
     return 0;                                                                       // Return no error.
 }
 
 
 /**
- *  Gets input from user.
- *  Returns error code.
+ *  Waits for the user to finish typing a line.
+ *  Lines are read by the input thread, so a line counts once it is complete and getInput() will not block on it.
+ *  Returns true if a line is waiting, false if the time ran out.
  */
-int getInput(char *inputBuffer, int &messageLength) {
+bool waitForInput(DWORD milliseconds) {
 
-    if (fgets(inputBuffer, SEGMENT_SIZE, stdin) == NULL) {                          // Get input from user and store in buffer, check if executed incorrectly.
-        cout << "error using fgets()" << endl;                                      // Alert user.
-        return 10;                                                                  // Return error code.
+    if (startInputThread()) {                                                       // If the input thread could not be started.
+        return false;                                                               // No line can be waiting.
     }
-    messageLength = strlen(inputBuffer);                                            // Get message length.
-    inputBuffer[--messageLength] = '\0';                                            // Strip '\n' from cin.
-    return 0;                                                                       // Return no error.
+    return WaitForSingleObject(inputReady, milliseconds) == WAIT_OBJECT_0;          // Wait for a queued line.
 }
 
 
 /**
- *  Encrypt method used to encrypt the message to be sent.
+ *  Gets input from user, the next line the input thread read.
+ *  Returns error code.
  */
-void encrypt(char *sendBuffer, int &messageLength, int e, int n, long nOnce) {
+int getInput(char *inputBuffer, int &messageLength) {
 
-    long cbcEncryptedBuffer[BUFFER_SIZE];                                           // Buffer to store CBCed message.
-    long rsaAndCBCEncryptedBuffer[BUFFER_SIZE];                                     // Buffer to store RSA encrypted message.
-    memset(&cbcEncryptedBuffer, 0, BUFFER_SIZE);                                    // Ensure blank.
-    memset(&rsaAndCBCEncryptedBuffer, 0, BUFFER_SIZE);                              // Ensure blank.
-    for (int i = 0; i < messageLength; i++) {                                       // Loop through message.
-        cbcEncryptedBuffer[i] = cbc(sendBuffer[i], i == 0 ? nOnce : cbcEncryptedBuffer[i-1]);   // Encrypt with CBC.
-        rsaAndCBCEncryptedBuffer[i] = repeatsquare(cbcEncryptedBuffer[i], e, n);    // Encrypt with RSA.
+    if (startInputThread()) {                                                       // If the input thread could not be started.
+        LOG(LOG_ERROR) << "error starting the input thread" << endl;                // Alert user.
+        return 10;                                                                  // Return error code.
     }
-    createStringToSend(sendBuffer, rsaAndCBCEncryptedBuffer, messageLength);        // Create string for sending to server.
+    WaitForSingleObject(inputReady, INFINITE);                                      // Wait for a line.
+    EnterCriticalSection(&inputLock);                                               // Lock queue.
+    InputLine &line = inputQueue[inputHead];                                        // The line taken.
+    messageLength = line.length;                                                    // Get message length.
+    if (messageLength >= 0) {                                                       // If a line was read.
+        memcpy(inputBuffer, line.text, messageLength + 1);                          // Copy it with its '\0'.
+        inputHead = (inputHead + 1) % INPUT_QUEUE_LINES;                            // Take it.
+        if (--inputCount == 0) {                                                    // If no line is left.
+            ResetEvent(inputReady);                                                 // Wait for the next one.
+        }
+    }                                                                               // Else the end stays queued for every later call.
+    LeaveCriticalSection(&inputLock);                                               // Unlock queue.
+    SetEvent(inputSpace);                                                           // Let the input thread queue another line.
+    if (messageLength < 0) {                                                        // If the input ended or failed.
+        LOG(LOG_ERROR) << "error using fgets()" << endl;                            // Alert user.
+        return 10;                                                                  // Return error code.
+    }
+    return 0;                                                                       // Return no error.
 }
 
 
 /**
- *  Cypher Block Chain encryption.
- *  Returns encrypted long value.
+ *  Starts the thread that reads the user's lines into the input queue, if not already started.
+ *  Returns error code.
  */
-long cbc(char charToEncrypt, long rand) {
+int startInputThread() {
 
-    return charToEncrypt ^ rand;                                                    // Return encrypted value.
+    if (inputThread != NULL) {                                                      // If already started.
+        return 0;                                                                   // Nothing more to do.
+    }
+    InitializeCriticalSection(&inputLock);                                          // Prepare lock.
+    inputReady = CreateEvent(NULL, TRUE, FALSE, NULL);                              // Manual reset, no line yet.
+    inputSpace = CreateEvent(NULL, FALSE, FALSE, NULL);                             // Auto reset, set as lines are taken.
+    if (inputReady == NULL || inputSpace == NULL) {                                 // If the events could not be created.
+        return 1;                                                                   // Return error code.
+    }
+    inputThread = CreateThread(NULL, 0, readInputLines, NULL, 0, NULL);             // Start reading lines.
+    return inputThread == NULL ? 1 : 0;                                             // Return error code if not started.
 }
 
 
 /**
- *  Creates a string of char representation of long values from the encrypted long buffer.
- *  Returns new message length.
+ *  Reads the user's lines into the input queue, waiting while it is full, until the input ends.
+ *  A line longer than SEGMENT_SIZE is queued as several, as fgets() segments it.
+ *  Returns 0 when the input ends.
  */
-void createStringToSend(char *sendBuffer, long *encryptedBuffer, int &messageLength) {
-
-    char charBuffer[BUFFER_SIZE];                                                   // Temporary character buffer to store string to send.
-    memset(&charBuffer, 0, BUFFER_SIZE);                                            // Make blank.
-    for (int i = 0; i < messageLength; i++) {                                       // Loop through encrypted message.
-        char tempBuffer[BUFFER_SIZE];                                               // Stores the char representation of the long value from the encrypted buffer.
-        memset(&tempBuffer, 0, BUFFER_SIZE);                                        // Ensure blank.
-        sprintf(tempBuffer, "%ld", encryptedBuffer[i]);                             // Copy encrypted value from buffer into char string.
-        strcat(charBuffer, tempBuffer);                                             // Concatenate onto send buffer.
-        strcat(charBuffer, " ");                                                    // Space seperate values.
-    }
-    strcat(charBuffer, "\r\n");                                                     // Add terminating characters to message.
-    strcpy(sendBuffer, charBuffer);                                                 // Copy the message to send buffer.
-    messageLength = strlen(sendBuffer);                                             // Update message length.
+DWORD WINAPI readInputLines(LPVOID parameter) {
+
+    while (true) {                                                                  // Until the input ends.
+        InputLine line;                                                             // The line read.
+        line.length = -1;                                                           // The input ended or failed unless a line is read.
+        if (fgets(line.text, SEGMENT_SIZE, stdin) != NULL) {                        // Get input from user and store in buffer, check if executed incorrectly.
+            line.length = strlen(line.text);                                        // Get message length.
+            line.text[--line.length] = '\0';                                        // Strip '\n' from cin.
+        }
+        EnterCriticalSection(&inputLock);                                           // Lock queue.
+        while (inputCount == INPUT_QUEUE_LINES) {                                   // While the queue is full.
+            LeaveCriticalSection(&inputLock);                                       // Unlock queue.
+            WaitForSingleObject(inputSpace, INFINITE);                              // Wait for a line to be taken.
+            EnterCriticalSection(&inputLock);                                       // Lock queue.
+        }
+        inputQueue[(inputHead + inputCount) % INPUT_QUEUE_LINES] = line;            // Queue line.
+        inputCount++;                                                               // Count line.
+        SetEvent(inputReady);                                                       // Wake getInput().
+        LeaveCriticalSection(&inputLock);                                           // Unlock queue.
+        if (line.length < 0) {                                                      // If the input ended.
+            return 0;                                                               // Stop reading.
+        }
+    }
 }
 
 
 /**
  *  Napoleon's print buffer method.
  *  Outputs each byte of a char buffer in readable format with special characters displayed.
+ *  Writes to the log at LOG_TRACE, callers check the level first as this is one line per byte.
  */
 void printBuffer(const char *header, char *buffer, int messageLength) {
 
-    cout << "\n------ " << header << " ------" << endl;
+    logStream() << "\n------ " << header << " ------" << endl;
     for (int i = 0; i < messageLength; i++) {
         if (buffer[i] == '\r') {
-            cout << "buffer[0x";
-            cout << hex << uppercase << i << "]=\\r" << endl;
+            logStream() << "buffer[0x";
+            logStream() << hex << uppercase << i << "]=\\r" << endl;
         } else if (buffer[i] == '\n') {
-            cout << "buffer[0x";
-            cout << hex << uppercase << i << "]=\\n" << endl;
+            logStream() << "buffer[0x";
+            logStream() << hex << uppercase << i << "]=\\n" << endl;
         } else {
-            cout << "buffer[0x";
-            cout << hex << uppercase << i << "]=" << buffer[i] << endl;
+            logStream() << "buffer[0x";
+            logStream() << hex << uppercase << i << "]=" << buffer[i] << endl;
         }
     }
-    cout << dec << "---" << endl;
+    logStream() << dec << "---" << endl;
 }
 
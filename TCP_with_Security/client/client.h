@@ -1,3 +1,6 @@
+#ifndef CLIENT_H
+#define CLIENT_H
+
 #define _WIN32_WINNT 0x501
 #include <ws2tcpip.h>
 #include <winsock2.h>
@@ -5,20 +8,47 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <iostream>
+#include "../common/cipher.h"
+#include "../common/log.h"
+#include "../common/rsatable.h"
+#include "../common/stream.h"
+#include "../common/compress.h"
+#include "../common/batch.h"
+#include "../common/transport.h"
+#include "certcache.h"
 
 #define USE_IPV6 false                                                              // Sets whether to use IPv6 (true) or IPv4 (false).
 #define DEFAULT_PORT "1234"                                                         // The port number used for TCP connection.
 #define BUFFER_SIZE 800                                                             // Size of buffer to receive and send messages with.
 #define SEGMENT_SIZE 70                                                             // If fgets gets more than this number of bytes it segments the message.
+#define CHAIN_MODE CHAIN_CTR                                                        // Chaining asked for with the nOnce, the server may answer with CBC instead.
+#define COMPRESSION true                                                            // Whether compression is asked for with the nOnce, the server may not agree.
+#define SHARED_MEMORY true                                                          // Whether shared memory is asked for with the nOnce, only used if the server is on this host.
+#define BATCH_MESSAGES BATCH_MAX_MESSAGES                                           // Most lines typed within BATCH_MAX_DELAY_MS sent as one message, 1 never asks for batching.
+#define INPUT_QUEUE_LINES 16                                                        // Lines the input thread reads ahead of the sender.
 #define WSVERS MAKEWORD(2,2)
 
 using namespace std;
 
 
+/**
+ *  Structures.
+ */
+struct HandshakeOptions {                                                           // The options asked for with the nOnce, then the options the server agreed.
+    ChainMode chainMode;                                                            // Counter mode is asked for with CHAIN_CTR, CBC is used unless the server agrees.
+    bool      compression;                                                          // True if compression is asked for, then whether it was agreed.
+    int       batchMessages;                                                        // Batching is asked for if above 1, then the most messages the server accepts, 1 if none.
+    int       batchBytes;                                                           // The most bytes in a batch, then the most the server accepts, 0 if it does not batch.
+    int       streamCredits;                                                        // Streams are asked for if above 0, then the credits of each stream, 0 if none.
+    int       connectionCredits;                                                    // The credits of the connection, if streams were agreed.
+    bool      sharedMemory;                                                         // True if shared memory is asked for, then whether frames go through it.
+};
+
+
 /**
  *  Function declarations.
  */
-int  tcpConnect(SOCKET &s, int argc, char *argv[]);                                 // Setup TCP connection with server.
+int  tcpConnect(SOCKET &s, int argc, char *argv[]);                                 // Setup TCP connection with server, or an AF_UNIX one if its address starts "unix:".
 int  startWSA();                                                                    // Start WSA.
 int  getServerAddressInfo(int argc, char *argv[], struct addrinfo *&result, char *portNum); // Gets the server's address info.
 int  createSocket(SOCKET &s, struct addrinfo *result);                              // Creates the socket for connection to server.
@@ -28,17 +58,24 @@ int  receiveServerPublicKey(SOCKET &s, int caKeyE, int caKeyN, int &serverKeyE,
 int  receiveKey(SOCKET s, int caKeyE, int caKeyN, int &serverKeyE, int &serverKeyN);    // Receives the message containing the server's public key information.
 int  receiveEncryptedMessage(SOCKET s, long *encryptedBuffer, int &messageLength);  // Receives encrypted message and stores in encryptedBuffer.
 void displayCharBuffer(char *charBuffer, int messageLength);                        // Displays character buffer in human readable format to user.
-void decryptCA(long *encryptedBuffer, char *receiveBuffer, int &messageLength, int e, int n);   // Decrypt method used to decrypt received encrypted messages.
-long repeatsquare(long x, long eORd, long n);                                       // Repeat Square method as found in Assignment guide.
 int  sendMessage(SOCKET s, char *sendBuffer, int strlen);                           // Sends buffer to server.
 int  receiveACK(SOCKET s, char *expectedACK);                                       // Receives message from user and compares to expected ACK string.
 int  receiveMessage(SOCKET s, char *receiveBuffer, int messageLength);              // Receives a message from the server and displays message.
 void removeTerminatingCharacters(char *charBuffer, int &messageLength);             // Removes terminating characters "\r\n" from messages.
-int  sendNOnce(SOCKET s, long nOnce);                                               // Sends the nOnce to the server and waits for ACK.
-int  sendUserMessages(SOCKET s, int serverKeyE, int serverKeyN, long nOnce);        // Gets input from user and sends as encrypted message to server.
+void initHandshakeOptions(HandshakeOptions &options);                               // Sets the options the interactive client asks for.
+int  sendNOnce(SOCKET s, long nOnce, HandshakeOptions &options);                    // Sends the nOnce to the server and waits for ACK, agreeing the chaining mode, compression, batching, streams and shared memory.
+int  parseACK(char *receiveBuffer, HandshakeOptions &options);                      // Agrees the options the server named in its ACK to the nOnce.
+void encryptMessage(char *sendBuffer, int &messageLength, int e, int n, long nOnce, long long &ctrCounter, ChainMode chainMode, bool compression);  // Encrypts a message with the agreed chaining mode, compressing it first if agreed.
+int  sendStreamMessage(SOCKET s, int stream, char *sendBuffer, int &messageLength);    // Sends an encrypted message on a stream of a multiplexed connection.
+int  receiveStreamMessage(SOCKET s, int &stream, char *receiveBuffer, int &messageLength);  // Receives a reply on any stream of a multiplexed connection.
+void encryptBatch(char *sendBuffer, int &messageLength, int batchCount, int e, int n, long nOnce, long long &ctrCounter, ChainMode chainMode, bool compression);   // Encrypts a packed batch of messages and starts it with a batch header.
+int  receiveBatchReply(SOCKET s, char *receiveBuffer, int batchCount, int &messageLength);  // Receives the one reply to a batch, checking it packs a reply to every message.
+int  sendUserMessages(SOCKET s, int serverKeyE, int serverKeyN, long nOnce, const HandshakeOptions &options);  // Gets input from user and sends as encrypted message to server.
+int  batchUserInput(char *sendBuffer, int &messageLength, int &batchCount, int batchMessages, int batchBytes, char *inputBuffer, int &inputLength, bool &inputPending);   // Packs further lines typed within BATCH_MAX_DELAY_MS with the first.
+bool waitForInput(DWORD milliseconds);                                              // Waits for the user to finish typing a line.
 int  getInput(char *inputBuffer, int &messageLength);                               // Gets input from user.
-void encrypt(char *sendBuffer, int &messageLength, int e, int n, long nOnce);       // Encrypt method used to encrypt the message to be sent.
-long cbc(char charToEncrypt, long rand);                                            // Cypher Block Chain encryption.
-void createStringToSend(char *sendBuffer, long *encryptedBuffer, int &messageLength);   // Creates a string of char representation of long values from the encrypted long buffer.
+int  startInputThread();                                                            // Starts the thread that reads the user's lines into the input queue.
+DWORD WINAPI readInputLines(LPVOID parameter);                                      // Reads the user's lines into the input queue until the input ends.
 void printBuffer(const char *header, char *buffer, int messageLength);              // Napoleon's print buffer method.
 
+#endif
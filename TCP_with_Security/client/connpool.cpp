@@ -0,0 +1,333 @@
+#include "connpool.h"
+
+static int          connectPooledSession(ConnectionPool &pool, PooledSession *&session);    // Connects and does the handshake for a new session.
+static void         closePooledSession(PooledSession *session);                     // Closes a session's socket and frees it.
+static bool         sessionAlive(PooledSession *session);                           // Checks an idle session has not been closed by the server.
+static void         handOver(ConnectionPool &pool, PooledSession *session);         // Gives a session to the thread waiting longest, or makes it idle.
+static void         checkIdleSessions(ConnectionPool &pool);                        // Closes idle sessions that were lost or idle too long.
+static void         refillPool(ConnectionPool &pool);                               // Connects sessions until the pool is at its minimum and no thread waits.
+static DWORD WINAPI runRefillThread(LPVOID parameter);                              // The refill thread's function.
+
+
+/**
+ *  Connects minSize sessions, so the pool is warm when it returns, and starts the refill thread.
+ *  Sessions are handshaked with the client's own chaining and compression, without batching or streams, and with shared memory if asked for and the server is on this host.
+ *  initTransport() must have been called first.
+ *  Returns error code.
+ */
+int startConnectionPool(ConnectionPool &pool, char *host, char *port, int minSize, int maxSize, bool sharedMemory) {
+
+    if (minSize < 0 || maxSize < 1 || minSize > maxSize) {                          // If the sizes make no pool.
+        LOG(LOG_ERROR) << "Pool sizes must satisfy 0 <= min <= max and max >= 1" << endl;   // Alert user.
+        return 1;                                                                   // Return error code.
+    }
+    memset(&pool, 0, sizeof(ConnectionPool));                                       // Ensure blank.
+    pool.host = host;                                                               // Store server.
+    pool.port = port;                                                               // Store server.
+    pool.minSize = minSize;                                                         // Store sizes.
+    pool.maxSize = maxSize;                                                         // Store sizes.
+    pool.sharedMemory = sharedMemory;                                               // Store transport.
+    InitializeCriticalSection(&pool.lock);                                          // Prepare lock.
+    pool.wakeEvent = CreateEvent(NULL, FALSE, FALSE, NULL);                         // Auto reset, each wake runs one check.
+    for (int i = 0; i < minSize; i++) {                                             // Loop through the first sessions.
+        PooledSession *session = NULL;                                              // The new session.
+        int error = connectPooledSession(pool, session);                            // Connect it.
+        if (error) {                                                                // If error occurred.
+            stopConnectionPool(pool);                                               // Close the sessions already open.
+            return error;                                                           // Return error code.
+        }
+        pool.openCount++;                                                           // Count session.
+        pool.connects++;                                                            // Count connect.
+        handOver(pool, session);                                                    // Make it idle.
+    }
+    pool.refillThread = CreateThread(NULL, 0, runRefillThread, &pool, 0, NULL);     // Start the refill thread.
+    if (pool.refillThread == NULL) {                                                // If it could not be started.
+        LOG(LOG_ERROR) << "Pool refill thread could not be started" << endl;        // Alert user.
+        stopConnectionPool(pool);                                                   // Close the sessions.
+        return 2;                                                                   // Return error code.
+    }
+    return 0;                                                                       // Return no error.
+}
+
+
+/**
+ *  Stops the refill thread and closes every idle session.
+ *  Call once no thread is using the pool, every session must have been checked in.
+ */
+void stopConnectionPool(ConnectionPool &pool) {
+
+    InterlockedExchange(&pool.stopping, 1);                                         // Stop refilling.
+    if (pool.refillThread != NULL) {                                                // If started.
+        SetEvent(pool.wakeEvent);                                                   // Wake the refill thread.
+        WaitForSingleObject(pool.refillThread, INFINITE);                           // Wait for it to finish.
+        CloseHandle(pool.refillThread);                                             // Free thread.
+    }
+    while (pool.idleHead != NULL) {                                                 // Loop through idle sessions.
+        PooledSession *session = pool.idleHead;                                     // The session.
+        pool.idleHead = session->next;                                              // Remove from list.
+        closePooledSession(session);                                                // Close it.
+    }
+    CloseHandle(pool.wakeEvent);                                                    // Free event.
+    DeleteCriticalSection(&pool.lock);                                              // Free lock.
+}
+
+
+/**
+ *  Takes the session idle longest, checking first that the server has not closed it.
+ *  With no idle session, the thread waits in line and sessions are handed out in the order threads asked for them, while the refill thread connects more up to maxSize.
+ *  Returns error code, 1 if no session was handed over within timeoutMs, 2 if the pool is stopping.
+ */
+int checkoutSession(ConnectionPool &pool, PooledSession *&session, DWORD timeoutMs) {
+
+    session = NULL;                                                                 // No session yet.
+    if (pool.stopping) {                                                            // If stopping.
+        return 2;                                                                   // Return error code.
+    }
+    EnterCriticalSection(&pool.lock);                                               // Lock pool.
+    while (pool.waitHead == NULL && pool.idleHead != NULL && session == NULL) {     // While no thread is ahead and a session is idle.
+        PooledSession *idle = pool.idleHead;                                        // The session idle longest.
+        pool.idleHead = idle->next;                                                 // Remove from list.
+        if (pool.idleHead == NULL) {                                                // If it was the last.
+            pool.idleTail = NULL;                                                   // List is empty.
+        }
+        if (sessionAlive(idle)) {                                                   // If still connected.
+            session = idle;                                                         // Take it.
+        } else {                                                                    // Else lost.
+            closePooledSession(idle);                                               // Close it.
+            pool.openCount--;                                                       // Uncount it.
+            pool.replaced++;                                                        // Count it.
+        }
+    }
+    if (session != NULL) {                                                          // If a session was taken.
+        LeaveCriticalSection(&pool.lock);                                           // Unlock pool.
+        return 0;                                                                   // Return no error.
+    }
+    PoolWaiter waiter;                                                              // This thread's place in line.
+    waiter.event = CreateEvent(NULL, TRUE, FALSE, NULL);                            // Signalled on hand over.
+    waiter.session = NULL;                                                          // Nothing handed over yet.
+    waiter.next = NULL;                                                             // Last in line.
+    if (pool.waitTail != NULL) {                                                    // If others are waiting.
+        pool.waitTail->next = &waiter;                                              // Join the end of the line.
+    } else {                                                                        // Else first.
+        pool.waitHead = &waiter;                                                    // Start the line.
+    }
+    pool.waitTail = &waiter;                                                        // Join the end of the line.
+    pool.waits++;                                                                   // Count wait.
+    bool grow = pool.openCount < pool.maxSize;                                      // True if the refill thread may connect another session.
+    LeaveCriticalSection(&pool.lock);                                               // Unlock pool.
+    if (grow) {                                                                     // If the pool may grow.
+        SetEvent(pool.wakeEvent);                                                   // Ask for a session now rather than at the next check.
+    }
+    WaitForSingleObject(waiter.event, timeoutMs);                                   // Wait for a session.
+    EnterCriticalSection(&pool.lock);                                               // Lock pool.
+    session = waiter.session;                                                       // The session handed over, if any.
+    if (session == NULL) {                                                          // If timed out, still in line.
+        PoolWaiter **link = &pool.waitHead;                                         // The link to the waiter checked.
+        PoolWaiter *previous = NULL;                                                // The waiter before it.
+        while (*link != &waiter) {                                                  // Until this thread's place is found.
+            previous = *link;                                                       // Move along.
+            link = &(*link)->next;                                                  // Move along.
+        }
+        *link = waiter.next;                                                        // Leave the line.
+        if (pool.waitTail == &waiter) {                                             // If last in line.
+            pool.waitTail = previous;                                               // The one before is now last.
+        }
+    }
+    LeaveCriticalSection(&pool.lock);                                               // Unlock pool.
+    CloseHandle(waiter.event);                                                      // Free event.
+    return session != NULL ? 0 : 1;                                                 // Return error code if no session.
+}
+
+
+/**
+ *  Returns a session to the pool, handing it straight to the thread waiting longest if any.
+ *  A session whose send or receive failed is closed instead, and the refill thread replaces it.
+ */
+void checkinSession(ConnectionPool &pool, PooledSession *session, bool healthy) {
+
+    if (!healthy || pool.stopping) {                                                // If broken or no longer wanted.
+        closePooledSession(session);                                                // Close it.
+        EnterCriticalSection(&pool.lock);                                           // Lock pool.
+        pool.openCount--;                                                           // Uncount it.
+        pool.replaced += healthy ? 0 : 1;                                           // Count it if lost.
+        LeaveCriticalSection(&pool.lock);                                           // Unlock pool.
+        SetEvent(pool.wakeEvent);                                                   // Replace it now.
+        return;                                                                     // Done.
+    }
+    session->lastUsed = GetTickCount();                                             // Time its idle period.
+    EnterCriticalSection(&pool.lock);                                               // Lock pool.
+    handOver(pool, session);                                                        // Give it out or make it idle.
+    LeaveCriticalSection(&pool.lock);                                               // Unlock pool.
+}
+
+
+/**
+ *  Connects and does the handshake for a new session, using the client's own functions.
+ *  Returns error code.
+ */
+static int connectPooledSession(ConnectionPool &pool, PooledSession *&session) {
+
+    session = new PooledSession;                                                    // The new session.
+    memset(session, 0, sizeof(PooledSession));                                      // Ensure blank.
+    char program[] = "connpool";                                                    // Program name for the client's arguments.
+    char *clientArgv[3] = { program, pool.host, pool.port };                        // Arguments in the form tcpConnect() expects.
+    int error = tcpConnect(session->s, 3, clientArgv);                              // Connect to server using TCP.
+    if (error) {                                                                    // If error occurred.
+        delete session;                                                             // Free memory, socket was closed.
+        session = NULL;                                                             // No session.
+        return error;                                                               // Return error code.
+    }
+    int caKeyE = 4297;                                                              // Hardcoded certification authority public key e.
+    int caKeyN = 7171;                                                              // Hardcoded certification authority public key n.
+    error = receiveServerPublicKey(session->s, caKeyE, caKeyN, session->serverKeyE, session->serverKeyN);  // Receive the public key information for the server from the CA.
+    session->nOnce = 23;                                                            // Used as the first random number in CBC encryption.
+    session->ctrCounter = 0;                                                        // No symbols sent.
+    initHandshakeOptions(session->options);                                         // Ask for the client's chaining and compression.
+    session->options.batchMessages = 1;                                             // Pooled sessions send one message at a time, batching is not asked for.
+    session->options.sharedMemory = pool.sharedMemory;                              // Whether shared memory is asked for, used if the server is on this host.
+    if (!error) {                                                                   // If the key was received.
+        error = sendNOnce(session->s, session->nOnce, session->options);            // Send the nOnce to the server.
+        if (error) {                                                                // If the nOnce exchange failed.
+            invalidateCertificate(caKeyE, caKeyN, session->serverKeyE, session->serverKeyN);    // Decrypt the CA blob again next time, in case the cached key is wrong.
+        }
+    }
+    if (error) {                                                                    // If error occurred.
+        closePooledSession(session);                                                // Close it.
+        session = NULL;                                                             // No session.
+        return error;                                                               // Return error code.
+    }
+    session->lastUsed = GetTickCount();                                             // Idle from now.
+    return 0;                                                                       // Return no error.
+}
+
+
+/**
+ *  Closes a session's socket, and its shared memory, and frees it.
+ */
+static void closePooledSession(PooledSession *session) {
+
+    closeTransport(session->s);                                                     // Close the socket.
+    delete session;                                                                 // Free memory.
+}
+
+
+/**
+ *  Checks an idle session has not been closed by the server, without sending anything.
+ *  The server never sends unasked, so an idle socket that is readable has been closed, has failed, or is out of step.
+ *  A session on shared memory may hold a doorbell left from its last reply, which does not count.
+ *  Returns true if the session can be used.
+ */
+static bool sessionAlive(PooledSession *session) {
+
+    return transportAlive(session->s);                                              // Alive if nothing but doorbells to read and no error.
+}
+
+
+/**
+ *  Gives a session to the thread waiting longest, or adds it to the end of the idle list, the pool's lock must be held.
+ */
+static void handOver(ConnectionPool &pool, PooledSession *session) {
+
+    if (pool.waitHead != NULL) {                                                    // If a thread is waiting.
+        PoolWaiter *waiter = pool.waitHead;                                         // The thread waiting longest.
+        pool.waitHead = waiter->next;                                               // Remove it from the line.
+        if (pool.waitHead == NULL) {                                                // If it was the last.
+            pool.waitTail = NULL;                                                   // Line is empty.
+        }
+        waiter->session = session;                                                  // Hand the session over.
+        SetEvent(waiter->event);                                                    // Wake it.
+        return;                                                                     // Done.
+    }
+    session->next = NULL;                                                           // Last in list.
+    if (pool.idleTail != NULL) {                                                    // If others are idle.
+        pool.idleTail->next = session;                                              // Add to the end.
+    } else {                                                                        // Else first.
+        pool.idleHead = session;                                                    // Start the list.
+    }
+    pool.idleTail = session;                                                        // Add to the end.
+}
+
+
+/**
+ *  Closes idle sessions the server has closed, and sessions idle longer than POOL_MAX_IDLE_MS before the server times them out.
+ */
+static void checkIdleSessions(ConnectionPool &pool) {
+
+    PooledSession *closing = NULL;                                                  // Sessions to close once the lock is released.
+    DWORD now = GetTickCount();                                                     // The time of the check.
+    EnterCriticalSection(&pool.lock);                                               // Lock pool.
+    PooledSession **link = &pool.idleHead;                                          // The link to the session checked.
+    pool.idleTail = NULL;                                                           // Found again while walking the list.
+    while (*link != NULL) {                                                         // Loop through idle sessions.
+        PooledSession *session = *link;                                             // The session.
+        if (now - session->lastUsed > POOL_MAX_IDLE_MS || !sessionAlive(session)) { // If idle too long or lost.
+            *link = session->next;                                                  // Remove from list.
+            session->next = closing;                                                // Close it.
+            closing = session;                                                      // Close it.
+            pool.openCount--;                                                       // Uncount it.
+            pool.replaced++;                                                        // Count it.
+        } else {                                                                    // Else kept.
+            pool.idleTail = session;                                                // The last kept so far.
+            link = &session->next;                                                  // Next session.
+        }
+    }
+    LeaveCriticalSection(&pool.lock);                                               // Unlock pool.
+    while (closing != NULL) {                                                       // Loop through sessions to close.
+        PooledSession *session = closing;                                           // The session.
+        closing = session->next;                                                    // Next session.
+        closePooledSession(session);                                                // Close it.
+    }
+}
+
+
+/**
+ *  Connects sessions until the pool holds minSize, and while threads wait and the pool holds fewer than maxSize.
+ *  Each session is counted before it connects, so the pool never exceeds maxSize.
+ */
+static void refillPool(ConnectionPool &pool) {
+
+    while (!pool.stopping) {                                                        // Until stopped.
+        EnterCriticalSection(&pool.lock);                                           // Lock pool.
+        bool needed = pool.openCount < pool.minSize || (pool.waitHead != NULL && pool.openCount < pool.maxSize);    // True if a session is wanted.
+        if (needed) {                                                               // If wanted.
+            pool.openCount++;                                                       // Count it now.
+        }
+        LeaveCriticalSection(&pool.lock);                                           // Unlock pool.
+        if (!needed) {                                                              // If the pool is full enough.
+            return;                                                                 // Done.
+        }
+        PooledSession *session = NULL;                                              // The new session.
+        int error = connectPooledSession(pool, session);                            // Connect it.
+        EnterCriticalSection(&pool.lock);                                           // Lock pool.
+        if (error) {                                                                // If error occurred.
+            pool.openCount--;                                                       // Uncount it.
+        } else {                                                                    // Else connected.
+            pool.connects++;                                                        // Count connect.
+            handOver(pool, session);                                                // Give it out or make it idle.
+        }
+        LeaveCriticalSection(&pool.lock);                                           // Unlock pool.
+        if (error) {                                                                // If error occurred.
+            Sleep(POOL_RETRY_MS);                                                   // Give the server time.
+            return;                                                                 // Try again at the next check.
+        }
+    }
+}
+
+
+/**
+ *  The refill thread's function, checks the idle sessions every POOL_CHECK_MS, and refills when woken.
+ *  Returns 0.
+ */
+static DWORD WINAPI runRefillThread(LPVOID parameter) {
+
+    ConnectionPool &pool = *(ConnectionPool *)parameter;                            // The pool.
+    while (!pool.stopping) {                                                        // Until stopped.
+        WaitForSingleObject(pool.wakeEvent, POOL_CHECK_MS);                         // Wait for the next check, or to be woken.
+        if (pool.stopping) {                                                        // If stopped while waiting.
+            break;                                                                  // Done.
+        }
+        checkIdleSessions(pool);                                                    // Close lost and stale sessions.
+        refillPool(pool);                                                           // Replace them.
+    }
+    return 0;                                                                       // Return no error.
+}
@@ -0,0 +1,60 @@
+#ifndef CONNPOOL_H
+#define CONNPOOL_H
+
+#include "client.h"
+
+#define POOL_CHECK_MS 1000                                                          // Time between health checks of the idle sessions.
+#define POOL_MAX_IDLE_MS 240000                                                     // Idle sessions are replaced after this long, before the server's IDLE_TIMEOUT_MS disconnects them.
+#define POOL_RETRY_MS 500                                                           // Time waited after a failed connect before trying again.
+
+
+/**
+ *  Structures.
+ */
+struct PooledSession {                                                              // A connected, handshaked session, ready to send on.
+    SOCKET         s;                                                               // The socket connected to the server.
+    int            serverKeyE;                                                      // The server's public key e.
+    int            serverKeyN;                                                      // The server's public key n.
+    long           nOnce;                                                           // The nOnce sent to the server.
+    long long      ctrCounter;                                                      // Symbols sent in counter mode, carried from one checkout to the next so pads never repeat.
+    HandshakeOptions options;                                                       // The options agreed.
+    DWORD          lastUsed;                                                        // Tick count when last checked in.
+    PooledSession *next;                                                            // The next idle session.
+};
+
+struct PoolWaiter {                                                                 // A thread waiting to check out a session, in the order they asked.
+    HANDLE         event;                                                           // Signalled once a session is handed over, or the pool stops.
+    PooledSession *session;                                                         // The session handed over, NULL if the pool stopped.
+    PoolWaiter    *next;                                                            // The next waiter.
+};
+
+struct ConnectionPool {                                                             // Warm sessions to one server, shared by any number of threads.
+    char            *host;                                                          // The server's IP address.
+    char            *port;                                                          // The server's port number.
+    int              minSize;                                                       // Sessions kept open, idle or not.
+    int              maxSize;                                                       // Most sessions open at once.
+    CRITICAL_SECTION lock;                                                          // Guards the idle list, the waiters and the counts.
+    PooledSession   *idleHead;                                                      // Session idle longest, checked out first.
+    PooledSession   *idleTail;                                                      // Session idle shortest.
+    PoolWaiter      *waitHead;                                                      // Thread waiting longest, served first.
+    PoolWaiter      *waitTail;                                                      // Thread waiting shortest.
+    int              openCount;                                                     // Sessions idle, checked out or connecting.
+    HANDLE           refillThread;                                                  // Connects new sessions and checks idle ones.
+    HANDLE           wakeEvent;                                                     // Wakes the refill thread early, when a thread waits or a session is lost.
+    bool             sharedMemory;                                                  // True if sessions ask for shared memory.
+    volatile LONG    stopping;                                                      // 1 once the pool is being stopped.
+    long             connects;                                                      // Sessions connected.
+    long             replaced;                                                      // Sessions closed by a health check, idle too long or lost.
+    long             waits;                                                         // Checkouts that found no idle session.
+};
+
+
+/**
+ *  Function declarations.
+ */
+int  startConnectionPool(ConnectionPool &pool, char *host, char *port, int minSize, int maxSize, bool sharedMemory);  // Connects the first sessions and starts the refill thread.
+void stopConnectionPool(ConnectionPool &pool);                                      // Closes every session, once every session is checked in.
+int  checkoutSession(ConnectionPool &pool, PooledSession *&session, DWORD timeoutMs);   // Takes a warm session, waiting in turn if none is idle.
+void checkinSession(ConnectionPool &pool, PooledSession *session, bool healthy);    // Returns a session to the pool, or closes it if it failed.
+
+#endif
@@ -0,0 +1,186 @@
+#define _WIN32_WINNT 0x601
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "affinity.h"
+#include "copycount.h"
+
+struct NodeCounters {                                                               // One node's counters, on a cache line of their own so nodes do not share one.
+    volatile LONG counts[NODE_COUNTER_COUNT];                                       // The counters.
+    char          pad[64 - NODE_COUNTER_COUNT * sizeof(LONG)];                      // Fills the cache line.
+};
+
+static NodeCounters nodeCounters[MAX_NUMA_NODES];                                   // Every node's counters.
+
+
+/**
+ *  Reads a list of cores such as "0,2,4-7", cores are numbered as Windows numbers processors.
+ *  Returns error code.
+ */
+int parseAffinityList(const char *list, AffinityPlan &plan) {
+
+    plan.count = 0;                                                                 // No cores yet.
+    const char *next = list;                                                        // The next entry.
+    while (*next != '\0') {                                                         // Loop through entries.
+        int first = 0;                                                              // First core of the entry.
+        int last = 0;                                                               // Last core of the entry.
+        int length = 0;                                                             // Characters read.
+        if (sscanf(next, "%d-%d%n", &first, &last, &length) != 2) {                 // If not a range.
+            length = 0;                                                             // Nothing read yet.
+            if (sscanf(next, "%d%n", &first, &length) != 1) {                       // If not a core either.
+                return 1;                                                           // Return error code.
+            }
+            last = first;                                                           // One core.
+        }
+        if (first < 0 || last < first || last >= MAX_AFFINITY_CORES) {              // If not cores a mask can name.
+            return 2;                                                               // Return error code.
+        }
+        for (int core = first; core <= last; core++) {                              // Loop through the entry's cores.
+            if (plan.count == MAX_AFFINITY_CORES) {                                 // If the list is full.
+                return 3;                                                           // Return error code.
+            }
+            plan.cores[plan.count++] = core;                                        // Add core.
+        }
+        next += length;                                                             // Move past the entry.
+        if (*next == ',') {                                                         // If another entry follows.
+            next++;                                                                 // Move past the comma.
+        } else if (*next != '\0') {                                                 // Else if not the end.
+            return 1;                                                               // Return error code.
+        }
+    }
+    return plan.count > 0 ? 0 : 1;                                                  // Return error code if no cores.
+}
+
+
+/**
+ *  Gets the core the event loop is pinned to, the first in the list.
+ *  Returns the core, -1 if threads are not pinned.
+ */
+int eventLoopCore(AffinityPlan &plan) {
+
+    return plan.count > 0 ? plan.cores[0] : -1;                                     // Return the first core.
+}
+
+
+/**
+ *  Gets the core a worker is pinned to, the cores after the first in turn, or the first if it is the only one.
+ *  Returns the core, -1 if threads are not pinned.
+ */
+int workerCore(AffinityPlan &plan, int worker) {
+
+    if (plan.count <= 1) {                                                          // If at most one core.
+        return eventLoopCore(plan);                                                 // Share it.
+    }
+    return plan.cores[1 + worker % (plan.count - 1)];                               // Return the worker's core.
+}
+
+
+/**
+ *  Pins a thread to one core, so the scheduler never moves it away from its memory.
+ *  A core of -1 leaves the thread where the scheduler puts it.
+ *  Returns error code.
+ */
+int pinThread(HANDLE thread, int core) {
+
+    if (core < 0) {                                                                 // If not pinned.
+        return 0;                                                                   // Nothing to do.
+    }
+    if (SetThreadAffinityMask(thread, (DWORD_PTR)1 << core) == 0) {                 // If the core does not exist or is not allowed.
+        return 1;                                                                   // Return error code.
+    }
+    return 0;                                                                       // Return no error.
+}
+
+
+/**
+ *  Gets the number of NUMA nodes.
+ *  Returns the number, at least 1.
+ */
+int numaNodeCount() {
+
+    ULONG highest = 0;                                                              // The highest node number.
+    if (!GetNumaHighestNodeNumber(&highest)) {                                      // If not known.
+        return 1;                                                                   // One node.
+    }
+    return (int)highest + 1;                                                        // Return number of nodes.
+}
+
+
+/**
+ *  Gets the NUMA node of a core.
+ *  Returns the node, 0 if not known, -1 for core -1.
+ */
+int nodeOfCore(int core) {
+
+    if (core < 0) {                                                                 // If no core.
+        return -1;                                                                  // Any node.
+    }
+    UCHAR node = 0;                                                                 // The core's node.
+    if (!GetNumaProcessorNode((UCHAR)core, &node) || node == 0xFF) {                // If not known.
+        return 0;                                                                   // Assume the first node.
+    }
+    return node;                                                                    // Return the node.
+}
+
+
+/**
+ *  Gets the NUMA node of the processor the calling thread is running on, which may change unless it is pinned.
+ *  Returns the node.
+ */
+int currentNode() {
+
+    return nodeOfCore((int)GetCurrentProcessorNumber());                            // Return the processor's node.
+}
+
+
+/**
+ *  Allocates zeroed memory on a NUMA node, whole pages straight from the system so no other allocation shares them.
+ *  A node of -1 lets the system place the memory, on the node of the thread that first touches it.
+ *  Returns the memory, NULL if none could be allocated.
+ */
+void *allocateOnNode(size_t size, int node) {
+
+    void *memory = NULL;                                                            // The memory.
+    if (node >= 0) {                                                                // If placed.
+        memory = VirtualAllocExNuma(GetCurrentProcess(), NULL, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE, (DWORD)node);    // Allocate on the node.
+    }
+    if (memory == NULL) {                                                           // If not placed, or the node is full.
+        memory = VirtualAlloc(NULL, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);    // Allocate anywhere.
+    }
+    if (memory != NULL) {                                                           // If allocated.
+        countAllocation(size);                                                      // Count allocation.
+    }
+    return memory;                                                                  // Return the memory.
+}
+
+
+/**
+ *  Frees memory from allocateOnNode().
+ */
+void freeOnNode(void *memory) {
+
+    if (memory != NULL) {                                                           // If allocated.
+        VirtualFree(memory, 0, MEM_RELEASE);                                        // Free memory.
+    }
+}
+
+
+/**
+ *  Counts an event against a NUMA node, from any thread.
+ */
+void countNodeEvent(NodeCounter counter, int node) {
+
+    node = node < 0 ? 0 : (node >= MAX_NUMA_NODES ? MAX_NUMA_NODES - 1 : node);     // Keep within the counted nodes.
+    InterlockedIncrement(&nodeCounters[node].counts[counter]);                      // Count event.
+}
+
+
+/**
+ *  Gets an event count of a NUMA node.
+ *  Returns the count.
+ */
+long nodeEventCount(NodeCounter counter, int node) {
+
+    return nodeCounters[node].counts[counter];                                      // Return count.
+}
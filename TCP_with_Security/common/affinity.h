@@ -0,0 +1,42 @@
+#ifndef AFFINITY_H
+#define AFFINITY_H
+
+#include <windows.h>
+
+#define MAX_AFFINITY_CORES 64                                                       // Most cores in an affinity list, one per bit of a thread affinity mask.
+#define MAX_NUMA_NODES 16                                                           // Most NUMA nodes counted, higher nodes are counted as the last.
+
+
+/**
+ *  Structures.
+ */
+enum NodeCounter {                                                                  // Events counted per NUMA node, to confirm work stays where its memory is.
+    NODE_SESSIONS,                                                                  // Sessions allocated on the node.
+    NODE_DECRYPTS,                                                                  // Messages decrypted on one of the node's processors.
+    NODE_JOBS,                                                                      // Handler jobs run on one of the node's processors.
+    NODE_REMOTE_JOBS,                                                               // Handler jobs run on the node whose session was allocated on another node.
+    NODE_COUNTER_COUNT                                                              // Number of counters.
+};
+
+struct AffinityPlan {                                                               // The cores the server's threads are pinned to, the event loop's first, then the workers' in turn.
+    int cores[MAX_AFFINITY_CORES];                                                  // The cores, in the order given.
+    int count;                                                                      // Number of cores, 0 if threads are not pinned.
+};
+
+
+/**
+ *  Function declarations.
+ */
+int   parseAffinityList(const char *list, AffinityPlan &plan);                      // Reads a list of cores such as "0,2,4-7".
+int   eventLoopCore(AffinityPlan &plan);                                            // Gets the core the event loop is pinned to.
+int   workerCore(AffinityPlan &plan, int worker);                                   // Gets the core a worker is pinned to.
+int   pinThread(HANDLE thread, int core);                                           // Pins a thread to one core.
+int   numaNodeCount();                                                              // Gets the number of NUMA nodes.
+int   nodeOfCore(int core);                                                         // Gets the NUMA node of a core.
+int   currentNode();                                                                // Gets the NUMA node of the processor the calling thread is running on.
+void *allocateOnNode(size_t size, int node);                                        // Allocates zeroed memory on a NUMA node.
+void  freeOnNode(void *memory);                                                     // Frees memory from allocateOnNode().
+void  countNodeEvent(NodeCounter counter, int node);                                // Counts an event against a NUMA node.
+long  nodeEventCount(NodeCounter counter, int node);                                // Gets an event count of a NUMA node.
+
+#endif
@@ -0,0 +1,88 @@
+#include <stdio.h>
+#include <string.h>
+#include "batch.h"
+#include "copycount.h"
+
+
+/**
+ *  Packs a message onto the end of a batch as "<length>:<bytes>", the length in decimal.
+ *  Lengths make the packing binary safe, a message may contain ':' or any other byte.
+ *  Returns new batch length, -1 if the message does not fit in capacity.
+ */
+int appendToBatch(char *batch, int batchLength, int capacity, const char *message, int messageLength) {
+
+    char prefix[16];                                                                // The length prefix.
+    int prefixLength = sprintf(prefix, "%d:", messageLength);                       // Write prefix.
+    if (batchLength + prefixLength + messageLength > capacity) {                    // If it does not fit.
+        return -1;                                                                  // Leave batch unchanged.
+    }
+    memcpy(&batch[batchLength], prefix, prefixLength);                              // Add prefix.
+    memcpy(&batch[batchLength + prefixLength], message, messageLength);             // Add message.
+    return batchLength + prefixLength + messageLength;                              // Return new batch length.
+}
+
+
+/**
+ *  Reads the next message packed in a batch, starting at offset, which is moved past it.
+ *  message points into the batch, it is not copied or terminated.
+ *  Returns 1 if a message was read, 0 at the end of the batch, -1 if the batch is corrupt.
+ */
+int readBatchMessage(const char *batch, int batchLength, int &offset, const char *&message, int &messageLength) {
+
+    if (offset >= batchLength) {                                                    // If every message has been read.
+        return 0;                                                                   // End of batch.
+    }
+    int length = 0;                                                                 // The message length.
+    int i = offset;                                                                 // Index of batch.
+    while (i < batchLength && batch[i] >= '0' && batch[i] <= '9') {                 // Loop through digits.
+        length = length * 10 + (batch[i] - '0');                                    // Add digit.
+        if (length > batchLength) {                                                 // If longer than the whole batch.
+            return -1;                                                              // Corrupt.
+        }
+        i++;                                                                        // Next character.
+    }
+    if (i == offset || i == batchLength || batch[i] != ':' || length > batchLength - i - 1) {  // If no digits, no ':' or the message runs past the end.
+        return -1;                                                                  // Corrupt.
+    }
+    message = &batch[i + 1];                                                        // The message follows the ':'.
+    messageLength = length;                                                         // Store length.
+    offset = i + 1 + length;                                                        // Move to the next message.
+    return 1;                                                                       // Message read.
+}
+
+
+/**
+ *  Writes the "B<count> " header that starts a batched message or reply.
+ *  Returns header length.
+ */
+int writeBatchHeader(char *buffer, int count) {
+
+    return sprintf(buffer, "B%d ", count);                                          // Write header.
+}
+
+
+/**
+ *  Reads the batch header from the start of a message or reply.
+ *  Encrypted values, compression headers and replies never start with 'B', so a message without a header is never mistaken for one.
+ *  Returns header length, 0 if there is no valid header.
+ */
+int parseBatchHeader(const char *frame, int frameLength, int &count) {
+
+    if (frameLength < 3 || frame[0] != 'B') {                                       // If too short or not a batch.
+        return 0;                                                                   // No header.
+    }
+    int n = 0;                                                                      // The number of messages.
+    int i = 1;                                                                      // Index of frame.
+    while (i < frameLength && frame[i] >= '0' && frame[i] <= '9') {                 // Loop through digits.
+        n = n * 10 + (frame[i] - '0');                                              // Add digit.
+        if (n > BATCH_MAX_MESSAGES) {                                               // If out of range.
+            return 0;                                                               // No valid header.
+        }
+        i++;                                                                        // Next character.
+    }
+    if (i == 1 || n < 1 || i == frameLength || frame[i] != ' ') {                   // If no digits, no messages or not followed by a space.
+        return 0;                                                                   // No valid header.
+    }
+    count = n;                                                                      // Store count.
+    return i + 1;                                                                   // Return header length, including the space.
+}
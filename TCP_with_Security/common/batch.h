@@ -0,0 +1,17 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#define BATCH_MAX_MESSAGES 8                                                        // Most messages coalesced into one frame.
+#define BATCH_MAX_BYTES 100                                                         // Most bytes in a packed batch, so its encrypted frame and the batched reply fit in BUFFER_SIZE.
+#define BATCH_MAX_DELAY_MS 20                                                       // Longest a message waits for others to join its batch.
+
+
+/**
+ *  Function declarations.
+ */
+int appendToBatch(char *batch, int batchLength, int capacity, const char *message, int messageLength);  // Packs a message onto the end of a batch as "<length>:<bytes>".
+int readBatchMessage(const char *batch, int batchLength, int &offset, const char *&message, int &messageLength);  // Reads the next message packed in a batch.
+int writeBatchHeader(char *buffer, int count);                                      // Writes the "B<count> " header that starts a batched message or reply.
+int parseBatchHeader(const char *frame, int frameLength, int &count);               // Reads the batch header from the start of a message or reply.
+
+#endif
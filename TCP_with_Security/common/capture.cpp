@@ -0,0 +1,238 @@
+#define _WIN32_WINNT 0x501
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "capture.h"
+#include "copycount.h"
+
+static char         *ring = NULL;                                                   // Records waiting to be written, NULL while not capturing.
+static volatile LONGLONG head = 0;                                                  // Bytes ever written to the file, only the writer thread moves it.
+static volatile LONGLONG tail = 0;                                                  // Bytes ever queued, only the capturing thread moves it.
+static volatile LONG droppedRecords = 0;                                            // Records dropped because the ring was full.
+static volatile LONG running = 0;                                                   // 1 while the writer thread is writing queued records.
+static FILE         *captureFile = NULL;                                            // The capture file.
+static HANDLE        writerThread = NULL;                                           // Writes queued records to the file.
+static HANDLE        wakeEvent = NULL;                                              // Wakes the writer thread early.
+static LARGE_INTEGER frequency;                                                     // Counter ticks per second.
+static LARGE_INTEGER startCounter;                                                  // Counter when the capture started, record times are relative to it.
+
+static DWORD WINAPI  writeCapture(LPVOID parameter);                                // Writes queued records to the file until the capture stops.
+static int           writeQueuedRecords();                                          // Writes every queued record to the file.
+static void          copyToRing(LONGLONG position, const char *bytes, int length);  // Copies bytes into the ring at a position, wrapping at its end.
+static BOOL WINAPI   stopCaptureOnExit(DWORD controlType);                          // Writes the queued records when the console is closed or interrupted.
+static void          stopCaptureAtExit();                                           // Writes the queued records when the program ends.
+
+
+/**
+ *  Opens a capture file and starts the thread that writes records to it.
+ *  Returns error code.
+ */
+int startCapture(const char *path) {
+
+    captureFile = fopen(path, "wb");                                                // Open capture file.
+    if (captureFile == NULL) {                                                      // If file could not be opened.
+        fprintf(stderr, "Could not open capture file %s\n", path);                  // Alert user.
+        return 1;                                                                   // Return error code.
+    }
+    setvbuf(captureFile, NULL, _IOFBF, CAPTURE_FILE_BUFFER);                        // Write to disk in large pieces.
+    CaptureFileHeader header = { CAPTURE_MAGIC, CAPTURE_VERSION };                  // Identifies the file and its layout.
+    fwrite(&header, sizeof(header), 1, captureFile);                                // Write header.
+    ring = new char[CAPTURE_RING_SIZE];                                             // Room for records waiting to be written.
+    QueryPerformanceFrequency(&frequency);                                          // Get frequency.
+    QueryPerformanceCounter(&startCounter);                                         // Record times start here.
+    wakeEvent = CreateEvent(NULL, FALSE, FALSE, NULL);                              // Auto reset event to wake the writer thread.
+    running = 1;                                                                    // Records are written from now on.
+    writerThread = CreateThread(NULL, 0, writeCapture, NULL, 0, NULL);              // Start the writer thread.
+    SetConsoleCtrlHandler(stopCaptureOnExit, TRUE);                                 // Write the queued records if the server is stopped with Ctrl+C.
+    atexit(stopCaptureAtExit);                                                      // Write the queued records if the server exits.
+    return 0;                                                                       // Return no error.
+}
+
+
+/**
+ *  Checks whether records are being captured.
+ *  Returns true if they are.
+ */
+bool isCapturing() {
+
+    return ring != NULL && running;                                                 // Return whether capturing.
+}
+
+
+/**
+ *  Queues a record for the writer thread.
+ *  Only one thread may capture, so the ring needs no lock: it copies the record in, then publishes it by moving tail.
+ *  A record that does not fit is dropped rather than making the caller wait for the disk.
+ */
+void captureRecord(int type, int session, const char *data, int length) {
+
+    if (!isCapturing()) {                                                           // If not capturing.
+        return;                                                                     // Nothing to do.
+    }
+    int size = sizeof(CaptureRecord) + length;                                      // Bytes the record takes in the ring.
+    if (length > 0xFFFF || CAPTURE_RING_SIZE - (tail - InterlockedExchangeAdd64(&head, 0)) < size) {  // If too long, or the writer thread is behind.
+        InterlockedIncrement(&droppedRecords);                                      // Count dropped record.
+        return;                                                                     // Drop record.
+    }
+    LARGE_INTEGER counter;                                                          // Counter value.
+    QueryPerformanceCounter(&counter);                                              // Get counter.
+    CaptureRecord record;                                                           // The record's header.
+    record.time = (unsigned long long)((counter.QuadPart - startCounter.QuadPart) * (1000000000.0 / frequency.QuadPart));   // Nanoseconds since the capture started.
+    record.session = session;                                                       // Store record.
+    record.length = (unsigned short)length;                                         // Store record.
+    record.type = (unsigned char)type;                                              // Store record.
+    record.reserved = 0;                                                            // Store record.
+    copyToRing(tail, (const char *)&record, sizeof(record));                        // Copy header.
+    copyToRing(tail + sizeof(record), data, length);                                // Copy data.
+    LONGLONG queued = InterlockedExchangeAdd64(&tail, size) + size - InterlockedExchangeAdd64(&head, 0);   // Publish the record to the writer thread, with a full barrier.
+    if (queued >= CAPTURE_RING_SIZE / 2 && queued - size < CAPTURE_RING_SIZE / 2) { // If the ring has just become half full.
+        SetEvent(wakeEvent);                                                        // Wake the writer thread early.
+    }
+}
+
+
+/**
+ *  Stops the writer thread once it has written every queued record, and closes the capture file.
+ *  Only the first call does anything.
+ *  Returns number of records dropped because the ring was full.
+ */
+int stopCapture() {
+
+    if (InterlockedExchange(&running, 0) == 0) {                                    // If not capturing or already stopped.
+        return 0;                                                                   // Nothing to do.
+    }
+    SetEvent(wakeEvent);                                                            // Wake the writer thread.
+    WaitForSingleObject(writerThread, INFINITE);                                    // Wait for it to write the last records.
+    CloseHandle(writerThread);                                                      // Free thread.
+    CloseHandle(wakeEvent);                                                         // Free event.
+    fclose(captureFile);                                                            // Close capture file.
+    if (droppedRecords > 0) {                                                       // If any were dropped.
+        fprintf(stderr, "%ld capture records dropped\n", (long)droppedRecords);     // Alert user.
+    }
+    return droppedRecords;                                                          // Return number of records dropped.
+}
+
+
+/**
+ *  Reads a whole capture file into memory, checking its header.
+ *  data holds the records after the header, free it with delete[].
+ *  Returns error code.
+ */
+int readCaptureFile(const char *path, char *&data, long &length) {
+
+    data = NULL;                                                                    // Nothing read yet.
+    length = 0;                                                                     // Nothing read yet.
+    FILE *file = fopen(path, "rb");                                                 // Open capture file.
+    if (file == NULL) {                                                             // If file could not be opened.
+        fprintf(stderr, "Could not open capture file %s\n", path);                  // Alert user.
+        return 1;                                                                   // Return error code.
+    }
+    CaptureFileHeader header;                                                       // Identifies the file and its layout.
+    if (fread(&header, sizeof(header), 1, file) != 1 || header.magic != CAPTURE_MAGIC || header.version != CAPTURE_VERSION) {  // If not a capture file this build reads.
+        fprintf(stderr, "%s is not a version %d capture file\n", path, CAPTURE_VERSION);    // Alert user.
+        fclose(file);                                                               // Close file.
+        return 2;                                                                   // Return error code.
+    }
+    fseek(file, 0, SEEK_END);                                                       // Find the end.
+    length = ftell(file) - sizeof(header);                                          // Bytes of records.
+    fseek(file, sizeof(header), SEEK_SET);                                          // Back to the first record.
+    data = new char[length > 0 ? length : 1];                                       // Room for every record.
+    if (length > 0 && fread(data, length, 1, file) != 1) {                          // If records could not be read.
+        fprintf(stderr, "Could not read capture file %s\n", path);                  // Alert user.
+        fclose(file);                                                               // Close file.
+        delete[] data;                                                              // Free memory.
+        data = NULL;                                                                // Nothing read.
+        return 3;                                                                   // Return error code.
+    }
+    fclose(file);                                                                   // Close file.
+    return 0;                                                                       // Return no error.
+}
+
+
+/**
+ *  Gets the record at offset and moves offset past it.
+ *  payload points at the record's data inside data, records are not aligned so the header is copied out.
+ *  Returns false at the end of the records, or at a record cut short by the capture stopping abruptly.
+ */
+bool nextCaptureRecord(const char *data, long length, long &offset, CaptureRecord &record, const char *&payload) {
+
+    if (length - offset < (long)sizeof(CaptureRecord)) {                            // If no whole header left.
+        return false;                                                               // End of records.
+    }
+    memcpy(&record, &data[offset], sizeof(record));                                 // Copy header.
+    if (length - offset - (long)sizeof(record) < record.length) {                   // If the data was cut short.
+        return false;                                                               // End of records.
+    }
+    payload = &data[offset + sizeof(record)];                                       // The record's data.
+    offset += sizeof(record) + record.length;                                       // Move past record.
+    return true;                                                                    // Return record.
+}
+
+
+/**
+ *  Writes queued records to the file until the capture stops.
+ *  Returns 0.
+ */
+static DWORD WINAPI writeCapture(LPVOID parameter) {
+
+    while (running) {                                                               // Until the capture stops.
+        if (writeQueuedRecords() == 0) {                                            // If nothing was waiting.
+            WaitForSingleObject(wakeEvent, CAPTURE_DRAIN_MS);                       // Sleep until woken or the next check.
+        }
+    }
+    writeQueuedRecords();                                                           // Write the last records.
+    fflush(captureFile);                                                            // Flush them to disk.
+    return 0;                                                                       // Return no error.
+}
+
+
+/**
+ *  Writes every queued record to the file, straight from the ring in at most two pieces.
+ *  Returns number of bytes written.
+ */
+static int writeQueuedRecords() {
+
+    int queued = (int)(InterlockedExchangeAdd64(&tail, 0) - head);                  // Bytes published by the capturing thread, never more than the ring.
+    if (queued == 0) {                                                              // If nothing queued.
+        return 0;                                                                   // Nothing to write.
+    }
+    int start = (int)(head & (CAPTURE_RING_SIZE - 1));                              // Index of the first queued byte.
+    int first = queued < CAPTURE_RING_SIZE - start ? queued : CAPTURE_RING_SIZE - start;    // Bytes before the ring wraps.
+    fwrite(&ring[start], 1, first, captureFile);                                    // Write them.
+    fwrite(ring, 1, queued - first, captureFile);                                   // Write the rest from the start of the ring.
+    InterlockedExchangeAdd64(&head, queued);                                        // Free the space for the capturing thread.
+    return queued;                                                                  // Return number of bytes written.
+}
+
+
+/**
+ *  Copies bytes into the ring at a position, wrapping at its end.
+ */
+static void copyToRing(LONGLONG position, const char *bytes, int length) {
+
+    int start = (int)(position & (CAPTURE_RING_SIZE - 1));                          // Index of the first byte.
+    int first = length < CAPTURE_RING_SIZE - start ? length : CAPTURE_RING_SIZE - start;    // Bytes before the ring wraps.
+    memcpy(&ring[start], bytes, first);                                             // Copy them.
+    memcpy(ring, &bytes[first], length - first);                                    // Copy the rest to the start of the ring.
+}
+
+
+/**
+ *  Writes the queued records when the console is closed or interrupted.
+ *  Returns FALSE so the default handler still ends the program.
+ */
+static BOOL WINAPI stopCaptureOnExit(DWORD controlType) {
+
+    stopCapture();                                                                  // Write the queued records.
+    return FALSE;                                                                   // Let the program end.
+}
+
+
+/**
+ *  Writes the queued records when the program ends.
+ */
+static void stopCaptureAtExit() {
+
+    stopCapture();                                                                  // Write the queued records.
+}
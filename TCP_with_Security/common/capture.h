@@ -0,0 +1,44 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#define CAPTURE_MAGIC 0x50414354                                                    // "TCAP" read as a little endian int, the first 4 bytes of every capture file.
+#define CAPTURE_VERSION 1                                                           // Layout of the records below.
+#define CAPTURE_RING_SIZE (1 << 22)                                                 // Bytes of records waiting to be written, a power of 2, records that do not fit are dropped.
+#define CAPTURE_FILE_BUFFER (1 << 20)                                               // Bytes the file stream gathers before each write to disk.
+#define CAPTURE_DRAIN_MS 50                                                         // Longest time the writer thread sleeps before checking the ring.
+
+
+/**
+ *  Structures.
+ */
+enum CaptureRecordType {                                                            // What a record holds.
+    CAPTURE_HANDSHAKE = 1,                                                          // The server key sent, as two ints e and n, then the nOnce line without "\r\n".
+    CAPTURE_FRAME = 2,                                                              // An encrypted message frame as received, including "\r\n".
+    CAPTURE_CLOSE = 3                                                               // The client disconnected, no data.
+};
+
+struct CaptureFileHeader {                                                          // The start of a capture file.
+    unsigned int magic;                                                             // CAPTURE_MAGIC.
+    unsigned int version;                                                           // CAPTURE_VERSION.
+};
+
+struct CaptureRecord {                                                              // The header of one record, followed by length bytes of data.
+    unsigned long long time;                                                        // Nanoseconds since the capture started.
+    unsigned int       session;                                                     // The client's number, the order it was accepted in.
+    unsigned short     length;                                                      // Number of data bytes following.
+    unsigned char      type;                                                        // CaptureRecordType.
+    unsigned char      reserved;                                                    // Always 0.
+};
+
+
+/**
+ *  Function declarations.
+ */
+int  startCapture(const char *path);                                                // Opens a capture file and starts the thread that writes records to it.
+bool isCapturing();                                                                 // Checks whether records are being captured.
+void captureRecord(int type, int session, const char *data, int length);            // Queues a record, from the one thread that captures.
+int  stopCapture();                                                                 // Writes every queued record and closes the capture file.
+int  readCaptureFile(const char *path, char *&data, long &length);                  // Reads a whole capture file into memory, checking its header.
+bool nextCaptureRecord(const char *data, long length, long &offset, CaptureRecord &record, const char *&payload);  // Gets the record at offset and moves past it.
+
+#endif
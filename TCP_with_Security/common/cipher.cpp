@@ -0,0 +1,243 @@
+#include <string.h>
+#include <stdio.h>
+#include "cipher.h"
+#include "pipeline.h"
+#include "threadpool.h"
+#include "copycount.h"
+
+struct CtrJob {                                                                     // A counter mode job split into chunks.
+    const char *plain;                                                              // Plain text symbols, read when encrypting, written when decrypting.
+    long       *values;                                                             // Encrypted values, written when encrypting, read when decrypting.
+    long        count;                                                              // Number of symbols.
+    long        exponent;                                                           // The key's e when encrypting, d when decrypting.
+    long        n;                                                                  // The key's modulus.
+    long        nOnce;                                                              // The nOnce the pads are derived from.
+};
+
+static void encryptCTRChunk(void *context, int chunk);                              // Encrypts one chunk of a counter mode job.
+static void decryptCTRChunk(void *context, int chunk);                              // Decrypts one chunk of a counter mode job.
+
+
+/**
+ *  Repeat Square method as found in Assignment guide.
+ *  Returns encrypted long value.
+ *  Magic maths occurs here.
+ */
+long repeatsquare(long x, long eORd, long n) {
+
+    long y = 1;
+    while (eORd > 0) {
+        if ((eORd % 2) == 0) {
+            x = (x * x) % n;
+            eORd = eORd / 2;
+        } else {
+            y = (x * y) % n;
+            eORd = eORd - 1;
+        }
+    }
+    return y;
+}
+
+
+/**
+ *  Cypher Block Chain encryption.
+ *  Returns encrypted long value.
+ */
+long cbc(char charToEncrypt, long rand) {
+
+    return charToEncrypt ^ rand;                                                    // Return encrypted value.
+}
+
+
+/**
+ *  Encrypt method used to encrypt the message to be sent.
+ */
+void encrypt(char *sendBuffer, int &messageLength, int e, int n, long nOnce) {
+
+    messageLength = CbcPipeline::encrypt(sendBuffer, messageLength, e, n, nOnce);   // Encrypt with CBC and RSA, then write as text.
+}
+
+
+/**
+ *  Decrypt method used to decrypt received encrypted messages.
+ */
+void decrypt(long *encryptedBuffer, char *receiveBuffer, int &messageLength, int d, int n, int nOnce) {
+
+    char charBuffer[BUFFER_SIZE];                                                   // Temporary buffer to store decrypted message.
+    CbcPipeline::decryptValues(encryptedBuffer, charBuffer, 0, messageLength, d, n, nOnce);   // Decrypt with RSA and CBC in one pass.
+    charBuffer[messageLength] = '\0';                                               // Terminate string.
+    strcpy(receiveBuffer, charBuffer);                                              // Copy decrypted string to receive buffer.
+}
+
+
+/**
+ *  First pass of decrypt(), removes the RSA encryption from every value.
+ */
+void decryptRSA(long *encryptedBuffer, long *rsaDecryptedBuffer, int messageLength, int d, int n) {
+
+    CbcPipeline::raiseValues(encryptedBuffer, rsaDecryptedBuffer, messageLength, d, n);   // Decrypt with RSA.
+}
+
+
+/**
+ *  Second pass of decrypt(), removes the CBC chaining and terminates the string.
+ */
+void decryptCBC(long *rsaDecryptedBuffer, char *receiveBuffer, int messageLength, long nOnce) {
+
+    CbcPipeline::unchainValues(rsaDecryptedBuffer, receiveBuffer, messageLength, nOnce);   // Decrypt with CBC.
+    receiveBuffer[messageLength] = '\0';                                            // Terminate string, the message may hold compressed bytes so is not copied as a string.
+}
+
+
+/**
+ *  Counter mode pad of the symbol at index, mixed from the nOnce and the index alone so any symbol can be processed without the ones before it.
+ *  The index counts symbols from the start of the session, its high half is mixed in too so pads do not repeat after 2^32 symbols.
+ *  Returns a pad from 0 to 255.
+ */
+long ctrPad(long nOnce, long long index) {
+
+    unsigned int x = (unsigned int)nOnce * 2654435761u + (unsigned int)index * 2246822519u + (unsigned int)(index >> 32) * 3266489917u;  // Combine nOnce and index.
+    x ^= x >> 15;                                                                   // Mix high bits down.
+    x *= 2246822507u;                                                               // Spread bits.
+    x ^= x >> 13;                                                                   // Mix high bits down.
+    return x & 0xFF;                                                                // Return one byte.
+}
+
+
+/**
+ *  Encrypt method used to encrypt the message to be sent in counter mode.
+ *  counter is the session's index of the message's first symbol, it is moved past the message so the next one gets new pads.
+ */
+void encryptCTR(char *sendBuffer, int &messageLength, int e, int n, long nOnce, long long &counter) {
+
+    int symbols = messageLength;                                                    // Number of symbols encrypted.
+    messageLength = CtrPipeline::encrypt(sendBuffer, messageLength, e, n, nOnce, counter);  // Encrypt with counter mode and RSA, then write as text.
+    counter += symbols;                                                             // The next message starts after this one.
+}
+
+
+/**
+ *  Second pass of decrypt() in counter mode, removes the pads and terminates the string.
+ *  counter is the session's index of the message's first symbol, it is moved past the message as the sender's was.
+ */
+void decryptCTR(long *rsaDecryptedBuffer, char *receiveBuffer, int messageLength, long nOnce, long long &counter) {
+
+    CtrPipeline::unchainValues(rsaDecryptedBuffer, receiveBuffer, messageLength, nOnce, counter);  // Decrypt with counter mode.
+    counter += messageLength;                                                       // The next message starts after this one.
+    receiveBuffer[messageLength] = '\0';                                            // Terminate string, the message may hold compressed bytes so is not copied as a string.
+}
+
+
+/**
+ *  Encrypts any number of symbols in counter mode.
+ *  Symbols do not depend on each other, so large inputs are split into chunks run in parallel on pool and written straight to their place in values.
+ */
+void encryptCTRValues(const char *plain, long *values, long count, int e, int n, long nOnce, ThreadPool *pool) {
+
+    CtrJob job = { plain, values, count, e, n, nOnce };                             // The job.
+    int chunks = (int)((count + CTR_CHUNK_SYMBOLS - 1) / CTR_CHUNK_SYMBOLS);        // Number of chunks.
+    runParallel(count >= CTR_PARALLEL_MIN ? pool : NULL, encryptCTRChunk, &job, chunks);   // Encrypt every chunk.
+}
+
+
+/**
+ *  Decrypts any number of symbols in counter mode, removing RSA and the pads in one pass.
+ *  Large inputs are split into chunks run in parallel on pool.
+ */
+void decryptCTRValues(const long *values, char *plain, long count, int d, int n, long nOnce, ThreadPool *pool) {
+
+    CtrJob job = { plain, (long *)values, count, d, n, nOnce };                     // The job.
+    int chunks = (int)((count + CTR_CHUNK_SYMBOLS - 1) / CTR_CHUNK_SYMBOLS);        // Number of chunks.
+    runParallel(count >= CTR_PARALLEL_MIN ? pool : NULL, decryptCTRChunk, &job, chunks);   // Decrypt every chunk.
+}
+
+
+/**
+ *  Encrypts one chunk of a counter mode job.
+ */
+static void encryptCTRChunk(void *context, int chunk) {
+
+    CtrJob *job = (CtrJob *)context;                                                // The job.
+    long first = (long)chunk * CTR_CHUNK_SYMBOLS;                                   // First symbol of the chunk.
+    long last = first + CTR_CHUNK_SYMBOLS < job->count ? first + CTR_CHUNK_SYMBOLS : job->count;  // One past the last symbol.
+    CtrPipeline::encryptValues(job->plain, job->values, first, last, job->exponent, job->n, job->nOnce);   // Encrypt with counter mode and RSA.
+}
+
+
+/**
+ *  Decrypts one chunk of a counter mode job.
+ */
+static void decryptCTRChunk(void *context, int chunk) {
+
+    CtrJob *job = (CtrJob *)context;                                                // The job.
+    long first = (long)chunk * CTR_CHUNK_SYMBOLS;                                   // First symbol of the chunk.
+    long last = first + CTR_CHUNK_SYMBOLS < job->count ? first + CTR_CHUNK_SYMBOLS : job->count;  // One past the last symbol.
+    CtrPipeline::decryptValues(job->values, (char *)job->plain, first, last, job->exponent, job->n, job->nOnce);   // Decrypt with RSA and counter mode.
+}
+
+
+/**
+ *  Encrypt method used to encrypt the certificate authority's message.
+ */
+void encryptCA(char *sendBuffer, int &messageLength, int d, int n) {
+
+    messageLength = CaPipeline::encrypt(sendBuffer, messageLength, d, n, 0);        // Encrypt with RSA, then write as text.
+}
+
+
+/**
+ *  Decrypt method used to decrypt the certificate authority's message.
+ */
+void decryptCA(long *encryptedBuffer, char *receiveBuffer, int &messageLength, int e, int n) {
+
+    char tempBuffer[BUFFER_SIZE];                                                   // Temporary buffer to store decrypted characters.
+    CaPipeline::decryptValues(encryptedBuffer, tempBuffer, 0, messageLength, e, n, 0);   // Decrypt with RSA.
+    tempBuffer[messageLength] = '\0';                                               // Terminate string.
+    strcpy(receiveBuffer, tempBuffer);                                              // Copy to receive buffer.
+}
+
+
+/**
+ *  Creates a string of char representation of long values from the encrypted long buffer.
+ *  Returns new message length.
+ */
+void createStringToSend(char *sendBuffer, long *encryptedBuffer, int &messageLength) {
+
+    messageLength = DecimalEncoding::encode(encryptedBuffer, messageLength, sendBuffer);   // Write values as text, update message length.
+}
+
+
+/**
+ *  Parses the long values of an encrypted message from a received line.
+ *  receiveBuffer is given the values as received, space separated and "\r\n" terminated, for display.
+ *  Returns error code.
+ */
+int parseEncryptedMessage(char *frame, int frameLength, long *encryptedBuffer, int &messageLength, char *receiveBuffer) {
+
+    char receivedMessage[BUFFER_SIZE];                                              // Buffer to store incoming value.
+    memset(receivedMessage, 0, BUFFER_SIZE);                                        // Ensure blank.
+    receiveBuffer[0] = '\0';                                                        // Ensure blank.
+    int i = 0;                                                                      // The index of receivedMessage.
+    messageLength = 0;                                                              // The length of the encrypted buffer.
+    for (int f = 0; f < frameLength; f++) {                                         // Loop through frame.
+        receivedMessage[i] = frame[f];                                              // Take a char.
+        if (receivedMessage[i] == '\n') {                                           // If received character is new line.
+            strcat(receiveBuffer, "\r\n");                                          // Concatenate message end onto receive buffer.
+            break;                                                                  // Full message has been parsed.
+        } else if (receivedMessage[i] == ' ') {                                     // If received character is space.
+            if (messageLength == BUFFER_SIZE) {                                     // If at buffer limit.
+                return 1;                                                           // Return error code.
+            }
+            receivedMessage[i] = '\0';                                              // Terminate string.
+            sscanf(receivedMessage, "%ld ", &encryptedBuffer[messageLength]);       // Get long value from string.
+            messageLength++;                                                        // Increment encrypted buffer length.
+            strcat(receiveBuffer, receivedMessage);                                 // Copy received message to receive buffer (for display).
+            strcat(receiveBuffer, " ");                                             // Add space.
+            memset(receivedMessage, 0, BUFFER_SIZE);                                // Make received message blank again.
+            i = 0;                                                                  // Reset i.
+        } else if (receivedMessage[i] != '\r' && i < BUFFER_SIZE - 1) {             // Normal character.
+            i++;                                                                    // Increment i.
+        }
+    }
+    return 0;                                                                       // Return no error.
+}
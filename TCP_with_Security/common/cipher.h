@@ -0,0 +1,42 @@
+#ifndef CIPHER_H
+#define CIPHER_H
+
+#ifndef BUFFER_SIZE
+#define BUFFER_SIZE 800                                                             // Size of buffer to receive and send messages with.
+#endif
+#define CTR_PARALLEL_MIN 65536                                                      // Fewest symbols worth splitting across a thread pool in counter mode.
+#define CTR_CHUNK_SYMBOLS 16384                                                     // Symbols in each chunk of a parallel counter mode job.
+
+struct ThreadPool;                                                                  // Worker threads, see threadpool.h.
+
+
+/**
+ *  Structures.
+ */
+enum ChainMode {                                                                    // How each symbol is chained before RSA, agreed with the nOnce.
+    CHAIN_CBC,                                                                      // Each symbol is XORed with the previous encrypted symbol, strictly serial.
+    CHAIN_CTR                                                                       // Each symbol is XORed with a pad derived from the nOnce and its index in the session, so symbols are independent.
+};
+
+
+/**
+ *  Function declarations.
+ *  The RSA, CBC and wire encoding kernels shared by the client, the server and the benchmarks.
+ */
+long repeatsquare(long x, long eORd, long n);                                       // Repeat Square method as found in Assignment guide.
+long cbc(char charToEncrypt, long rand);                                            // Cypher Block Chain encryption.
+void encrypt(char *sendBuffer, int &messageLength, int e, int n, long nOnce);       // Encrypt method used to encrypt the message to be sent.
+void decrypt(long *encryptedBuffer, char *receiveBuffer, int &messageLength, int d, int n, int nOnce);  // Decrypt method used to decrypt received encrypted messages.
+void decryptRSA(long *encryptedBuffer, long *rsaDecryptedBuffer, int messageLength, int d, int n);   // First pass of decrypt(), removes the RSA encryption from every value.
+void decryptCBC(long *rsaDecryptedBuffer, char *receiveBuffer, int messageLength, long nOnce);      // Second pass of decrypt(), removes the CBC chaining.
+void encryptCA(char *sendBuffer, int &messageLength, int d, int n);                 // Encrypt method used to encrypt the certificate authority's message.
+void decryptCA(long *encryptedBuffer, char *receiveBuffer, int &messageLength, int e, int n);   // Decrypt method used to decrypt the certificate authority's message.
+long ctrPad(long nOnce, long long index);                                           // Counter mode pad of the symbol at index in the session.
+void encryptCTR(char *sendBuffer, int &messageLength, int e, int n, long nOnce, long long &counter);    // Encrypt method used to encrypt the message to be sent in counter mode, moving the session's symbol counter past it.
+void decryptCTR(long *rsaDecryptedBuffer, char *receiveBuffer, int messageLength, long nOnce, long long &counter);  // Second pass of decrypt() in counter mode, removes the pads and moves the session's symbol counter past the message.
+void encryptCTRValues(const char *plain, long *values, long count, int e, int n, long nOnce, ThreadPool *pool);   // Encrypts any number of symbols in counter mode, in parallel on pool if large.
+void decryptCTRValues(const long *values, char *plain, long count, int d, int n, long nOnce, ThreadPool *pool);   // Decrypts any number of symbols in counter mode, in parallel on pool if large.
+void createStringToSend(char *sendBuffer, long *encryptedBuffer, int &messageLength);   // Creates a string of char representation of long values from the encrypted long buffer.
+int  parseEncryptedMessage(char *frame, int frameLength, long *encryptedBuffer, int &messageLength, char *receiveBuffer);  // Parses the long values of an encrypted message from a received line.
+
+#endif
@@ -0,0 +1,192 @@
+#include <stdio.h>
+#include <string.h>
+#include "compress.h"
+#include "copycount.h"
+
+static int writeSequence(unsigned char *output, int o, int capacity, const unsigned char *literals, int literalLength, int offset, int matchLength);  // Writes one LZ4 sequence.
+static int writeLength(unsigned char *output, int o, int length);                   // Writes the bytes of a length that did not fit in its token nibble.
+
+
+/**
+ *  Compresses bytes into an LZ4 style block: sequences of a token, literals, and a match given as an offset back into the output and a length.
+ *  Repeats are found through a table of the last position of each hashed four bytes, so compression is one pass with no search.
+ *  Returns compressed length, 0 if the block would not be smaller than the input.
+ */
+int compressBlock(const char *input, int length, char *output, int capacity) {
+
+    const unsigned char *in = (const unsigned char *)input;                         // The input bytes.
+    unsigned char *out = (unsigned char *)output;                                   // The output bytes.
+    int table[1 << COMPRESS_HASH_BITS];                                             // Last position of each hash of four bytes.
+    memset(table, 0xFF, sizeof(table));                                             // Every entry starts empty, -1.
+    if (capacity > length - 1) {                                                    // If output could be as long as the input.
+        capacity = length - 1;                                                      // Give up once it is no smaller.
+    }
+    int anchor = 0;                                                                 // Start of the literals not yet written.
+    int o = 0;                                                                      // Number of bytes written.
+    int i = 0;                                                                      // Position in input.
+    while (i < length - COMPRESS_MATCH_LIMIT) {                                     // While a match may start.
+        unsigned int sequence;                                                      // The four bytes at i.
+        memcpy(&sequence, &in[i], sizeof(sequence));                                // Read them.
+        unsigned int hash = (sequence * 2654435761u) >> (32 - COMPRESS_HASH_BITS);  // Hash them.
+        int candidate = table[hash];                                                // The last position with the same hash.
+        table[hash] = i;                                                            // Remember this one.
+        if (candidate < 0 || i - candidate > 65535 || memcmp(&in[candidate], &in[i], COMPRESS_MIN_MATCH) != 0) {  // If no repeat.
+            i++;                                                                    // Try the next position.
+            continue;                                                               // Keep looking.
+        }
+        int matchLength = COMPRESS_MIN_MATCH;                                       // Length of the repeat.
+        while (i + matchLength < length - COMPRESS_LAST_LITERALS && in[candidate + matchLength] == in[i + matchLength]) {  // While it continues.
+            matchLength++;                                                          // Extend it.
+        }
+        o = writeSequence(out, o, capacity, &in[anchor], i - anchor, i - candidate, matchLength);  // Write literals and match.
+        if (o < 0) {                                                                // If no smaller than the input.
+            return 0;                                                               // Send uncompressed.
+        }
+        i += matchLength;                                                           // Skip the repeat.
+        anchor = i;                                                                 // Literals start after it.
+    }
+    o = writeSequence(out, o, capacity, &in[anchor], length - anchor, 0, 0);        // Write the last literals, with no match.
+    return o < 0 ? 0 : o;                                                           // Return compressed length, 0 if no smaller.
+}
+
+
+/**
+ *  Decompresses an LZ4 style block, checking every length and offset so a corrupt block cannot write outside output.
+ *  Returns decompressed length, -1 if the block is corrupt or does not fit.
+ */
+int decompressBlock(const char *input, int length, char *output, int capacity) {
+
+    const unsigned char *in = (const unsigned char *)input;                         // The input bytes.
+    int i = 0;                                                                      // Position in input.
+    int o = 0;                                                                      // Number of bytes written.
+    while (i < length) {                                                            // Loop through sequences.
+        int token = in[i++];                                                        // Literal and match length nibbles.
+        int literalLength = token >> 4;                                             // Number of literals.
+        if (literalLength == 15) {                                                  // If the length continues.
+            int extra;                                                              // One more byte of length.
+            do {                                                                    // Until a byte below 255.
+                if (i >= length) {                                                  // If the block ends early.
+                    return -1;                                                      // Corrupt.
+                }
+                extra = in[i++];                                                    // Read byte.
+                literalLength += extra;                                             // Add to length.
+            } while (extra == 255);
+        }
+        if (literalLength > length - i || literalLength > capacity - o) {           // If the literals overrun either buffer.
+            return -1;                                                              // Corrupt.
+        }
+        memcpy(&output[o], &in[i], literalLength);                                  // Copy literals.
+        i += literalLength;                                                         // Move past literals.
+        o += literalLength;                                                         // Count output.
+        if (i == length) {                                                          // If that was the last sequence.
+            break;                                                                  // Done.
+        }
+        if (i + 2 > length) {                                                       // If the offset is cut off.
+            return -1;                                                              // Corrupt.
+        }
+        int offset = in[i] | (in[i + 1] << 8);                                      // Distance back to the repeat.
+        i += 2;                                                                     // Move past offset.
+        if (offset == 0 || offset > o) {                                            // If before the start of the output.
+            return -1;                                                              // Corrupt.
+        }
+        int matchLength = token & 15;                                               // Length of the repeat, less COMPRESS_MIN_MATCH.
+        if (matchLength == 15) {                                                    // If the length continues.
+            int extra;                                                              // One more byte of length.
+            do {                                                                    // Until a byte below 255.
+                if (i >= length) {                                                  // If the block ends early.
+                    return -1;                                                      // Corrupt.
+                }
+                extra = in[i++];                                                    // Read byte.
+                matchLength += extra;                                               // Add to length.
+            } while (extra == 255);
+        }
+        matchLength += COMPRESS_MIN_MATCH;                                          // Restore the minimum.
+        if (matchLength > capacity - o) {                                           // If the repeat overruns the output.
+            return -1;                                                              // Corrupt.
+        }
+        for (int m = 0; m < matchLength; m++, o++) {                                // Loop through repeat, byte by byte as it may overlap itself.
+            output[o] = output[o - offset];                                         // Copy byte.
+        }
+    }
+    return o;                                                                       // Return decompressed length.
+}
+
+
+/**
+ *  Writes the "Z<length> " header that starts the values of a compressed message, length is the size before compression.
+ *  Returns header length.
+ */
+int writeCompressionHeader(char *buffer, int originalLength) {
+
+    return sprintf(buffer, "Z%d ", originalLength);                                 // Write header.
+}
+
+
+/**
+ *  Reads the compression header from the start of a message's values.
+ *  Encrypted values never start with 'Z', so an uncompressed message is never mistaken for a compressed one.
+ *  Returns header length, 0 if the message is not compressed.
+ */
+int parseCompressionHeader(const char *frame, int frameLength, int &originalLength) {
+
+    if (frameLength < 3 || frame[0] != 'Z') {                                       // If too short or not compressed.
+        return 0;                                                                   // No header.
+    }
+    int value = 0;                                                                  // The length before compression.
+    int i = 1;                                                                      // Index of frame.
+    while (i < frameLength && frame[i] >= '0' && frame[i] <= '9' && value < 1000000) {  // Loop through digits, stopping before they overflow.
+        value = value * 10 + (frame[i] - '0');                                      // Add digit.
+        i++;                                                                        // Next character.
+    }
+    if (i == 1 || i == frameLength || frame[i] != ' ' || value == 0) {              // If no length or not followed by a space.
+        return 0;                                                                   // No valid header.
+    }
+    originalLength = value;                                                         // Store length.
+    return i + 1;                                                                   // Return header length, including the space.
+}
+
+
+/**
+ *  Writes one LZ4 sequence: a token holding both lengths, the literals, then the match offset and length unless matchLength is 0.
+ *  Returns the new number of bytes written, -1 if it does not fit in capacity.
+ */
+static int writeSequence(unsigned char *output, int o, int capacity, const unsigned char *literals, int literalLength, int offset, int matchLength) {
+
+    int needed = 1 + literalLength + literalLength / 255 + 1 + (matchLength > 0 ? 2 + matchLength / 255 + 1 : 0);  // Most bytes the sequence can take.
+    if (o + needed > capacity) {                                                    // If it may not fit.
+        return -1;                                                                  // Give up.
+    }
+    int tokenAt = o++;                                                              // The token is written once both lengths are known.
+    int token = (literalLength >= 15 ? 15 : literalLength) << 4;                    // Literal length nibble.
+    if (literalLength >= 15) {                                                      // If it did not fit.
+        o = writeLength(output, o, literalLength - 15);                             // Write the rest.
+    }
+    memcpy(&output[o], literals, literalLength);                                    // Copy literals.
+    o += literalLength;                                                             // Count output.
+    if (matchLength > 0) {                                                          // If there is a match.
+        output[o++] = offset & 0xFF;                                                // Low byte of offset.
+        output[o++] = offset >> 8;                                                  // High byte of offset.
+        int length = matchLength - COMPRESS_MIN_MATCH;                              // Match length as stored.
+        token |= length >= 15 ? 15 : length;                                        // Match length nibble.
+        if (length >= 15) {                                                         // If it did not fit.
+            o = writeLength(output, o, length - 15);                                // Write the rest.
+        }
+    }
+    output[tokenAt] = token;                                                        // Write token.
+    return o;                                                                       // Return bytes written.
+}
+
+
+/**
+ *  Writes the bytes of a length that did not fit in its token nibble, 255 until the last byte.
+ *  Returns the new number of bytes written.
+ */
+static int writeLength(unsigned char *output, int o, int length) {
+
+    while (length >= 255) {                                                         // While a full byte remains.
+        output[o++] = 255;                                                          // Write it.
+        length -= 255;                                                              // Take it off.
+    }
+    output[o++] = length;                                                           // Write the last byte.
+    return o;                                                                       // Return bytes written.
+}
@@ -0,0 +1,19 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#define COMPRESS_MIN_BYTES 32                                                       // Messages shorter than this are sent uncompressed, too short to gain.
+#define COMPRESS_HASH_BITS 10                                                       // Bits of the hash of four bytes, sets the size of the match table.
+#define COMPRESS_MIN_MATCH 4                                                        // Shortest repeat encoded as a match.
+#define COMPRESS_LAST_LITERALS 5                                                    // Bytes at the end of a block always sent as literals, as in LZ4.
+#define COMPRESS_MATCH_LIMIT 12                                                     // No match starts in this many bytes at the end of a block, as in LZ4.
+
+
+/**
+ *  Function declarations.
+ */
+int compressBlock(const char *input, int length, char *output, int capacity);       // Compresses bytes into an LZ4 style block.
+int decompressBlock(const char *input, int length, char *output, int capacity);     // Decompresses an LZ4 style block.
+int writeCompressionHeader(char *buffer, int originalLength);                       // Writes the "Z<length> " header that starts the values of a compressed message.
+int parseCompressionHeader(const char *frame, int frameLength, int &originalLength);    // Reads the compression header from the start of a message's values.
+
+#endif
@@ -0,0 +1,152 @@
+#define _WIN32_WINNT 0x501
+#include <windows.h>
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+#include "copycount.h"
+
+enum CopyTotal {                                                                    // Index of each call count in totals, its byte count follows it.
+    TOTAL_ALLOCATIONS = 0,                                                          // Allocations.
+    TOTAL_COPIES = 2,                                                               // Copies.
+    TOTAL_ZEROINGS = 4                                                              // Zeroings.
+};
+
+static volatile LONGLONG totals[6];                                                 // The counts, in the order of CopyCounts.
+
+static void countCall(int total, size_t bytes);                                     // Counts one call and its bytes.
+
+
+/**
+ *  Gets the totals so far, from every thread, all 0 unless built with -DCOUNT_COPIES.
+ */
+void readCopyCounts(CopyCounts &counts) {
+
+    counts.allocations = totals[0];                                                 // Read count.
+    counts.allocatedBytes = totals[1];                                              // Read count.
+    counts.copies = totals[2];                                                      // Read count.
+    counts.copiedBytes = totals[3];                                                 // Read count.
+    counts.zeroings = totals[4];                                                    // Read count.
+    counts.zeroedBytes = totals[5];                                                 // Read count.
+}
+
+
+/**
+ *  Leaves only what was counted since before.
+ */
+void subtractCopyCounts(CopyCounts &counts, CopyCounts &before) {
+
+    counts.allocations -= before.allocations;                                       // Subtract count.
+    counts.allocatedBytes -= before.allocatedBytes;                                 // Subtract count.
+    counts.copies -= before.copies;                                                 // Subtract count.
+    counts.copiedBytes -= before.copiedBytes;                                       // Subtract count.
+    counts.zeroings -= before.zeroings;                                             // Subtract count.
+    counts.zeroedBytes -= before.zeroedBytes;                                       // Subtract count.
+}
+
+
+/**
+ *  Counts an allocation made without new, such as whole pages from the system.
+ */
+void countAllocation(size_t bytes) {
+
+    if (COPY_COUNTING) {                                                            // If counts are kept.
+        countCall(TOTAL_ALLOCATIONS, bytes);                                        // Count allocation.
+    }
+}
+
+
+/**
+ *  memcpy(), counted.
+ *  The real functions are called with their names in brackets, which the renaming macros do not match.
+ *  Returns destination.
+ */
+void *countedMemcpy(void *destination, const void *source, size_t length) {
+
+    countCall(TOTAL_COPIES, length);                                                // Count copy.
+    return (memcpy)(destination, source, length);                                   // Copy.
+}
+
+
+/**
+ *  memmove(), counted.
+ *  Returns destination.
+ */
+void *countedMemmove(void *destination, const void *source, size_t length) {
+
+    countCall(TOTAL_COPIES, length);                                                // Count copy.
+    return (memmove)(destination, source, length);                                  // Copy.
+}
+
+
+/**
+ *  memset(), counted.
+ *  Returns destination.
+ */
+void *countedMemset(void *destination, int value, size_t length) {
+
+    countCall(TOTAL_ZEROINGS, length);                                              // Count zeroing.
+    return (memset)(destination, value, length);                                    // Set.
+}
+
+
+/**
+ *  strcpy(), counted, including the terminator.
+ *  Returns destination.
+ */
+char *countedStrcpy(char *destination, const char *source) {
+
+    countCall(TOTAL_COPIES, strlen(source) + 1);                                    // Count copy.
+    return (strcpy)(destination, source);                                           // Copy.
+}
+
+
+/**
+ *  strcat(), counted, including the terminator but not the search for the end of destination.
+ *  Returns destination.
+ */
+char *countedStrcat(char *destination, const char *source) {
+
+    countCall(TOTAL_COPIES, strlen(source) + 1);                                    // Count copy.
+    return (strcat)(destination, source);                                           // Copy.
+}
+
+
+/**
+ *  Counts one call and its bytes.
+ */
+static void countCall(int total, size_t bytes) {
+
+    InterlockedIncrement64(&totals[total]);                                         // Count call.
+    InterlockedExchangeAdd64(&totals[total + 1], (LONGLONG)bytes);                  // Count bytes.
+}
+
+
+#ifdef COUNT_COPIES
+/**
+ *  Replaces the global new and delete, so every allocation by new or new[] in the program is counted.
+ */
+void *operator new(size_t size) {
+
+    countCall(TOTAL_ALLOCATIONS, size);                                             // Count allocation.
+    void *memory = malloc(size > 0 ? size : 1);                                     // Allocate, a distinct address even for 0 bytes.
+    if (memory == NULL) {                                                           // If out of memory.
+        throw std::bad_alloc();                                                     // Fail as new does.
+    }
+    return memory;                                                                  // Return the memory.
+}
+
+void *operator new[](size_t size) {
+
+    return operator new(size);                                                      // Allocate, counted.
+}
+
+void operator delete(void *memory) noexcept {
+
+    free(memory);                                                                   // Free memory.
+}
+
+void operator delete[](void *memory) noexcept {
+
+    free(memory);                                                                   // Free memory.
+}
+#endif
@@ -0,0 +1,50 @@
+#ifndef COPYCOUNT_H
+#define COPYCOUNT_H
+
+#include <stddef.h>
+
+#ifdef COUNT_COPIES                                                                 // Build with -DCOUNT_COPIES to count heap allocations, copies and zeroing.
+#define COPY_COUNTING true                                                          // True if counts are kept, constant so uses compile out otherwise.
+#else
+#define COPY_COUNTING false                                                         // True if counts are kept, constant so uses compile out otherwise.
+#endif
+
+
+/**
+ *  Structures.
+ */
+struct CopyCounts {                                                                 // Totals since the program started, or between two readings.
+    long long allocations;                                                          // Heap allocations, by new and by allocateOnNode().
+    long long allocatedBytes;                                                       // Bytes allocated.
+    long long copies;                                                               // Calls to memcpy(), memmove(), strcpy() and strcat() in counted files.
+    long long copiedBytes;                                                          // Bytes copied.
+    long long zeroings;                                                             // Calls to memset() in counted files.
+    long long zeroedBytes;                                                          // Bytes set.
+};
+
+
+/**
+ *  Function declarations.
+ */
+void  readCopyCounts(CopyCounts &counts);                                           // Gets the totals so far, all 0 unless built with -DCOUNT_COPIES.
+void  subtractCopyCounts(CopyCounts &counts, CopyCounts &before);                   // Leaves only what was counted since before.
+void  countAllocation(size_t bytes);                                                // Counts an allocation made without new.
+void *countedMemcpy(void *destination, const void *source, size_t length);          // memcpy(), counted.
+void *countedMemmove(void *destination, const void *source, size_t length);         // memmove(), counted.
+void *countedMemset(void *destination, int value, size_t length);                   // memset(), counted.
+char *countedStrcpy(char *destination, const char *source);                         // strcpy(), counted.
+char *countedStrcat(char *destination, const char *source);                         // strcat(), counted.
+
+
+/**
+ *  Counted files include this header after every other, so only their own calls are renamed.
+ */
+#ifdef COUNT_COPIES
+#define memcpy(destination, source, length) countedMemcpy(destination, source, length)
+#define memmove(destination, source, length) countedMemmove(destination, source, length)
+#define memset(destination, value, length) countedMemset(destination, value, length)
+#define strcpy(destination, source) countedStrcpy(destination, source)
+#define strcat(destination, source) countedStrcat(destination, source)
+#endif
+
+#endif
@@ -0,0 +1,103 @@
+#include <string.h>
+#include "histogram.h"
+
+
+/**
+ *  Prepares a histogram for use.
+ */
+void initHistogram(Histogram &histogram) {
+
+    memset(&histogram, 0, sizeof(Histogram));                                       // Ensure blank.
+    histogram.min = ~0ULL;                                                          // Any value is smaller.
+}
+
+
+/**
+ *  Gets the bucket a value is recorded in.
+ *  Values below 2 * HISTOGRAM_SUB_BUCKETS have a bucket each, above that every power of two is split into HISTOGRAM_SUB_BUCKETS buckets.
+ *  Returns bucket index.
+ */
+int histogramIndex(unsigned long long value) {
+
+    int shift = 0;                                                                  // Number of low bits dropped from value.
+    while ((value >> shift) >= 2 * HISTOGRAM_SUB_BUCKETS) {                         // While value does not fit the sub-buckets.
+        shift++;                                                                    // Drop another bit.
+    }
+    return shift * HISTOGRAM_SUB_BUCKETS + (int)(value >> shift);                   // Return bucket index.
+}
+
+
+/**
+ *  Gets the largest value recorded in a bucket.
+ *  Returns value.
+ */
+unsigned long long histogramBucketValue(int index) {
+
+    if (index < 2 * HISTOGRAM_SUB_BUCKETS) {                                        // If bucket holds one value.
+        return index;                                                               // Return value.
+    }
+    int shift = index / HISTOGRAM_SUB_BUCKETS - 1;                                  // Number of low bits dropped from values in bucket.
+    unsigned long long base = (unsigned long long)(index - shift * HISTOGRAM_SUB_BUCKETS);  // Value with the low bits dropped.
+    return ((base + 1) << shift) - 1;                                               // Return largest value.
+}
+
+
+/**
+ *  Records a value.
+ */
+void recordValue(Histogram &histogram, unsigned long long value) {
+
+    histogram.counts[histogramIndex(value)]++;                                      // Count value in its bucket.
+    histogram.total++;                                                              // Count value.
+    histogram.sum += value;                                                         // Add to sum.
+    if (value < histogram.min) {                                                    // If smallest yet.
+        histogram.min = value;                                                      // Store minimum.
+    }
+    if (value > histogram.max) {                                                    // If largest yet.
+        histogram.max = value;                                                      // Store maximum.
+    }
+}
+
+
+/**
+ *  Adds every value recorded in one histogram to another.
+ */
+void mergeHistogram(Histogram &into, Histogram &from) {
+
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {                                   // Loop through buckets.
+        into.counts[i] += from.counts[i];                                           // Add counts.
+    }
+    into.total += from.total;                                                       // Add number of values.
+    into.sum += from.sum;                                                           // Add sums.
+    if (from.min < into.min) {                                                      // If smaller minimum.
+        into.min = from.min;                                                        // Store minimum.
+    }
+    if (from.max > into.max) {                                                      // If larger maximum.
+        into.max = from.max;                                                        // Store maximum.
+    }
+}
+
+
+/**
+ *  Gets the value below which the given percentage of values fall.
+ *  Returns value, accurate to the width of its bucket.
+ */
+unsigned long long histogramPercentile(Histogram &histogram, double percentile) {
+
+    if (histogram.total == 0) {                                                     // If nothing recorded.
+        return 0;                                                                   // No values.
+    }
+    unsigned long long rank = (unsigned long long)(percentile / 100.0 * histogram.total + 0.5);    // Number of values at or below the percentile.
+    if (rank == 0) {                                                                // If below first value.
+        rank = 1;                                                                   // Use first value.
+    }
+    unsigned long long count = 0;                                                   // Number of values seen.
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {                                   // Loop through buckets.
+        count += histogram.counts[i];                                               // Add bucket's values.
+        if (count >= rank) {                                                        // If percentile is in this bucket.
+            unsigned long long value = histogramBucketValue(i);                     // Largest value in bucket.
+            return value < histogram.max ? value : histogram.max;                   // Never report more than the maximum.
+        }
+    }
+    return histogram.max;                                                           // Return maximum.
+}
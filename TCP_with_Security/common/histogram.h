@@ -0,0 +1,31 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#define HISTOGRAM_SUB_BITS 5                                                        // Each power of two is split into 2^HISTOGRAM_SUB_BITS buckets, about 3% precision.
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BITS)                             // Number of buckets per power of two.
+#define HISTOGRAM_BUCKETS ((65 - HISTOGRAM_SUB_BITS) * HISTOGRAM_SUB_BUCKETS)       // Number of buckets needed to cover every 64 bit value.
+
+
+/**
+ *  Structures.
+ */
+struct Histogram {                                                                  // HDR style log-linear histogram of recorded values.
+    unsigned long long counts[HISTOGRAM_BUCKETS];                                   // Number of values recorded in each bucket.
+    unsigned long long total;                                                       // Number of values recorded.
+    unsigned long long sum;                                                         // Sum of values recorded.
+    unsigned long long min;                                                         // Smallest value recorded.
+    unsigned long long max;                                                         // Largest value recorded.
+};
+
+
+/**
+ *  Function declarations.
+ */
+void               initHistogram(Histogram &histogram);                             // Prepares a histogram for use.
+int                histogramIndex(unsigned long long value);                        // Gets the bucket a value is recorded in.
+unsigned long long histogramBucketValue(int index);                                 // Gets the largest value recorded in a bucket.
+void               recordValue(Histogram &histogram, unsigned long long value);     // Records a value.
+void               mergeHistogram(Histogram &into, Histogram &from);                // Adds every value recorded in one histogram to another.
+unsigned long long histogramPercentile(Histogram &histogram, double percentile);    // Gets the value below which the given percentage of values fall.
+
+#endif
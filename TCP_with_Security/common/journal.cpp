@@ -0,0 +1,463 @@
+#define _WIN32_WINNT 0x501
+#include <winsock2.h>
+#include <windows.h>
+#include <io.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "journal.h"
+#include "copycount.h"
+
+static char             *ring = NULL;                                               // Records waiting to be made durable, NULL while not journaling.
+static volatile LONGLONG tail = 0;                                                  // Bytes ever appended, only the appending thread moves it.
+static volatile LONGLONG durable = 0;                                               // Bytes ever synced to disk, only the writer thread moves it.
+static volatile LONG     running = 0;                                               // 1 while the writer thread is committing records.
+static volatile LONG     failed = 0;                                                // 1 once a write or sync failed.
+static int               groupMs = DEFAULT_COMMIT_MS;                               // Longest time a group waits for more records.
+static int               groupBytes = DEFAULT_COMMIT_BYTES;                         // Bytes that make a group sync early.
+static SOCKET            wakeup = INVALID_SOCKET;                                   // Written after each sync so the event loop's select() returns, INVALID_SOCKET if nobody selects.
+static FILE             *journalFile = NULL;                                        // The journal file.
+static HANDLE            writerThread = NULL;                                       // Commits records to the file.
+static HANDLE            wakeEvent = NULL;                                          // Wakes the writer thread when a group starts or fills.
+static HANDLE            durableEvent = NULL;                                       // Set after each sync, for waitForJournal().
+static JournalStats      stats;                                                     // Counts of the journal's work, records and stalls by the appending thread, commits by the writer.
+static LARGE_INTEGER     frequency;                                                 // Counter ticks per second.
+static LARGE_INTEGER     startCounter;                                              // Counter when the journal was opened, record times are relative to it.
+static bool              exitHandlersAdded = false;                                 // True once the exit handlers are registered, they stay for the life of the program.
+
+static DWORD WINAPI      writeJournal(LPVOID parameter);                            // Commits groups of records until the journal stops.
+static int               commitGroup();                                             // Writes every queued record and syncs the file.
+static double            millisecondsSince(LARGE_INTEGER &since);                   // Gets the time since a counter value.
+static void              copyToRing(LONGLONG position, const char *bytes, int length);  // Copies bytes into the ring at a position, wrapping at its end.
+static long              findJournalEnd(FILE *file, long size);                     // Finds the end of the last whole record in a journal file.
+static BOOL WINAPI       stopJournalOnExit(DWORD controlType);                      // Commits the queued records when the console is closed or interrupted.
+static void              stopJournalAtExit();                                       // Commits the queued records when the program ends.
+
+
+/**
+ *  Reads the commit interval in milliseconds and the group size in bytes from a policy such as "2,65536".
+ *  Returns error code.
+ */
+int parseCommitPolicy(const char *policy, int &commitMs, int &commitBytes) {
+
+    int ms = 0;                                                                     // The interval read.
+    int bytes = 0;                                                                  // The group size read.
+    int length = 0;                                                                 // Number of characters read.
+    if (sscanf(policy, "%d,%d%n", &ms, &bytes, &length) != 2 || policy[length] != '\0') {   // If not an interval and a size.
+        return 1;                                                                   // Return error code.
+    }
+    if (ms < 0 || ms > 1000 || bytes < 1 || bytes > JOURNAL_RING_SIZE / 2) {        // If records would wait too long, or a group could not fit the ring while the next gathers.
+        return 2;                                                                   // Return error code.
+    }
+    commitMs = ms;                                                                  // Store interval.
+    commitBytes = bytes;                                                            // Store group size.
+    return 0;                                                                       // Return no error.
+}
+
+
+/**
+ *  Opens the journal for appending, writing its header if it is new, and starts the thread that commits records to it.
+ *  A record torn by a crash at the end of an existing journal is cut off, so new records follow the last whole one.
+ *  A group of records is synced once commitMs has passed since its first record, or once it holds commitBytes.
+ *  The wakeup socket, if given, is written after each sync so an event loop waiting in select() sees the new durable position.
+ *  Returns error code.
+ */
+int startJournal(const char *path, int commitMs, int commitBytes, SOCKET wakeupSocket) {
+
+    journalFile = fopen(path, "ab");                                                // Open journal, appending to any records already in it.
+    if (journalFile == NULL) {                                                      // If file could not be opened.
+        fprintf(stderr, "Could not open journal %s\n", path);                       // Alert user.
+        return 1;                                                                   // Return error code.
+    }
+    fseek(journalFile, 0, SEEK_END);                                                // Find the end.
+    if (ftell(journalFile) == 0) {                                                  // If new.
+        JournalFileHeader header = { JOURNAL_MAGIC, JOURNAL_VERSION };              // Identifies the file and its layout.
+        fwrite(&header, sizeof(header), 1, journalFile);                            // Write header, synced with the first group.
+    } else {                                                                        // Else records are appended to an existing journal.
+        long size = ftell(journalFile);                                             // Bytes in it.
+        FILE *existing = fopen(path, "rb");                                         // Open it to check its header and records.
+        JournalFileHeader header;                                                   // Identifies the file and its layout.
+        bool matches = existing != NULL && fread(&header, sizeof(header), 1, existing) == 1 && header.magic == JOURNAL_MAGIC && header.version == JOURNAL_VERSION;  // True if this build wrote it.
+        long end = matches ? findJournalEnd(existing, size) : size;                 // End of the last whole record.
+        if (existing != NULL) {                                                     // If opened.
+            fclose(existing);                                                       // Close file.
+        }
+        if (!matches) {                                                             // If another file or layout.
+            fprintf(stderr, "%s is not a version %d journal\n", path, JOURNAL_VERSION); // Alert user.
+            fclose(journalFile);                                                    // Close file.
+            return 2;                                                               // Return error code.
+        }
+        if (end < size) {                                                           // If a torn record follows it.
+            if (_chsize(_fileno(journalFile), end) != 0) {                          // If it could not be cut off.
+                fprintf(stderr, "Could not cut the torn record off journal %s\n", path);   // Alert user.
+                fclose(journalFile);                                                // Close file.
+                return 3;                                                           // Return error code.
+            }
+            fprintf(stderr, "Journal %s ended in a torn record, dropped its last %ld bytes\n", path, size - end);   // Alert user.
+        }
+    }
+    setvbuf(journalFile, NULL, _IOFBF, JOURNAL_FILE_BUFFER);                        // Write each group to disk in large pieces.
+    ring = new char[JOURNAL_RING_SIZE];                                             // Room for records waiting to be made durable.
+    tail = 0;                                                                       // Nothing appended.
+    durable = 0;                                                                    // Nothing synced.
+    failed = 0;                                                                     // Not failed.
+    memset(&stats, 0, sizeof(stats));                                               // Ensure blank.
+    groupMs = commitMs;                                                             // Store interval.
+    groupBytes = commitBytes;                                                       // Store byte limit.
+    wakeup = wakeupSocket;                                                          // Store wakeup socket.
+    QueryPerformanceFrequency(&frequency);                                          // Get frequency.
+    QueryPerformanceCounter(&startCounter);                                         // Record times start here.
+    wakeEvent = CreateEvent(NULL, FALSE, FALSE, NULL);                              // Auto reset event to wake the writer thread.
+    durableEvent = CreateEvent(NULL, FALSE, FALSE, NULL);                           // Auto reset event set after each sync.
+    running = 1;                                                                    // Records are committed from now on.
+    writerThread = CreateThread(NULL, 0, writeJournal, NULL, 0, NULL);              // Start the writer thread.
+    if (!exitHandlersAdded) {                                                       // If not yet registered.
+        SetConsoleCtrlHandler(stopJournalOnExit, TRUE);                             // Commit the queued records if the server is stopped with Ctrl+C.
+        atexit(stopJournalAtExit);                                                  // Commit the queued records if the server exits.
+        exitHandlersAdded = true;                                                   // Registered.
+    }
+    return 0;                                                                       // Return no error.
+}
+
+
+/**
+ *  Checks whether records are being journaled.
+ *  Returns true if they are.
+ */
+bool isJournaling() {
+
+    return ring != NULL && running;                                                 // Return whether journaling.
+}
+
+
+/**
+ *  Queues a record for the writer thread.
+ *  Only one thread may append, so the ring needs no lock: it copies the record in, then publishes it by moving tail.
+ *  Unlike a capture, a record is never dropped: while the ring is full the caller waits for the writer to free room.
+ *  Returns the record's end position, the record is durable once journalDurablePosition() reaches it, -1 if not journaling.
+ */
+long long journalAppend(int session, const char *data, int length) {
+
+    if (!isJournaling()) {                                                          // If not journaling.
+        return -1;                                                                  // Nothing to do.
+    }
+    int size = sizeof(JournalRecord) + length;                                      // Bytes the record takes in the ring.
+    if (JOURNAL_RING_SIZE - (tail - InterlockedExchangeAdd64(&durable, 0)) < size) {    // If the writer thread is behind.
+        stats.stalls++;                                                             // Count stall.
+        SetEvent(wakeEvent);                                                        // Commit now rather than at the end of the interval.
+        while (!failed && JOURNAL_RING_SIZE - (tail - InterlockedExchangeAdd64(&durable, 0)) < size) {  // Until there is room.
+            WaitForSingleObject(durableEvent, JOURNAL_IDLE_MS);                     // Wait for a sync.
+        }
+        if (failed) {                                                               // If nothing more will be synced.
+            return -1;                                                              // Record cannot be made durable.
+        }
+    }
+    LARGE_INTEGER counter;                                                          // Counter value.
+    QueryPerformanceCounter(&counter);                                              // Get counter.
+    JournalRecord record;                                                           // The record's header.
+    record.time = (unsigned long long)((counter.QuadPart - startCounter.QuadPart) * (1000000000.0 / frequency.QuadPart));   // Nanoseconds since the journal was opened.
+    record.session = session;                                                       // Store record.
+    record.length = length;                                                         // Store record.
+    record.checksum = journalChecksum(data, length);                                // Store record.
+    record.reserved = 0;                                                            // Store record.
+    copyToRing(tail, (const char *)&record, sizeof(record));                        // Copy header.
+    copyToRing(tail + sizeof(record), data, length);                                // Copy data.
+    LONGLONG end = InterlockedExchangeAdd64(&tail, size) + size;                    // Publish the record to the writer thread, with a full barrier.
+    LONGLONG waiting = end - InterlockedExchangeAdd64(&durable, 0);                 // Bytes not yet synced, including this record.
+    if (waiting == size || (waiting >= groupBytes && waiting - size < groupBytes)) {    // If the record starts a group, or fills it.
+        SetEvent(wakeEvent);                                                        // Wake the writer thread to time or commit the group.
+    }
+    stats.records++;                                                                // Count record.
+    stats.bytes += size;                                                            // Count bytes.
+    return end;                                                                     // Return position the record is durable at.
+}
+
+
+/**
+ *  Gets the position up to which records are on disk, comparable with the positions journalAppend() returns.
+ *  Returns the position.
+ */
+long long journalDurablePosition() {
+
+    return InterlockedExchangeAdd64(&durable, 0);                                   // Return position, read atomically.
+}
+
+
+/**
+ *  Checks whether a write or sync failed, so no more records will become durable.
+ *  Returns true if failed.
+ */
+bool journalFailed() {
+
+    return failed != 0;                                                             // Return whether failed.
+}
+
+
+/**
+ *  Waits until records up to a position are on disk, or the journal fails.
+ */
+void waitForJournal(long long position) {
+
+    while (!failed && InterlockedExchangeAdd64(&durable, 0) < position) {           // Until durable.
+        WaitForSingleObject(durableEvent, JOURNAL_IDLE_MS);                         // Wait for a sync.
+    }
+}
+
+
+/**
+ *  Gets the counts of the journal's work, read from the appending thread.
+ */
+void readJournalStats(JournalStats &counts) {
+
+    counts.records = stats.records;                                                 // Read count.
+    counts.bytes = stats.bytes;                                                     // Read count.
+    counts.commits = InterlockedExchangeAdd64((volatile LONGLONG *)&stats.commits, 0);  // Read count, moved by the writer thread.
+    counts.stalls = stats.stalls;                                                   // Read count.
+}
+
+
+/**
+ *  Stops the writer thread once it has committed every queued record, and closes the journal.
+ *  Only the first call does anything.
+ *  Returns error code, 1 if a write or sync failed.
+ */
+int stopJournal() {
+
+    if (InterlockedExchange(&running, 0) == 0) {                                    // If not journaling or already stopped.
+        return 0;                                                                   // Nothing to do.
+    }
+    SetEvent(wakeEvent);                                                            // Wake the writer thread.
+    WaitForSingleObject(writerThread, INFINITE);                                    // Wait for it to commit the last records.
+    CloseHandle(writerThread);                                                      // Free thread.
+    CloseHandle(wakeEvent);                                                         // Free event.
+    CloseHandle(durableEvent);                                                      // Free event.
+    fclose(journalFile);                                                            // Close journal.
+    delete[] ring;                                                                  // Free memory.
+    ring = NULL;                                                                    // Not journaling.
+    if (failed) {                                                                   // If records were lost.
+        fprintf(stderr, "Journal writes failed, the last records are not durable\n");   // Alert user.
+        return 1;                                                                   // Return error code.
+    }
+    return 0;                                                                       // Return no error.
+}
+
+
+/**
+ *  Reads a whole journal file into memory, checking its header.
+ *  data holds the records after the header, free it with delete[].
+ *  Returns error code.
+ */
+int readJournalFile(const char *path, char *&data, long &length) {
+
+    data = NULL;                                                                    // Nothing read yet.
+    length = 0;                                                                     // Nothing read yet.
+    FILE *file = fopen(path, "rb");                                                 // Open journal.
+    if (file == NULL) {                                                             // If file could not be opened.
+        fprintf(stderr, "Could not open journal %s\n", path);                       // Alert user.
+        return 1;                                                                   // Return error code.
+    }
+    JournalFileHeader header;                                                       // Identifies the file and its layout.
+    if (fread(&header, sizeof(header), 1, file) != 1 || header.magic != JOURNAL_MAGIC || header.version != JOURNAL_VERSION) {  // If not a journal this build reads.
+        fprintf(stderr, "%s is not a version %d journal\n", path, JOURNAL_VERSION); // Alert user.
+        fclose(file);                                                               // Close file.
+        return 2;                                                                   // Return error code.
+    }
+    fseek(file, 0, SEEK_END);                                                       // Find the end.
+    length = ftell(file) - sizeof(header);                                          // Bytes of records.
+    fseek(file, sizeof(header), SEEK_SET);                                          // Back to the first record.
+    data = new char[length > 0 ? length : 1];                                       // Room for every record.
+    if (length > 0 && fread(data, length, 1, file) != 1) {                          // If records could not be read.
+        fprintf(stderr, "Could not read journal %s\n", path);                       // Alert user.
+        fclose(file);                                                               // Close file.
+        delete[] data;                                                              // Free memory.
+        data = NULL;                                                                // Nothing read.
+        return 3;                                                                   // Return error code.
+    }
+    fclose(file);                                                                   // Close file.
+    return 0;                                                                       // Return no error.
+}
+
+
+/**
+ *  Gets the record at offset, checking its data against its checksum, and moves offset past it.
+ *  payload points at the record's data inside data, records are not aligned so the header is copied out.
+ *  Returns false at the end of the records, or at a record torn by a crash before its group was synced.
+ */
+bool nextJournalRecord(const char *data, long length, long &offset, JournalRecord &record, const char *&payload) {
+
+    if (length - offset < (long)sizeof(JournalRecord)) {                            // If no whole header left.
+        return false;                                                               // End of records.
+    }
+    memcpy(&record, &data[offset], sizeof(record));                                 // Copy header.
+    if ((unsigned long)(length - offset - sizeof(record)) < record.length) {        // If the data was cut short.
+        return false;                                                               // End of records.
+    }
+    payload = &data[offset + sizeof(record)];                                       // The record's data.
+    if (journalChecksum(payload, record.length) != record.checksum) {               // If the data was torn.
+        return false;                                                               // End of records.
+    }
+    offset += sizeof(record) + record.length;                                       // Move past record.
+    return true;                                                                    // Return record.
+}
+
+
+/**
+ *  Hashes a record's data with 32-bit FNV-1a.
+ *  Returns the hash.
+ */
+unsigned int journalChecksum(const char *data, int length) {
+
+    unsigned int hash = 2166136261u;                                                // FNV offset basis.
+    for (int i = 0; i < length; i++) {                                              // Loop through bytes.
+        hash = (hash ^ (unsigned char)data[i]) * 16777619u;                         // Mix in byte with the FNV prime.
+    }
+    return hash;                                                                    // Return hash.
+}
+
+
+/**
+ *  Commits groups of records until the journal stops.
+ *  A group opens with the first record not yet synced, then gathers records until commitMs has passed or it holds commitBytes.
+ *  Every record appended while a sync runs joins the next group, so the more clients are waiting the more each sync carries.
+ *  Returns 0.
+ */
+static DWORD WINAPI writeJournal(LPVOID parameter) {
+
+    while (running) {                                                               // Until the journal stops.
+        if (tail == durable) {                                                      // If nothing waiting.
+            WaitForSingleObject(wakeEvent, JOURNAL_IDLE_MS);                        // Sleep until a record starts a group.
+            continue;                                                               // Check again.
+        }
+        LARGE_INTEGER groupStart;                                                   // When the group opened.
+        QueryPerformanceCounter(&groupStart);                                       // Get counter.
+        double waited = 0;                                                          // Milliseconds the group has gathered for.
+        while (running && tail - durable < groupBytes && waited < groupMs) {        // Until the group is due or full.
+            WaitForSingleObject(wakeEvent, (DWORD)(groupMs - waited + 0.999));      // Sleep until woken by a full group or the interval ends.
+            waited = millisecondsSince(groupStart);                                 // Time gathered.
+        }
+        if (commitGroup()) {                                                        // If the group could not be synced.
+            break;                                                                  // Stop committing, appenders see failed.
+        }
+    }
+    commitGroup();                                                                  // Commit the last records.
+    return 0;                                                                       // Return no error.
+}
+
+
+/**
+ *  Writes every queued record straight from the ring in at most two pieces, then syncs the file.
+ *  _commit() is FlushFileBuffers() on the file's handle, Windows' fdatasync, one per group however many records it holds.
+ *  Returns error code.
+ */
+static int commitGroup() {
+
+    if (failed) {                                                                   // If an earlier group failed.
+        return 1;                                                                   // Return error code.
+    }
+    LONGLONG end = InterlockedExchangeAdd64(&tail, 0);                              // Bytes published by the appending thread.
+    LONGLONG queued = end - durable;                                                // Bytes to commit.
+    if (queued == 0) {                                                              // If nothing queued.
+        return 0;                                                                   // Nothing to commit.
+    }
+    LONGLONG start = durable & (JOURNAL_RING_SIZE - 1);                             // Index of the first queued byte.
+    LONGLONG first = queued < JOURNAL_RING_SIZE - start ? queued : JOURNAL_RING_SIZE - start;   // Bytes before the ring wraps.
+    bool written = fwrite(&ring[start], 1, first, journalFile) == (size_t)first     // Write them,
+        && fwrite(ring, 1, queued - first, journalFile) == (size_t)(queued - first) // the rest from the start of the ring,
+        && fflush(journalFile) == 0                                                 // hand the group to the system,
+        && _commit(_fileno(journalFile)) == 0;                                      // and wait for it to reach the disk.
+    if (!written) {                                                                 // If the group is not durable.
+        InterlockedExchange(&failed, 1);                                            // No record from here on becomes durable.
+        SetEvent(durableEvent);                                                     // Release any waiter.
+        return 1;                                                                   // Return error code.
+    }
+    InterlockedExchangeAdd64(&durable, queued);                                     // Publish the durable position, freeing the space.
+    InterlockedIncrement64((volatile LONGLONG *)&stats.commits);                    // Count commit.
+    SetEvent(durableEvent);                                                         // Wake a waiter.
+    if (wakeup != INVALID_SOCKET) {                                                 // If an event loop selects on it.
+        send(wakeup, "j", 1, 0);                                                    // Wake it, a full socket already holds a wakeup.
+    }
+    return 0;                                                                       // Return no error.
+}
+
+
+/**
+ *  Gets the time since a counter value.
+ *  Returns milliseconds.
+ */
+static double millisecondsSince(LARGE_INTEGER &since) {
+
+    LARGE_INTEGER counter;                                                          // Counter value.
+    QueryPerformanceCounter(&counter);                                              // Get counter.
+    return (counter.QuadPart - since.QuadPart) * 1000.0 / frequency.QuadPart;       // Return milliseconds.
+}
+
+
+/**
+ *  Copies bytes into the ring at a position, wrapping at its end.
+ */
+static void copyToRing(LONGLONG position, const char *bytes, int length) {
+
+    int start = (int)(position & (JOURNAL_RING_SIZE - 1));                          // Index of the first byte.
+    int first = length < JOURNAL_RING_SIZE - start ? length : JOURNAL_RING_SIZE - start;    // Bytes before the ring wraps.
+    memcpy(&ring[start], bytes, first);                                             // Copy them.
+    memcpy(ring, &bytes[first], length - first);                                    // Copy the rest to the start of the ring.
+}
+
+
+/**
+ *  Finds the end of the last whole record in a journal file, read from just after its header.
+ *  Records are checked as nextJournalRecord() checks them, a piece at a time, so a large journal is not read into memory.
+ *  Returns the offset of the end, the file's size if every record is whole.
+ */
+static long findJournalEnd(FILE *file, long size) {
+
+    char buffer[JOURNAL_SCAN_BUFFER];                                               // A piece of a record's data.
+    long end = sizeof(JournalFileHeader);                                           // End of the last whole record.
+    JournalRecord record;                                                           // The record's header.
+    while (size - end >= (long)sizeof(record) && fread(&record, sizeof(record), 1, file) == 1) {  // While a whole header is left.
+        if ((unsigned long)(size - end - sizeof(record)) < record.length) {         // If the data was cut short.
+            break;                                                                  // Torn.
+        }
+        unsigned int hash = 2166136261u;                                            // FNV offset basis, hashed as journalChecksum() does.
+        unsigned int left = record.length;                                          // Data bytes not yet hashed.
+        while (left > 0) {                                                          // Loop through the data.
+            size_t piece = left < sizeof(buffer) ? left : sizeof(buffer);           // Bytes read this time.
+            if (fread(buffer, 1, piece, file) != piece) {                           // If they could not be read.
+                return end;                                                         // Treat the rest as torn.
+            }
+            for (size_t i = 0; i < piece; i++) {                                    // Loop through bytes.
+                hash = (hash ^ (unsigned char)buffer[i]) * 16777619u;               // Mix in byte with the FNV prime.
+            }
+            left -= piece;                                                          // Count bytes.
+        }
+        if (hash != record.checksum) {                                              // If the data was torn.
+            break;                                                                  // Torn.
+        }
+        end += sizeof(record) + record.length;                                      // Move past record.
+    }
+    return end;                                                                     // Return end.
+}
+
+
+/**
+ *  Commits the queued records when the console is closed or interrupted.
+ *  Runs on the system's control thread while the event loop may still be appending, so it only waits for the records queued so far to be synced.
+ *  The ring and events stay open, stopJournal() frees them from the main thread or at exit, once no appender is left.
+ *  Returns FALSE so the default handler still ends the program.
+ */
+static BOOL WINAPI stopJournalOnExit(DWORD controlType) {
+
+    if (isJournaling()) {                                                           // If journaling.
+        waitForJournal(InterlockedExchangeAdd64(&tail, 0));                         // Wait for the queued records to be synced.
+    }
+    return FALSE;                                                                   // Let the program end.
+}
+
+
+/**
+ *  Commits the queued records when the program ends.
+ */
+static void stopJournalAtExit() {
+
+    stopJournal();                                                                  // Commit the queued records.
+}
@@ -0,0 +1,57 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <winsock2.h>
+#include <windows.h>
+
+#define JOURNAL_MAGIC 0x4E524A54                                                    // "TJRN" read as a little endian int, the first 4 bytes of every journal file.
+#define JOURNAL_VERSION 1                                                           // Layout of the records below.
+#define JOURNAL_RING_SIZE (1 << 22)                                                 // Bytes of records waiting to be made durable, a power of 2, appends wait while it is full.
+#define JOURNAL_FILE_BUFFER (1 << 20)                                               // Bytes the file stream gathers, so a group reaches the disk in one write.
+#define JOURNAL_SCAN_BUFFER 65536                                                   // Bytes read at a time when checking an existing journal's records.
+#define JOURNAL_IDLE_MS 50                                                          // Longest time the writer thread sleeps with nothing to commit before checking again.
+#define DEFAULT_COMMIT_MS 2                                                         // Longest time a record waits for others to share its sync, 0 syncs as soon as the writer sees it.
+#define DEFAULT_COMMIT_BYTES 65536                                                  // Bytes of records that make a group sync without waiting for the rest of the interval.
+
+
+/**
+ *  Structures.
+ */
+struct JournalFileHeader {                                                          // The start of a journal file, written once when it is created.
+    unsigned int magic;                                                             // JOURNAL_MAGIC.
+    unsigned int version;                                                           // JOURNAL_VERSION.
+};
+
+struct JournalRecord {                                                              // The header of one record, followed by length bytes of data.
+    unsigned long long time;                                                        // Nanoseconds since the server opened the journal.
+    unsigned int       session;                                                     // The client's number, the order it was accepted in, 0 if taken over from an old server.
+    unsigned int       length;                                                      // Number of data bytes following.
+    unsigned int       checksum;                                                    // FNV-1a hash of the data, so a record torn by a crash is found when reading.
+    unsigned int       reserved;                                                    // Always 0.
+};
+
+struct JournalStats {                                                               // Counts of the journal's work since it was opened.
+    long long records;                                                              // Records appended.
+    long long bytes;                                                                // Bytes appended, including record headers.
+    long long commits;                                                              // Groups synced to disk, one FlushFileBuffers() each.
+    long long stalls;                                                               // Appends that waited for room in the ring.
+};
+
+
+/**
+ *  Function declarations.
+ */
+int          parseCommitPolicy(const char *policy, int &commitMs, int &commitBytes);  // Reads the commit interval and group size from a policy such as "2,65536".
+int          startJournal(const char *path, int commitMs, int commitBytes, SOCKET wakeupSocket);  // Opens the journal for appending and starts the thread that commits records to it.
+bool         isJournaling();                                                        // Checks whether records are being journaled.
+long long    journalAppend(int session, const char *data, int length);              // Queues a record, from the one thread that appends.
+long long    journalDurablePosition();                                              // Gets the position up to which records are on disk.
+bool         journalFailed();                                                       // Checks whether a write or sync failed, so no more records will become durable.
+void         waitForJournal(long long position);                                    // Waits until records up to a position are on disk, or the journal fails.
+void         readJournalStats(JournalStats &stats);                                 // Gets the counts of the journal's work.
+int          stopJournal();                                                         // Commits every queued record and closes the journal.
+int          readJournalFile(const char *path, char *&data, long &length);          // Reads a whole journal file into memory, checking its header.
+bool         nextJournalRecord(const char *data, long length, long &offset, JournalRecord &record, const char *&payload);  // Gets the record at offset, checking its data, and moves past it.
+unsigned int journalChecksum(const char *data, int length);                         // Hashes a record's data.
+
+#endif
@@ -0,0 +1,48 @@
+#define _WIN32_WINNT 0x501
+#include <windows.h>
+#include <stdio.h>
+#include <string.h>
+#include "keyframe.h"
+
+enum { KEY_E, KEY_D, KEY_N };                                                       // Used to access values in key arrays.
+
+
+/**
+ *  Builds the handshake frame announcing a server key, held once by the caller.
+ *  The frame is the same for every client, so it is encrypted once here rather than once per connection.
+ *  Returns the frame.
+ */
+KeyFrame *buildKeyFrame(long *encryptKeyCA, long *encryptKeyServer) {
+
+    KeyFrame *frame = new KeyFrame;                                                 // The frame.
+    memset(frame, 0, sizeof(KeyFrame));                                             // Ensure blank.
+    frame->references = 1;                                                          // Held by the caller.
+    memcpy(frame->key, encryptKeyServer, sizeof(frame->key));                       // Remember the key, clients sent this frame are decrypted with it.
+    sprintf(frame->data, "KEYS %ld %ld", encryptKeyServer[KEY_E], encryptKeyServer[KEY_N]);  // Create data to send.
+    int messageLength = strlen(frame->data);                                        // Get the message length.
+    encryptCA(frame->data, messageLength, encryptKeyCA[KEY_D], encryptKeyCA[KEY_N]);    // Encrypt the message.
+    frame->length = messageLength;                                                  // Store frame length.
+    return frame;                                                                   // Return the frame.
+}
+
+
+/**
+ *  Adds a holder to a frame.
+ *  Returns the frame.
+ */
+KeyFrame *acquireKeyFrame(KeyFrame *frame) {
+
+    InterlockedIncrement(&frame->references);                                       // Add holder.
+    return frame;                                                                   // Return the frame.
+}
+
+
+/**
+ *  Removes a holder from a frame, freeing it after the last one.
+ */
+void releaseKeyFrame(KeyFrame *frame) {
+
+    if (frame != NULL && InterlockedDecrement(&frame->references) == 0) {           // If that was the last holder.
+        delete frame;                                                               // Free memory.
+    }
+}
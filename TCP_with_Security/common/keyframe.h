@@ -0,0 +1,25 @@
+#ifndef KEYFRAME_H
+#define KEYFRAME_H
+
+#include "cipher.h"
+
+
+/**
+ *  Structures.
+ */
+struct KeyFrame {                                                                   // The CA-encrypted "KEYS e n" line for one server key, shared by every client sent it.
+    volatile long references;                                                       // Number of holders, the frame is freed when the last one releases it.
+    long          key[3];                                                           // The server key the frame announces: { e, d, n }.
+    int           length;                                                           // Number of bytes in data, including "\r\n".
+    char          data[BUFFER_SIZE];                                                // The frame as sent, never changed once built.
+};
+
+
+/**
+ *  Function declarations.
+ */
+KeyFrame *buildKeyFrame(long *encryptKeyCA, long *encryptKeyServer);                // Builds the handshake frame announcing a server key, held once by the caller.
+KeyFrame *acquireKeyFrame(KeyFrame *frame);                                         // Adds a holder to a frame.
+void      releaseKeyFrame(KeyFrame *frame);                                         // Removes a holder from a frame, freeing it after the last one.
+
+#endif
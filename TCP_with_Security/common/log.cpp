@@ -0,0 +1,237 @@
+#define _WIN32_WINNT 0x501
+#include <windows.h>
+#include <stdio.h>
+#include <string.h>
+#include "log.h"
+#include "copycount.h"
+
+using namespace std;
+
+struct LogEntry {                                                                   // One line, or piece of a line, in the ring buffer.
+    volatile LONG sequence;                                                         // Equals the write position when free, one past it when holding a line.
+    int           length;                                                           // Number of characters in text.
+    char          text[LOG_ENTRY_SIZE];                                             // The characters.
+};
+
+class LogBuffer : public streambuf {                                                // Collects a thread's characters into lines and queues each complete line.
+public:
+    LogBuffer() : length(0) {}
+
+protected:
+    int overflow(int c) {                                                           // Adds a character, queuing the line at its end.
+        if (c == EOF) {                                                             // If not a character.
+            return 0;                                                               // Nothing to add.
+        }
+        line[length++] = (char)c;                                                   // Add character.
+        if (c == '\n' || length == LOG_ENTRY_SIZE) {                                // If line is complete or the entry is full.
+            queueLogLine(line, length);                                             // Queue it.
+            length = 0;                                                             // Start the next line.
+        }
+        return c;                                                                   // Return character added.
+    }
+
+    int sync() {                                                                    // Queues a partial line when the stream is flushed.
+        if (length > 0) {                                                           // If part of a line is waiting.
+            queueLogLine(line, length);                                             // Queue it.
+            length = 0;                                                             // Start the next line.
+        }
+        return 0;                                                                   // Return no error.
+    }
+
+private:
+    char line[LOG_ENTRY_SIZE];                                                      // The line being built.
+    int  length;                                                                    // Number of characters in line.
+};
+
+struct LogStream {                                                                  // A thread's log stream.
+    LogBuffer buffer;                                                               // Builds the thread's lines.
+    ostream   stream;                                                               // Formats into buffer.
+    LogStream() : stream(&buffer) {}
+};
+
+volatile int         logLevel = LOG_INFO;                                           // The most verbose level written, set at run time.
+static LogEntry      ring[LOG_RING_ENTRIES];                                        // Lines waiting to be written to the console.
+static volatile LONG writePosition = 0;                                             // Position the next line is queued at, shared by every thread.
+static volatile LONG readPosition = 0;                                              // Position of the next line written to the console, only moved by the drain thread.
+static volatile LONG droppedLines = 0;                                              // Lines dropped because the ring buffer was full.
+static volatile LONG running = 0;                                                   // 1 while the drain thread is writing queued lines.
+static HANDLE        drainThread = NULL;                                            // Writes queued lines to the console.
+static HANDLE        wakeEvent = NULL;                                              // Wakes the drain thread early.
+static DWORD         streamIndex = TlsAlloc();                                      // Thread local storage slot holding each thread's LogStream.
+
+static DWORD WINAPI  drainLog(LPVOID parameter);                                    // Writes queued lines to the console until the logger stops.
+
+
+/**
+ *  Sets the level and starts the thread that writes queued lines to the console.
+ *  Lines written before the logger starts, or after it stops, go straight to the console.
+ *  Returns error code.
+ */
+int startLogger(int level) {
+
+    logLevel = level;                                                               // Set the level.
+    if (running) {                                                                  // If already started.
+        return 0;                                                                   // Nothing more to do.
+    }
+    for (LONG i = 0; i < LOG_RING_ENTRIES; i++) {                                   // Loop through entries.
+        ring[i].sequence = i;                                                       // Entry is free for the first pass.
+    }
+    wakeEvent = CreateEvent(NULL, FALSE, FALSE, NULL);                              // Auto reset event to wake the drain thread.
+    running = 1;                                                                    // Lines are queued from now on.
+    drainThread = CreateThread(NULL, 0, drainLog, NULL, 0, NULL);                   // Start the drain thread.
+    if (wakeEvent == NULL || drainThread == NULL) {                                 // If the thread could not be started.
+        running = 0;                                                                // Write lines straight to the console.
+        return 1;                                                                   // Return error code.
+    }
+    atexit(stopLogger);                                                             // Write queued lines however the program ends.
+    return 0;                                                                       // Return no error.
+}
+
+
+/**
+ *  Writes every queued line and stops the drain thread.
+ */
+void stopLogger() {
+
+    if (InterlockedExchange(&running, 0) == 0) {                                    // If not running.
+        return;                                                                     // Nothing to do.
+    }
+    SetEvent(wakeEvent);                                                            // Wake the drain thread so it sees the logger stopping.
+    WaitForSingleObject(drainThread, INFINITE);                                     // Wait for it to finish.
+    CloseHandle(drainThread);                                                       // Free thread.
+    CloseHandle(wakeEvent);                                                         // Free event.
+    writeQueuedLines();                                                             // Write anything queued while it was finishing.
+}
+
+
+/**
+ *  Waits until every queued line has been written.
+ *  Used before reading from the console so prompts appear after the lines before them.
+ */
+void flushLog() {
+
+    LogStream *log = (LogStream *)TlsGetValue(streamIndex);                         // The thread's log stream, if it has one.
+    if (log != NULL) {                                                              // If the thread has written lines.
+        log->stream.flush();                                                        // Queue any partial line.
+    }
+    while (running && readPosition != writePosition) {                              // While lines are waiting.
+        SetEvent(wakeEvent);                                                        // Wake the drain thread.
+        Sleep(1);                                                                   // Give it time to write them.
+    }
+    fflush(stdout);                                                                 // Write out the console buffer.
+}
+
+
+/**
+ *  Gets the level named "error", "info", "debug" or "trace", or given as its number.
+ *  Returns the level, LOG_INFO if the name is not known.
+ */
+int parseLogLevel(const char *name) {
+
+    const char *names[] = { "error", "info", "debug", "trace" };                    // Level names, in level order.
+    for (int i = LOG_ERROR; i <= LOG_TRACE; i++) {                                  // Loop through levels.
+        if (strcmp(name, names[i]) == 0 || (name[0] == '0' + i && name[1] == '\0')) {   // If name or number matches.
+            return i;                                                               // Return level.
+        }
+    }
+    return LOG_INFO;                                                                // Return default level.
+}
+
+
+/**
+ *  Gets the calling thread's log stream.
+ *  Each thread builds its own lines so lines from different threads are never mixed.
+ *  Returns the stream.
+ */
+ostream &logStream() {
+
+    LogStream *log = (LogStream *)TlsGetValue(streamIndex);                         // The thread's log stream, if it has one.
+    if (log == NULL) {                                                              // If the thread has not logged before.
+        log = new LogStream;                                                        // Create its stream, kept for the life of the thread.
+        TlsSetValue(streamIndex, log);                                              // Remember stream for this thread.
+    }
+    return log->stream;                                                             // Return stream.
+}
+
+
+/**
+ *  Copies a line into the ring buffer without blocking.
+ *  Threads claim entries by moving writePosition with compare and swap, so there is no lock, if the ring buffer is full the line is dropped and counted.
+ */
+void queueLogLine(const char *text, int length) {
+
+    if (!running) {                                                                 // If the drain thread is not running.
+        fwrite(text, 1, length, stdout);                                            // Write straight to the console.
+        return;                                                                     // Nothing more to do.
+    }
+    LONG position = writePosition;                                                  // The position to try.
+    LogEntry *entry = NULL;                                                         // The entry claimed.
+    while (1) {                                                                     // Until an entry is claimed or the ring buffer is full.
+        entry = &ring[position & (LOG_RING_ENTRIES - 1)];                           // The entry at position.
+        LONG difference = entry->sequence - position;                               // 0 if free, negative if still holding a line from the last pass.
+        if (difference == 0) {                                                      // If entry is free.
+            LONG seen = InterlockedCompareExchange(&writePosition, position + 1, position); // Try to claim it.
+            if (seen == position) {                                                 // If claimed.
+                break;                                                              // Fill it.
+            }
+            position = seen;                                                        // Another thread claimed it, try the next one.
+        } else if (difference < 0) {                                                // Else if ring buffer is full.
+            InterlockedIncrement(&droppedLines);                                    // Count dropped line.
+            SetEvent(wakeEvent);                                                    // Make room as soon as possible.
+            return;                                                                 // Never block the caller.
+        } else {                                                                    // Else position is out of date.
+            position = writePosition;                                               // Try again from the latest position.
+        }
+    }
+    memcpy(entry->text, text, length);                                              // Copy line.
+    entry->length = length;                                                         // Store length.
+    InterlockedExchange(&entry->sequence, position + 1);                            // Publish the line to the drain thread.
+    if (position - readPosition == LOG_RING_ENTRIES / 2) {                          // If the ring buffer has just become half full.
+        SetEvent(wakeEvent);                                                        // Wake the drain thread early.
+    }
+}
+
+
+/**
+ *  Writes queued lines to the console until the logger stops.
+ *  Returns 0.
+ */
+static DWORD WINAPI drainLog(LPVOID parameter) {
+
+    while (running) {                                                               // Until the logger stops.
+        if (writeQueuedLines() == 0) {                                              // If nothing was waiting.
+            WaitForSingleObject(wakeEvent, LOG_DRAIN_MS);                           // Sleep until woken or the next check.
+        }
+    }
+    writeQueuedLines();                                                             // Write the last lines.
+    return 0;                                                                       // Return no error.
+}
+
+
+/**
+ *  Writes every line in the ring buffer to the console, then flushes the console once.
+ *  Only one thread may call this at a time.
+ *  Returns number of lines written.
+ */
+int writeQueuedLines() {
+
+    int lines = 0;                                                                  // Number of lines written.
+    while (1) {                                                                     // Until the ring buffer is empty.
+        LogEntry *entry = &ring[readPosition & (LOG_RING_ENTRIES - 1)];             // The oldest entry.
+        if (entry->sequence != readPosition + 1) {                                  // If no line has been published there.
+            break;                                                                  // Ring buffer is empty.
+        }
+        fwrite(entry->text, 1, entry->length, stdout);                              // Write line.
+        InterlockedExchange(&entry->sequence, readPosition + LOG_RING_ENTRIES);     // Free entry for the next pass.
+        InterlockedIncrement(&readPosition);                                        // Move to the next entry.
+        lines++;                                                                    // Count line.
+    }
+    LONG dropped = InterlockedExchange(&droppedLines, 0);                           // Lines dropped since last time.
+    if (dropped > 0) {                                                              // If any were dropped.
+        fprintf(stdout, "[%ld log lines dropped]\n", (long)dropped);                // Alert user.
+    }
+    if (lines > 0 || dropped > 0) {                                                 // If anything was written.
+        fflush(stdout);                                                             // Flush once for every batch of lines.
+    }
+    return lines;                                                                   // Return number of lines written.
+}
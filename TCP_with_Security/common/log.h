@@ -0,0 +1,38 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <iostream>
+
+#define LOG_RING_ENTRIES 4096                                                       // Number of lines the ring buffer holds, must be a power of two.
+#define LOG_ENTRY_SIZE 256                                                          // Longest piece of a line held by one entry, longer lines take several.
+#define LOG_DRAIN_MS 20                                                             // Longest time the drain thread sleeps before checking the ring buffer.
+
+enum LogLevel {                                                                     // How important a line is, each level includes the ones above it.
+    LOG_ERROR,                                                                      // Failures.
+    LOG_INFO,                                                                       // Clients connecting and disconnecting, timeouts and counters.
+    LOG_DEBUG,                                                                      // Every message sent and received.
+    LOG_TRACE                                                                       // Every byte of every message.
+};
+
+#ifndef LOG_COMPILED_LEVEL
+#define LOG_COMPILED_LEVEL LOG_TRACE                                                // Most verbose level compiled in, build with -DLOG_COMPILED_LEVEL=LOG_INFO to remove the dumps.
+#endif
+
+#define LOG_ENABLED(level) ((level) <= LOG_COMPILED_LEVEL && (level) <= logLevel)   // True if lines at level are written, constant false for levels not compiled in.
+#define LOG(level) if (!LOG_ENABLED(level)) {} else logStream()                     // Stream to write a line at level, the line is not formatted if the level is off.
+
+extern volatile int logLevel;                                                       // The most verbose level written, set at run time.
+
+
+/**
+ *  Function declarations.
+ */
+int           startLogger(int level);                                               // Sets the level and starts the thread that writes queued lines to the console.
+void          stopLogger();                                                         // Writes every queued line and stops the drain thread.
+void          flushLog();                                                           // Waits until every queued line has been written.
+int           parseLogLevel(const char *name);                                      // Gets the level named "error", "info", "debug" or "trace".
+std::ostream &logStream();                                                          // Gets the calling thread's log stream.
+void          queueLogLine(const char *text, int length);                           // Copies a line into the ring buffer without blocking.
+int           writeQueuedLines();                                                   // Writes every line in the ring buffer to the console.
+
+#endif
@@ -0,0 +1,206 @@
+#define _WIN32_WINNT 0x501
+#include <windows.h>
+#include <stdio.h>
+#include <string.h>
+#include "metrics.h"
+
+static DWORD          shardIndex = TLS_OUT_OF_INDEXES;                              // Thread local storage slot holding each thread's shard.
+static MetricsShard  *volatile shards[MAX_METRICS_SHARDS];                          // Every registered shard, filled in order.
+static volatile LONG  shardCount = 0;                                               // Number of slots in shards claimed by threads.
+
+static const char *counterNames[METRIC_COUNTER_COUNT][2] = {                        // Exported name and help text of each counter.
+    { "connections_accepted_total", "Clients accepted." },
+    { "connections_closed_total", "Clients disconnected." },
+    { "handshakes_completed_total", "Clients that finished the handshake." },
+    { "messages_received_total", "Encrypted messages received." },
+    { "messages_sent_total", "Messages queued to be sent." },
+    { "bytes_received_total", "Bytes received." },
+    { "bytes_sent_total", "Bytes sent." }
+};
+
+static const char *histogramNames[METRIC_HISTOGRAM_COUNT][2] = {                    // Exported name and help text of each histogram.
+    { "handshake_duration_seconds", "Time from accept to the nOnce being received." },
+    { "decrypt_duration_seconds", "Time to decrypt one message." },
+    { "handler_duration_seconds", "Time from a decrypted message being given to the handler to its reply being queued." }
+};
+
+static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };                        // Quantiles exported for each histogram.
+
+
+/**
+ *  Prepares the metrics registry, call once before any thread records metrics.
+ *  Returns error code.
+ */
+int initMetrics() {
+
+    if (shardIndex != TLS_OUT_OF_INDEXES) {                                         // If already prepared.
+        return 0;                                                                   // Nothing to do.
+    }
+    shardIndex = TlsAlloc();                                                        // Reserve a thread local slot.
+    if (shardIndex == TLS_OUT_OF_INDEXES) {                                         // If no slot was free.
+        return 1;                                                                   // Return error code.
+    }
+    return 0;                                                                       // Return no error.
+}
+
+
+/**
+ *  Gets the calling thread's shard, registering it on first use.
+ *  Each shard has a single writer so recording needs no locks or atomic instructions, only the exporter reads other threads' shards.
+ *  Returns the shard, or NULL if every slot is taken and the thread's metrics are dropped.
+ */
+MetricsShard *metricsShard() {
+
+    MetricsShard *shard = (MetricsShard *)TlsGetValue(shardIndex);                  // The thread's shard, if registered.
+    if (shard != NULL) {                                                            // If registered.
+        return shard;                                                               // Return shard.
+    }
+    LONG slot = InterlockedIncrement(&shardCount) - 1;                              // Claim the next slot.
+    if (slot >= MAX_METRICS_SHARDS) {                                               // If no slots left.
+        InterlockedDecrement(&shardCount);                                          // Give the slot back.
+        return NULL;                                                                // Drop the thread's metrics.
+    }
+    shard = new MetricsShard;                                                       // The thread's shard, kept for the life of the process.
+    memset(shard, 0, sizeof(MetricsShard));                                         // Ensure blank.
+    for (int i = 0; i < METRIC_HISTOGRAM_COUNT; i++) {                              // Loop through histograms.
+        initHistogram(shard->histograms[i]);                                        // Prepare histogram.
+    }
+    InterlockedExchangePointer((void *volatile *)&shards[slot], shard);             // Publish the finished shard to the exporter.
+    TlsSetValue(shardIndex, shard);                                                 // Remember shard for this thread.
+    return shard;                                                                   // Return shard.
+}
+
+
+/**
+ *  Adds to one of the calling thread's counters.
+ */
+void countMetric(MetricCounter counter, unsigned long long amount) {
+
+    MetricsShard *shard = metricsShard();                                           // The thread's shard.
+    if (shard != NULL) {                                                            // If registered.
+        shard->counters[counter] += amount;                                         // Count.
+    }
+}
+
+
+/**
+ *  Records a value in one of the calling thread's histograms.
+ */
+void recordMetric(MetricHistogram histogram, unsigned long long value) {
+
+    MetricsShard *shard = metricsShard();                                           // The thread's shard.
+    if (shard != NULL) {                                                            // If registered.
+        recordValue(shard->histograms[histogram], value);                           // Record.
+    }
+}
+
+
+/**
+ *  Gets the time used for latency metrics.
+ *  Returns nanoseconds from the high resolution counter.
+ */
+unsigned long long metricsClock() {
+
+    static LARGE_INTEGER frequency = { { 0, 0 } };                                  // Counter ticks per second.
+    if (frequency.QuadPart == 0) {                                                  // If not yet known.
+        QueryPerformanceFrequency(&frequency);                                      // Get frequency.
+    }
+    LARGE_INTEGER counter;                                                          // Counter value.
+    QueryPerformanceCounter(&counter);                                              // Get counter.
+    return (unsigned long long)(counter.QuadPart * (1000000000.0 / frequency.QuadPart));   // Return nanoseconds.
+}
+
+
+/**
+ *  Sums every thread's shard.
+ *  Shards are read while their threads keep writing, so a snapshot may be a moment behind but is never blocked.
+ */
+void snapshotMetrics(MetricsShard &snapshot) {
+
+    memset(&snapshot, 0, sizeof(MetricsShard));                                     // Ensure blank.
+    for (int i = 0; i < METRIC_HISTOGRAM_COUNT; i++) {                              // Loop through histograms.
+        initHistogram(snapshot.histograms[i]);                                      // Prepare histogram.
+    }
+    LONG count = shardCount < MAX_METRICS_SHARDS ? shardCount : MAX_METRICS_SHARDS; // Number of slots claimed.
+    for (LONG s = 0; s < count; s++) {                                              // Loop through slots.
+        MetricsShard *shard = shards[s];                                            // The shard, NULL if its thread is still building it.
+        if (shard == NULL) {                                                        // If not yet published.
+            continue;                                                               // Nothing recorded yet.
+        }
+        for (int i = 0; i < METRIC_COUNTER_COUNT; i++) {                            // Loop through counters.
+            snapshot.counters[i] += shard->counters[i];                             // Sum counter.
+        }
+        for (int i = 0; i < METRIC_HISTOGRAM_COUNT; i++) {                          // Loop through histograms.
+            mergeHistogram(snapshot.histograms[i], shard->histograms[i]);           // Sum histogram.
+        }
+    }
+}
+
+
+/**
+ *  Writes every metric in Prometheus text exposition format.
+ *  Histograms are written as summaries in seconds.
+ *  Returns number of characters written.
+ */
+int writeMetrics(char *buffer, int size) {
+
+    MetricsShard *snapshot = new MetricsShard;                                      // The summed shards, too large for the stack.
+    snapshotMetrics(*snapshot);                                                     // Sum every thread's shard.
+    int length = 0;                                                                 // Number of characters written.
+    for (int i = 0; i < METRIC_COUNTER_COUNT; i++) {                                // Loop through counters.
+        length += writeMetric(&buffer[length], size - length, counterNames[i][0], "counter", counterNames[i][1], (double)snapshot->counters[i]);
+    }
+    double active = (double)snapshot->counters[METRIC_CONNECTIONS_ACCEPTED] - (double)snapshot->counters[METRIC_CONNECTIONS_CLOSED]; // Clients connected now.
+    length += writeMetric(&buffer[length], size - length, "connections_active", "gauge", "Clients connected.", active);
+    for (int i = 0; i < METRIC_HISTOGRAM_COUNT; i++) {                              // Loop through histograms.
+        Histogram &histogram = snapshot->histograms[i];                             // The histogram.
+        const char *name = histogramNames[i][0];                                    // The exported name.
+        int written = snprintf(&buffer[length], size - length, "# HELP " METRICS_PREFIX "%s %s\n# TYPE " METRICS_PREFIX "%s summary\n", name, histogramNames[i][1], name);
+        length += written < 0 || written >= size - length ? 0 : written;            // Keep output if it fitted.
+        for (unsigned int q = 0; q < sizeof(quantiles) / sizeof(quantiles[0]); q++) {   // Loop through quantiles.
+            double value = histogram.total == 0 ? 0 : histogramPercentile(histogram, quantiles[q] * 100.0) / 1e9;  // Quantile in seconds.
+            written = snprintf(&buffer[length], size - length, METRICS_PREFIX "%s{quantile=\"%g\"} %.9f\n", name, quantiles[q], value);
+            length += written < 0 || written >= size - length ? 0 : written;        // Keep output if it fitted.
+        }
+        written = snprintf(&buffer[length], size - length, METRICS_PREFIX "%s_sum %.9f\n" METRICS_PREFIX "%s_count %llu\n", name, histogram.sum / 1e9, name, histogram.total);
+        length += written < 0 || written >= size - length ? 0 : written;            // Keep output if it fitted.
+    }
+    delete snapshot;                                                                // Free memory.
+    return length;                                                                  // Return number of characters written.
+}
+
+
+/**
+ *  Writes one counter or gauge in Prometheus text exposition format.
+ *  Returns number of characters written, 0 if it did not fit.
+ */
+int writeMetric(char *buffer, int size, const char *name, const char *type, const char *help, double value) {
+
+    int written = snprintf(buffer, size, "# HELP " METRICS_PREFIX "%s %s\n# TYPE " METRICS_PREFIX "%s %s\n" METRICS_PREFIX "%s %.0f\n", name, help, name, type, name, value);
+    if (written < 0 || written >= size) {                                           // If it did not fit.
+        return 0;                                                                   // Nothing written.
+    }
+    return written;                                                                 // Return number of characters written.
+}
+
+
+/**
+ *  Writes a counter or gauge with one series per label value in Prometheus text exposition format.
+ *  The label values are the given names, or the numbers 0 to count - 1 if names is NULL.
+ *  Returns number of characters written, 0 if it did not fit.
+ */
+int writeLabelledMetric(char *buffer, int size, const char *name, const char *type, const char *help, const char *label, const double *values, int count, const char *const *names) {
+
+    int length = snprintf(buffer, size, "# HELP " METRICS_PREFIX "%s %s\n# TYPE " METRICS_PREFIX "%s %s\n", name, help, name, type);
+    for (int i = 0; i < count && length >= 0 && length < size; i++) {               // Loop through series while they fit.
+        if (names != NULL) {                                                        // If the values are named.
+            length += snprintf(&buffer[length], size - length, METRICS_PREFIX "%s{%s=\"%s\"} %.0f\n", name, label, names[i], values[i]);
+        } else {                                                                    // Else numbered.
+            length += snprintf(&buffer[length], size - length, METRICS_PREFIX "%s{%s=\"%d\"} %.0f\n", name, label, i, values[i]);
+        }
+    }
+    if (length < 0 || length >= size) {                                             // If it did not fit.
+        return 0;                                                                   // Nothing written.
+    }
+    return length;                                                                  // Return number of characters written.
+}
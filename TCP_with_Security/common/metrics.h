@@ -0,0 +1,50 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include "histogram.h"
+
+#define MAX_METRICS_SHARDS 64                                                       // Maximum number of threads that can record metrics.
+#define METRICS_PREFIX "tcp_security_"                                              // Prefix of every exported metric name.
+
+
+/**
+ *  Structures.
+ */
+enum MetricCounter {                                                                // Counters kept by every thread.
+    METRIC_CONNECTIONS_ACCEPTED,                                                    // Clients accepted.
+    METRIC_CONNECTIONS_CLOSED,                                                      // Clients disconnected.
+    METRIC_HANDSHAKES_COMPLETED,                                                    // Clients that finished the handshake.
+    METRIC_MESSAGES_IN,                                                             // Encrypted messages received.
+    METRIC_MESSAGES_OUT,                                                            // Messages queued to be sent.
+    METRIC_BYTES_IN,                                                                // Bytes received.
+    METRIC_BYTES_OUT,                                                               // Bytes sent.
+    METRIC_COUNTER_COUNT                                                            // Number of counters.
+};
+
+enum MetricHistogram {                                                              // Latency histograms kept by every thread, values in nanoseconds.
+    METRIC_HANDSHAKE_TIME,                                                          // Time from accept to the nOnce being received.
+    METRIC_DECRYPT_TIME,                                                            // Time to decrypt one message.
+    METRIC_HANDLER_TIME,                                                            // Time from a decrypted message being given to the handler to its reply being queued.
+    METRIC_HISTOGRAM_COUNT                                                          // Number of histograms.
+};
+
+struct MetricsShard {                                                               // The metrics recorded by one thread, written only by that thread.
+    volatile unsigned long long counters[METRIC_COUNTER_COUNT];                     // The counters.
+    Histogram                   histograms[METRIC_HISTOGRAM_COUNT];                 // The histograms.
+};
+
+
+/**
+ *  Function declarations.
+ */
+int                initMetrics();                                                   // Prepares the metrics registry, call once before any thread records metrics.
+MetricsShard      *metricsShard();                                                  // Gets the calling thread's shard, registering it on first use.
+void               countMetric(MetricCounter counter, unsigned long long amount);   // Adds to one of the calling thread's counters.
+void               recordMetric(MetricHistogram histogram, unsigned long long value);   // Records a value in one of the calling thread's histograms.
+unsigned long long metricsClock();                                                  // Gets the time used for latency metrics.
+void               snapshotMetrics(MetricsShard &snapshot);                         // Sums every thread's shard.
+int                writeMetrics(char *buffer, int size);                            // Writes every metric in Prometheus text exposition format.
+int                writeMetric(char *buffer, int size, const char *name, const char *type, const char *help, double value);   // Writes one counter or gauge in Prometheus text exposition format.
+int                writeLabelledMetric(char *buffer, int size, const char *name, const char *type, const char *help, const char *label, const double *values, int count, const char *const *names = NULL);  // Writes a counter or gauge with one series per label value, named or numbered 0 to count - 1.
+
+#endif
@@ -0,0 +1,164 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include "cipher.h"
+#include "rsatable.h"
+
+
+/**
+ *  Chaining policies.
+ *  Each is built from the nOnce and the session's symbol counter at the start of a message, and sees the symbols in order.
+ */
+struct CbcChain {                                                                   // Each symbol is XORed with the previous encrypted symbol.
+    long previous;                                                                  // The previous chained value, the nOnce for the first symbol.
+
+    CbcChain(long nOnce, long long counter) : previous(nOnce) {}
+
+    long chain(char symbol, long index) {                                           // Chains a plain text symbol.
+        previous = cbc(symbol, previous);                                           // Encrypt with CBC.
+        return previous;                                                            // Return chained value.
+    }
+
+    char unchain(long value, long index) {                                          // Recovers a plain text symbol.
+        char symbol = (char)(value ^ previous);                                     // Decrypt with CBC.
+        previous = value;                                                           // The next symbol is chained to this one.
+        return symbol;                                                              // Return symbol.
+    }
+};
+
+struct CtrChain {                                                                   // Each symbol is XORed with a pad from the nOnce and its index in the session.
+    long      nOnce;                                                                // The nOnce the pads are derived from.
+    long long counter;                                                              // Index in the session of the message's first symbol, so no two messages share pads.
+
+    CtrChain(long nOnce, long long counter) : nOnce(nOnce), counter(counter) {}
+
+    long chain(char symbol, long index) {                                           // Chains a plain text symbol.
+        return (unsigned char)symbol ^ ctrPad(nOnce, counter + index);              // Encrypt with counter mode.
+    }
+
+    char unchain(long value, long index) {                                          // Recovers a plain text symbol.
+        return (char)(value ^ ctrPad(nOnce, counter + index));                      // Decrypt with counter mode.
+    }
+};
+
+struct NoChain {                                                                    // Symbols are encrypted as they are, used by the certificate authority.
+    NoChain(long nOnce, long long counter) {}
+
+    long chain(char symbol, long index) {                                           // Chains a plain text symbol.
+        return symbol;                                                              // Return symbol unchanged.
+    }
+
+    char unchain(long value, long index) {                                          // Recovers a plain text symbol.
+        return (char)value;                                                         // Return symbol unchanged.
+    }
+};
+
+
+/**
+ *  Exponentiation policies.
+ *  Each is built from the key at the start of a message.
+ */
+struct ComputedPower {                                                              // Raises every value with repeatsquare().
+    long exponent;                                                                  // The key's e or d.
+    long n;                                                                         // The key's modulus.
+
+    ComputedPower(long exponent, long n) : exponent(exponent), n(n) {}
+
+    long raise(long x) {                                                            // Raises x to the key's exponent.
+        return repeatsquare(x, exponent, n);                                        // Compute.
+    }
+};
+
+struct TablePower {                                                                 // Loads values from the key's lookup table, computing those outside it.
+    long        exponent;                                                           // The key's e or d.
+    long        n;                                                                  // The key's modulus.
+    const long *table;                                                              // The key's lookup table, NULL if it has none.
+
+    TablePower(long exponent, long n) : exponent(exponent), n(n), table(rsaTable(exponent, n)) {}
+
+    long raise(long x) {                                                            // Raises x to the key's exponent.
+        return rsaLookup(table, x, exponent, n);                                    // Look up or compute.
+    }
+};
+
+
+/**
+ *  Wire encoding policies.
+ */
+struct DecimalEncoding {                                                            // Space separated decimal values ending in "\r\n".
+    static int encode(const long *values, int count, char *text) {                  // Writes the values as text, returns the text length.
+        int length = 0;                                                             // Number of characters written.
+        for (int i = 0; i < count; i++) {                                           // Loop through values.
+            unsigned long magnitude = values[i] < 0 ? 0UL - values[i] : values[i];  // The value without its sign.
+            if (values[i] < 0) {                                                    // If negative.
+                text[length++] = '-';                                               // Write sign.
+            }
+            char digits[24];                                                        // The digits, least significant first.
+            int digitCount = 0;                                                     // Number of digits.
+            do {                                                                    // Until every digit is found.
+                digits[digitCount++] = '0' + magnitude % 10;                        // Take lowest digit.
+                magnitude /= 10;                                                    // Move to next digit.
+            } while (magnitude > 0);
+            while (digitCount > 0) {                                                // Loop through digits, most significant first.
+                text[length++] = digits[--digitCount];                              // Write digit.
+            }
+            text[length++] = ' ';                                                   // Space seperate values.
+        }
+        text[length++] = '\r';                                                      // Add terminating characters to message.
+        text[length++] = '\n';                                                      // Add terminating characters to message.
+        text[length] = '\0';                                                        // Terminate string.
+        return length;                                                              // Return text length.
+    }
+};
+
+
+/**
+ *  A cipher built from a chaining, an exponentiation and a wire encoding policy.
+ *  Every call is resolved when the template is instantiated, so each combination compiles to one loop with nothing dispatched at run time.
+ *  Ranges starting after the first symbol are only valid for chaining that depends on the index alone, such as CtrChain.
+ */
+template <class Chain, class Power, class Encoding>
+struct CipherPipeline {
+
+    static void encryptValues(const char *plain, long *values, long first, long last, long exponent, long n, long nOnce, long long counter = 0) {  // Chains and raises the symbols from first to last.
+        Chain chain(nOnce, counter);                                                // Chaining state.
+        Power power(exponent, n);                                                   // Key state.
+        for (long i = first; i < last; i++) {                                       // Loop through symbols.
+            values[i] = power.raise(chain.chain(plain[i], i));                      // Chain then raise.
+        }
+    }
+
+    static int encrypt(char *text, int length, long exponent, long n, long nOnce, long long counter = 0) {   // Encrypts a message in place as its wire text, returns the text length.
+        long values[BUFFER_SIZE];                                                   // The encrypted values.
+        encryptValues(text, values, 0, length, exponent, n, nOnce, counter);        // Encrypt.
+        return Encoding::encode(values, length, text);                              // Write wire text over the message.
+    }
+
+    static void raiseValues(const long *values, long *raised, long count, long exponent, long n) {  // Raises every value, the RSA pass of decryption.
+        Power power(exponent, n);                                                   // Key state.
+        for (long i = 0; i < count; i++) {                                          // Loop through values.
+            raised[i] = power.raise(values[i]);                                     // Raise.
+        }
+    }
+
+    static void unchainValues(const long *raised, char *plain, long count, long nOnce, long long counter = 0) {  // Recovers every symbol from raised values, the chaining pass of decryption.
+        Chain chain(nOnce, counter);                                                // Chaining state.
+        for (long i = 0; i < count; i++) {                                          // Loop through values.
+            plain[i] = chain.unchain(raised[i], i);                                 // Unchain.
+        }
+    }
+
+    static void decryptValues(const long *values, char *plain, long first, long last, long exponent, long n, long nOnce, long long counter = 0) {  // Raises and unchains the values from first to last in one pass.
+        Chain chain(nOnce, counter);                                                // Chaining state.
+        Power power(exponent, n);                                                   // Key state.
+        for (long i = first; i < last; i++) {                                       // Loop through values.
+            plain[i] = chain.unchain(power.raise(values[i]), i);                    // Raise then unchain.
+        }
+    }
+};
+
+typedef CipherPipeline<CbcChain, TablePower, DecimalEncoding> CbcPipeline;          // Messages chained with CBC.
+typedef CipherPipeline<CtrChain, TablePower, DecimalEncoding> CtrPipeline;          // Messages chained in counter mode.
+typedef CipherPipeline<NoChain, TablePower, DecimalEncoding>  CaPipeline;           // The certificate authority's messages.
+
+#endif
@@ -0,0 +1,115 @@
+#define _WIN32_WINNT 0x501
+#include <windows.h>
+#include <string.h>
+#include "rsatable.h"
+
+struct RsaTableRange {                                                              // The part of a table one thread fills.
+    RsaTable *table;                                                                // The table.
+    long      first;                                                                // First x filled.
+    long      last;                                                                 // One past the last x filled.
+};
+
+static CRITICAL_SECTION    buildLock;                                               // Lets one thread build at a time, so a table is never built twice.
+static bool                ready = false;                                           // True once the registry is prepared, keys are computed until then.
+static RsaTable *volatile  tables[RSA_TABLE_MAX_TABLES];                            // Every published table, filled in order.
+static volatile LONG       tableCount = 0;                                          // Number of tables published.
+
+static DWORD WINAPI        fillRsaTable(LPVOID parameter);                          // Fills part of a table.
+
+
+/**
+ *  Prepares the table registry, call once before any thread loads a key.
+ *  Returns error code.
+ */
+int initRsaTables() {
+
+    if (ready) {                                                                    // If already prepared.
+        return 0;                                                                   // Nothing to do.
+    }
+    InitializeCriticalSection(&buildLock);                                          // Prepare lock.
+    ready = true;                                                                   // Build tables from now on.
+    return 0;                                                                       // Return no error.
+}
+
+
+/**
+ *  Builds the table for a key if its modulus is small enough, otherwise the key keeps being computed.
+ *  The table is filled by the given number of threads before it is published, after that it is only read, so sessions on any thread share it without locking.
+ *  Returns the table, or NULL if the key is computed.
+ */
+const long *loadRsaTable(long exponent, long n, int threads) {
+
+    if (!ready || n <= 0 || n > RSA_TABLE_MAX_MODULUS) {                            // If not building tables or modulus too large.
+        return NULL;                                                                // Compute the key.
+    }
+    const long *values = rsaTable(exponent, n);                                     // The table, if already built.
+    if (values != NULL) {                                                           // If already built.
+        return values;                                                              // Return table.
+    }
+    EnterCriticalSection(&buildLock);                                               // Lock registry.
+    values = rsaTable(exponent, n);                                                 // Another thread may have built it while waiting.
+    if (values == NULL && tableCount < RSA_TABLE_MAX_TABLES) {                      // If not built and there is room.
+        RsaTable *table = new RsaTable;                                             // The table, kept for the life of the process.
+        table->exponent = exponent;                                                 // Store key.
+        table->n = n;                                                               // Store key.
+        table->values = new long[n];                                                // Room for every x below n.
+        threads = threads < 1 ? 1 : threads;                                        // At least one thread fills it.
+        RsaTableRange *ranges = new RsaTableRange[threads];                         // The part each thread fills.
+        HANDLE *handles = new HANDLE[threads];                                      // The filling threads.
+        for (int t = 0; t < threads; t++) {                                         // Loop through threads.
+            ranges[t].table = table;                                                // Share table.
+            ranges[t].first = n * t / threads;                                      // Split x evenly.
+            ranges[t].last = n * (t + 1) / threads;                                 // Split x evenly.
+            handles[t] = t == 0 ? NULL : CreateThread(NULL, 0, fillRsaTable, &ranges[t], 0, NULL);   // Start the other threads.
+            if (t > 0 && handles[t] == NULL) {                                      // If a thread could not be started.
+                fillRsaTable(&ranges[t]);                                           // Fill its part here.
+            }
+        }
+        fillRsaTable(&ranges[0]);                                                   // Fill the first part on this thread.
+        for (int t = 1; t < threads; t++) {                                         // Loop through the other threads.
+            if (handles[t] != NULL) {                                               // If it was started.
+                WaitForSingleObject(handles[t], INFINITE);                          // Wait for its part.
+                CloseHandle(handles[t]);                                            // Free thread.
+            }
+        }
+        delete[] handles;                                                           // Free memory.
+        delete[] ranges;                                                            // Free memory.
+        InterlockedExchangePointer((void *volatile *)&tables[tableCount], table);   // Publish the finished table.
+        InterlockedIncrement(&tableCount);                                          // Let readers see it.
+        values = table->values;                                                     // Return the new table.
+    }
+    LeaveCriticalSection(&buildLock);                                               // Unlock registry.
+    return values;                                                                  // Return table, NULL if the registry is full.
+}
+
+
+/**
+ *  Finds the table for a key, called once per message by the kernels.
+ *  Returns the table, or NULL if the key has none.
+ */
+const long *rsaTable(long exponent, long n) {
+
+    LONG count = tableCount;                                                        // Number of tables published.
+    for (LONG i = 0; i < count; i++) {                                              // Loop through tables.
+        RsaTable *table = tables[i];                                                // The table.
+        if (table->exponent == exponent && table->n == n) {                         // If it is the key's.
+            return table->values;                                                   // Return table.
+        }
+    }
+    return NULL;                                                                    // No table.
+}
+
+
+/**
+ *  Fills part of a table.
+ *  Returns 0.
+ */
+static DWORD WINAPI fillRsaTable(LPVOID parameter) {
+
+    RsaTableRange *range = (RsaTableRange *)parameter;                              // The part to fill.
+    RsaTable *table = range->table;                                                 // The table.
+    for (long x = range->first; x < range->last; x++) {                             // Loop through x.
+        table->values[x] = repeatsquare(x, table->exponent, table->n);              // Compute once.
+    }
+    return 0;                                                                       // Return no error.
+}
@@ -0,0 +1,40 @@
+#ifndef RSATABLE_H
+#define RSATABLE_H
+
+#include "cipher.h"
+
+#ifndef RSA_TABLE_MAX_MODULUS
+#define RSA_TABLE_MAX_MODULUS 65536                                                 // Largest modulus given a lookup table, build with -DRSA_TABLE_MAX_MODULUS=0 to always compute.
+#endif
+#define RSA_TABLE_MAX_TABLES 16                                                     // Maximum number of tables kept, keys loaded after that are computed.
+#define RSA_TABLE_THREADS 4                                                         // Number of threads that fill a table.
+
+
+/**
+ *  Structures.
+ */
+struct RsaTable {                                                                   // repeatsquare(x, exponent, n) for every x below n, read only once published.
+    long  exponent;                                                                 // The key's e or d.
+    long  n;                                                                        // The key's modulus, the number of values.
+    long *values;                                                                   // The result for each x.
+};
+
+
+/**
+ *  Function declarations.
+ */
+int         initRsaTables();                                                        // Prepares the table registry, call once before any thread loads a key.
+const long *loadRsaTable(long exponent, long n, int threads);                       // Builds the table for a key if its modulus is small enough.
+const long *rsaTable(long exponent, long n);                                        // Finds the table for a key.
+
+
+/**
+ *  Raises x to a key's exponent, with one load from table when x is in it.
+ *  Returns encrypted long value.
+ */
+inline long rsaLookup(const long *table, long x, long exponent, long n) {
+
+    return (table != NULL && x >= 0 && x < n) ? table[x] : repeatsquare(x, exponent, n);
+}
+
+#endif
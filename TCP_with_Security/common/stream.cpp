@@ -0,0 +1,40 @@
+#include <stdio.h>
+#include "stream.h"
+#include "copycount.h"
+
+
+/**
+ *  Writes the "S<id> " header that starts every frame of a multiplexed connection.
+ *  Returns header length.
+ */
+int writeStreamHeader(char *buffer, int stream) {
+
+    return sprintf(buffer, "S%d ", stream);                                         // Write header.
+}
+
+
+/**
+ *  Reads the stream header from the start of a frame.
+ *  Encrypted values and replies never start with 'S', so a frame without a header is never mistaken for one.
+ *  Returns header length, 0 if the frame has no valid header.
+ */
+int parseStreamHeader(const char *frame, int frameLength, int &stream) {
+
+    if (frameLength < 3 || frame[0] != 'S') {                                       // If too short or not a stream frame.
+        return 0;                                                                   // No header.
+    }
+    int id = 0;                                                                     // The stream ID.
+    int i = 1;                                                                      // Index of frame.
+    while (i < frameLength && frame[i] >= '0' && frame[i] <= '9') {                 // Loop through digits.
+        id = id * 10 + (frame[i] - '0');                                            // Add digit.
+        if (id >= MUX_MAX_STREAMS) {                                                // If out of range.
+            return 0;                                                               // No valid header.
+        }
+        i++;                                                                        // Next character.
+    }
+    if (i == 1 || i == frameLength || frame[i] != ' ') {                            // If no digits or not followed by a space.
+        return 0;                                                                   // No valid header.
+    }
+    stream = id;                                                                    // Store stream ID.
+    return i + 1;                                                                   // Return header length, including the space.
+}
@@ -0,0 +1,15 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#define MUX_MAX_STREAMS 256                                                         // Number of stream IDs, 0 to MUX_MAX_STREAMS - 1, a connection may use.
+#define MUX_STREAM_CREDITS 4                                                        // Messages one stream may have waiting for replies, advertised by the server.
+#define MUX_CONNECTION_CREDITS 16                                                   // Messages all streams of a connection may have waiting for replies, advertised by the server.
+
+
+/**
+ *  Function declarations.
+ */
+int writeStreamHeader(char *buffer, int stream);                                    // Writes the "S<id> " header that starts every frame of a multiplexed connection.
+int parseStreamHeader(const char *frame, int frameLength, int &stream);             // Reads the stream header from the start of a frame.
+
+#endif
@@ -0,0 +1,125 @@
+#define _WIN32_WINNT 0x501
+#include <windows.h>
+#include <string.h>
+#include "threadpool.h"
+
+static DWORD WINAPI runWorker(LPVOID parameter);                                    // Works on each job until the pool is destroyed.
+static void         runChunks(ThreadPool *pool);                                    // Claims and runs chunks until none are left.
+
+
+/**
+ *  Starts a pool of worker threads.
+ *  A pool of 0 threads is valid, its jobs run entirely on the caller.
+ *  Returns the pool.
+ */
+ThreadPool *createThreadPool(int threads) {
+
+    ThreadPool *pool = new ThreadPool;                                              // The pool.
+    memset(pool, 0, sizeof(ThreadPool));                                            // Ensure blank.
+    pool->threadCount = threads > 0 ? threads : 0;                                  // Number of workers.
+    pool->threads = new HANDLE[pool->threadCount + 1];                              // Room for every worker.
+    pool->workSemaphore = CreateSemaphore(NULL, 0, pool->threadCount + 1, NULL);    // Workers wait here between jobs.
+    pool->doneEvent = CreateEvent(NULL, FALSE, FALSE, NULL);                        // Auto reset event, set once per job.
+    InitializeCriticalSection(&pool->jobLock);                                      // Prepare lock.
+    for (int i = 0; i < pool->threadCount; i++) {                                   // Loop through workers.
+        pool->threads[i] = CreateThread(NULL, 0, runWorker, pool, 0, NULL);         // Start worker.
+        if (pool->threads[i] == NULL) {                                             // If it could not be started.
+            pool->threadCount = i;                                                  // Run with the workers started.
+            break;                                                                  // Start no more.
+        }
+    }
+    return pool;                                                                    // Return the pool.
+}
+
+
+/**
+ *  Stops the workers and frees the pool, waiting for any job to finish first.
+ */
+void destroyThreadPool(ThreadPool *pool) {
+
+    if (pool == NULL) {                                                             // If no pool.
+        return;                                                                     // Nothing to do.
+    }
+    EnterCriticalSection(&pool->jobLock);                                           // Wait for the running job.
+    InterlockedExchange(&pool->stopping, 1);                                        // Tell the workers to stop.
+    ReleaseSemaphore(pool->workSemaphore, pool->threadCount, NULL);                 // Wake every worker.
+    for (int i = 0; i < pool->threadCount; i++) {                                   // Loop through workers.
+        WaitForSingleObject(pool->threads[i], INFINITE);                            // Wait for worker to stop.
+        CloseHandle(pool->threads[i]);                                              // Free thread.
+    }
+    LeaveCriticalSection(&pool->jobLock);                                           // Unlock.
+    DeleteCriticalSection(&pool->jobLock);                                          // Free lock.
+    CloseHandle(pool->workSemaphore);                                               // Free semaphore.
+    CloseHandle(pool->doneEvent);                                                   // Free event.
+    delete[] pool->threads;                                                         // Free memory.
+    delete pool;                                                                    // Free memory.
+}
+
+
+/**
+ *  Runs every chunk of a job and waits for them to finish, the caller works on chunks too.
+ *  Every worker checks in before the job returns, so no worker can still be looking at this job when the next one starts.
+ */
+void runParallel(ThreadPool *pool, ParallelTask task, void *context, int chunks) {
+
+    if (pool == NULL || pool->threadCount == 0 || chunks <= 1) {                    // If there is nothing to share.
+        for (int i = 0; i < chunks; i++) {                                          // Loop through chunks.
+            task(context, i);                                                       // Run chunk here.
+        }
+        return;                                                                     // Done.
+    }
+    EnterCriticalSection(&pool->jobLock);                                           // One job at a time.
+    pool->task = task;                                                              // Store job.
+    pool->context = context;                                                        // Store job.
+    pool->chunkCount = chunks;                                                      // Store job.
+    pool->workersLeft = pool->threadCount;                                          // Every worker checks in.
+    InterlockedExchange(&pool->nextChunk, 0);                                       // Publish the job, chunks may now be claimed.
+    ReleaseSemaphore(pool->workSemaphore, pool->threadCount, NULL);                 // Wake every worker.
+    runChunks(pool);                                                                // Work on the job here too.
+    WaitForSingleObject(pool->doneEvent, INFINITE);                                 // Wait for the workers.
+    LeaveCriticalSection(&pool->jobLock);                                           // Let the next job run.
+}
+
+
+/**
+ *  Gets the number of processors.
+ *  Returns the number, at least 1.
+ */
+int processorCount() {
+
+    SYSTEM_INFO info;                                                               // System information.
+    GetSystemInfo(&info);                                                           // Get information.
+    return info.dwNumberOfProcessors > 0 ? (int)info.dwNumberOfProcessors : 1;      // Return processors.
+}
+
+
+/**
+ *  Works on each job until the pool is destroyed.
+ *  Returns 0.
+ */
+static DWORD WINAPI runWorker(LPVOID parameter) {
+
+    ThreadPool *pool = (ThreadPool *)parameter;                                     // The pool.
+    while (1) {                                                                     // Until the pool is destroyed.
+        WaitForSingleObject(pool->workSemaphore, INFINITE);                         // Wait for a job.
+        if (pool->stopping) {                                                       // If the pool is being destroyed.
+            return 0;                                                               // Stop.
+        }
+        runChunks(pool);                                                            // Work on the job.
+        if (InterlockedDecrement(&pool->workersLeft) == 0) {                        // If the last worker to finish.
+            SetEvent(pool->doneEvent);                                              // Tell the caller.
+        }
+    }
+}
+
+
+/**
+ *  Claims and runs chunks until none are left.
+ */
+static void runChunks(ThreadPool *pool) {
+
+    LONG chunk;                                                                     // The claimed chunk.
+    while ((chunk = InterlockedIncrement(&pool->nextChunk) - 1) < pool->chunkCount) {   // While chunks are left.
+        pool->task(pool->context, chunk);                                           // Run chunk.
+    }
+}
@@ -0,0 +1,35 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <windows.h>
+
+
+/**
+ *  Structures.
+ */
+typedef void (*ParallelTask)(void *context, int chunk);                             // Processes one chunk of a job.
+
+struct ThreadPool {                                                                 // Worker threads that split a job into chunks, one job at a time.
+    int              threadCount;                                                   // Number of worker threads, the caller of runParallel() also works.
+    HANDLE          *threads;                                                       // The worker threads.
+    HANDLE           workSemaphore;                                                 // Released once per worker for each job.
+    HANDLE           doneEvent;                                                     // Set when the last worker has finished a job.
+    CRITICAL_SECTION jobLock;                                                       // Lets one caller run a job at a time.
+    ParallelTask     task;                                                          // The job's chunk function.
+    void            *context;                                                       // The job's data.
+    volatile LONG    chunkCount;                                                    // Number of chunks in the job.
+    volatile LONG    nextChunk;                                                     // The next chunk to be claimed.
+    volatile LONG    workersLeft;                                                   // Number of workers yet to finish the job.
+    volatile LONG    stopping;                                                      // 1 once the pool is being destroyed.
+};
+
+
+/**
+ *  Function declarations.
+ */
+ThreadPool *createThreadPool(int threads);                                          // Starts a pool of worker threads.
+void        destroyThreadPool(ThreadPool *pool);                                    // Stops the workers and frees the pool.
+void        runParallel(ThreadPool *pool, ParallelTask task, void *context, int chunks);    // Runs every chunk of a job and waits for them to finish.
+int         processorCount();                                                       // Gets the number of processors.
+
+#endif
@@ -0,0 +1,154 @@
+#define _WIN32_WINNT 0x501
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#include "trace.h"
+
+static TraceEvent   *events = NULL;                                                 // The recorded spans, NULL while not tracing.
+static volatile LONG eventCount = 0;                                                // Number of spans claimed, may pass TRACE_MAX_EVENTS once full.
+static volatile LONG written = 0;                                                   // 1 once the trace file has been written.
+static volatile LONG sampleCount = 0;                                               // Number of clients considered for tracing.
+static int           sampleInterval = 1;                                            // One client in this many is traced.
+static const char   *tracePath = NULL;                                              // The trace file.
+static double        ticksPerMicrosecond = 1;                                       // Timestamp counter frequency.
+static unsigned long long firstTick = 0;                                            // Timestamp counter when tracing started, trace times are relative to it.
+
+static BOOL WINAPI   writeTraceOnExit(DWORD controlType);                           // Writes the trace file when the console is closed or interrupted.
+static void          writeTraceAtExit();                                            // Writes the trace file when the program ends.
+
+
+/**
+ *  Calibrates the timestamp counter and starts recording spans.
+ *  The counter is compared with QueryPerformanceCounter once, after that a span costs two counter reads and an interlocked increment.
+ *  Returns error code.
+ */
+int startTracing(const char *path, int sampleEvery) {
+
+    events = new TraceEvent[TRACE_MAX_EVENTS];                                      // Room for every span.
+    memset(events, 0, sizeof(TraceEvent) * TRACE_MAX_EVENTS);                       // Ensure blank.
+    tracePath = path;                                                               // Remember the trace file.
+    sampleInterval = sampleEvery > 0 ? sampleEvery : 1;                             // Trace at least every client.
+    LARGE_INTEGER frequency, counterStart, counterEnd;                              // High resolution counter readings.
+    QueryPerformanceFrequency(&frequency);                                          // Get frequency.
+    QueryPerformanceCounter(&counterStart);                                         // Start calibration.
+    unsigned long long tickStart = __rdtsc();                                       // Start calibration.
+    Sleep(TRACE_CALIBRATION_MS);                                                    // Let both counters run.
+    QueryPerformanceCounter(&counterEnd);                                           // End calibration.
+    unsigned long long tickEnd = __rdtsc();                                         // End calibration.
+    double microseconds = (counterEnd.QuadPart - counterStart.QuadPart) * 1000000.0 / frequency.QuadPart;  // Time calibration took.
+    ticksPerMicrosecond = (tickEnd - tickStart) / microseconds;                     // Store frequency.
+    firstTick = tickEnd;                                                            // Trace times start here.
+    SetConsoleCtrlHandler(writeTraceOnExit, TRUE);                                  // Write the trace file if the server is stopped with Ctrl+C.
+    atexit(writeTraceAtExit);                                                       // Write the trace file if the server exits.
+    return 0;                                                                       // Return no error.
+}
+
+
+/**
+ *  Decides whether a new client is traced.
+ *  Returns true for one client in every sampleEvery, false for all clients while not tracing.
+ */
+int traceSample() {
+
+    if (events == NULL || eventCount >= TRACE_MAX_EVENTS) {                         // If not tracing or full.
+        return 0;                                                                   // Do not trace.
+    }
+    return (InterlockedIncrement(&sampleCount) - 1) % sampleInterval == 0;          // Trace every sampleEvery'th client.
+}
+
+
+/**
+ *  Reads the timestamp counter.
+ *  Returns counter ticks.
+ */
+unsigned long long traceClock() {
+
+    return __rdtsc();                                                               // Read counter.
+}
+
+
+/**
+ *  Records a span.
+ *  Threads claim slots with an interlocked increment, so there is no lock, the thread that fills the last slot writes the trace file.
+ */
+void traceSpan(const char *name, const char *category, int session, unsigned long long start, unsigned long long end) {
+
+    if (events == NULL) {                                                           // If not tracing.
+        return;                                                                     // Nothing to do.
+    }
+    LONG slot = InterlockedIncrement(&eventCount) - 1;                              // Claim a slot.
+    if (slot >= TRACE_MAX_EVENTS) {                                                 // If full.
+        return;                                                                     // Drop span.
+    }
+    TraceEvent *event = &events[slot];                                              // The claimed slot.
+    event->name = name;                                                             // Store span.
+    event->category = category;                                                     // Store span.
+    event->session = session;                                                       // Store span.
+    event->start = start;                                                           // Store span.
+    MemoryBarrier();                                                                // Fill in the span before marking it filled in.
+    event->end = end > start ? end : start + 1;                                     // Store span, marking it filled in.
+    if (slot == TRACE_MAX_EVENTS - 1) {                                             // If this was the last slot.
+        writeTrace();                                                               // Write the trace file.
+    }
+}
+
+
+/**
+ *  Writes every recorded span as Chrome trace event JSON, loadable in chrome://tracing or Perfetto.
+ *  Only the first call writes the file.
+ *  Returns error code.
+ */
+int writeTrace() {
+
+    if (events == NULL || InterlockedExchange(&written, 1) == 1) {                  // If not tracing or already written.
+        return 0;                                                                   // Nothing to do.
+    }
+    FILE *file = fopen(tracePath, "w");                                             // Open trace file.
+    if (file == NULL) {                                                             // If file could not be opened.
+        fprintf(stderr, "Could not write trace file %s\n", tracePath);              // Alert user.
+        return 1;                                                                   // Return error code.
+    }
+    LONG count = eventCount < TRACE_MAX_EVENTS ? eventCount : TRACE_MAX_EVENTS;     // Number of slots claimed.
+    fprintf(file, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+    bool first = true;                                                              // True until a span is written.
+    for (LONG i = 0; i < count; i++) {                                              // Loop through spans.
+        TraceEvent *event = &events[i];                                             // The span.
+        if (event->end == 0) {                                                      // If claimed but not yet filled in.
+            continue;                                                               // Skip span.
+        }
+        fprintf(file, "%s{\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f}",
+                first ? "" : ",\n", event->name, event->category, event->session,
+                (double)(long long)(event->start - firstTick) / ticksPerMicrosecond, (event->end - event->start) / ticksPerMicrosecond);
+        first = false;                                                              // A span has been written.
+    }
+    fprintf(file, "\n]}\n");
+    fclose(file);                                                                   // Close trace file.
+    fprintf(stderr, "Trace of %ld spans written to %s\n", (long)count, tracePath);  // Alert user.
+    return 0;                                                                       // Return no error.
+}
+
+
+/**
+ *  Writes the trace file when the console is closed or interrupted.
+ *  Returns FALSE so the default handler still ends the program.
+ */
+static BOOL WINAPI writeTraceOnExit(DWORD controlType) {
+
+    writeTrace();                                                                   // Write the trace file.
+    return FALSE;                                                                   // Let the program end.
+}
+
+
+/**
+ *  Writes the trace file when the program ends.
+ */
+static void writeTraceAtExit() {
+
+    writeTrace();                                                                   // Write the trace file.
+}
@@ -0,0 +1,29 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#define TRACE_MAX_EVENTS 65536                                                      // Number of spans held before the trace file is written and tracing stops.
+#define TRACE_CALIBRATION_MS 50                                                     // Time spent measuring the timestamp counter's frequency.
+
+
+/**
+ *  Structures.
+ */
+struct TraceEvent {                                                                 // One timed span.
+    const char        *name;                                                        // What was timed, a string literal.
+    const char        *category;                                                    // "handshake" or "message".
+    int                session;                                                     // The traced client, shown as a thread in the trace viewer.
+    unsigned long long start;                                                       // Timestamp counter when the span started.
+    unsigned long long end;                                                         // Timestamp counter when the span ended, 0 until the span is filled in.
+};
+
+
+/**
+ *  Function declarations.
+ */
+int                startTracing(const char *path, int sampleEvery);                 // Calibrates the timestamp counter and starts recording spans.
+int                traceSample();                                                   // Decides whether a new client is traced.
+unsigned long long traceClock();                                                    // Reads the timestamp counter.
+void               traceSpan(const char *name, const char *category, int session, unsigned long long start, unsigned long long end);   // Records a span.
+int                writeTrace();                                                    // Writes every recorded span as Chrome trace event JSON.
+
+#endif
@@ -0,0 +1,596 @@
+#define _WIN32_WINNT 0x501
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <windows.h>
+#include <afunix.h>
+#include <stdio.h>
+#include <string.h>
+#include "transport.h"
+#include "threadpool.h"
+#include "log.h"
+#include "copycount.h"
+
+using namespace std;
+
+static CRITICAL_SECTION stripeLocks[SHM_TABLE_STRIPES];                             // Guards each stripe's list.
+static SharedChannel   *stripes[SHM_TABLE_STRIPES];                                 // Registered channels, by socket.
+static volatile LONG    registeredCount = 0;                                        // Number of registered channels, sockets go straight to winsock while 0.
+static volatile LONG    regionCounter = 0;                                          // Numbers the regions this process creates.
+static volatile LONG    loopbackCounter = 0;                                        // Numbers the loopback pairs this process creates.
+static int              spinCount = 0;                                              // Times a blocking side polls before sleeping, 0 on one processor where the peer cannot run meanwhile.
+
+static int            ringRead(SharedRing *ring, char *buffer, int length);         // Takes bytes from a ring.
+static int            ringWrite(SharedRing *ring, const char *buffer, int length);  // Adds bytes to a ring.
+static unsigned long  ringUsed(SharedRing *ring);                                   // Gets the number of unread bytes in a ring.
+static void           wakePeer(SharedChannel *channel);                             // Rings the doorbell if the other side is sleeping.
+static int            sleepOnSocket(SharedChannel *channel);                        // Waits for, or drains, doorbell bytes.
+static int            sleepOnDoorbell(SharedChannel *channel);                      // Waits for, or checks, a loopback end's doorbell event.
+static SharedChannel *findSharedChannel(SOCKET s, bool remove);                     // Finds the channel registered for a socket.
+
+
+/**
+ *  Prepares the socket to channel table, call once before any thread connects.
+ *  Returns error code.
+ */
+int initTransport() {
+
+    for (int i = 0; i < SHM_TABLE_STRIPES; i++) {                                   // Loop through stripes.
+        InitializeCriticalSection(&stripeLocks[i]);                                 // Prepare lock.
+        stripes[i] = NULL;                                                          // No channels.
+    }
+    spinCount = processorCount() > 1 ? SHM_SPIN_COUNT : 0;                          // Spin only if the peer can run meanwhile.
+    return 0;                                                                       // Return no error.
+}
+
+
+/**
+ *  Checks whether a server address names an AF_UNIX socket, "unix:" followed by its path.
+ *  Returns true if it does.
+ */
+bool isUnixAddress(const char *host) {
+
+    return host != NULL && strncmp(host, UNIX_ADDRESS_PREFIX, strlen(UNIX_ADDRESS_PREFIX)) == 0;
+}
+
+
+/**
+ *  Connects to a server's AF_UNIX socket, a blocking socket like the client's TCP one.
+ *  Returns error code.
+ */
+int connectUnixSocket(SOCKET &s, const char *path) {
+
+    if (strlen(path) >= UNIX_PATH_SIZE) {                                           // If the path does not fit.
+        LOG(LOG_ERROR) << "AF_UNIX path too long: " << path << endl;                // Alert user.
+        return 4;                                                                   // Return error code.
+    }
+    s = socket(AF_UNIX, SOCK_STREAM, 0);                                            // Create socket.
+    if (s == INVALID_SOCKET) {                                                      // If not created.
+        LOG(LOG_ERROR) << "Error at socket(): " << WSAGetLastError() << endl;       // Alert user.
+        return 4;                                                                   // Return error code.
+    }
+    struct sockaddr_un address;                                                     // The server's address.
+    memset(&address, 0, sizeof(address));                                           // Ensure blank.
+    address.sun_family = AF_UNIX;                                                   // Use AF_UNIX.
+    strcpy(address.sun_path, path);                                                 // The socket's path.
+    if (connect(s, (struct sockaddr *)&address, sizeof(address)) == SOCKET_ERROR) { // If not connected.
+        LOG(LOG_ERROR) << "connect failed to " << path << ", error " << WSAGetLastError() << endl;  // Alert user.
+        closesocket(s);                                                             // Close socket.
+        s = INVALID_SOCKET;                                                         // No socket.
+        return 6;                                                                   // Return error code.
+    }
+    LOG(LOG_INFO) << "\nConnected to " << UNIX_ADDRESS_PREFIX << path << endl;      // Alert user.
+    return 0;                                                                       // Return no error.
+}
+
+
+/**
+ *  Listens on an AF_UNIX socket, replacing a file left by a server that did not remove it.
+ *  Returns error code.
+ */
+int listenUnixSocket(SOCKET &s, const char *path) {
+
+    if (strlen(path) >= UNIX_PATH_SIZE) {                                           // If the path does not fit.
+        LOG(LOG_ERROR) << "AF_UNIX path too long: " << path << endl;                // Alert user.
+        return 1;                                                                   // Return error code.
+    }
+    s = socket(AF_UNIX, SOCK_STREAM, 0);                                            // Create socket.
+    if (s == INVALID_SOCKET) {                                                      // If not created.
+        LOG(LOG_ERROR) << "Error at socket(): " << WSAGetLastError() << endl;       // Alert user.
+        return 2;                                                                   // Return error code.
+    }
+    struct sockaddr_un address;                                                     // The socket's address.
+    memset(&address, 0, sizeof(address));                                           // Ensure blank.
+    address.sun_family = AF_UNIX;                                                   // Use AF_UNIX.
+    strcpy(address.sun_path, path);                                                 // The socket's path.
+    DeleteFile(path);                                                               // Remove a stale socket file, bind() fails if it exists.
+    if (bind(s, (struct sockaddr *)&address, sizeof(address)) == SOCKET_ERROR
+        || listen(s, SOMAXCONN) == SOCKET_ERROR) {                                  // If not bound or not listening.
+        LOG(LOG_ERROR) << "Could not listen on " << path << ", error " << WSAGetLastError() << endl;    // Alert user.
+        closesocket(s);                                                             // Close socket.
+        s = INVALID_SOCKET;                                                         // No socket.
+        return 3;                                                                   // Return error code.
+    }
+    u_long nonBlocking = 1;                                                         // Enables non-blocking mode.
+    ioctlsocket(s, FIONBIO, &nonBlocking);                                          // Never block in accept(), the event loop waits in select().
+    return 0;                                                                       // Return no error.
+}
+
+
+/**
+ *  Checks whether the other end of a connection is on this host, over AF_UNIX or a loopback address.
+ *  Returns true if it is.
+ */
+bool isLocalPeer(SOCKET s) {
+
+    struct sockaddr_storage address;                                                // The peer's address.
+    int addressLength = sizeof(address);                                            // Size of address.
+    if (getpeername(s, (struct sockaddr *)&address, &addressLength) == SOCKET_ERROR) {  // If not found.
+        return false;                                                               // Assume remote.
+    }
+    if (address.ss_family == AF_UNIX) {                                             // If AF_UNIX.
+        return true;                                                                // Always local.
+    } else if (address.ss_family == AF_INET) {                                      // Else if IPv4.
+        return (ntohl(((struct sockaddr_in *)&address)->sin_addr.s_addr) >> 24) == 127;    // Local if 127.x.x.x.
+    } else if (address.ss_family == AF_INET6) {                                     // Else if IPv6.
+        return IN6_IS_ADDR_LOOPBACK(&((struct sockaddr_in6 *)&address)->sin6_addr) != 0;    // Local if ::1.
+    }
+    return false;                                                                   // Assume remote.
+}
+
+
+/**
+ *  Creates a region for a new connection, named after this process so names never clash.
+ *  The region starts zeroed, both rings empty.
+ *  Returns error code.
+ */
+int createSharedRegion(char *name, HANDLE &mapping, SharedRegion *&region) {
+
+    sprintf(name, "%s%lu-%ld", SHM_NAME_PREFIX, (unsigned long)GetCurrentProcessId(), (long)InterlockedIncrement(&regionCounter));  // Name the region.
+    mapping = CreateFileMapping(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, sizeof(SharedRegion), name);   // Create it, backed by the paging file.
+    if (mapping == NULL) {                                                          // If not created.
+        LOG(LOG_ERROR) << "Shared memory could not be created, error " << GetLastError() << endl;   // Alert user.
+        return 1;                                                                   // Return error code.
+    }
+    region = (SharedRegion *)MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(SharedRegion));   // Map it.
+    if (region == NULL) {                                                           // If not mapped.
+        LOG(LOG_ERROR) << "Shared memory could not be mapped, error " << GetLastError() << endl;    // Alert user.
+        CloseHandle(mapping);                                                       // Free mapping.
+        return 2;                                                                   // Return error code.
+    }
+    return 0;                                                                       // Return no error.
+}
+
+
+/**
+ *  Opens a region a client created, only names made by createSharedRegion() are opened.
+ *  Fails if the client is not on this host, or not in the same Windows session, as the name is not found.
+ *  Returns error code.
+ */
+int openSharedRegion(const char *name, HANDLE &mapping, SharedRegion *&region) {
+
+    if (strlen(name) >= SHM_NAME_SIZE || strncmp(name, SHM_NAME_PREFIX, strlen(SHM_NAME_PREFIX)) != 0) {   // If not a region name.
+        return 1;                                                                   // Return error code.
+    }
+    mapping = OpenFileMapping(FILE_MAP_ALL_ACCESS, FALSE, name);                    // Open it.
+    if (mapping == NULL) {                                                          // If not found.
+        return 2;                                                                   // Return error code.
+    }
+    region = (SharedRegion *)MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(SharedRegion));   // Map it.
+    if (region == NULL) {                                                           // If not mapped, or smaller than a region.
+        CloseHandle(mapping);                                                       // Free mapping.
+        return 3;                                                                   // Return error code.
+    }
+    return 0;                                                                       // Return no error.
+}
+
+
+/**
+ *  Makes one side's channel over a mapped region, the channel owns the mapping from now on.
+ *  Returns the channel.
+ */
+SharedChannel *openSharedChannel(SOCKET s, HANDLE mapping, SharedRegion *region, SharedSide side, bool blocking) {
+
+    SharedChannel *channel = new SharedChannel;                                     // The channel.
+    channel->s = s;                                                                 // Doorbell socket.
+    channel->mapping = mapping;                                                     // Store mapping.
+    channel->region = region;                                                       // Store region.
+    channel->in = side == SHARED_CLIENT ? &region->toClient : &region->toServer;    // The ring this side reads.
+    channel->out = side == SHARED_CLIENT ? &region->toServer : &region->toClient;   // The ring this side writes.
+    channel->ownSleeping = &region->sleeping[side];                                 // This side's flag.
+    channel->peerSleeping = &region->sleeping[side == SHARED_CLIENT ? SHARED_SERVER : SHARED_CLIENT];  // The other side's flag.
+    channel->blocking = blocking;                                                   // Wait, or fail with WSAEWOULDBLOCK.
+    channel->loopback = NULL;                                                       // Between processes unless made by createLoopbackPair().
+    channel->side = side;                                                           // Store side.
+    channel->next = NULL;                                                           // Not registered.
+    if (s != INVALID_SOCKET) {                                                      // If there is a socket to ring.
+        BOOL noDelay = TRUE;                                                        // Disables Nagle's algorithm.
+        setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (char *)&noDelay, sizeof(noDelay)); // Send each doorbell byte at once, fails harmlessly on AF_UNIX.
+    }
+    return channel;                                                                 // Return the channel.
+}
+
+
+/**
+ *  Unmaps a channel's region and frees the channel, the region is freed once both sides have closed it.
+ *  A loopback end wakes the other end, which then reads the rest of its ring and sees the connection closed.
+ */
+void closeSharedChannel(SharedChannel *channel) {
+
+    LoopbackPair *pair = channel->loopback;                                         // The in-process pair, if any.
+    if (pair != NULL) {                                                             // If a loopback end.
+        InterlockedExchange(&pair->closed[channel->side], 1);                       // Close this end.
+        SetEvent(pair->doorbells[channel->side == SHARED_CLIENT ? SHARED_SERVER : SHARED_CLIENT]);  // Wake the other end if it sleeps.
+        if (InterlockedDecrement(&pair->references) == 0) {                         // If the other end was already closed.
+            CloseHandle(pair->doorbells[SHARED_CLIENT]);                            // Free event.
+            CloseHandle(pair->doorbells[SHARED_SERVER]);                            // Free event.
+            delete pair;                                                            // Free memory.
+        }
+        delete channel;                                                             // Free memory.
+        return;                                                                     // No mapping.
+    }
+    UnmapViewOfFile(channel->region);                                               // Unmap region.
+    CloseHandle(channel->mapping);                                                  // Free mapping.
+    delete channel;                                                                 // Free memory.
+}
+
+
+/**
+ *  Writes bytes to the channel's out ring, like send().
+ *  A blocking channel writes every byte, spinning and then sleeping on the socket while the ring is full.
+ *  A non-blocking channel writes what fits, and drains any doorbell bytes once full so select() only reports the socket again once rung.
+ *  Returns number of bytes written, SOCKET_ERROR if none could be, with WSAEWOULDBLOCK if the ring is full.
+ */
+int sharedSend(SharedChannel *channel, const char *buffer, int length) {
+
+    int sent = 0;                                                                   // Bytes written.
+    int spins = 0;                                                                  // Times the full ring was polled.
+    while (sent < length) {                                                         // Until every byte is written.
+        int bytes = ringWrite(channel->out, &buffer[sent], length - sent);          // Write what fits.
+        if (bytes < 0) {                                                            // If the peer corrupted the ring.
+            WSASetLastError(WSAECONNRESET);                                         // Treat as a reset connection.
+            return SOCKET_ERROR;                                                    // Return error.
+        }
+        if (bytes > 0) {                                                            // If some were written.
+            sent += bytes;                                                          // Count them.
+            wakePeer(channel);                                                      // Tell the reader.
+            spins = 0;                                                              // Poll afresh next time.
+            continue;                                                               // Write the rest.
+        }
+        if (channel->blocking && spins++ < spinCount) {                             // If a blocking channel has not polled for long.
+            YieldProcessor();                                                       // Let the reader catch up.
+            continue;                                                               // Poll again.
+        }
+        InterlockedExchange(channel->ownSleeping, 1);                               // Ask the reader to ring when it frees space.
+        if (ringUsed(channel->out) < SHM_RING_SIZE) {                               // If it freed space meanwhile.
+            InterlockedExchange(channel->ownSleeping, 0);                           // No need to ring.
+            continue;                                                               // Write again.
+        }
+        int rung = sleepOnSocket(channel);                                          // Wait for, or drain, the doorbell.
+        if (rung > 0) {                                                             // If rung.
+            spins = 0;                                                              // Poll afresh.
+            continue;                                                               // Write again.
+        }
+        if (!channel->blocking && sent > 0) {                                       // If the caller waits in select() and some were written.
+            return sent;                                                            // Return number written.
+        }
+        if (rung == 0) {                                                            // If the reader closed the connection.
+            WSASetLastError(WSAECONNRESET);                                         // Nothing more can be sent.
+        }
+        return SOCKET_ERROR;                                                        // Return error, with WSAEWOULDBLOCK if not rung.
+    }
+    return sent;                                                                    // Return number written.
+}
+
+
+/**
+ *  Reads bytes from the channel's in ring, like recv().
+ *  A blocking channel spins and then sleeps on the socket while the ring is empty.
+ *  A non-blocking channel drains any doorbell bytes instead, so select() only reports the socket again once rung.
+ *  Returns number of bytes read, 0 if the peer closed the connection, SOCKET_ERROR on error or with WSAEWOULDBLOCK if the ring is empty.
+ */
+int sharedRecv(SharedChannel *channel, char *buffer, int length) {
+
+    int spins = 0;                                                                  // Times the empty ring was polled.
+    while (1) {                                                                     // Until something is read.
+        int bytes = ringRead(channel->in, buffer, length);                          // Read what is there.
+        if (bytes < 0) {                                                            // If the peer corrupted the ring.
+            WSASetLastError(WSAECONNRESET);                                         // Treat as a reset connection.
+            return SOCKET_ERROR;                                                    // Return error.
+        }
+        if (bytes > 0) {                                                            // If some were read.
+            wakePeer(channel);                                                      // Tell a writer waiting for space.
+            return bytes;                                                           // Return number read.
+        }
+        if (channel->blocking && spins++ < spinCount) {                             // If a blocking channel has not polled for long.
+            YieldProcessor();                                                       // Let the writer catch up.
+            continue;                                                               // Poll again.
+        }
+        InterlockedExchange(channel->ownSleeping, 1);                               // Ask the writer to ring when it writes.
+        if (ringUsed(channel->in) > 0) {                                            // If it wrote meanwhile.
+            InterlockedExchange(channel->ownSleeping, 0);                           // No need to ring.
+            continue;                                                               // Read again.
+        }
+        int rung = sleepOnSocket(channel);                                          // Wait for, or drain, the doorbell.
+        if (rung <= 0) {                                                            // If closed, failed or nothing rung yet.
+            return rung;                                                            // Return 0 or SOCKET_ERROR, with WSAEWOULDBLOCK if not rung.
+        }
+        spins = 0;                                                                  // Poll afresh.
+    }
+}
+
+
+/**
+ *  Asks to be rung when the channel's in ring gets bytes, for a non-blocking reader about to wait in select().
+ *  The flag is set before the ring is checked, so bytes written after the check always ring.
+ *  Returns true if the ring already has bytes, so the reader should read instead of waiting.
+ */
+bool sharedWait(SharedChannel *channel) {
+
+    InterlockedExchange(channel->ownSleeping, 1);                                   // Ask the writer to ring when it writes.
+    if (ringUsed(channel->in) > 0) {                                                // If it wrote already.
+        InterlockedExchange(channel->ownSleeping, 0);                               // No need to ring.
+        return true;                                                                // Read now.
+    }
+    return false;                                                                   // Wait to be rung.
+}
+
+
+/**
+ *  Sends and receives on the channel's socket through the channel from now on.
+ */
+void registerSharedChannel(SharedChannel *channel) {
+
+    int stripe = (int)((channel->s / 4) % SHM_TABLE_STRIPES);                       // The socket's stripe, winsock numbers sockets in steps of 4.
+    EnterCriticalSection(&stripeLocks[stripe]);                                     // Lock stripe.
+    channel->next = stripes[stripe];                                                // Add to the front of the list.
+    stripes[stripe] = channel;                                                      // Add to the front of the list.
+    InterlockedIncrement(&registeredCount);                                         // Look channels up from now on.
+    LeaveCriticalSection(&stripeLocks[stripe]);                                     // Unlock stripe.
+}
+
+
+/**
+ *  Sends on a socket, through its registered channel if it has one, like a blocking send().
+ *  Returns number of bytes sent, SOCKET_ERROR on error.
+ */
+int transportSend(SOCKET s, const char *buffer, int length) {
+
+    SharedChannel *channel = registeredCount > 0 ? findSharedChannel(s, false) : NULL;  // The socket's channel, if any.
+    if (channel != NULL) {                                                          // If shared memory was agreed.
+        return sharedSend(channel, buffer, length);                                 // Write to the ring.
+    }
+    return send(s, buffer, length, 0);                                              // Send on the socket.
+}
+
+
+/**
+ *  Receives on a socket, through its registered channel if it has one, like a blocking recv().
+ *  Returns number of bytes received, 0 if the connection closed, SOCKET_ERROR on error.
+ */
+int transportRecv(SOCKET s, char *buffer, int length) {
+
+    SharedChannel *channel = registeredCount > 0 ? findSharedChannel(s, false) : NULL;  // The socket's channel, if any.
+    if (channel != NULL) {                                                          // If shared memory was agreed.
+        return sharedRecv(channel, buffer, length);                                 // Read from the ring.
+    }
+    return recv(s, buffer, length, 0);                                              // Receive on the socket.
+}
+
+
+/**
+ *  Checks an idle connection has not been closed by its peer, without sending anything, for a peer that never sends unasked.
+ *  A plain socket that is readable has been closed, has failed, or is out of step.
+ *  A socket carrying a channel may still hold a doorbell rung after the last read, so it is drained, and only a close or an error counts.
+ *  Returns true if the connection can be used.
+ */
+bool transportAlive(SOCKET s) {
+
+    SharedChannel *channel = registeredCount > 0 ? findSharedChannel(s, false) : NULL;  // The socket's channel, if any.
+    if (channel != NULL && channel->loopback != NULL) {                             // If a loopback end, which has no socket.
+        return true;                                                                // Its peer is in this process.
+    }
+    fd_set readSet;                                                                 // The socket.
+    FD_ZERO(&readSet);                                                              // Ensure blank.
+    FD_SET(s, &readSet);                                                            // Check the socket.
+    struct timeval noWait = { 0, 0 };                                               // Poll, do not wait.
+    int ready = select(0, &readSet, NULL, NULL, &noWait);                           // Check for bytes, a close or an error.
+    if (ready == 0) {                                                               // If nothing to read.
+        return true;                                                                // Alive.
+    }
+    if (ready == SOCKET_ERROR || channel == NULL) {                                 // If failed, or a plain socket with bytes the peer should not have sent.
+        return false;                                                               // Not usable.
+    }
+    char doorbells[64];                                                             // Doorbell bytes, discarded.
+    u_long nonBlocking = 1;                                                         // Enables non-blocking mode.
+    ioctlsocket(s, FIONBIO, &nonBlocking);                                          // Drain without waiting.
+    int drained = 0;                                                                // Result of the last recv().
+    while ((drained = recv(s, doorbells, sizeof(doorbells), 0)) > 0) {              // Until no doorbells are left.
+    }
+    bool alive = drained == SOCKET_ERROR && WSAGetLastError() == WSAEWOULDBLOCK;    // Alive if emptied, not closed or failed.
+    u_long mode = channel->blocking ? 0 : 1;                                        // The channel's own mode.
+    ioctlsocket(s, FIONBIO, &mode);                                                 // Restore it.
+    return alive;                                                                   // Return whether usable.
+}
+
+
+/**
+ *  Closes a socket, and closes its registered channel if it has one.
+ *  Returns the result of closesocket().
+ */
+int closeTransport(SOCKET s) {
+
+    SharedChannel *channel = registeredCount > 0 ? findSharedChannel(s, true) : NULL;   // Unregister the socket's channel, if any.
+    if (channel != NULL && channel->loopback != NULL) {                             // If a loopback end, which has no socket.
+        closeSharedChannel(channel);                                                // Close it.
+        return 0;                                                                   // Return no error.
+    }
+    if (channel != NULL) {                                                          // If shared memory was agreed.
+        closeSharedChannel(channel);                                                // Close it.
+    }
+    return closesocket(s);                                                          // Close the socket, waking the peer if it sleeps.
+}
+
+
+/**
+ *  Connects two ends inside this process, for benchmarks that run a client and a server session without the kernel.
+ *  The ends are rings on the heap, laid out as a shared-memory connection, with events in place of the doorbell socket.
+ *  Each end gets an id no winsock socket has and is registered under it, so transportSend(), transportRecv() and closeTransport() use it as they would a socket.
+ *  Both ends block like sockets, so a single thread must only read bytes already written.
+ *  Returns error code.
+ */
+int createLoopbackPair(SOCKET &clientEnd, SOCKET &serverEnd) {
+
+    LoopbackPair *pair = new LoopbackPair();                                        // The rings, zeroed.
+    pair->doorbells[SHARED_CLIENT] = CreateEvent(NULL, FALSE, FALSE, NULL);         // Auto reset event to wake the client end.
+    pair->doorbells[SHARED_SERVER] = CreateEvent(NULL, FALSE, FALSE, NULL);         // Auto reset event to wake the server end.
+    if (pair->doorbells[SHARED_CLIENT] == NULL || pair->doorbells[SHARED_SERVER] == NULL) {     // If an event could not be created.
+        LOG(LOG_ERROR) << "CreateEvent failed with error: " << GetLastError() << endl;  // Alert user.
+        if (pair->doorbells[SHARED_CLIENT] != NULL) {                               // If one was created.
+            CloseHandle(pair->doorbells[SHARED_CLIENT]);                            // Free event.
+        }
+        if (pair->doorbells[SHARED_SERVER] != NULL) {                               // If one was created.
+            CloseHandle(pair->doorbells[SHARED_SERVER]);                            // Free event.
+        }
+        delete pair;                                                                // Free memory.
+        return 1;                                                                   // Return error code.
+    }
+    pair->references = 2;                                                           // Both ends open.
+    LONG number = InterlockedIncrement(&loopbackCounter) - 1;                       // Number the pair.
+    clientEnd = (SOCKET)(LOOPBACK_SOCKET_BASE + (SOCKET)number * 8);                // The client end's id.
+    serverEnd = clientEnd + 4;                                                      // The server end's id, in the next stripe.
+    SharedChannel *client = openSharedChannel(INVALID_SOCKET, NULL, &pair->region, SHARED_CLIENT, true);    // The client end.
+    SharedChannel *server = openSharedChannel(INVALID_SOCKET, NULL, &pair->region, SHARED_SERVER, true);    // The server end.
+    client->s = clientEnd;                                                          // Register under its id.
+    server->s = serverEnd;                                                          // Register under its id.
+    client->loopback = pair;                                                        // Ring with events.
+    server->loopback = pair;                                                        // Ring with events.
+    registerSharedChannel(client);                                                  // Use through the socket functions.
+    registerSharedChannel(server);                                                  // Use through the socket functions.
+    return 0;                                                                       // Return no error.
+}
+
+
+/**
+ *  Takes up to length bytes from a ring.
+ *  The peer writes the indices, so they are checked before use and a ring claiming more than it holds is corrupt.
+ *  Returns number of bytes read, -1 if the ring is corrupt.
+ */
+static int ringRead(SharedRing *ring, char *buffer, int length) {
+
+    unsigned long head = (unsigned long)ring->head;                                 // Bytes read so far, only this side moves it.
+    unsigned long used = (unsigned long)ring->tail - head;                          // Bytes waiting.
+    if (used > SHM_RING_SIZE) {                                                     // If more than the ring holds.
+        return -1;                                                                  // Corrupt.
+    }
+    MemoryBarrier();                                                                // Read the bytes only after the tail that published them.
+    int count = used < (unsigned long)length ? (int)used : length;                  // Bytes to read.
+    int index = (int)(head & (SHM_RING_SIZE - 1));                                  // Index of the first.
+    int first = count < SHM_RING_SIZE - index ? count : SHM_RING_SIZE - index;      // Bytes before the ring wraps.
+    memcpy(buffer, &ring->data[index], first);                                      // Copy up to the wrap.
+    memcpy(&buffer[first], ring->data, count - first);                              // Copy the rest.
+    InterlockedExchange(&ring->head, (LONG)(head + count));                         // Free the space, after the copy.
+    return count;                                                                   // Return number read.
+}
+
+
+/**
+ *  Adds up to length bytes to a ring.
+ *  Returns number of bytes written, -1 if the ring is corrupt.
+ */
+static int ringWrite(SharedRing *ring, const char *buffer, int length) {
+
+    unsigned long tail = (unsigned long)ring->tail;                                 // Bytes written so far, only this side moves it.
+    unsigned long used = tail - (unsigned long)ring->head;                          // Bytes not yet read.
+    if (used > SHM_RING_SIZE) {                                                     // If more than the ring holds.
+        return -1;                                                                  // Corrupt.
+    }
+    int space = SHM_RING_SIZE - (int)used;                                          // Room left.
+    int count = space < length ? space : length;                                    // Bytes to write.
+    int index = (int)(tail & (SHM_RING_SIZE - 1));                                  // Index of the first.
+    int first = count < SHM_RING_SIZE - index ? count : SHM_RING_SIZE - index;      // Bytes before the ring wraps.
+    memcpy(&ring->data[index], buffer, first);                                      // Copy up to the wrap.
+    memcpy(ring->data, &buffer[first], count - first);                              // Copy the rest.
+    InterlockedExchange(&ring->tail, (LONG)(tail + count));                         // Publish the bytes, after the copy.
+    return count;                                                                   // Return number written.
+}
+
+
+/**
+ *  Gets the number of unread bytes in a ring.
+ *  Returns the count, SHM_RING_SIZE if the ring is corrupt so neither side waits on it.
+ */
+static unsigned long ringUsed(SharedRing *ring) {
+
+    unsigned long used = (unsigned long)ring->tail - (unsigned long)ring->head;     // Bytes not yet read.
+    return used > SHM_RING_SIZE ? SHM_RING_SIZE : used;                             // Return count.
+}
+
+
+/**
+ *  Rings the doorbell, one byte on the socket, if the other side is sleeping on it.
+ *  Clearing the flag first means each sleep is rung at most once, so a busy pair never touches the socket.
+ */
+static void wakePeer(SharedChannel *channel) {
+
+    if (*channel->peerSleeping && InterlockedExchange(channel->peerSleeping, 0)) {  // If sleeping, and this side is first to notice.
+        if (channel->loopback != NULL) {                                            // If a loopback end.
+            SetEvent(channel->loopback->doorbells[channel->side == SHARED_CLIENT ? SHARED_SERVER : SHARED_CLIENT]);   // Ring the other end's event.
+        } else {                                                                    // Else between processes.
+            send(channel->s, "!", 1, 0);                                            // Ring.
+        }
+    }
+}
+
+
+/**
+ *  Waits for doorbell bytes on a blocking channel, or drains them on a non-blocking one.
+ *  Returns number of bytes drained, 0 if the peer closed the connection, SOCKET_ERROR on error or with WSAEWOULDBLOCK if not rung.
+ */
+static int sleepOnSocket(SharedChannel *channel) {
+
+    if (channel->loopback != NULL) {                                                // If a loopback end.
+        return sleepOnDoorbell(channel);                                            // Wait on its event instead.
+    }
+    char doorbell[SHM_DOORBELL_SIZE];                                               // Doorbell bytes, their value is ignored.
+    return recv(channel->s, doorbell, SHM_DOORBELL_SIZE, 0);                        // Wait for, or drain, them.
+}
+
+
+/**
+ *  Waits for a loopback end's doorbell event on a blocking end, or checks it on a non-blocking one.
+ *  Returns 1 if rung, 0 if the other end closed, SOCKET_ERROR with WSAEWOULDBLOCK if not rung.
+ */
+static int sleepOnDoorbell(SharedChannel *channel) {
+
+    LoopbackPair *pair = channel->loopback;                                         // The in-process pair.
+    if (pair->closed[channel->side == SHARED_CLIENT ? SHARED_SERVER : SHARED_CLIENT]) {     // If the other end closed.
+        return 0;                                                                   // Closed, as recv() reports it.
+    }
+    if (WaitForSingleObject(pair->doorbells[channel->side], channel->blocking ? INFINITE : 0) == WAIT_OBJECT_0) {    // If rung, or woken by the other end closing.
+        return 1;                                                                   // Rung.
+    }
+    WSASetLastError(WSAEWOULDBLOCK);                                                // Not rung yet.
+    return SOCKET_ERROR;                                                            // Return error.
+}
+
+
+/**
+ *  Finds the channel registered for a socket, removing it if asked.
+ *  Returns the channel, NULL if the socket has none.
+ */
+static SharedChannel *findSharedChannel(SOCKET s, bool remove) {
+
+    int stripe = (int)((s / 4) % SHM_TABLE_STRIPES);                                // The socket's stripe.
+    EnterCriticalSection(&stripeLocks[stripe]);                                     // Lock stripe.
+    SharedChannel **link = &stripes[stripe];                                        // The link to the channel checked.
+    while (*link != NULL && (*link)->s != s) {                                      // Until the socket is found.
+        link = &(*link)->next;                                                      // Next channel.
+    }
+    SharedChannel *channel = *link;                                                 // The channel, NULL if not found.
+    if (channel != NULL && remove) {                                                // If found and to be removed.
+        *link = channel->next;                                                      // Unregister it.
+        InterlockedDecrement(&registeredCount);                                     // Count it.
+    }
+    LeaveCriticalSection(&stripeLocks[stripe]);                                     // Unlock stripe.
+    return channel;                                                                 // Return the channel.
+}
@@ -0,0 +1,84 @@
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <winsock2.h>
+#include <windows.h>
+
+#define UNIX_ADDRESS_PREFIX "unix:"                                                 // A server address starting with this is the path of an AF_UNIX socket.
+#define UNIX_PATH_SIZE 108                                                          // Longest AF_UNIX socket path, including the terminator.
+#define SHM_NAME_PREFIX "Local\\TcpSecShm-"                                         // Start of every shared-memory region name, the server opens no other.
+#define SHM_NAME_SIZE 64                                                            // Longest region name, including the terminator.
+#define SHM_RING_SIZE 16384                                                         // Bytes in each direction's ring, a power of 2 larger than the server's output buffer.
+#define SHM_SPIN_COUNT 2000                                                         // Times a blocking side polls its ring before sleeping on the socket, on more than one processor.
+#define SHM_DOORBELL_SIZE 16                                                        // Most doorbell bytes drained from the socket at once.
+#define SHM_TABLE_STRIPES 64                                                        // Number of locked lists the sockets' channels are found in.
+#define LOOPBACK_SOCKET_BASE 0x40000003                                             // First id given to a loopback end, never a multiple of 4 so never a winsock socket.
+
+
+/**
+ *  Structures.
+ */
+enum SharedSide {                                                                   // Which end of a region a channel is.
+    SHARED_CLIENT,                                                                  // Writes toServer, reads toClient.
+    SHARED_SERVER                                                                   // Writes toClient, reads toServer.
+};
+
+struct SharedRing {                                                                 // A single-producer, single-consumer byte ring in shared memory.
+    volatile LONG head;                                                             // Bytes ever read, only the reader moves it.
+    char          headPad[60];                                                      // Keeps head and tail on separate cache lines.
+    volatile LONG tail;                                                             // Bytes ever written, only the writer moves it.
+    char          tailPad[60];                                                      // Keeps tail off the data's first cache line.
+    char          data[SHM_RING_SIZE];                                              // The bytes, at index count % SHM_RING_SIZE.
+};
+
+struct SharedRegion {                                                               // The shared memory of one connection, laid out the same in both processes.
+    SharedRing    toServer;                                                         // Frames from the client.
+    SharedRing    toClient;                                                         // Replies from the server.
+    volatile LONG sleeping[2];                                                      // Per side, 1 while it waits on the socket for the other side to write a doorbell byte.
+};
+
+struct LoopbackPair {                                                               // Two connected ends inside one process, a region on the heap with events for doorbells.
+    SharedRegion  region;                                                           // The rings, as a shared-memory connection lays them out.
+    HANDLE        doorbells[2];                                                     // Per side, set to wake it.
+    volatile LONG closed[2];                                                        // Per side, 1 once it has closed its end.
+    volatile LONG references;                                                       // Number of ends open, the pair is freed when the last closes.
+};
+
+struct SharedChannel {                                                              // One side's view of a region, used in place of the socket for frames and replies.
+    SOCKET         s;                                                               // The connection's socket, kept open to carry doorbell bytes and to notice the peer closing.
+    HANDLE         mapping;                                                         // The region's file mapping.
+    SharedRegion  *region;                                                          // The mapped region.
+    SharedRing    *in;                                                              // The ring this side reads.
+    SharedRing    *out;                                                             // The ring this side writes.
+    volatile LONG *ownSleeping;                                                     // Set while this side waits on the socket.
+    volatile LONG *peerSleeping;                                                    // Set while the other side waits on the socket.
+    bool           blocking;                                                        // True if calls wait like a blocking socket, false if they fail with WSAEWOULDBLOCK.
+    LoopbackPair  *loopback;                                                        // The in-process pair the channel is one end of, NULL for shared memory between processes.
+    SharedSide     side;                                                            // Which end of the region the channel is.
+    SharedChannel *next;                                                            // The next channel in the same stripe.
+};
+
+
+/**
+ *  Function declarations.
+ */
+int            initTransport();                                                     // Prepares the socket to channel table, call once before any thread connects.
+bool           isUnixAddress(const char *host);                                     // Checks whether a server address names an AF_UNIX socket.
+int            connectUnixSocket(SOCKET &s, const char *path);                      // Connects to a server's AF_UNIX socket.
+int            listenUnixSocket(SOCKET &s, const char *path);                       // Listens on an AF_UNIX socket.
+bool           isLocalPeer(SOCKET s);                                               // Checks whether the other end of a connection is on this host.
+int            createSharedRegion(char *name, HANDLE &mapping, SharedRegion *&region);  // Creates a region for a new connection, the client's side.
+int            openSharedRegion(const char *name, HANDLE &mapping, SharedRegion *&region);  // Opens a region a client created, the server's side.
+SharedChannel *openSharedChannel(SOCKET s, HANDLE mapping, SharedRegion *region, SharedSide side, bool blocking);   // Makes one side's channel over a mapped region.
+void           closeSharedChannel(SharedChannel *channel);                          // Unmaps a channel's region and frees the channel.
+int            sharedSend(SharedChannel *channel, const char *buffer, int length);  // Writes bytes to the channel's out ring, like send().
+int            sharedRecv(SharedChannel *channel, char *buffer, int length);        // Reads bytes from the channel's in ring, like recv().
+bool           sharedWait(SharedChannel *channel);                                  // Asks to be rung when the in ring gets bytes, unless it already has some.
+void           registerSharedChannel(SharedChannel *channel);                       // Sends and receives on the channel's socket through the channel from now on.
+int            transportSend(SOCKET s, const char *buffer, int length);             // Sends on a socket, or its registered channel.
+int            transportRecv(SOCKET s, char *buffer, int length);                   // Receives on a socket, or its registered channel.
+int            closeTransport(SOCKET s);                                            // Closes a socket and its registered channel.
+bool           transportAlive(SOCKET s);                                            // Checks an idle connection has not been closed by its peer, draining any doorbells.
+int            createLoopbackPair(SOCKET &clientEnd, SOCKET &serverEnd);            // Connects two ends inside this process, used through the socket functions above.
+
+#endif
@@ -0,0 +1,2 @@
+del *.o
+del *.exe
\ No newline at end of file
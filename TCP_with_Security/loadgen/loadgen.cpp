@@ -0,0 +1,635 @@
+#include "loadgen.h"
+
+
+/**
+ *  The main function of the program.
+ *  Returns error code.
+ */
+int main(int argc, char *argv[]) {
+
+    printf("<<< TCP LOAD GENERATOR, by Cai and Steve >>>\n");                       // Output program title.
+
+    LoadConfig config;                                                              // The load to generate.
+    int error = parseArguments(argc, argv, config);                                 // Read the load from the command line.
+    if (error) {                                                                    // If error occurred.
+        return error;                                                               // Return error code.
+    }
+    printf("\nServer %s:%s, %d sessions, %d messages of %d bytes each, ", config.host, config.port, config.sessions, config.messages, config.messageSize);
+    if (config.streams > 0) {                                                       // If multiplexed.
+        printf("on each of %d streams per session, ", config.streams);             // Alert user.
+    }
+    if (config.batch > 1) {                                                         // If batched.
+        printf("up to %d per batch, ", config.batch);                               // Alert user.
+    }
+    if (config.poolSize > 0) {                                                      // If pooled.
+        printf("over a pool of %d connections, ", config.poolSize);                 // Alert user.
+    }
+    if (!config.sharedMemory) {                                                     // If shared memory is not asked for.
+        printf("without shared memory, ");                                          // Alert user.
+    }
+    if (config.kvWorkload) {                                                        // If sending kv commands.
+        printf("as kv commands, ");                                                 // Alert user.
+    }
+    if (config.rate > 0) {                                                          // If rate limited.
+        printf("%.0f messages/sec\n", config.rate);                                 // Alert user.
+    } else {                                                                        // Else flat out.
+        printf("flat out\n");                                                       // Alert user.
+    }
+
+    startLogger(LOG_ERROR);                                                         // Only log the client functions' failures, logging every step would dominate the measurement.
+    initCertCache();                                                                // Sessions share verified server keys, so only the first handshake decrypts the CA blob.
+    initRsaTables();                                                                // Sessions share the server key's lookup table, built by the first handshake.
+    initTransport();                                                                // Prepare for shared-memory sessions.
+    volatile LONG readyCount = 0;                                                   // Number of sessions that have finished their handshake.
+    HANDLE startEvent = CreateEvent(NULL, TRUE, FALSE, NULL);                       // Releases every session at once.
+    LoadSession *sessions = new LoadSession[config.sessions];                       // The sessions.
+    HANDLE *threads = new HANDLE[config.sessions];                                  // The session threads.
+    unsigned long long handshakeStart = currentMicroseconds();                      // Time the handshakes.
+    ConnectionPool pool;                                                            // The warm sessions shared by every session, if pooled.
+    if (config.poolSize > 0) {                                                      // If pooled.
+        error = startConnectionPool(pool, config.host, config.port, config.poolSize, config.poolSize, config.sharedMemory);  // Do every handshake before the clock starts.
+        if (error) {                                                                // If error occurred.
+            flushLog();                                                             // Show the failure.
+            return 7;                                                               // Return error code.
+        }
+        config.pool = &pool;                                                        // Sessions send on the pool.
+    }
+    for (int i = 0; i < config.sessions; i++) {                                     // Loop through sessions.
+        memset(&sessions[i], 0, sizeof(LoadSession));                               // Ensure blank.
+        sessions[i].index = i;                                                      // Number the session.
+        sessions[i].config = &config;                                               // Share the load config.
+        sessions[i].startEvent = startEvent;                                        // Share the start signal.
+        sessions[i].readyCount = &readyCount;                                       // Share the ready count.
+        initHistogram(sessions[i].handshakeLatency);                                // Prepare for use.
+        initHistogram(sessions[i].messageLatency);                                  // Prepare for use.
+        threads[i] = CreateThread(NULL, 0, runLoadSession, &sessions[i], 0, NULL);  // Start the session.
+    }
+    while (readyCount < config.sessions) {                                          // Until every session is connected or failed.
+        Sleep(1);                                                                   // Wait.
+    }
+    unsigned long long handshakeElapsed = currentMicroseconds() - handshakeStart;   // Time every session took to connect.
+    printf("Handshakes done, sending messages...\n");                               // Alert user.
+    unsigned long long start = currentMicroseconds();                               // Time the messages.
+    SetEvent(startEvent);                                                           // Release the sessions.
+    for (int i = 0; i < config.sessions; i++) {                                     // Loop through sessions.
+        WaitForSingleObject(threads[i], INFINITE);                                  // Wait for session to finish.
+        CloseHandle(threads[i]);                                                    // Free thread.
+    }
+    unsigned long long elapsed = currentMicroseconds() - start;                     // Time taken.
+    flushLog();                                                                     // Show any failures before the report.
+    displayReport(config, sessions, handshakeElapsed, elapsed);                     // Alert user.
+    if (config.pool != NULL) {                                                      // If pooled.
+        stopConnectionPool(pool);                                                   // Close the pool's sessions.
+    }
+    CloseHandle(startEvent);                                                        // Free event.
+    delete[] threads;                                                               // Free memory.
+    delete[] sessions;                                                              // Free memory.
+    return 0;                                                                       // Return no error.
+}
+
+
+/**
+ *  Reads the load to generate from the command line.
+ *  Returns error code.
+ */
+int parseArguments(int argc, char *argv[], LoadConfig &config) {
+
+    config.host = (char *)"localhost";                                              // Default server IP address.
+    config.port = (char *)DEFAULT_PORT;                                             // Default server port number.
+    config.sessions = DEFAULT_SESSIONS;                                             // Default number of sessions.
+    config.messageSize = DEFAULT_MESSAGE_SIZE;                                      // Default message size.
+    config.messages = DEFAULT_MESSAGES;                                             // Default number of messages.
+    config.rate = DEFAULT_RATE;                                                     // Default rate.
+    config.streams = DEFAULT_STREAMS;                                               // Default number of streams.
+    config.batch = DEFAULT_BATCH;                                                   // Default batch size.
+    const char *workload = DEFAULT_WORKLOAD;                                        // Default workload.
+    config.poolSize = DEFAULT_POOL;                                                 // Default pool size.
+    config.pool = NULL;                                                             // Started once the arguments are checked.
+    config.sharedMemory = DEFAULT_SHARED_MEMORY;                                    // Default use of shared memory.
+    if (argc < 3) {                                                                 // If server not given.
+        printf("\nUSAGE: loadgen.exe [IP_address] [port_number] [sessions] [message_size] [messages_per_session] [messages_per_sec] [streams_per_session] [batch_size] [workload] [pool_size] [shared_memory]\n");
+        printf("Using default settings, IP: localhost, Port: %s\n", DEFAULT_PORT);  // Alert user.
+    }
+    if (argc > 1) config.host = argv[1];                                            // Argument 2 is IP address.
+    if (argc > 2) config.port = argv[2];                                            // Argument 3 is port number.
+    if (argc > 3) config.sessions = atoi(argv[3]);                                  // Argument 4 is number of sessions.
+    if (argc > 4) config.messageSize = atoi(argv[4]);                               // Argument 5 is message size.
+    if (argc > 5) config.messages = atoi(argv[5]);                                  // Argument 6 is number of messages.
+    if (argc > 6) config.rate = atof(argv[6]);                                      // Argument 7 is rate.
+    if (argc > 7) config.streams = atoi(argv[7]);                                   // Argument 8 is number of streams.
+    if (argc > 8) config.batch = atoi(argv[8]);                                     // Argument 9 is batch size.
+    if (argc > 9) workload = argv[9];                                               // Argument 10 is workload.
+    config.kvWorkload = strcmp(workload, "kv") == 0;                                // Send kv commands.
+    if (argc > 10) config.poolSize = atoi(argv[10]);                                // Argument 11 is pool size.
+    if (argc > 11) config.sharedMemory = atoi(argv[11]) != 0;                       // Argument 12 is whether to ask for shared memory.
+    if (config.sessions < 1 || config.sessions > MAX_LOAD_SESSIONS) {               // If too few or too many sessions.
+        printf("sessions must be between 1 and %d\n", MAX_LOAD_SESSIONS);          // Alert user.
+        return 1;                                                                   // Return error code.
+    }
+    if (config.messageSize < 1 || config.messageSize > MAX_MESSAGE_SIZE) {          // If message too small or too large.
+        printf("message_size must be between 1 and %d\n", MAX_MESSAGE_SIZE);       // Alert user.
+        return 2;                                                                   // Return error code.
+    }
+    if (config.messages < 1 || config.rate < 0) {                                   // If no messages or negative rate.
+        printf("messages_per_session must be positive and messages_per_sec must not be negative\n");    // Alert user.
+        return 3;                                                                   // Return error code.
+    }
+    if (config.streams < 0 || config.streams > MUX_MAX_STREAMS) {                   // If too many streams.
+        printf("streams_per_session must be between 0 and %d\n", MUX_MAX_STREAMS); // Alert user.
+        return 4;                                                                   // Return error code.
+    }
+    if (config.batch < 0 || config.batch > BATCH_MAX_MESSAGES || (config.batch > 1 && (config.streams > 0 || config.messageSize > BATCH_MAX_BYTES / 2 - 4))) {  // If too large, combined with streams, or too few messages fit.
+        printf("batch_size must be between 0 and %d, without streams and with message_size at most %d\n", BATCH_MAX_MESSAGES, BATCH_MAX_BYTES / 2 - 4);
+        return 5;                                                                   // Return error code.
+    }
+    if ((!config.kvWorkload && strcmp(workload, "echo") != 0) || (config.kvWorkload && config.messageSize < LOAD_KV_MIN_SIZE)) {  // If unknown, or too short for a command.
+        printf("workload must be echo or kv, kv with message_size at least %d\n", LOAD_KV_MIN_SIZE);
+        return 6;                                                                   // Return error code.
+    }
+    if (config.poolSize < 0 || (config.poolSize > 0 && (config.streams > 0 || config.batch > 1))) { // If negative, or combined with streams or batching.
+        printf("pool_size must not be negative, and is used without streams or batching\n");
+        return 7;                                                                   // Return error code.
+    }
+    return 0;                                                                       // Return no error.
+}
+
+
+/**
+ *  Runs one session, the thread function of each session.
+ *  Returns error code.
+ */
+DWORD WINAPI runLoadSession(LPVOID parameter) {
+
+    LoadSession *session = (LoadSession *)parameter;                                // The session.
+    SOCKET s = INVALID_SOCKET;                                                      // The socket connected to the server.
+    int serverKeyE = 0;                                                             // Stores the server's public key e.
+    int serverKeyN = 0;                                                             // Stores the server's public key n.
+    long nOnce = 23;                                                                // Used as the first random number in CBC encryption.
+    HandshakeOptions options;                                                       // The options asked for, then the options agreed.
+    initHandshakeOptions(options);                                                  // Ask for the client's chaining and compression.
+    options.batchMessages = session->config->batch;                                 // Batching is asked for if above 1.
+    options.streamCredits = session->config->streams;                               // Streams are asked for if above 0.
+    options.sharedMemory = session->config->sharedMemory;                           // Whether shared memory is asked for.
+    if (session->config->pool != NULL) {                                            // If sending on the shared pool.
+        InterlockedIncrement(session->readyCount);                                  // Session is ready, the pool did the handshakes.
+        WaitForSingleObject(session->startEvent, INFINITE);                         // Wait for every other session.
+        session->error = sendPooledMessages(session);                               // Send the messages.
+        return session->error;                                                      // Return error code if any.
+    }
+    unsigned long long start = currentMicroseconds();                               // Time the handshake.
+    session->error = connectLoadSession(session, s, serverKeyE, serverKeyN, nOnce, options);  // Connect and do the handshake.
+    if (!session->error) {                                                          // If connected.
+        recordValue(session->handshakeLatency, currentMicroseconds() - start);      // Record handshake time.
+    }
+    InterlockedIncrement(session->readyCount);                                      // Session is ready.
+    WaitForSingleObject(session->startEvent, INFINITE);                             // Wait for every other session.
+    if (!session->error) {                                                          // If connected.
+        if (session->config->streams > 0) {                                         // If multiplexed.
+            session->error = sendLoadStreams(session, s, serverKeyE, serverKeyN, nOnce, options.chainMode, options.compression, options.streamCredits, options.connectionCredits);   // Send the messages on every stream.
+        } else if (session->config->batch > 1) {                                    // Else if batched.
+            session->error = sendLoadBatches(session, s, serverKeyE, serverKeyN, nOnce, options.chainMode, options.compression, options.batchMessages, options.batchBytes);   // Send the messages in batches.
+        } else {                                                                    // Else one conversation.
+            session->error = sendLoadMessages(session, s, serverKeyE, serverKeyN, nOnce, options.chainMode, options.compression);   // Send the messages.
+        }
+    }
+    if (s != INVALID_SOCKET) {                                                      // If socket was opened.
+        closeTransport(s);                                                          // Close the socket, and its shared memory.
+    }
+    return session->error;                                                          // Return error code if any.
+}
+
+
+/**
+ *  Connects to the server and does the handshake using the client's own functions, asking for the options given and leaving the options agreed.
+ *  Returns error code.
+ */
+int connectLoadSession(LoadSession *session, SOCKET &s, int &serverKeyE, int &serverKeyN, long nOnce, HandshakeOptions &options) {
+
+    char program[] = "loadgen";                                                     // Program name for the client's arguments.
+    char *clientArgv[3] = { program, session->config->host, session->config->port };  // Arguments in the form tcpConnect() expects.
+    int error = tcpConnect(s, 3, clientArgv);                                       // Connect to server using TCP.
+    if (error) {                                                                    // If error occurred.
+        s = INVALID_SOCKET;                                                         // Socket was closed.
+        return error;                                                               // Return error code.
+    }
+    int caKeyE = 4297;                                                              // Hardcoded certification authority public key e.
+    int caKeyN = 7171;                                                              // Hardcoded certification authority public key n.
+    error = receiveServerPublicKey(s, caKeyE, caKeyN, serverKeyE, serverKeyN);      // Receive the public key information for the server from the CA.
+    if (error) {                                                                    // If error occurred.
+        return error;                                                               // Return error code.
+    }
+    bool askedForBatching = options.batchMessages > 1;                              // True if batching is asked for.
+    bool askedForStreams = options.streamCredits > 0;                               // True if streams are asked for.
+    error = sendNOnce(s, nOnce, options);                                           // Send the nOnce to the server.
+    session->sharedMemory = options.sharedMemory;                                   // Whether shared memory was agreed.
+    if (error) {                                                                    // If the nOnce exchange failed.
+        invalidateCertificate(caKeyE, caKeyN, serverKeyE, serverKeyN);              // Decrypt the CA blob again next time, in case the cached key is wrong.
+    }
+    if (!error && askedForStreams && options.streamCredits == 0) {                  // If the server does not support streams.
+        LOG(LOG_ERROR) << "Server does not support streams" << endl;                // Alert user.
+        return 4;                                                                   // Return error code.
+    }
+    if (!error && askedForBatching && (options.batchMessages < 2 || options.batchBytes < 2 * (session->config->messageSize + 4))) {   // If the server does not batch, or not two messages.
+        LOG(LOG_ERROR) << "Server does not support batching" << endl;               // Alert user.
+        return 6;                                                                   // Return error code.
+    }
+    return error;                                                                   // Return error code if any.
+}
+
+
+/**
+ *  Sends the session's messages and times each reply.
+ *  When rate limited each message has a due time and latency is measured from it, so a slow server cannot hide queueing delay.
+ *  Returns error code.
+ */
+int sendLoadMessages(LoadSession *session, SOCKET s, int serverKeyE, int serverKeyN, long nOnce, ChainMode chainMode, bool compression) {
+
+    LoadConfig *config = session->config;                                           // The load to generate.
+    long long ctrCounter = 0;                                                       // Symbols sent in counter mode on the session, every message gets new pads.
+    double interval = 0;                                                            // Microseconds between this session's messages.
+    if (config->rate > 0) {                                                         // If rate limited.
+        interval = 1000000.0 * config->sessions / config->rate;                     // Share the rate between sessions.
+    }
+    unsigned long long start = currentMicroseconds() + (unsigned long long)(interval * session->index / config->sessions); // Stagger sessions across one interval.
+    for (int m = 0; m < config->messages; m++) {                                    // Loop through messages.
+        unsigned long long due = start + (unsigned long long)(interval * m);        // When the message should be sent.
+        if (interval > 0) {                                                         // If rate limited.
+            waitUntil(due);                                                         // Wait until due.
+        } else {                                                                    // Else flat out.
+            due = currentMicroseconds();                                            // Message is due now.
+        }
+        int error = exchangeLoadMessage(session, s, serverKeyE, serverKeyN, nOnce, ctrCounter, chainMode, compression, m);    // Send message and wait for reply.
+        if (error) {                                                                // If error occurred.
+            return error;                                                           // Return error code.
+        }
+        recordValue(session->messageLatency, currentMicroseconds() - due);          // Record latency.
+    }
+    return 0;                                                                       // Return no error.
+}
+
+
+/**
+ *  Sends the session's messages, each on a session checked out of the shared pool, and times each reply.
+ *  Latency includes any wait for a free session but no connection setup, the pool was warmed before the clock started.
+ *  Returns error code.
+ */
+int sendPooledMessages(LoadSession *session) {
+
+    LoadConfig *config = session->config;                                           // The load to generate.
+    double interval = 0;                                                            // Microseconds between this session's messages.
+    if (config->rate > 0) {                                                         // If rate limited.
+        interval = 1000000.0 * config->sessions / config->rate;                     // Share the rate between sessions.
+    }
+    unsigned long long start = currentMicroseconds() + (unsigned long long)(interval * session->index / config->sessions); // Stagger sessions across one interval.
+    for (int m = 0; m < config->messages; m++) {                                    // Loop through messages.
+        unsigned long long due = start + (unsigned long long)(interval * m);        // When the message should be sent.
+        if (interval > 0) {                                                         // If rate limited.
+            waitUntil(due);                                                         // Wait until due.
+        } else {                                                                    // Else flat out.
+            due = currentMicroseconds();                                            // Message is due now.
+        }
+        PooledSession *pooled = NULL;                                               // The warm session to send on.
+        int error = checkoutSession(*config->pool, pooled, POOL_CHECKOUT_MS);       // Take one, waiting in turn if none is free.
+        if (error) {                                                                // If error occurred.
+            LOG(LOG_ERROR) << "No pooled session within " << POOL_CHECKOUT_MS << " ms" << endl;    // Alert user.
+            return error;                                                           // Return error code.
+        }
+        error = exchangeLoadMessage(session, pooled->s, pooled->serverKeyE, pooled->serverKeyN, pooled->nOnce, pooled->ctrCounter, pooled->options.chainMode, pooled->options.compression, m);   // Send message and wait for reply.
+        checkinSession(*config->pool, pooled, error == 0);                          // Return it, or have it replaced if it failed.
+        if (error) {                                                                // If error occurred.
+            return error;                                                           // Return error code.
+        }
+        recordValue(session->messageLatency, currentMicroseconds() - due);          // Record latency.
+    }
+    return 0;                                                                       // Return no error.
+}
+
+
+/**
+ *  Sends one message of the load and waits for its reply, counting the bytes of both.
+ *  Returns error code.
+ */
+int exchangeLoadMessage(LoadSession *session, SOCKET s, int serverKeyE, int serverKeyN, long nOnce, long long &ctrCounter, ChainMode chainMode, bool compression, int m) {
+
+    LoadConfig *config = session->config;                                           // The load to generate.
+    char sendBuffer[BUFFER_SIZE];                                                   // The buffer to store the message.
+    memset(&sendBuffer, 0, BUFFER_SIZE);                                            // Ensure blank.
+    fillLoadMessage(config, sendBuffer, m);                                         // Write message.
+    int messageLength = config->messageSize;                                        // Stores the length of the message.
+    encryptMessage(sendBuffer, messageLength, serverKeyE, serverKeyN, nOnce, ctrCounter, chainMode, compression);   // Encrypt message with the agreed chaining and compression.
+    int error = sendMessage(s, sendBuffer, messageLength);                          // Send message to server.
+    if (error) {                                                                    // If error occurred.
+        return error;                                                               // Return error code.
+    }
+    char receiveBuffer[BUFFER_SIZE];                                                // The buffer to store received characters.
+    memset(&receiveBuffer, 0, BUFFER_SIZE);                                         // Ensure blank.
+    error = receiveMessage(s, receiveBuffer, messageLength);                        // Receive reply from server.
+    if (error) {                                                                    // If error occurred.
+        return error;                                                               // Return error code.
+    }
+    session->messagesSent++;                                                        // Count message.
+    session->payloadBytes += config->messageSize;                                   // Count message bytes.
+    session->wireBytes += messageLength + strlen(receiveBuffer) + 2;                // Count bytes sent and received, including "\r\n".
+    return 0;                                                                       // Return no error.
+}
+
+
+/**
+ *  Sends every stream's messages over the session and times each reply.
+ *  Messages are sent round robin across the streams while credits allow, then replies are read until credit is returned, so the session never has more messages waiting than the server advertised.
+ *  Replies on a stream arrive in the order its messages were sent, so each stream keeps a ring of the due times of its messages waiting for replies.
+ *  Returns error code.
+ */
+int sendLoadStreams(LoadSession *session, SOCKET s, int serverKeyE, int serverKeyN, long nOnce, ChainMode chainMode, bool compression, int streamCredits, int connectionCredits) {
+
+    LoadConfig *config = session->config;                                           // The load to generate.
+    long long ctrCounter = 0;                                                       // Symbols sent in counter mode on the session, every message gets new pads.
+    int streams = config->streams;                                                  // Number of streams.
+    double interval = 0;                                                            // Microseconds between this session's messages.
+    if (config->rate > 0) {                                                         // If rate limited.
+        interval = 1000000.0 * config->sessions / config->rate;                     // Share the rate between sessions, the session's streams share its part.
+    }
+    unsigned long long start = currentMicroseconds() + (unsigned long long)(interval * session->index / config->sessions); // Stagger sessions across one interval.
+    int *sent = new int[streams];                                                   // Number of messages sent on each stream.
+    int *waiting = new int[streams];                                                // Number of messages waiting for replies on each stream.
+    unsigned long long *dueTimes = new unsigned long long[streams * streamCredits]; // Ring of due times of the messages waiting on each stream.
+    memset(sent, 0, streams * sizeof(int));                                         // Ensure blank.
+    memset(waiting, 0, streams * sizeof(int));                                      // Ensure blank.
+    long total = (long)streams * config->messages;                                  // Number of messages sent across every stream.
+    long sentTotal = 0;                                                             // Number of messages sent.
+    int waitingTotal = 0;                                                           // Number of messages waiting for replies across every stream.
+    int nextStream = 0;                                                             // The stream tried first for the next message, for round robin.
+    int error = 0;                                                                  // Stores the error code returned from functions.
+    while (!error && session->messagesSent < total) {                               // Until every message is replied to.
+        int stream = -1;                                                            // The stream to send on, -1 to read a reply instead.
+        for (int i = 0; i < streams && sentTotal < total && waitingTotal < connectionCredits && stream < 0; i++) {  // Loop through streams while the connection has credit.
+            int candidate = (nextStream + i) % streams;                             // The stream tried.
+            if (sent[candidate] < config->messages && waiting[candidate] < streamCredits) { // If it has a message to send and credit.
+                stream = candidate;                                                 // Send on it.
+            }
+        }
+        unsigned long long due = start + (unsigned long long)(interval * sentTotal);    // When the next message should be sent.
+        if (stream >= 0 && waitingTotal > 0) {                                      // If a message can be sent but replies are waiting.
+            unsigned long long now = currentMicroseconds();                         // The time now.
+            unsigned long long wait = interval > 0 && due > now ? due - now : 0;    // Time until the message is due, a reply may be read meanwhile.
+            fd_set readSet;                                                         // The socket, checked for a reply.
+            FD_ZERO(&readSet);                                                      // Ensure blank.
+            FD_SET(s, &readSet);                                                    // Check the socket.
+            timeval timeout = { (long)(wait / 1000000), (long)(wait % 1000000) };   // Wait no longer than the message is due.
+            if (select(s + 1, &readSet, NULL, NULL, &timeout) > 0) {                // If a reply has arrived.
+                stream = -1;                                                        // Read it first, so its latency is not inflated by sending.
+            }
+        }
+        if (stream >= 0) {                                                          // If a message can be sent.
+            nextStream = (stream + 1) % streams;                                    // Try the next stream first next time.
+            if (interval > 0) {                                                     // If rate limited.
+                waitUntil(due);                                                     // Wait until due.
+            } else {                                                                // Else flat out.
+                due = currentMicroseconds();                                        // Message is due now.
+            }
+            char sendBuffer[BUFFER_SIZE];                                           // The buffer to store the message.
+            memset(&sendBuffer, 0, BUFFER_SIZE);                                    // Ensure blank.
+            fillLoadMessage(config, sendBuffer, sent[stream] + stream);             // Write message.
+            int messageLength = config->messageSize;                                // Stores the length of the message.
+            encryptMessage(sendBuffer, messageLength, serverKeyE, serverKeyN, nOnce, ctrCounter, chainMode, compression);   // Encrypt message with the agreed chaining and compression.
+            error = sendStreamMessage(s, stream, sendBuffer, messageLength);        // Send message to server on the stream.
+            dueTimes[stream * streamCredits + sent[stream] % streamCredits] = due;  // Remember when it was due.
+            sent[stream]++;                                                         // Count message.
+            waiting[stream]++;                                                      // Message uses one of the stream's credits.
+            waitingTotal++;                                                         // Message uses one of the connection's credits.
+            sentTotal++;                                                            // Count message.
+            session->wireBytes += messageLength;                                    // Count bytes sent.
+        } else {                                                                    // Else a reply has arrived, or out of credit or messages, read a reply.
+            char receiveBuffer[BUFFER_SIZE + 1];                                    // The buffer to store received characters.
+            int replyLength = 0;                                                    // Length of the reply without its stream header.
+            error = receiveStreamMessage(s, stream, receiveBuffer, replyLength);    // Receive a reply on any stream.
+            if (!error && (stream >= streams || waiting[stream] == 0)) {            // If the reply matches no waiting message.
+                LOG(LOG_ERROR) << "Reply received on stream " << stream << " with no message waiting" << endl;  // Alert user.
+                error = 5;                                                          // Return error code.
+            }
+            if (!error) {                                                           // If a reply to a waiting message.
+                unsigned long long due = dueTimes[stream * streamCredits + (sent[stream] - waiting[stream]) % streamCredits];  // The oldest message waiting on the stream.
+                recordValue(session->messageLatency, currentMicroseconds() - due);  // Record latency.
+                waiting[stream]--;                                                  // The reply returns the stream's credit.
+                waitingTotal--;                                                     // The reply returns the connection's credit.
+                session->messagesSent++;                                            // Count message.
+                session->payloadBytes += config->messageSize;                       // Count message bytes.
+                char header[BUFFER_SIZE];                                           // The reply's stream header.
+                session->wireBytes += replyLength + writeStreamHeader(header, stream) + 2;  // Count bytes received, including the header and "\r\n".
+            }
+        }
+    }
+    delete[] dueTimes;                                                              // Free memory.
+    delete[] waiting;                                                               // Free memory.
+    delete[] sent;                                                                  // Free memory.
+    return error;                                                                   // Return error code if any.
+}
+
+
+/**
+ *  Sends the session's messages coalesced into batches and times each reply.
+ *  A batch is sent when it holds batchMessages messages, when the next message does not fit in batchBytes, or, when rate limited, when the next message is due more than BATCH_MAX_DELAY_MS after the first.
+ *  Latency is measured from each message's own due time, so it includes the time spent waiting for the batch to fill.
+ *  Returns error code.
+ */
+int sendLoadBatches(LoadSession *session, SOCKET s, int serverKeyE, int serverKeyN, long nOnce, ChainMode chainMode, bool compression, int batchMessages, int batchBytes) {
+
+    LoadConfig *config = session->config;                                           // The load to generate.
+    long long ctrCounter = 0;                                                       // Symbols sent in counter mode on the session, every message gets new pads.
+    double interval = 0;                                                            // Microseconds between this session's messages.
+    if (config->rate > 0) {                                                         // If rate limited.
+        interval = 1000000.0 * config->sessions / config->rate;                     // Share the rate between sessions.
+    }
+    unsigned long long start = currentMicroseconds() + (unsigned long long)(interval * session->index / config->sessions); // Stagger sessions across one interval.
+    int m = 0;                                                                      // The next message.
+    while (m < config->messages) {                                                  // Until every message is sent.
+        char sendBuffer[BUFFER_SIZE];                                               // The packed batch.
+        int messageLength = 0;                                                      // Length of the packed batch.
+        int batchCount = 0;                                                         // Number of messages packed.
+        unsigned long long dueTimes[BATCH_MAX_MESSAGES];                            // When each packed message was due.
+        while (m < config->messages && batchCount < batchMessages) {                // While the batch has room.
+            unsigned long long due = start + (unsigned long long)(interval * m);    // When the message should be sent.
+            if (interval > 0 && batchCount > 0 && due > dueTimes[0] + BATCH_MAX_DELAY_MS * 1000ULL) {   // If the first message would wait too long for it.
+                break;                                                              // Send the batch.
+            }
+            char message[BUFFER_SIZE];                                              // The message.
+            fillLoadMessage(config, message, m);                                    // Write message.
+            int length = appendToBatch(sendBuffer, messageLength, batchBytes, message, config->messageSize);  // Pack the message.
+            if (length < 0) {                                                       // If it does not fit.
+                break;                                                              // Send the batch.
+            }
+            if (interval > 0) {                                                     // If rate limited.
+                waitUntil(due);                                                     // Wait until due.
+            } else {                                                                // Else flat out.
+                due = currentMicroseconds();                                        // Message is due now.
+            }
+            messageLength = length;                                                 // The message joined the batch.
+            dueTimes[batchCount++] = due;                                           // Remember when it was due.
+            m++;                                                                    // Next message.
+        }
+        if (batchCount > 1) {                                                       // If several messages were batched.
+            encryptBatch(sendBuffer, messageLength, batchCount, serverKeyE, serverKeyN, nOnce, ctrCounter, chainMode, compression);    // Encrypt the batch.
+        } else {                                                                    // Else one message, sent on its own.
+            int offset = 0;                                                         // Index of the message in the batch.
+            const char *message = NULL;                                             // The message.
+            readBatchMessage(sendBuffer, messageLength, offset, message, messageLength);    // Unpack it.
+            memmove(sendBuffer, message, messageLength);                            // Send it without its length.
+            encryptMessage(sendBuffer, messageLength, serverKeyE, serverKeyN, nOnce, ctrCounter, chainMode, compression);   // Encrypt message with the agreed chaining and compression.
+        }
+        int error = sendMessage(s, sendBuffer, messageLength);                      // Send message to server.
+        if (error) {                                                                // If error occurred.
+            return error;                                                           // Return error code.
+        }
+        char receiveBuffer[BUFFER_SIZE + 1];                                        // The buffer to store received characters.
+        memset(&receiveBuffer, 0, BUFFER_SIZE);                                     // Ensure blank.
+        int replyLength = 0;                                                        // Length of the reply without "\r\n".
+        if (batchCount > 1) {                                                       // If batched.
+            error = receiveBatchReply(s, receiveBuffer, batchCount, replyLength);   // Receive the reply to every message.
+            char header[BUFFER_SIZE];                                               // The reply's batch header.
+            replyLength += writeBatchHeader(header, batchCount);                    // Count the header too.
+        } else {                                                                    // Else one message.
+            error = receiveMessage(s, receiveBuffer, 0);                            // Receive reply from server.
+            replyLength = strlen(receiveBuffer);                                    // Length of the reply.
+        }
+        if (error) {                                                                // If error occurred.
+            return error;                                                           // Return error code.
+        }
+        unsigned long long now = currentMicroseconds();                             // When the replies arrived.
+        for (int i = 0; i < batchCount; i++) {                                      // Loop through messages.
+            recordValue(session->messageLatency, now - dueTimes[i]);                // Record latency.
+        }
+        session->messagesSent += batchCount;                                        // Count messages.
+        session->framesSent++;                                                      // Count frame.
+        session->payloadBytes += (unsigned long long)batchCount * config->messageSize;  // Count message bytes.
+        session->wireBytes += messageLength + replyLength + 2;                      // Count bytes sent and received, including "\r\n".
+    }
+    return 0;                                                                       // Return no error.
+}
+
+
+/**
+ *  Writes one message of the load, config->messageSize letters, or for the kv workload a command padded with letters to that size.
+ *  Every fourth kv message SETs a key, the rest GET one, GETs ignore the padding after the key.
+ */
+void fillLoadMessage(LoadConfig *config, char *message, int seed) {
+
+    int start = 0;                                                                  // Index of the first letter.
+    if (config->kvWorkload) {                                                       // If sending kv commands.
+        start = sprintf(message, "%s key%03d ", seed % 4 == 0 ? "SET" : "GET", seed % LOAD_KV_KEYS);  // Write command and key.
+    }
+    for (int i = start; i < config->messageSize; i++) {                             // Loop through message.
+        message[i] = 'a' + (seed + i) % 26;                                         // Fill with letters.
+    }
+}
+
+
+/**
+ *  Gets the time from the high resolution counter.
+ *  Returns microseconds.
+ */
+unsigned long long currentMicroseconds() {
+
+    static LARGE_INTEGER frequency = { { 0, 0 } };                                  // Counter ticks per second.
+    if (frequency.QuadPart == 0) {                                                  // If not yet known.
+        QueryPerformanceFrequency(&frequency);                                      // Get frequency.
+    }
+    LARGE_INTEGER counter;                                                          // Counter value.
+    QueryPerformanceCounter(&counter);                                              // Get counter.
+    return (unsigned long long)(counter.QuadPart / (double)frequency.QuadPart * 1000000.0);    // Return microseconds.
+}
+
+
+/**
+ *  Waits until the given time.
+ *  Sleeps while more than a scheduler tick remains, then yields, as Sleep() is only accurate to a few milliseconds.
+ */
+void waitUntil(unsigned long long dueMicroseconds) {
+
+    unsigned long long now = currentMicroseconds();                                 // The time now.
+    while (now < dueMicroseconds) {                                                 // Until due.
+        unsigned long long remaining = dueMicroseconds - now;                       // Time left.
+        if (remaining > 2000) {                                                     // If more than a scheduler tick left.
+            Sleep((DWORD)(remaining / 1000 - 1));                                   // Sleep most of it.
+        } else {                                                                    // Else nearly due.
+            SwitchToThread();                                                       // Give up the rest of this time slice.
+        }
+        now = currentMicroseconds();                                                // The time now.
+    }
+}
+
+
+/**
+ *  Displays throughput and latency results.
+ *  Handshakes are timed from the first thread starting to the last session connecting, so with many sessions it measures a connection storm.
+ */
+void displayReport(LoadConfig &config, LoadSession *sessions, unsigned long long handshakeMicroseconds, unsigned long long elapsedMicroseconds) {
+
+    Histogram handshakeLatency;                                                     // Handshake times of every session.
+    Histogram messageLatency;                                                       // Message latencies of every session.
+    initHistogram(handshakeLatency);                                                // Prepare for use.
+    initHistogram(messageLatency);                                                  // Prepare for use.
+    long messages = 0;                                                              // Total messages sent.
+    unsigned long long payloadBytes = 0;                                            // Total message bytes.
+    unsigned long long wireBytes = 0;                                               // Total bytes on the socket.
+    int failed = 0;                                                                 // Number of sessions that failed.
+    int shared = 0;                                                                 // Number of sessions that used shared memory.
+    for (int i = 0; i < config.sessions; i++) {                                     // Loop through sessions.
+        mergeHistogram(handshakeLatency, sessions[i].handshakeLatency);             // Add handshake times.
+        mergeHistogram(messageLatency, sessions[i].messageLatency);                 // Add message latencies.
+        messages += sessions[i].messagesSent;                                       // Add messages.
+        payloadBytes += sessions[i].payloadBytes;                                   // Add message bytes.
+        wireBytes += sessions[i].wireBytes;                                         // Add socket bytes.
+        shared += sessions[i].sharedMemory ? 1 : 0;                                 // Add shared-memory sessions.
+        if (sessions[i].error) {                                                    // If session failed.
+            failed++;                                                               // Count failure.
+        }
+    }
+    double seconds = elapsedMicroseconds / 1000000.0;                               // Time taken in seconds.
+    double handshakeSeconds = handshakeMicroseconds / 1000000.0;                    // Time handshakes took in seconds.
+    printf("\n============== RESULTS ==============\n");
+    printf("Sessions:      %d (%d failed)\n", config.sessions, failed);
+    int handshakes = config.pool != NULL ? config.poolSize : config.sessions - failed;  // Sessions handshake, unless the pool did before the clock started.
+    printf("Handshakes:    %d in %.3f s, %.1f handshakes/sec\n", handshakes, handshakeSeconds, handshakes / handshakeSeconds);
+    printf("Messages:      %ld in %.3f s\n", messages, seconds);
+    printf("Throughput:    %.1f messages/sec\n", messages / seconds);
+    printf("Payload:       %.3f MB/s\n", payloadBytes / seconds / 1000000.0);
+    printf("Wire:          %.3f MB/s\n", wireBytes / seconds / 1000000.0);
+    long certHits = 0;                                                              // Handshakes that found the server key in the cache.
+    long certMisses = 0;                                                            // Handshakes that decrypted the CA blob.
+    certCacheCounts(certHits, certMisses);                                          // Get counts.
+    printf("Cert cache:    %ld hits, %ld misses\n", certHits, certMisses);
+    if (config.batch > 1) {                                                         // If batched.
+        long frames = 0;                                                            // Total frames sent.
+        for (int i = 0; i < config.sessions; i++) {                                 // Loop through sessions.
+            frames += sessions[i].framesSent;                                       // Add frames.
+        }
+        printf("Frames:        %ld, %.2f messages each\n", frames, frames > 0 ? (double)messages / frames : 0.0);
+    }
+    if (config.sharedMemory && config.pool == NULL) {                               // If shared memory was asked for.
+        printf("Shared memory: %d of %d sessions\n", shared, config.sessions);
+    }
+    if (config.pool != NULL) {                                                      // If pooled.
+        printf("Pool:          %ld connects, %ld checkouts waited, %ld replaced\n", config.pool->connects, config.pool->waits, config.pool->replaced);
+    }
+    displayLatency("Handshake", handshakeLatency);                                  // Alert user.
+    displayLatency("Message", messageLatency);                                      // Alert user.
+}
+
+
+/**
+ *  Displays a latency histogram's percentiles.
+ */
+void displayLatency(const char *name, Histogram &histogram) {
+
+    if (histogram.total == 0) {                                                     // If nothing recorded.
+        printf("%-14s no samples\n", name);                                         // Alert user.
+        return;                                                                     // Nothing more to display.
+    }
+    printf("%-14s (us) min %llu, p50 %llu, p99 %llu, p999 %llu, max %llu, mean %.1f\n", name,
+           histogram.min,
+           histogramPercentile(histogram, 50.0),
+           histogramPercentile(histogram, 99.0),
+           histogramPercentile(histogram, 99.9),
+           histogram.max,
+           (double)histogram.sum / histogram.total);
+}
@@ -0,0 +1,70 @@
+#include "../client/client.h"
+#include "../client/connpool.h"
+#include "../common/histogram.h"
+
+#define DEFAULT_SESSIONS 10                                                         // Number of concurrent sessions opened to the server.
+#define DEFAULT_MESSAGE_SIZE 32                                                     // Number of bytes in each message.
+#define DEFAULT_MESSAGES 1000                                                       // Number of messages sent by each session.
+#define DEFAULT_RATE 0                                                              // Total messages per second across all sessions, 0 sends flat out.
+#define DEFAULT_STREAMS 0                                                           // Number of streams multiplexed over each session, 0 sends without streams.
+#define DEFAULT_BATCH 0                                                             // Most messages coalesced into one frame, 0 sends every message on its own.
+#define DEFAULT_POOL 0                                                              // Warm connections shared by every session, 0 gives each session its own connection.
+#define DEFAULT_SHARED_MEMORY 1                                                     // Asks for shared memory with the nOnce, used only if the server is on this host, 0 never asks.
+#define POOL_CHECKOUT_MS 10000                                                      // Longest a message waits for a pooled connection.
+#define DEFAULT_WORKLOAD "echo"                                                     // Messages the server's echo handler replies to, "kv" sends commands for the kv handler.
+#define LOAD_KV_KEYS 100                                                            // Number of keys the kv workload reads and writes.
+#define LOAD_KV_MIN_SIZE 12                                                         // Shortest kv message, "SET key000 " and one byte of value.
+#define MAX_LOAD_SESSIONS 1000                                                      // Maximum number of concurrent sessions.
+#define MAX_MESSAGE_SIZE 100                                                        // Largest message whose encrypted form and reply fit in BUFFER_SIZE.
+
+
+/**
+ *  Structures.
+ */
+struct LoadConfig {                                                                 // The load to generate.
+    char           *host;                                                           // The server's IP address.
+    char           *port;                                                           // The server's port number.
+    int             sessions;                                                       // Number of concurrent sessions.
+    int             messageSize;                                                    // Number of bytes in each message.
+    int             messages;                                                       // Number of messages sent by each session.
+    double          rate;                                                           // Total messages per second, 0 sends flat out.
+    int             streams;                                                        // Number of streams multiplexed over each session, each sends every message, 0 sends without streams.
+    int             batch;                                                          // Most messages coalesced into one frame, 0 or 1 sends every message on its own.
+    bool            kvWorkload;                                                     // True if messages are GET and SET commands for the server's kv handler.
+    int             poolSize;                                                       // Warm connections shared by every session, 0 gives each session its own connection.
+    ConnectionPool *pool;                                                           // The shared connections, NULL unless poolSize is above 0.
+    bool            sharedMemory;                                                   // True if shared memory is asked for.
+};
+
+struct LoadSession {                                                                // The state and results of one session.
+    int                 index;                                                      // The session number.
+    LoadConfig         *config;                                                     // The load to generate.
+    HANDLE              startEvent;                                                 // Signalled once every session has done its handshake.
+    volatile LONG      *readyCount;                                                 // Number of sessions that have finished their handshake.
+    int                 error;                                                      // Error code of the session, 0 if no error.
+    bool                sharedMemory;                                               // True if frames went through shared memory instead of the socket.
+    long                messagesSent;                                               // Number of messages sent and replied to.
+    long                framesSent;                                                 // Number of frames sent when batching, each carrying one or more messages.
+    unsigned long long  payloadBytes;                                               // Number of message bytes sent before encryption.
+    unsigned long long  wireBytes;                                                  // Number of bytes sent and received on the socket.
+    Histogram           handshakeLatency;                                           // Time taken to connect and do the handshake, in microseconds.
+    Histogram           messageLatency;                                             // Time from a message being due to its reply arriving, in microseconds.
+};
+
+
+/**
+ *  Function declarations.
+ */
+int                parseArguments(int argc, char *argv[], LoadConfig &config);      // Reads the load to generate from the command line.
+DWORD WINAPI       runLoadSession(LPVOID parameter);                                // Runs one session, the thread function of each session.
+int                connectLoadSession(LoadSession *session, SOCKET &s, int &serverKeyE, int &serverKeyN, long nOnce, HandshakeOptions &options);   // Connects to the server and does the handshake.
+int                sendLoadMessages(LoadSession *session, SOCKET s, int serverKeyE, int serverKeyN, long nOnce, ChainMode chainMode, bool compression);     // Sends the session's messages and times each reply.
+int                sendPooledMessages(LoadSession *session);                        // Sends the session's messages on sessions checked out of the shared pool.
+int                exchangeLoadMessage(LoadSession *session, SOCKET s, int serverKeyE, int serverKeyN, long nOnce, long long &ctrCounter, ChainMode chainMode, bool compression, int m);  // Sends one message and waits for its reply.
+int                sendLoadStreams(LoadSession *session, SOCKET s, int serverKeyE, int serverKeyN, long nOnce, ChainMode chainMode, bool compression, int streamCredits, int connectionCredits);  // Sends every stream's messages over the session and times each reply.
+int                sendLoadBatches(LoadSession *session, SOCKET s, int serverKeyE, int serverKeyN, long nOnce, ChainMode chainMode, bool compression, int batchMessages, int batchBytes);  // Sends the session's messages coalesced into batches and times each reply.
+void               fillLoadMessage(LoadConfig *config, char *message, int seed);    // Writes one message of the load.
+unsigned long long currentMicroseconds();                                           // Gets the time from the high resolution counter.
+void               waitUntil(unsigned long long dueMicroseconds);                   // Waits until the given time.
+void               displayReport(LoadConfig &config, LoadSession *sessions, unsigned long long handshakeMicroseconds, unsigned long long elapsedMicroseconds);   // Displays throughput and latency results.
+void               displayLatency(const char *name, Histogram &histogram);          // Displays a latency histogram's percentiles.
@@ -0,0 +1,426 @@
+#include "replay.h"
+
+
+/**
+ *  The main function of the program.
+ *  Returns error code.
+ */
+int main(int argc, char *argv[]) {
+
+    printf("<<< TCP CAPTURE REPLAY, by Cai and Steve >>>\n");                       // Output program title.
+
+    ReplayConfig config;                                                            // The capture and how to play it.
+    int error = parseArguments(argc, argv, config);                                 // Read the capture and pacing from the command line.
+    if (error) {                                                                    // If error occurred.
+        return error;                                                               // Return error code.
+    }
+    if (readCaptureFile(config.path, config.data, config.length)) {                 // If the capture could not be read.
+        return 2;                                                                   // Return error code.
+    }
+    ReplaySession *sessions = NULL;                                                 // The captured clients.
+    int sessionCount = 0;                                                           // Number of captured clients played back.
+    int skipped = 0;                                                                // Number of captured clients over the session limit.
+    error = indexCapture(config, sessions, sessionCount, skipped);                  // Group the frames by client.
+    if (error) {                                                                    // If error occurred.
+        delete[] config.data;                                                       // Free memory.
+        return error;                                                               // Return error code.
+    }
+    long frames = 0;                                                                // Number of frames captured.
+    for (int i = 0; i < sessionCount; i++) {                                        // Loop through sessions.
+        frames += sessions[i].frameCount;                                           // Add frames.
+    }
+    printf("\nCapture %s, %d sessions, %ld frames, to server %s:%s, ", config.path, sessionCount, frames, config.host, config.port);
+    if (config.speed > 0) {                                                         // If paced.
+        printf("at %gx the captured pacing\n", config.speed);                       // Alert user.
+    } else {                                                                        // Else flat out.
+        printf("as fast as possible\n");                                            // Alert user.
+    }
+
+    startLogger(LOG_ERROR);                                                         // Only log the client functions' failures, logging every step would dominate the measurement.
+    initCertCache();                                                                // Sessions share verified server keys, so only the first handshake decrypts the CA blob.
+    initRsaTables();                                                                // Sessions share the server key's lookup table, built by the first handshake.
+    initTransport();                                                                // Closing sessions goes through the transport.
+    HANDLE *threads = new HANDLE[sessionCount];                                     // The session threads.
+    config.start = currentMicroseconds();                                           // Playback starts now.
+    for (int i = 0; i < sessionCount; i++) {                                        // Loop through sessions.
+        threads[i] = CreateThread(NULL, 0, runReplaySession, &sessions[i], 0, NULL);    // Start the session, it waits until its handshake is due.
+    }
+    for (int i = 0; i < sessionCount; i++) {                                        // Loop through sessions.
+        WaitForSingleObject(threads[i], INFINITE);                                  // Wait for session to finish.
+        CloseHandle(threads[i]);                                                    // Free thread.
+    }
+    unsigned long long elapsed = currentMicroseconds() - config.start;              // Time taken.
+    flushLog();                                                                     // Show any failures before the report.
+    displayReport(config, sessions, sessionCount, skipped, elapsed);                // Alert user.
+    for (int i = 0; i < sessionCount; i++) {                                        // Loop through sessions.
+        delete[] sessions[i].frames;                                                // Free memory.
+    }
+    delete[] threads;                                                               // Free memory.
+    delete[] sessions;                                                              // Free memory.
+    delete[] config.data;                                                           // Free memory.
+    return 0;                                                                       // Return no error.
+}
+
+
+/**
+ *  Reads the capture and how to play it from the command line.
+ *  Returns error code.
+ */
+int parseArguments(int argc, char *argv[], ReplayConfig &config) {
+
+    config.path = (char *)DEFAULT_CAPTURE_FILE;                                     // Default capture file.
+    config.host = (char *)"localhost";                                              // Default server IP address.
+    config.port = (char *)DEFAULT_PORT;                                             // Default server port number.
+    config.speed = DEFAULT_SPEED;                                                   // Default pacing.
+    config.data = NULL;                                                             // Read once the arguments are checked.
+    config.length = 0;                                                              // Read once the arguments are checked.
+    config.firstTime = 0;                                                           // Found when the capture is indexed.
+    config.start = 0;                                                               // Set when playback starts.
+    if (argc < 2) {                                                                 // If capture not given.
+        printf("\nUSAGE: replay.exe [capture_file] [IP_address] [port_number] [speed]\n");
+        printf("Using default settings, capture: %s, IP: localhost, Port: %s\n", DEFAULT_CAPTURE_FILE, DEFAULT_PORT);  // Alert user.
+    }
+    if (argc > 1) config.path = argv[1];                                            // Argument 2 is capture file.
+    if (argc > 2) config.host = argv[2];                                            // Argument 3 is IP address.
+    if (argc > 3) config.port = argv[3];                                            // Argument 4 is port number.
+    if (argc > 4) config.speed = atof(argv[4]);                                     // Argument 5 is speed.
+    if (config.speed < 0) {                                                         // If negative speed.
+        printf("speed must not be negative, 0 replays as fast as possible\n");      // Alert user.
+        return 1;                                                                   // Return error code.
+    }
+    return 0;                                                                       // Return no error.
+}
+
+
+/**
+ *  Groups the captured frames by client, each client found by its handshake record.
+ *  Clients are played back in the order they were accepted, those over MAX_REPLAY_SESSIONS are skipped.
+ *  Returns error code.
+ */
+int indexCapture(ReplayConfig &config, ReplaySession *&sessions, int &sessionCount, int &skipped) {
+
+    CaptureRecord record;                                                           // The header of the record read.
+    const char *payload = NULL;                                                     // The data of the record read.
+    long offset = 0;                                                                // Index of the next record.
+    int handshakes = 0;                                                             // Number of handshake records.
+    while (nextCaptureRecord(config.data, config.length, offset, record, payload)) {    // Loop through records.
+        handshakes += record.type == CAPTURE_HANDSHAKE ? 1 : 0;                     // Count handshake.
+    }
+    if (handshakes == 0) {                                                          // If no client finished its handshake.
+        printf("%s holds no handshakes to replay\n", config.path);                  // Alert user.
+        return 3;                                                                   // Return error code.
+    }
+    sessions = new ReplaySession[handshakes];                                       // The captured clients.
+    sessionCount = 0;                                                               // No clients yet.
+    offset = 0;                                                                     // Back to the first record.
+    while (nextCaptureRecord(config.data, config.length, offset, record, payload)) {    // Loop through records.
+        if (record.type != CAPTURE_HANDSHAKE || record.length < (int)(2 * sizeof(int))) {    // If not a whole handshake.
+            continue;                                                               // Skip record.
+        }
+        ReplaySession *session = &sessions[sessionCount++];                         // The client.
+        memset(session, 0, sizeof(ReplaySession));                                  // Ensure blank.
+        session->id = record.session;                                               // Store client number.
+        session->config = &config;                                                  // Share the capture.
+        session->handshakeTime = record.time;                                       // Store handshake time.
+        memcpy(&session->serverKeyE, payload, sizeof(int));                         // Store the key the client was sent.
+        memcpy(&session->serverKeyN, &payload[sizeof(int)], sizeof(int));           // Store the key the client was sent.
+        char line[BUFFER_SIZE];                                                     // The nOnce line as captured.
+        int lineLength = record.length - 2 * sizeof(int);                           // Length of the line.
+        lineLength = lineLength < BUFFER_SIZE - 1 ? lineLength : BUFFER_SIZE - 1;   // Keep within the buffer.
+        memcpy(line, &payload[2 * sizeof(int)], lineLength);                        // Copy line.
+        line[lineLength] = '\0';                                                    // Terminate string.
+        HandshakeOptions *options = &session->options;                              // The options the client asked for.
+        options->chainMode = CHAIN_CBC;                                             // CBC unless the client asked for counter mode.
+        options->compression = false;                                               // No compression unless asked for.
+        options->batchMessages = 1;                                                 // No batching unless asked for.
+        options->batchBytes = BATCH_MAX_BYTES;                                      // The most bytes the client batched.
+        options->streamCredits = 0;                                                 // No streams unless asked for.
+        options->connectionCredits = 0;                                             // Unused without streams.
+        options->sharedMemory = false;                                              // The replay sends over the socket.
+        char option[BUFFER_SIZE];                                                   // An option of the line.
+        int position = 0;                                                           // Index of the next option.
+        int length = 0;                                                             // Length of the option read.
+        while (sscanf(&line[position], "%s%n", option, &length) == 1) {             // Loop through the nOnce and its options.
+            position += length;                                                     // Move past option.
+            if (strcmp(option, "SHM") == 0) {                                       // If the client asked for shared memory.
+                sscanf(&line[position], "%s%n", option, &length);                   // Read its region name, which only existed on the client's host.
+                position += length;                                                 // Move past name, the replay sends over the socket.
+                continue;                                                           // Leave both out.
+            }
+            if (strcmp(option, "CTR") == 0) {                                       // If the client asked for counter mode.
+                options->chainMode = CHAIN_CTR;                                     // Expect it in the ACK.
+            } else if (strcmp(option, "LZ") == 0) {                                 // Else if the client asked for compression.
+                options->compression = true;                                        // Expect it in the ACK.
+            } else if (strcmp(option, "BATCH") == 0) {                              // Else if the client asked for batching.
+                options->batchMessages = BATCH_MAX_MESSAGES;                        // Expect it in the ACK.
+            } else if (strcmp(option, "MUX") == 0) {                                // Else if the client asked for streams.
+                options->streamCredits = 1;                                         // Expect them in the ACK.
+            }
+            if (session->nOnceLine[0] != '\0') {                                    // If not the first word.
+                strcat(session->nOnceLine, " ");                                    // Separate words.
+            }
+            strcat(session->nOnceLine, option);                                     // Add word.
+        }
+    }
+    qsort(sessions, sessionCount, sizeof(ReplaySession), compareSessions);          // Order clients by number, so frames find theirs by binary search.
+    skipped = sessionCount > MAX_REPLAY_SESSIONS ? sessionCount - MAX_REPLAY_SESSIONS : 0;  // Clients over the limit.
+    sessionCount -= skipped;                                                        // Play back the first clients accepted.
+    config.firstTime = sessions[0].handshakeTime;                                   // Find the first handshake.
+    for (int i = 1; i < sessionCount; i++) {                                        // Loop through sessions.
+        config.firstTime = sessions[i].handshakeTime < config.firstTime ? sessions[i].handshakeTime : config.firstTime;
+    }
+    for (int pass = 0; pass < 2; pass++) {                                          // Count each client's frames, then store them.
+        offset = 0;                                                                 // Back to the first record.
+        while (nextCaptureRecord(config.data, config.length, offset, record, payload)) {    // Loop through records.
+            ReplaySession key;                                                      // The client to find.
+            key.id = record.session;                                                // Find by number.
+            ReplaySession *session = (ReplaySession *)bsearch(&key, sessions, sessionCount, sizeof(ReplaySession), compareSessions);  // The record's client.
+            if (session == NULL) {                                                  // If its handshake was not captured, or it was skipped.
+                continue;                                                           // Skip record.
+            }
+            if (record.type == CAPTURE_CLOSE) {                                     // If the client disconnected.
+                session->closeTime = record.time;                                   // Store disconnect time.
+            } else if (record.type == CAPTURE_FRAME && pass == 0) {                 // Else if counting frames.
+                session->frameCount++;                                              // Count frame.
+            } else if (record.type == CAPTURE_FRAME) {                              // Else storing frames.
+                ReplayFrame *frame = &session->frames[session->frameCount++];       // The next frame.
+                frame->time = record.time;                                          // Store frame.
+                frame->data = payload;                                              // Store frame.
+                frame->length = record.length;                                      // Store frame.
+            }
+        }
+        for (int i = 0; pass == 0 && i < sessionCount; i++) {                       // Loop through sessions once counted.
+            sessions[i].frames = new ReplayFrame[sessions[i].frameCount > 0 ? sessions[i].frameCount : 1];    // Room for the client's frames.
+            sessions[i].frameCount = 0;                                             // Count again while storing.
+        }
+    }
+    for (int i = 0; i < sessionCount; i++) {                                        // Loop through sessions.
+        initHistogram(sessions[i].frameLatency);                                    // Prepare for use.
+    }
+    return 0;                                                                       // Return no error.
+}
+
+
+/**
+ *  Orders sessions by client number, for qsort() and bsearch().
+ *  Returns negative, zero or positive as a comes before, with or after b.
+ */
+int compareSessions(const void *a, const void *b) {
+
+    int first = ((const ReplaySession *)a)->id;                                     // The first client number.
+    int second = ((const ReplaySession *)b)->id;                                    // The second client number.
+    return first < second ? -1 : (first > second ? 1 : 0);                          // Return order.
+}
+
+
+/**
+ *  Plays back one client, the thread function of each session.
+ *  The session connects when the client's handshake is due, sends each frame when due, and disconnects when the client did.
+ *  Returns error code.
+ */
+DWORD WINAPI runReplaySession(LPVOID parameter) {
+
+    ReplaySession *session = (ReplaySession *)parameter;                            // The session.
+    SOCKET s = INVALID_SOCKET;                                                      // The socket connected to the server.
+    waitUntil(dueMicroseconds(session->config, session->handshakeTime));            // Wait until the handshake is due.
+    session->error = connectReplaySession(session, s);                              // Connect and repeat the handshake.
+    if (!session->error && !session->keyMismatch) {                                 // If connected with the captured key.
+        session->error = sendReplayFrames(session, s);                              // Send the frames.
+    }
+    if (!session->error && session->closeTime != 0) {                               // If the client disconnected before the capture ended.
+        waitUntil(dueMicroseconds(session->config, session->closeTime));            // Wait until the disconnect is due.
+    }
+    if (s != INVALID_SOCKET) {                                                      // If socket was opened.
+        closeTransport(s);                                                          // Close the socket.
+    }
+    return session->error;                                                          // Return error code if any.
+}
+
+
+/**
+ *  Connects to the server and repeats the client's handshake, sending its nOnce line so the frames decrypt as they did.
+ *  The frames were encrypted with the captured server key, a server that sends another key cannot decrypt them.
+ *  The ACK is read with the client's parseACK(), the server must agree the chaining and compression the frames were encrypted with.
+ *  Returns error code.
+ */
+int connectReplaySession(ReplaySession *session, SOCKET &s) {
+
+    char program[] = "replay";                                                      // Program name for the client's arguments.
+    char *clientArgv[3] = { program, session->config->host, session->config->port };  // Arguments in the form tcpConnect() expects.
+    int error = tcpConnect(s, 3, clientArgv);                                       // Connect to server using TCP.
+    if (error) {                                                                    // If error occurred.
+        s = INVALID_SOCKET;                                                         // Socket was closed.
+        return error;                                                               // Return error code.
+    }
+    int caKeyE = 4297;                                                              // Hardcoded certification authority public key e.
+    int caKeyN = 7171;                                                              // Hardcoded certification authority public key n.
+    int serverKeyE = 0;                                                             // Stores the server's public key e.
+    int serverKeyN = 0;                                                             // Stores the server's public key n.
+    error = receiveServerPublicKey(s, caKeyE, caKeyN, serverKeyE, serverKeyN);      // Receive the public key information for the server from the CA.
+    if (error) {                                                                    // If error occurred.
+        return error;                                                               // Return error code.
+    }
+    if (serverKeyE != session->serverKeyE || serverKeyN != session->serverKeyN) {   // If the server sent another key.
+        session->keyMismatch = true;                                                // The frames cannot be decrypted.
+        return 0;                                                                   // Return no error, the session is skipped.
+    }
+    char sendBuffer[BUFFER_SIZE + 2];                                               // The nOnce line and terminating characters.
+    sprintf(sendBuffer, "%s\r\n", session->nOnceLine);                              // Add terminating characters to message.
+    error = sendMessage(s, sendBuffer, strlen(sendBuffer));                         // Send nOnce to server.
+    if (error) {                                                                    // If error occurred.
+        return error;                                                               // Return error code.
+    }
+    char receiveBuffer[BUFFER_SIZE + 1];                                            // The buffer to store received characters.
+    memset(&receiveBuffer, 0, BUFFER_SIZE);                                         // Ensure blank.
+    error = receiveMessage(s, receiveBuffer, 0);                                    // Receive ACK from server.
+    if (error) {                                                                    // If error occurred.
+        return error;                                                               // Return error code.
+    }
+    HandshakeOptions options = session->options;                                    // The options asked for, then the options agreed.
+    error = parseACK(receiveBuffer, options);                                       // Agree the options the server named.
+    if (error) {                                                                    // If error occurred.
+        return error;                                                               // Return error code.
+    }
+    if (options.chainMode != session->options.chainMode || options.compression != session->options.compression) {  // If the frames would not decrypt.
+        LOG(LOG_ERROR) << "Server did not agree the captured options" << endl;      // Alert user.
+        return 12;                                                                  // Return error code.
+    }
+    return 0;                                                                       // Return no error.
+}
+
+
+/**
+ *  Sends the client's frames at their captured times and times each reply.
+ *  Each frame waits for the reply to the one before, as the client did, so stream credits and the server's queue limits hold.
+ *  When paced, latency is measured from the captured time, so a slow server cannot hide queueing delay.
+ *  Returns error code.
+ */
+int sendReplayFrames(ReplaySession *session, SOCKET s) {
+
+    char sendBuffer[BUFFER_SIZE];                                                   // The buffer to store the frame.
+    char receiveBuffer[BUFFER_SIZE + 1];                                            // The buffer to store received characters.
+    for (int f = 0; f < session->frameCount; f++) {                                 // Loop through frames.
+        ReplayFrame *frame = &session->frames[f];                                   // The frame.
+        if (frame->length > BUFFER_SIZE) {                                          // If too long for the client's buffers.
+            LOG(LOG_ERROR) << "Captured frame too long" << endl;                    // Alert user.
+            return 11;                                                              // Return error code.
+        }
+        unsigned long long due = dueMicroseconds(session->config, frame->time);     // When the frame should be sent.
+        waitUntil(due);                                                             // Wait until due.
+        memcpy(sendBuffer, frame->data, frame->length);                             // Copy frame.
+        int error = sendMessage(s, sendBuffer, frame->length);                      // Send frame to server.
+        if (error) {                                                                // If error occurred.
+            return error;                                                           // Return error code.
+        }
+        memset(&receiveBuffer, 0, BUFFER_SIZE);                                     // Ensure blank.
+        error = receiveMessage(s, receiveBuffer, 0);                                // Receive reply from server.
+        if (error) {                                                                // If error occurred.
+            return error;                                                           // Return error code.
+        }
+        recordValue(session->frameLatency, currentMicroseconds() - due);            // Record latency.
+        session->framesSent++;                                                      // Count frame.
+        session->wireBytes += frame->length + strlen(receiveBuffer) + 2;            // Count bytes sent and received, including "\r\n".
+    }
+    return 0;                                                                       // Return no error.
+}
+
+
+/**
+ *  Gets when a captured event is due in the playback, its gap from the first handshake divided by the speed.
+ *  Returns the time in microseconds, now if replaying as fast as possible.
+ */
+unsigned long long dueMicroseconds(ReplayConfig *config, unsigned long long captureTime) {
+
+    if (config->speed <= 0 || captureTime < config->firstTime) {                    // If not paced, or before playback starts.
+        return currentMicroseconds();                                               // Due now.
+    }
+    return config->start + (unsigned long long)((captureTime - config->firstTime) / 1000.0 / config->speed);    // Return due time.
+}
+
+
+/**
+ *  Gets the time from the high resolution counter.
+ *  Returns microseconds since an arbitrary start.
+ */
+unsigned long long currentMicroseconds() {
+
+    static LARGE_INTEGER frequency = { { 0, 0 } };                                  // Counter ticks per second.
+    if (frequency.QuadPart == 0) {                                                  // If not yet known.
+        QueryPerformanceFrequency(&frequency);                                      // Get frequency.
+    }
+    LARGE_INTEGER counter;                                                          // Counter value.
+    QueryPerformanceCounter(&counter);                                              // Get counter.
+    return (unsigned long long)(counter.QuadPart / (double)frequency.QuadPart * 1000000.0);    // Return microseconds.
+}
+
+
+/**
+ *  Waits until the given time.
+ *  Sleeps while more than a scheduler tick remains, then yields, as Sleep() is only accurate to a few milliseconds.
+ */
+void waitUntil(unsigned long long dueMicroseconds) {
+
+    unsigned long long now = currentMicroseconds();                                 // The time now.
+    while (now < dueMicroseconds) {                                                 // Until due.
+        unsigned long long remaining = dueMicroseconds - now;                       // Time left.
+        if (remaining > 2000) {                                                     // If more than a scheduler tick left.
+            Sleep((DWORD)(remaining / 1000 - 1));                                   // Sleep most of it.
+        } else {                                                                    // Else nearly due.
+            SwitchToThread();                                                       // Give up the rest of this time slice.
+        }
+        now = currentMicroseconds();                                                // The time now.
+    }
+}
+
+
+/**
+ *  Displays throughput and latency results.
+ *  Throughput is over the whole playback, so when paced it follows the captured rate rather than the server's limit.
+ */
+void displayReport(ReplayConfig &config, ReplaySession *sessions, int sessionCount, int skipped, unsigned long long elapsedMicroseconds) {
+
+    Histogram frameLatency;                                                         // Frame latencies of every session.
+    initHistogram(frameLatency);                                                    // Prepare for use.
+    long framesCaptured = 0;                                                        // Total frames captured.
+    long framesSent = 0;                                                            // Total frames sent.
+    unsigned long long wireBytes = 0;                                               // Total bytes on the socket.
+    int failed = 0;                                                                 // Number of sessions that failed.
+    int mismatched = 0;                                                             // Number of sessions sent another server key.
+    for (int i = 0; i < sessionCount; i++) {                                        // Loop through sessions.
+        mergeHistogram(frameLatency, sessions[i].frameLatency);                     // Add frame latencies.
+        framesCaptured += sessions[i].frameCount;                                   // Add frames.
+        framesSent += sessions[i].framesSent;                                       // Add frames.
+        wireBytes += sessions[i].wireBytes;                                         // Add socket bytes.
+        failed += sessions[i].error ? 1 : 0;                                        // Add failure.
+        mismatched += sessions[i].keyMismatch ? 1 : 0;                              // Add key mismatch.
+    }
+    double seconds = elapsedMicroseconds / 1000000.0;                               // Time taken in seconds.
+    printf("\n============== RESULTS ==============\n");
+    printf("Sessions:      %d (%d failed, %d sent another server key)\n", sessionCount, failed, mismatched);
+    if (skipped > 0) {                                                              // If clients were over the limit.
+        printf("Skipped:       %d sessions over the limit of %d\n", skipped, MAX_REPLAY_SESSIONS);
+    }
+    printf("Frames:        %ld of %ld in %.3f s\n", framesSent, framesCaptured, seconds);
+    printf("Throughput:    %.1f frames/sec\n", framesSent / seconds);
+    printf("Wire:          %.3f MB/s\n", wireBytes / seconds / 1000000.0);
+    displayLatency("Frame", frameLatency);                                          // Alert user.
+}
+
+
+/**
+ *  Displays a latency histogram's percentiles.
+ */
+void displayLatency(const char *name, Histogram &histogram) {
+
+    if (histogram.total == 0) {                                                     // If nothing recorded.
+        printf("%-14s no samples\n", name);                                         // Alert user.
+        return;                                                                     // Nothing more to display.
+    }
+    printf("%-14s (us) min %llu, p50 %llu, p99 %llu, p999 %llu, max %llu, mean %.1f\n", name,
+           histogram.min,
+           histogramPercentile(histogram, 50.0),
+           histogramPercentile(histogram, 99.0),
+           histogramPercentile(histogram, 99.9),
+           histogram.max,
+           (double)histogram.sum / histogram.total);
+}
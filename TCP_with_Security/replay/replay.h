@@ -0,0 +1,62 @@
+#include "../client/client.h"
+#include "../common/capture.h"
+#include "../common/histogram.h"
+
+#define DEFAULT_CAPTURE_FILE "capture.bin"                                          // The capture file played back.
+#define DEFAULT_SPEED 1                                                             // Multiple of the captured pacing, 1 keeps the original gaps, 0 sends as fast as possible.
+#define MAX_REPLAY_SESSIONS 1000                                                    // Maximum number of concurrent sessions, later ones are skipped.
+
+
+/**
+ *  Structures.
+ */
+struct ReplayConfig {                                                               // The capture and how to play it.
+    char           *path;                                                           // The capture file.
+    char           *host;                                                           // The server's IP address.
+    char           *port;                                                           // The server's port number.
+    double          speed;                                                          // Multiple of the captured pacing, 0 sends as fast as possible.
+    char           *data;                                                           // Every record of the capture.
+    long            length;                                                         // Number of bytes in data.
+    unsigned long long firstTime;                                                   // Capture time of the first handshake, in nanoseconds, playback starts there.
+    unsigned long long start;                                                       // When playback started, in microseconds.
+};
+
+struct ReplayFrame {                                                                // One captured frame.
+    unsigned long long  time;                                                       // Capture time, in nanoseconds.
+    const char         *data;                                                       // The frame as received, including "\r\n", inside the capture.
+    int                 length;                                                     // Number of bytes in data.
+};
+
+struct ReplaySession {                                                              // One captured client, and the results of playing it back.
+    int                 id;                                                         // The client's number in the capture.
+    ReplayConfig       *config;                                                     // The capture and how to play it.
+    unsigned long long  handshakeTime;                                              // Capture time of the nOnce, in nanoseconds.
+    unsigned long long  closeTime;                                                  // Capture time of the disconnect, in nanoseconds, 0 if the capture ended first.
+    int                 serverKeyE;                                                 // The server key e the client was sent.
+    int                 serverKeyN;                                                 // The server key n the client was sent.
+    char                nOnceLine[BUFFER_SIZE];                                     // The nOnce line the client sent, without any shared memory it asked for.
+    HandshakeOptions    options;                                                    // The options the nOnce line asks for.
+    ReplayFrame        *frames;                                                     // The client's frames, in the order received.
+    int                 frameCount;                                                 // Number of frames.
+    int                 error;                                                      // Error code of the session, 0 if no error.
+    bool                keyMismatch;                                                // True if the server sent another key, so the frames could not be decrypted.
+    long                framesSent;                                                 // Number of frames sent and replied to.
+    unsigned long long  wireBytes;                                                  // Number of bytes sent and received on the socket.
+    Histogram           frameLatency;                                               // Time from a frame being due to its reply arriving, in microseconds.
+};
+
+
+/**
+ *  Function declarations.
+ */
+int                parseArguments(int argc, char *argv[], ReplayConfig &config);    // Reads the capture and how to play it from the command line.
+int                indexCapture(ReplayConfig &config, ReplaySession *&sessions, int &sessionCount, int &skipped);  // Groups the captured frames by client.
+int                compareSessions(const void *a, const void *b);                   // Orders sessions by client number.
+DWORD WINAPI       runReplaySession(LPVOID parameter);                              // Plays back one client, the thread function of each session.
+int                connectReplaySession(ReplaySession *session, SOCKET &s);         // Connects to the server and repeats the client's handshake.
+int                sendReplayFrames(ReplaySession *session, SOCKET s);              // Sends the client's frames at their captured times and times each reply.
+unsigned long long dueMicroseconds(ReplayConfig *config, unsigned long long captureTime);  // Gets when a captured event is due in the playback.
+unsigned long long currentMicroseconds();                                           // Gets the time from the high resolution counter.
+void               waitUntil(unsigned long long dueMicroseconds);                   // Waits until the given time.
+void               displayReport(ReplayConfig &config, ReplaySession *sessions, int sessionCount, int skipped, unsigned long long elapsedMicroseconds);    // Displays throughput and latency results.
+void               displayLatency(const char *name, Histogram &histogram);          // Displays a latency histogram's percentiles.
@@ -0,0 +1,2 @@
+START cmd /k "server\server.exe 1177"
+START cmd /k "loadgen\loadgen.exe localhost 1177"
\ No newline at end of file
@@ -0,0 +1,74 @@
+#include <stdio.h>
+#include "fairshare.h"
+
+
+/**
+ *  Reads the weight of each class from a list such as "4,1", interactive first, every weight at least 1.
+ *  Returns error code.
+ */
+int parseClassWeights(const char *list, FairScheduler &scheduler) {
+
+    int weights[SERVICE_CLASSES];                                                   // The weights read.
+    int length = 0;                                                                 // Number of characters read.
+    if (sscanf(list, "%d,%d%n", &weights[CLASS_INTERACTIVE], &weights[CLASS_BULK], &length) != SERVICE_CLASSES || list[length] != '\0') { // If not one weight per class.
+        return 1;                                                                   // Return error code.
+    }
+    for (int i = 0; i < SERVICE_CLASSES; i++) {                                     // Loop through classes.
+        if (weights[i] < 1 || weights[i] > 1000) {                                  // If the class would never be served, or its credit could overflow.
+            return 2;                                                               // Return error code.
+        }
+        scheduler.weights[i] = weights[i];                                          // Store weight.
+    }
+    return 0;                                                                       // Return no error.
+}
+
+
+/**
+ *  Credits a client with a frame waiting its quantum for the pass, in proportion to its class's weight.
+ *  Credit left from earlier passes is kept up to one quantum, so a client held back by its output cannot bank a burst.
+ */
+void grantQuantum(FairScheduler &scheduler, FairShare &share) {
+
+    int quantum = scheduler.weights[share.serviceClass] * DRR_QUANTUM_BYTES;        // The class's credit per pass.
+    share.deficit = (share.deficit < quantum ? share.deficit : quantum) + quantum;  // Add credit.
+}
+
+
+/**
+ *  Charges a frame to the client's credit if it has enough, then counts the frame against the client's class.
+ *  The frame's received bytes stand for its crypto work, as every encrypted value sent costs one modular exponentiation to decrypt.
+ *  Returns true if the frame may be processed, false if it must wait for the next pass.
+ */
+bool chargeFrame(FairScheduler &scheduler, FairShare &share, int frameBytes) {
+
+    if (frameBytes > share.deficit) {                                               // If not enough credit.
+        scheduler.creditWaits[share.serviceClass]++;                                // Count the wait.
+        return false;                                                               // Wait for the next pass.
+    }
+    share.deficit -= frameBytes;                                                    // Spend credit.
+    scheduler.framesServed[share.serviceClass]++;                                   // Count frame.
+    scheduler.bytesServed[share.serviceClass] += frameBytes;                        // Count bytes.
+    share.averageFrameBytes += (frameBytes - share.averageFrameBytes) >> FRAME_AVERAGE_SHIFT;   // Move the average toward the frame.
+    share.serviceClass = share.averageFrameBytes >= BULK_FRAME_BYTES ? CLASS_BULK : CLASS_INTERACTIVE;  // Class from the average, from the next pass.
+    return true;                                                                    // Process the frame.
+}
+
+
+/**
+ *  Ends a client's turn, dropping its credit if it has nothing left waiting so an idle client cannot save up for later.
+ */
+void endTurn(FairShare &share, bool queueEmpty) {
+
+    if (queueEmpty) {                                                               // If nothing waiting.
+        share.deficit = 0;                                                          // Drop credit.
+    }
+}
+
+
+/**
+ *  Gets the name of a class, as used in logs and metrics.
+ */
+const char *serviceClassName(ServiceClass serviceClass) {
+
+    return serviceClass == CLASS_BULK ? "bulk" : "interactive";                     // Return name.
+}
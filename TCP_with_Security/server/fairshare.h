@@ -0,0 +1,42 @@
+#ifndef FAIRSHARE_H
+#define FAIRSHARE_H
+
+#define SERVICE_CLASSES 2                                                           // Number of client classes.
+#define DRR_QUANTUM_BYTES 800                                                       // Bytes of frames credited per pass for each unit of weight, at least one whole frame so every pass serves a waiting client.
+#define BULK_FRAME_BYTES 128                                                        // Average frame size from which a client is served as bulk.
+#define FRAME_AVERAGE_SHIFT 3                                                       // Each frame moves the client's average frame size 1/2^FRAME_AVERAGE_SHIFT of the way to its own size.
+#define DEFAULT_CLASS_WEIGHTS "4,1"                                                 // Weights of the interactive and bulk classes.
+
+
+/**
+ *  Structures.
+ */
+enum ServiceClass {                                                                 // The class a client is served in, from the size of the frames it sends.
+    CLASS_INTERACTIVE,                                                              // Small frames, credited more per pass so its queue drains quickly.
+    CLASS_BULK                                                                      // Large frames, still credited every pass so it keeps its throughput.
+};
+
+struct FairShare {                                                                  // One client's place in deficit round robin, embedded in its session.
+    int          deficit;                                                           // Bytes of frames the client may still have processed this pass.
+    int          averageFrameBytes;                                                 // Moving average of the client's frame size.
+    ServiceClass serviceClass;                                                      // The class the client is served in.
+};
+
+struct FairScheduler {                                                              // The weight of each class and how service was shared out.
+    int       weights[SERVICE_CLASSES];                                             // Quanta credited per pass to a client of each class.
+    long long framesServed[SERVICE_CLASSES];                                        // Frames processed for clients of each class.
+    long long bytesServed[SERVICE_CLASSES];                                         // Bytes of frames processed for clients of each class.
+    long long creditWaits[SERVICE_CLASSES];                                         // Passes on which a client of each class had a frame waiting but not enough credit.
+};
+
+
+/**
+ *  Function declarations.
+ */
+int         parseClassWeights(const char *list, FairScheduler &scheduler);          // Reads the weight of each class from a list such as "4,1".
+void        grantQuantum(FairScheduler &scheduler, FairShare &share);               // Credits a client with a frame waiting its quantum for the pass.
+bool        chargeFrame(FairScheduler &scheduler, FairShare &share, int frameBytes);    // Charges a frame to the client's credit if it has enough.
+void        endTurn(FairShare &share, bool queueEmpty);                             // Ends a client's turn, dropping its credit if it has nothing left waiting.
+const char *serviceClassName(ServiceClass serviceClass);                            // Gets the name of a class.
+
+#endif
@@ -0,0 +1,361 @@
+#define _WIN32_WINNT 0x501
+#include <winsock2.h>
+#include <windows.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include "handler.h"
+#include "kvhandler.h"
+#include "../common/copycount.h"
+
+static HandlerStatus handleEcho(void *state, HandlerRequest *request);              // Replies with the message, the server's original behaviour.
+static DWORD WINAPI  runHandlerWorker(LPVOID parameter);                            // Runs its node's queued jobs, and other nodes' when its own is empty, until the pool is stopped.
+static HandlerJob   *takeJob(HandlerQueue *queue);                                  // Removes the oldest job from a queue.
+static bool          runJob(HandlerPool *pool, HandlerJob *job);                    // Runs the handler on every request of a job.
+static void          postFinishedJob(HandlerPool *pool, HandlerJob *job);           // Hands a job finished off the event loop back to it.
+static int           createWakeupSocket(SOCKET &s);                                 // Creates a loopback socket that sends to itself.
+
+
+/**
+ *  Creates a built-in handler by name.
+ *  "echo" replies with each message on the event loop, "kv" runs an in-memory key-value store on the worker pool.
+ *  Returns the handler, or NULL if the name is not known.
+ */
+RequestHandler *createRequestHandler(const char *name) {
+
+    RequestHandler *handler = new RequestHandler;                                   // The handler.
+    memset(handler, 0, sizeof(RequestHandler));                                     // Ensure blank.
+    if (strcmp(name, "echo") == 0) {                                                // If echoing.
+        handler->name = "echo";                                                     // Name it.
+        handler->onPool = false;                                                    // Too little work to be worth a thread switch.
+        handler->handle = handleEcho;                                               // Echo each message.
+    } else if (strcmp(name, "kv") == 0) {                                           // Else if the key-value store.
+        handler->name = "kv";                                                       // Name it.
+        handler->onPool = true;                                                     // Run beside the event loop.
+        handler->state = createKvStore();                                           // Start with an empty store.
+        handler->handle = handleKvRequest;                                          // Run each command.
+    } else {                                                                        // Else not known.
+        delete handler;                                                             // Free memory.
+        return NULL;                                                                // No handler.
+    }
+    return handler;                                                                 // Return the handler.
+}
+
+
+/**
+ *  Starts the pool running a handler, with worker threads only if the handler runs on the pool.
+ *  Workers are pinned to the cores after the event loop's in the affinity plan, and each takes jobs from the queue of its core's NUMA node.
+ *  A worker whose queue is empty steals from the other nodes' queues, so workers on a node with no sessions still help.
+ *  Returns error code.
+ */
+int startHandlerPool(HandlerPool &pool, RequestHandler *handler, int threads, AffinityPlan &affinity) {
+
+    memset(&pool, 0, sizeof(HandlerPool));                                          // Ensure blank.
+    pool.handler = handler;                                                         // Run this handler.
+    InitializeCriticalSection(&pool.lock);                                          // Prepare lock.
+    if (createWakeupSocket(pool.wakeupSocket)) {                                    // If the event loop could not be woken.
+        DeleteCriticalSection(&pool.lock);                                          // Free lock.
+        return 1;                                                                   // Return error code.
+    }
+    pool.threadCount = handler->onPool && threads > 0 ? threads : 0;                // Number of workers.
+    pool.workers = new HandlerWorker[pool.threadCount + 1];                         // Room for every worker.
+    for (int node = 0; node < MAX_NUMA_NODES; node++) {                             // Loop through queues.
+        pool.queues[node].semaphore = CreateSemaphore(NULL, 0, 0x7FFFFFFF, NULL);   // Workers wait here for jobs.
+    }
+    for (int i = 0; i < pool.threadCount; i++) {                                    // Loop through workers.
+        HandlerWorker *worker = &pool.workers[i];                                   // The worker.
+        worker->pool = &pool;                                                       // Work for this pool.
+        worker->core = workerCore(affinity, i);                                     // Its core, -1 if not pinned.
+        worker->node = worker->core < 0 ? 0 : nodeOfCore(worker->core) % MAX_NUMA_NODES;  // Unpinned workers share the first queue.
+        pool.queues[worker->node].workerCount++;                                    // Count it before any job is queued.
+    }
+    pool.defaultNode = pool.threadCount > 0 ? pool.workers[0].node : 0;             // Jobs from nodes with no workers go to the first worker's.
+    for (int i = 0; i < pool.threadCount; i++) {                                    // Loop through workers.
+        pool.workers[i].thread = CreateThread(NULL, 0, runHandlerWorker, &pool.workers[i], 0, NULL);   // Start worker.
+        if (pool.workers[i].thread == NULL) {                                       // If it could not be started.
+            stopHandlerPool(pool);                                                  // Stop the workers started.
+            return 2;                                                               // Return error code.
+        }
+    }
+    return 0;                                                                       // Return no error.
+}
+
+
+/**
+ *  Stops the workers, once every queued job has been run.
+ */
+void stopHandlerPool(HandlerPool &pool) {
+
+    InterlockedExchange(&pool.stopping, 1);                                         // Tell the workers to stop.
+    for (int node = 0; node < MAX_NUMA_NODES; node++) {                             // Loop through queues.
+        ReleaseSemaphore(pool.queues[node].semaphore, pool.queues[node].workerCount, NULL);    // Wake every worker.
+    }
+    for (int i = 0; i < pool.threadCount && pool.workers[i].thread != NULL; i++) {  // Loop through workers started.
+        WaitForSingleObject(pool.workers[i].thread, INFINITE);                      // Wait for worker to stop.
+        CloseHandle(pool.workers[i].thread);                                        // Free thread.
+    }
+    closesocket(pool.wakeupSocket);                                                 // Close wakeup socket.
+    for (int node = 0; node < MAX_NUMA_NODES; node++) {                             // Loop through queues.
+        CloseHandle(pool.queues[node].semaphore);                                   // Free semaphore.
+    }
+    DeleteCriticalSection(&pool.lock);                                              // Free lock.
+    delete[] pool.workers;                                                          // Free memory.
+}
+
+
+/**
+ *  Splits a job's decrypted frame into one request per message, each a view into the frame.
+ *  A batch's messages each give their own length as received, as the frame is shared, a lone message gives the frame's receivedLength.
+ *  Returns error code.
+ */
+int splitJob(HandlerJob *job, int receivedLength) {
+
+    job->requestCount = 0;                                                          // No requests yet.
+    if (job->batchCount == 0) {                                                     // If one message.
+        job->requests[0].payload = job->payload;                                    // The whole frame.
+        job->requests[0].length = job->payloadLength;                               // Length of the frame.
+        job->requests[0].receivedLength = receivedLength;                           // Bytes received for it.
+        job->requestCount = 1;                                                      // One request.
+        return 0;                                                                   // Return no error.
+    }
+    int offset = 0;                                                                 // Index of the next message.
+    const char *message = NULL;                                                     // The message read.
+    int length = 0;                                                                 // Length of the message read.
+    int result = 0;                                                                 // Result of reading a message.
+    while ((result = readBatchMessage(job->payload, job->payloadLength, offset, message, length)) == 1 && job->requestCount < job->batchCount) {   // Loop through messages.
+        HandlerRequest *request = &job->requests[job->requestCount++];              // The message's request.
+        request->payload = message;                                                 // View the message in place.
+        request->length = length;                                                   // Length of the message.
+        request->receivedLength = length;                                           // Bytes received for it.
+    }
+    if (result != 0 || job->requestCount != job->batchCount) {                      // If corrupt, or not the number announced.
+        return 1;                                                                   // Return error code.
+    }
+    return 0;                                                                       // Return no error.
+}
+
+
+/**
+ *  Runs the handler on every request of a job, on a worker if the handler runs on the pool, otherwise here on the event loop.
+ *  The job goes to a worker on its session's NUMA node, or to the default queue if that node has no workers.
+ *  If every worker on that node is busy, an idle worker on another node is woken to steal it.
+ *  A job that does not finish here is later returned by takeFinishedJobs(), the event loop must not touch it until then.
+ *  Returns true if the job finished here and its replies can be sent now.
+ */
+bool submitJob(HandlerPool &pool, HandlerJob *job) {
+
+    job->pool = &pool;                                                              // Finish through this pool.
+    job->next = NULL;                                                               // Not in a queue.
+    job->requestsLeft = job->requestCount + 1;                                      // Every request, plus a hold by whoever runs the handler.
+    if (pool.threadCount == 0) {                                                    // If the handler runs on the event loop.
+        return runJob(&pool, job);                                                  // Run it now.
+    }
+    int node = job->node >= 0 && job->node < MAX_NUMA_NODES && pool.queues[job->node].workerCount > 0 ? job->node : pool.defaultNode;   // The queue of a worker near the session.
+    HandlerQueue *queue = &pool.queues[node];                                       // The queue.
+    EnterCriticalSection(&pool.lock);                                               // Lock queue.
+    if (queue->tail != NULL) {                                                      // If jobs are waiting.
+        queue->tail->next = job;                                                    // Add after the newest.
+    } else {                                                                        // Else queue empty.
+        queue->head = job;                                                          // Job is the oldest.
+    }
+    queue->tail = job;                                                              // Job is the newest.
+    int thief = -1;                                                                 // Node of an idle worker to steal the job, -1 if none is needed.
+    for (int n = 0; queue->idleWorkers == 0 && thief < 0 && n < MAX_NUMA_NODES; n++) {  // If every worker near the session is busy, loop through the other nodes.
+        thief = pool.queues[n].idleWorkers > 0 ? n : -1;                            // Take the first with an idle worker.
+    }
+    LeaveCriticalSection(&pool.lock);                                               // Unlock queue.
+    ReleaseSemaphore(queue->semaphore, 1, NULL);                                    // Wake a worker.
+    if (thief >= 0) {                                                               // If a worker elsewhere is idle.
+        ReleaseSemaphore(pool.queues[thief].semaphore, 1, NULL);                    // Wake it too, whichever worker is free first runs the job.
+    }
+    return false;                                                                   // Finishes later.
+}
+
+
+/**
+ *  Marks a request's reply as written, called by the pool for handlers that return HANDLER_DONE and by handlers themselves, from any thread, after returning HANDLER_PENDING.
+ *  The job finishes with the last of its requests.
+ */
+void completeRequest(HandlerRequest *request) {
+
+    HandlerJob *job = request->job;                                                 // The request's job.
+    if (InterlockedDecrement(&job->requestsLeft) == 0) {                            // If the last request, after the handler has returned.
+        postFinishedJob(job->pool, job);                                            // Hand the job back to the event loop.
+    }
+}
+
+
+/**
+ *  Takes every job finished off the event loop, in the order they finished, draining the wakeup socket first so no wakeup is lost.
+ *  Returns the oldest finished job, the rest follow through next, NULL if none.
+ */
+HandlerJob *takeFinishedJobs(HandlerPool &pool) {
+
+    char drain[64];                                                                 // Wakeup bytes, discarded.
+    while (recv(pool.wakeupSocket, drain, sizeof(drain), 0) > 0) {                  // Until no wakeups are left.
+    }
+    EnterCriticalSection(&pool.lock);                                               // Lock list.
+    HandlerJob *jobs = pool.finishedHead;                                           // Take every finished job.
+    pool.finishedHead = NULL;                                                       // List is empty.
+    pool.finishedTail = NULL;                                                       // List is empty.
+    LeaveCriticalSection(&pool.lock);                                               // Unlock list.
+    return jobs;                                                                    // Return finished jobs.
+}
+
+
+/**
+ *  Writes a handler's reply with printf style formatting, cutting it short if it does not fit.
+ *  Returns reply length.
+ */
+int writeReply(HandlerRequest *request, const char *format, ...) {
+
+    va_list arguments;                                                              // The values to format.
+    va_start(arguments, format);                                                    // Start reading values.
+    int length = vsnprintf(request->reply, HANDLER_REPLY_SIZE, format, arguments);  // Format reply.
+    va_end(arguments);                                                              // Stop reading values.
+    if (length < 0 || length >= HANDLER_REPLY_SIZE) {                               // If it did not fit.
+        length = HANDLER_REPLY_SIZE - 1;                                            // Keep what fitted.
+    }
+    request->replyLength = length;                                                  // Store length.
+    return length;                                                                  // Return reply length.
+}
+
+
+/**
+ *  Replies with the message, the server's original behaviour.
+ *  Returns HANDLER_DONE.
+ */
+static HandlerStatus handleEcho(void *state, HandlerRequest *request) {
+
+    writeReply(request, "The client typed '%.*s' - %d bytes of information was received", request->length, request->payload, request->receivedLength);   // Echo the message.
+    return HANDLER_DONE;                                                            // Reply written.
+}
+
+
+/**
+ *  Runs its node's queued jobs until the pool is stopped, pinned to its core first if it has one.
+ *  When its own queue is empty it steals the oldest job from another node's, the job's memory is then remote but it runs sooner.
+ *  A stolen job leaves its queue's semaphore one ahead, so a worker there may wake to find nothing and wait again.
+ *  Returns 0.
+ */
+static DWORD WINAPI runHandlerWorker(LPVOID parameter) {
+
+    HandlerWorker *worker = (HandlerWorker *)parameter;                             // The worker.
+    HandlerPool *pool = worker->pool;                                               // The pool.
+    HandlerQueue *queue = &pool->queues[worker->node];                              // The queue it takes jobs from.
+    pinThread(GetCurrentThread(), worker->core);                                    // Stay on its core, the server checked the core exists.
+    while (1) {                                                                     // Until the pool is stopped.
+        EnterCriticalSection(&pool->lock);                                          // Lock queues.
+        queue->idleWorkers++;                                                       // Count as idle, so busy nodes wake it to steal.
+        LeaveCriticalSection(&pool->lock);                                          // Unlock queues.
+        WaitForSingleObject(queue->semaphore, INFINITE);                            // Wait for a job.
+        EnterCriticalSection(&pool->lock);                                          // Lock queues.
+        queue->idleWorkers--;                                                       // Busy.
+        HandlerJob *job = takeJob(queue);                                           // The oldest job on its node.
+        for (int n = 0; job == NULL && n < MAX_NUMA_NODES; n++) {                   // If none, loop through the other nodes.
+            job = takeJob(&pool->queues[n]);                                        // Steal their oldest job.
+        }
+        LeaveCriticalSection(&pool->lock);                                          // Unlock queues.
+        if (job == NULL) {                                                          // If woken to stop, or beaten to the job.
+            if (pool->stopping) {                                                   // If the pool is being stopped.
+                return 0;                                                           // Stop.
+            }
+            continue;                                                               // Wait again.
+        }
+        if (runJob(pool, job)) {                                                    // If every request was answered here.
+            postFinishedJob(pool, job);                                             // Hand the job back to the event loop.
+        }
+    }
+}
+
+
+/**
+ *  Removes the oldest job from a queue, the caller holds the pool's lock.
+ *  Returns the job, NULL if the queue is empty.
+ */
+static HandlerJob *takeJob(HandlerQueue *queue) {
+
+    HandlerJob *job = queue->head;                                                  // The oldest job.
+    if (job != NULL) {                                                              // If there is one.
+        queue->head = job->next;                                                    // Remove it.
+        if (queue->head == NULL) {                                                  // If the queue is now empty.
+            queue->tail = NULL;                                                     // No newest job.
+        }
+    }
+    return job;                                                                     // Return the job.
+}
+
+
+/**
+ *  Runs the handler on every request of a job, then releases the runner's hold on it.
+ *  Counts the job against the NUMA node it runs on, and as remote if its session is on another node.
+ *  Returns true if every request has completed, so the runner finishes the job.
+ */
+static bool runJob(HandlerPool *pool, HandlerJob *job) {
+
+    RequestHandler *handler = pool->handler;                                        // The handler.
+    int node = currentNode();                                                       // The node it runs on.
+    countNodeEvent(NODE_JOBS, node);                                                // Count job.
+    if (job->node >= 0 && job->node != node) {                                      // If its session's memory is on another node.
+        countNodeEvent(NODE_REMOTE_JOBS, node);                                     // Count remote job.
+    }
+    for (int i = 0; i < job->requestCount; i++) {                                   // Loop through requests.
+        HandlerRequest *request = &job->requests[i];                                // The request.
+        request->job = job;                                                         // Let the handler complete it later.
+        request->replyLength = 0;                                                   // No reply yet.
+        if (handler->handle(handler->state, request) == HANDLER_DONE) {             // If answered now.
+            completeRequest(request);                                               // Count it.
+        }
+    }
+    return InterlockedDecrement(&job->requestsLeft) == 0;                           // Release the hold, true if nothing is pending.
+}
+
+
+/**
+ *  Hands a job finished off the event loop back to it, and wakes it if it may be waiting in select().
+ */
+static void postFinishedJob(HandlerPool *pool, HandlerJob *job) {
+
+    job->next = NULL;                                                               // Job is the newest.
+    EnterCriticalSection(&pool->lock);                                              // Lock list.
+    bool wasEmpty = pool->finishedHead == NULL;                                     // True if the event loop has no wakeup pending.
+    if (pool->finishedTail != NULL) {                                               // If jobs are waiting.
+        pool->finishedTail->next = job;                                             // Add after the newest.
+    } else {                                                                        // Else list empty.
+        pool->finishedHead = job;                                                   // Job is the oldest.
+    }
+    pool->finishedTail = job;                                                       // Job is the newest.
+    LeaveCriticalSection(&pool->lock);                                              // Unlock list.
+    if (wasEmpty) {                                                                 // If the event loop has not been woken yet.
+        send(pool->wakeupSocket, "x", 1, 0);                                        // Wake it, a full socket already holds a wakeup.
+    }
+}
+
+
+/**
+ *  Creates a loopback UDP socket connected to itself, select() on winsock only waits on sockets, so workers wake the event loop by sending it a byte.
+ *  Returns error code.
+ */
+static int createWakeupSocket(SOCKET &s) {
+
+    s = socket(AF_INET, SOCK_DGRAM, 0);                                             // Create socket.
+    if (s == INVALID_SOCKET) {                                                      // If socket could not be created.
+        return 1;                                                                   // Return error code.
+    }
+    struct sockaddr_in address;                                                     // The loopback address.
+    memset(&address, 0, sizeof(address));                                           // Ensure blank.
+    address.sin_family = AF_INET;                                                   // IPv4.
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);                               // Only reachable from this machine.
+    address.sin_port = 0;                                                           // Any free port.
+    int addressLength = sizeof(address);                                            // Size of address.
+    u_long nonBlocking = 1;                                                         // Enables non-blocking mode.
+    if (bind(s, (struct sockaddr *)&address, sizeof(address)) == SOCKET_ERROR       // Bind to a free port,
+        || getsockname(s, (struct sockaddr *)&address, &addressLength) == SOCKET_ERROR  // find which,
+        || connect(s, (struct sockaddr *)&address, sizeof(address)) == SOCKET_ERROR     // and send to it.
+        || ioctlsocket(s, FIONBIO, &nonBlocking) == SOCKET_ERROR) {                 // Never block draining or waking.
+        closesocket(s);                                                             // Close socket.
+        s = INVALID_SOCKET;                                                         // No socket.
+        return 1;                                                                   // Return error code.
+    }
+    return 0;                                                                       // Return no error.
+}
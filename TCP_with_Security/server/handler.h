@@ -0,0 +1,98 @@
+#ifndef HANDLER_H
+#define HANDLER_H
+
+#include <winsock2.h>
+#include <windows.h>
+#include "../common/cipher.h"
+#include "../common/batch.h"
+#include "../common/affinity.h"
+
+#define HANDLER_WORKERS 4                                                           // Number of worker threads running handlers that ask for the pool.
+#define HANDLER_REPLY_SIZE (BUFFER_SIZE - 16)                                       // Size of each reply, leaving room for the stream header and "\r\n".
+
+
+/**
+ *  Structures.
+ */
+enum HandlerStatus {                                                                // What a handler did with a request.
+    HANDLER_DONE,                                                                   // The reply is written.
+    HANDLER_PENDING                                                                 // The reply will be written later, completeRequest() is then called from any thread.
+};
+
+struct HandlerJob;
+
+struct HandlerRequest {                                                             // One decrypted message handed to a handler.
+    const char *payload;                                                            // The message, a view into the job's decrypted frame, not copied or terminated.
+    int         length;                                                             // Number of bytes in payload.
+    int         receivedLength;                                                     // Number of bytes received for the message.
+    char        reply[HANDLER_REPLY_SIZE];                                          // The reply, written by the handler.
+    int         replyLength;                                                        // Number of bytes in reply.
+    HandlerJob *job;                                                                // The job the request belongs to.
+};
+
+struct RequestHandler;
+struct HandlerPool;
+
+struct HandlerJob {                                                                 // A decrypted frame and the replies to its messages, embedded in the session it came from.
+    void          *owner;                                                           // The session the frame came from.
+    int            node;                                                            // The NUMA node the session was allocated on, a worker on that node runs the job if there is one.
+    HandlerPool   *pool;                                                            // The pool the job was submitted to.
+    int            stream;                                                          // The frame's stream, -1 if the client does not use streams.
+    int            batchCount;                                                      // Number of messages packed in the frame, 0 if not batched.
+    char           payload[BUFFER_SIZE + 1];                                        // The decrypted frame, decrypted into place so requests view it without copying.
+    int            payloadLength;                                                   // Number of bytes in payload.
+    HandlerRequest requests[BATCH_MAX_MESSAGES];                                    // One request per message.
+    int            requestCount;                                                    // Number of requests.
+    volatile LONG  requestsLeft;                                                    // Requests yet to complete, plus one held by whoever is running the handler.
+    HandlerJob    *next;                                                            // The next job in the pool's queue.
+};
+
+struct RequestHandler {                                                             // A service run on every decrypted message.
+    const char     *name;                                                           // The name given on the command line.
+    bool            onPool;                                                         // True if run on the worker pool, false if run on the event loop.
+    void           *state;                                                          // The handler's own data.
+    HandlerStatus (*handle)(void *state, HandlerRequest *request);                  // Handles one message, may be called from several threads at once when onPool.
+};
+
+struct HandlerQueue {                                                               // Jobs waiting for the workers of one NUMA node.
+    HandlerJob      *head;                                                          // Oldest job waiting for a worker.
+    HandlerJob      *tail;                                                          // Newest job waiting for a worker.
+    HANDLE           semaphore;                                                     // Released once per job queued, and once per worker to stop.
+    int              workerCount;                                                   // Number of workers taking jobs from the queue.
+    int              idleWorkers;                                                   // Number of them waiting for a job, guarded by the pool's lock.
+};
+
+struct HandlerWorker {                                                              // One worker thread and where it runs.
+    HandlerPool     *pool;                                                          // The pool.
+    HANDLE           thread;                                                        // The thread.
+    int              core;                                                          // The core it is pinned to, -1 if not pinned.
+    int              node;                                                          // The queue it takes jobs from, its core's NUMA node.
+};
+
+struct HandlerPool {                                                                // Worker threads running a handler, and the jobs they have finished.
+    RequestHandler  *handler;                                                       // The handler.
+    int              threadCount;                                                   // Number of worker threads, 0 if the handler runs on the event loop.
+    HandlerWorker   *workers;                                                       // The worker threads.
+    HandlerQueue     queues[MAX_NUMA_NODES];                                        // Jobs waiting, by the NUMA node of their session.
+    int              defaultNode;                                                   // Queue of jobs from nodes with no workers.
+    CRITICAL_SECTION lock;                                                          // Guards the queues and the finished list.
+    HandlerJob      *finishedHead;                                                  // Oldest job finished and waiting for its reply to be sent.
+    HandlerJob      *finishedTail;                                                  // Newest finished job.
+    SOCKET           wakeupSocket;                                                  // Loopback socket written when a job finishes off the event loop, so select() returns.
+    volatile LONG    stopping;                                                      // 1 once the pool is being stopped.
+};
+
+
+/**
+ *  Function declarations.
+ */
+RequestHandler *createRequestHandler(const char *name);                             // Creates a built-in handler by name.
+int             startHandlerPool(HandlerPool &pool, RequestHandler *handler, int threads, AffinityPlan &affinity);    // Starts the pool running a handler, pinning each worker if asked.
+void            stopHandlerPool(HandlerPool &pool);                                 // Stops the workers, once every job has finished.
+int             splitJob(HandlerJob *job, int receivedLength);                      // Splits a job's decrypted frame into one request per message.
+bool            submitJob(HandlerPool &pool, HandlerJob *job);                      // Runs the handler on every request of a job.
+void            completeRequest(HandlerRequest *request);                           // Marks a request's reply as written.
+HandlerJob     *takeFinishedJobs(HandlerPool &pool);                                // Takes every job finished off the event loop.
+int             writeReply(HandlerRequest *request, const char *format, ...);       // Writes a handler's reply.
+
+#endif
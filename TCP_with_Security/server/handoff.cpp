@@ -0,0 +1,379 @@
+#define _WIN32_WINNT 0x600                                                          // QueryFullProcessImageName() and PROCESS_QUERY_LIMITED_INFORMATION, AF_UNIX needs Windows 10 anyway.
+#include "handoff.h"
+#include "session.h"
+#include "../common/copycount.h"
+
+static int  sendRecord(SOCKET s, const void *record, int size);                     // Sends a whole record on a blocking socket.
+static int  receiveRecord(SOCKET s, void *record, int size);                        // Receives a whole record, waiting no longer than HANDOFF_TIMEOUT_MS.
+static bool canHandOff(Session *session);                                           // Checks whether a client is between messages and off shared memory.
+static bool isSameServer(SOCKET s, DWORD processId);                                // Checks that a successor is the process it names, runs this executable and belongs to this user.
+static bool getProcessIdentity(HANDLE process, ProcessIdentity &identity);          // Gets the executable and user of a process.
+static int  findServerKey(Server &server, const long *key);                         // Finds a server key in serverKeys.
+
+
+/**
+ *  Connects to a server waiting on path to be replaced, if there is one.
+ *  Returns error code, the caller then starts afresh.
+ */
+int connectToPredecessor(SOCKET &predecessor, const char *path) {
+
+    predecessor = INVALID_SOCKET;                                                   // No old server yet.
+    if (GetFileAttributes(path) == INVALID_FILE_ATTRIBUTES) {                       // If no server has listened on path.
+        return 1;                                                                   // Return error code, quietly.
+    }
+    return connectUnixSocket(predecessor, path);                                    // Connect, a file left by a crashed server fails here.
+}
+
+
+/**
+ *  Receives the old server's listening sockets and idle clients, then waits for it to let go of them.
+ *  Clients carry on their encrypted channels without a new handshake.
+ *  Until this returns the old server stays blocked, so it runs after everything else is ready.
+ *  Returns error code, the old server then keeps serving.
+ */
+int takeOverServer(Server &server, SOCKET predecessor) {
+
+    HandoffRequest request;                                                         // Names this process and the layout it expects.
+    memset(&request, 0, sizeof(request));                                           // Ensure blank.
+    request.version = HANDOFF_VERSION;                                              // Layout of the records.
+    request.sessionSize = sizeof(HandoffSession);                                   // Size of each client's record.
+    request.processId = GetCurrentProcessId();                                      // Duplicate sockets for this process.
+    HandoffHeader header;                                                           // The listening sockets and number of clients coming.
+    if (sendRecord(predecessor, &request, sizeof(request)) || receiveRecord(predecessor, &header, sizeof(header))) {  // If the old server refused or went away.
+        LOG(LOG_ERROR) << "The old server did not hand off" << endl;                // Alert user.
+        return 1;                                                                   // Return error code.
+    }
+    if (header.sessionCount > MAX_SESSIONS) {                                       // If this build serves fewer clients.
+        LOG(LOG_ERROR) << "The old server has more clients than this one can serve" << endl;    // Alert user.
+        return 1;                                                                   // Return error code.
+    }
+    SOCKET *listeners[] = { &server.s, &server.unixSocket, &server.statsSocket };   // Where each listening socket goes, in HandoffListener flag order.
+    for (int i = 0; i < 3; i++) {                                                   // Loop through listening sockets.
+        if (!(header.listeners & (1 << i))) {                                       // If not handed off.
+            continue;                                                               // Next socket.
+        }
+        WSAPROTOCOL_INFO info;                                                      // The duplicated socket.
+        if (receiveRecord(predecessor, &info, sizeof(info))
+            || (*listeners[i] = WSASocket(FROM_PROTOCOL_INFO, FROM_PROTOCOL_INFO, FROM_PROTOCOL_INFO, &info, 0, 0)) == INVALID_SOCKET) { // If not received or not opened.
+            LOG(LOG_ERROR) << "Listening socket could not be taken over, error " << WSAGetLastError() << endl;   // Alert user.
+            return 2;                                                               // Return error code.
+        }
+        u_long nonBlocking = 1;                                                     // Enables non-blocking mode.
+        ioctlsocket(*listeners[i], FIONBIO, &nonBlocking);                          // Never block in accept(), the event loop waits in select().
+    }
+    for (int i = 0; i < header.sessionCount; i++) {                                 // Loop through clients.
+        HandoffSession record;                                                      // The client's state.
+        SOCKET ns = INVALID_SOCKET;                                                 // The client connection socket.
+        if (receiveRecord(predecessor, &record, sizeof(record)) || record.inputLength < 0 || record.inputLength > BUFFER_SIZE
+            || (ns = WSASocket(FROM_PROTOCOL_INFO, FROM_PROTOCOL_INFO, FROM_PROTOCOL_INFO, &record.socket, 0, 0)) == INVALID_SOCKET) {    // If not received or not opened.
+            LOG(LOG_ERROR) << "Client could not be taken over, error " << WSAGetLastError() << endl;    // Alert user.
+            return 3;                                                               // Return error code.
+        }
+        if (record.keyIndex < 0 || record.keyIndex >= server.serverKeyCount) {      // If this build has no such key.
+            LOG(LOG_ERROR) << "Client could not be taken over, the old server has other keys" << endl;  // Alert user.
+            closesocket(ns);                                                        // Close the communication socket.
+            return 3;                                                               // Return error code.
+        }
+        Session *session = addSession(server, ns, record.clientHost, record.clientService); // Serve client.
+        if (session == NULL) {                                                      // If its state could not be allocated.
+            LOG(LOG_ERROR) << "Client could not be taken over, out of memory" << endl;  // Alert user.
+            closesocket(ns);                                                        // Close the communication socket.
+            return 3;                                                               // Return error code.
+        }
+        session->state = (SessionState)record.state;                                // Carry on from the same stage.
+        session->nOnce = record.nOnce;                                              // Chain from the same nOnce.
+        session->chainMode = (ChainMode)record.chainMode;                           // Same chaining.
+        session->ctrCounter = record.ctrCounter;                                    // Carry on from the same pad.
+        session->compression = record.compression;                                  // Same options.
+        session->batching = record.batching;                                        // Same options.
+        session->multiplexed = record.multiplexed;                                  // Same options.
+        long *key = server.serverKeys[record.keyIndex];                             // The key the client was sent.
+        bool currentKey = memcmp(key, server.keyFrame->key, sizeof(server.keyFrame->key)) == 0; // True if the client was sent the key this server sends.
+        session->keyFrame = currentKey ? acquireKeyFrame(server.keyFrame) : buildKeyFrame(server.encryptKeyCA, key);    // Decrypt with the key the client was sent.
+        session->keyFrameOffset = session->keyFrame->length;                        // The old server sent it.
+        memcpy(session->inputBuffer, record.input, record.inputLength);             // Keep the start of the next frame.
+        session->inputLength = record.inputLength;                                  // Bytes kept.
+        session->queuedBytes = record.inputLength;                                  // Count against client's limit.
+        server.queuedBytes += record.inputLength;                                   // Count against server's limit.
+        session->acceptedAt = metricsClock();                                       // Time the rest of the handshake, if not done.
+        startTimer(server.timers, &session->activityTimer, session->state == SESSION_READY ? IDLE_TIMEOUT_MS : HANDSHAKE_TIMEOUT_MS);   // Idle or handshake deadline, restarted.
+    }
+    char ack = 'A';                                                                 // Tells the old server to let go.
+    if (sendRecord(predecessor, &ack, 1)) {                                         // If it went away.
+        LOG(LOG_ERROR) << "The old server went away during the handoff" << endl;    // Alert user.
+        return 4;                                                                   // Return error code.
+    }
+    receiveRecord(predecessor, &ack, 1);                                            // Wait for it to close, having removed its restart socket's file.
+    closesocket(predecessor);                                                       // Close connection.
+    LOG(LOG_INFO) << "\nTook over the listening sockets and " << header.sessionCount << " clients from the old server" << endl;    // Alert user.
+    return 0;                                                                       // Return no error.
+}
+
+
+/**
+ *  Listens on path for the server that will replace this one.
+ *  Returns error code.
+ */
+int listenForSuccessor(Server &server, const char *path) {
+
+    if (listenUnixSocket(server.restartSocket, path)) {                             // If not listening.
+        return 1;                                                                   // Return error code.
+    }
+    server.restartPath = path;                                                      // Removed once handed off.
+    LOG(LOG_INFO) << "Waiting for a successor on " << path << endl;                 // Alert user.
+    return 0;                                                                       // Return no error.
+}
+
+
+/**
+ *  Accepts a successor and starts draining clients for it.
+ *  Only a successor running this server's executable as this server's user is accepted, as it is given the clients' sockets and chaining state.
+ *  The event loop stops accepting and reading, so every client finishes its current message.
+ *  Returns error code, the server keeps serving if one occurs.
+ */
+int beginHandoff(Server &server) {
+
+    SOCKET ns = accept(server.restartSocket, NULL, NULL);                           // Accept successor.
+    if (ns == INVALID_SOCKET) {                                                     // If it went away.
+        return 1;                                                                   // Return error code.
+    }
+    u_long blocking = 0;                                                            // Disables non-blocking mode.
+    ioctlsocket(ns, FIONBIO, &blocking);                                            // Records are sent and received whole, with select() timeouts.
+    HandoffRequest request;                                                         // The successor's process and layout.
+    if (receiveRecord(ns, &request, sizeof(request)) || request.version != HANDOFF_VERSION || request.sessionSize != (int)sizeof(HandoffSession)) {  // If not a successor this server can hand off to.
+        LOG(LOG_ERROR) << "Successor refused, it expects another handoff layout" << endl;   // Alert user.
+        closesocket(ns);                                                            // Close connection.
+        return 2;                                                                   // Return error code.
+    }
+    if (!isSameServer(ns, request.processId)) {                                     // If another program, or another user's, asks for the clients.
+        LOG(LOG_ERROR) << "Successor refused, process " << request.processId << " is not this server run by this user" << endl;  // Alert user.
+        closesocket(ns);                                                            // Close connection.
+        return 3;                                                                   // Return error code.
+    }
+    server.successor = ns;                                                          // Hand off once clients are idle.
+    server.successorProcess = request.processId;                                    // Duplicate sockets for it.
+    server.handoffStartedAt = GetTickCount();                                       // Start of the drain.
+    LOG(LOG_INFO) << "\nHanding off to process " << request.processId << ", draining clients..." << endl;    // Alert user.
+    return 0;                                                                       // Return no error.
+}
+
+
+/**
+ *  Checks whether every client is idle, with no frames, job or output pending, or the drain time is up.
+ *  Returns true if the handoff should go ahead.
+ */
+bool readyToHandOff(Server &server) {
+
+    if (GetTickCount() - server.handoffStartedAt >= HANDOFF_DRAIN_MS) {             // If the drain time is up.
+        return true;                                                                // Clients still busy are closed.
+    }
+    for (int i = 0; i < server.sessionCount; i++) {                                 // Loop through clients.
+        Session *session = server.sessions[i];                                      // The client.
+        if (session->state != SESSION_CLOSED && (session->frameCount > 0 || session->jobInFlight || hasPendingOutput(session))) { // If still busy.
+            return false;                                                           // Keep draining.
+        }
+    }
+    return true;                                                                    // Every client is idle.
+}
+
+
+/**
+ *  Gives the successor the listening sockets and idle clients, then lets go of them.
+ *  Clients still busy, or on shared memory, are closed and reconnect to the successor.
+ *  Returns error code, the server keeps serving if one occurs.
+ */
+int handOffServer(Server &server) {
+
+    SOCKET listeners[] = { server.s, server.unixSocket, server.statsSocket };       // The listening sockets, in HandoffListener flag order.
+    HandoffHeader header;                                                           // The listening sockets and number of clients coming.
+    memset(&header, 0, sizeof(header));                                             // Ensure blank.
+    for (int i = 0; i < 3; i++) {                                                   // Loop through listening sockets.
+        if (listeners[i] != INVALID_SOCKET) {                                       // If open.
+            header.listeners |= 1 << i;                                             // Hand off.
+        }
+    }
+    for (int i = 0; i < server.sessionCount; i++) {                                 // Loop through clients.
+        server.sessions[i]->handedOff = canHandOff(server.sessions[i]) && findServerKey(server, server.sessions[i]->keyFrame->key) >= 0;    // Decide once, the records must match the count.
+        header.sessionCount += server.sessions[i]->handedOff ? 1 : 0;               // Count client.
+    }
+    int error = sendRecord(server.successor, &header, sizeof(header));              // Send header.
+    for (int i = 0; i < 3 && !error; i++) {                                         // Loop through listening sockets.
+        WSAPROTOCOL_INFO info;                                                      // The socket, duplicated for the successor.
+        if (listeners[i] != INVALID_SOCKET
+            && (WSADuplicateSocket(listeners[i], server.successorProcess, &info) == SOCKET_ERROR || sendRecord(server.successor, &info, sizeof(info)))) {  // If not duplicated or not sent.
+            error = 1;                                                              // Stop.
+        }
+    }
+    HandoffSession record;                                                          // One client's state.
+    for (int i = 0; i < server.sessionCount && !error; i++) {                       // Loop through clients.
+        Session *session = server.sessions[i];                                      // The client.
+        if (!session->handedOff) {                                                  // If not handed off.
+            continue;                                                               // Next client.
+        }
+        memset(&record, 0, sizeof(record));                                         // Ensure blank.
+        record.state = session->state;                                              // Stage reached.
+        strcpy(record.clientHost, session->clientHost);                             // Client's IP address.
+        strcpy(record.clientService, session->clientService);                       // Client's port number.
+        record.nOnce = session->nOnce;                                              // Chaining.
+        record.chainMode = session->chainMode;                                      // Chaining.
+        record.ctrCounter = session->ctrCounter;                                    // Chaining.
+        record.compression = session->compression;                                  // Options.
+        record.batching = session->batching;                                        // Options.
+        record.multiplexed = session->multiplexed;                                  // Options.
+        record.keyIndex = findServerKey(server, session->keyFrame->key);            // The key the client was sent, by its place in serverKeys.
+        memcpy(record.input, session->inputBuffer, session->inputLength);           // The start of the next frame.
+        record.inputLength = session->inputLength;                                  // Bytes kept.
+        if (WSADuplicateSocket(session->ns, server.successorProcess, &record.socket) == SOCKET_ERROR || sendRecord(server.successor, &record, sizeof(record))) {    // If not duplicated or not sent.
+            error = 2;                                                              // Stop.
+        }
+    }
+    char ack = 0;                                                                   // The successor's go-ahead.
+    if (!error && (receiveRecord(server.successor, &ack, 1) || ack != 'A')) {       // If it did not take everything.
+        error = 3;                                                                  // Stop.
+    }
+    if (error) {                                                                    // If the handoff failed.
+        LOG(LOG_ERROR) << "Handoff failed, error " << error << ", serving clients again" << endl;   // Alert user.
+        for (int i = 0; i < server.sessionCount; i++) {                             // Loop through clients.
+            server.sessions[i]->handedOff = false;                                  // Still this server's.
+        }
+        closesocket(server.successor);                                              // Close connection.
+        server.successor = INVALID_SOCKET;                                          // Accept and read again.
+        return error;                                                               // Return error code.
+    }
+    for (int i = 0; i < 3; i++) {                                                   // Loop through listening sockets.
+        if (listeners[i] != INVALID_SOCKET) {                                       // If open.
+            closesocket(listeners[i]);                                              // The successor's copy stays open.
+        }
+    }
+    server.s = server.unixSocket = server.statsSocket = INVALID_SOCKET;             // No longer listening, the successor removes the AF_UNIX file.
+    for (int i = 0; i < server.sessionCount; i++) {                                 // Loop through clients.
+        closeSession(server.sessions[i]);                                           // Let go of client, or disconnect it if busy.
+    }
+    closesocket(server.restartSocket);                                              // Stop listening for successors.
+    DeleteFile(server.restartPath);                                                 // Free the path for the successor's own.
+    server.restartSocket = INVALID_SOCKET;                                          // Not listening.
+    closesocket(server.successor);                                                  // Tell the successor the path is free.
+    server.successor = INVALID_SOCKET;                                              // Done.
+    LOG(LOG_INFO) << "\nHanded off the listening sockets and " << header.sessionCount << " of " << server.sessionCount << " clients" << endl;    // Alert user.
+    return 0;                                                                       // Return no error.
+}
+
+
+/**
+ *  Sends a whole record on a blocking socket.
+ *  Returns error code.
+ */
+static int sendRecord(SOCKET s, const void *record, int size) {
+
+    const char *bytes = (const char *)record;                                       // The unsent bytes.
+    while (size > 0) {                                                              // Until all sent.
+        int sent = send(s, bytes, size, 0);                                         // Send.
+        if (sent == SOCKET_ERROR) {                                                 // If connection ended.
+            return 1;                                                               // Return error code.
+        }
+        bytes += sent;                                                              // Move past sent bytes.
+        size -= sent;                                                               // Fewer left.
+    }
+    return 0;                                                                       // Return no error.
+}
+
+
+/**
+ *  Receives a whole record, waiting no longer than HANDOFF_TIMEOUT_MS for it.
+ *  Returns error code, also when the other side closes.
+ */
+static int receiveRecord(SOCKET s, void *record, int size) {
+
+    char *bytes = (char *)record;                                                   // Where the next bytes go.
+    DWORD deadline = GetTickCount() + HANDOFF_TIMEOUT_MS;                           // Give up after this.
+    while (size > 0) {                                                              // Until all received.
+        long timeout = (long)(deadline - GetTickCount());                           // Time left.
+        if (timeout <= 0) {                                                         // If out of time.
+            return 1;                                                               // Return error code.
+        }
+        fd_set readSet;                                                             // The socket.
+        FD_ZERO(&readSet);                                                          // Ensure blank.
+        FD_SET(s, &readSet);                                                        // Wait for bytes.
+        struct timeval wait = { timeout / 1000, (timeout % 1000) * 1000 };          // The timeout in select() format.
+        if (select(0, &readSet, NULL, NULL, &wait) <= 0) {                          // If timed out or failed.
+            return 1;                                                               // Return error code.
+        }
+        int received = recv(s, bytes, size, 0);                                     // Receive.
+        if (received == SOCKET_ERROR || received == 0) {                            // If connection ended.
+            return 2;                                                               // Return error code.
+        }
+        bytes += received;                                                          // Move past received bytes.
+        size -= received;                                                           // Fewer left.
+    }
+    return 0;                                                                       // Return no error.
+}
+
+
+/**
+ *  Checks that the successor on a restart socket is the process it names, runs this server's executable and belongs to this server's user.
+ *  The process is read from the socket itself, so a peer cannot name another process to pass the check.
+ *  Returns true if it is.
+ */
+static bool isSameServer(SOCKET s, DWORD processId) {
+
+    DWORD peerId = 0;                                                               // The process at the other end of the socket.
+    DWORD returned = 0;                                                             // Bytes written to peerId.
+    if (WSAIoctl(s, SIO_AF_UNIX_GETPEERPID, NULL, 0, &peerId, sizeof(peerId), &returned, NULL, NULL) == SOCKET_ERROR || peerId != processId) {  // If the peer is not the process it names.
+        return false;                                                               // Refuse.
+    }
+    HANDLE process = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, processId);  // The successor.
+    if (process == NULL) {                                                          // If it cannot be looked at.
+        return false;                                                               // Refuse.
+    }
+    ProcessIdentity own;                                                            // This server's executable and user.
+    ProcessIdentity peer;                                                           // The successor's.
+    bool same = getProcessIdentity(GetCurrentProcess(), own) && getProcessIdentity(process, peer)
+        && _stricmp(own.image, peer.image) == 0 && EqualSid(own.user.User.Sid, peer.user.User.Sid);    // True if the same executable and user.
+    CloseHandle(process);                                                           // Free handle.
+    return same;                                                                    // Return whether the same.
+}
+
+
+/**
+ *  Gets the executable and user of a process.
+ *  Returns true if both were found.
+ */
+static bool getProcessIdentity(HANDLE process, ProcessIdentity &identity) {
+
+    DWORD imageSize = sizeof(identity.image);                                       // Room for the path.
+    DWORD userSize = 0;                                                             // Bytes of user written.
+    HANDLE token = NULL;                                                            // The process's access token.
+    bool found = QueryFullProcessImageName(process, 0, identity.image, &imageSize)  // Get the executable,
+        && OpenProcessToken(process, TOKEN_QUERY, &token)                           // open the token,
+        && GetTokenInformation(token, TokenUser, identity.userBuffer, sizeof(identity.userBuffer), &userSize);    // and get its user.
+    if (token != NULL) {                                                            // If the token was opened.
+        CloseHandle(token);                                                         // Free handle.
+    }
+    return found;                                                                   // Return whether found.
+}
+
+
+/**
+ *  Finds a server key in serverKeys, so a successor running the same executable can be told which key a client was sent without sending the key.
+ *  Returns its index, -1 if not found.
+ */
+static int findServerKey(Server &server, const long *key) {
+
+    for (int i = 0; i < server.serverKeyCount; i++) {                               // Loop through keys.
+        if (memcmp(server.serverKeys[i], key, sizeof(server.serverKeys[i])) == 0) { // If the same key.
+            return i;                                                               // Return its index.
+        }
+    }
+    return -1;                                                                      // Not found.
+}
+
+
+/**
+ *  Checks whether a client is between messages and off shared memory, so its socket and state are all it has.
+ *  Returns true if it can be handed off.
+ */
+static bool canHandOff(Session *session) {
+
+    return session->state != SESSION_CLOSED && session->shared == NULL && session->pendingShared == NULL
+        && session->frameCount == 0 && !session->jobInFlight && !hasPendingOutput(session) && session->messagesInFlight == 0;
+}
@@ -0,0 +1,69 @@
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+#include "server.h"
+#include <afunix.h>
+
+#define HANDOFF_VERSION 3                                                           // Layout of the records below, a successor with another layout is refused.
+#define HANDOFF_DRAIN_MS 2000                                                       // Time the old server waits for clients to finish their current message before handing off.
+#define HANDOFF_POLL_MS 10                                                          // Longest wait in select() while draining.
+#define HANDOFF_TIMEOUT_MS 5000                                                     // Time either side waits for the other's next record.
+#define HANDOFF_USER_SIZE 128                                                       // Room for a token's user and its SID, SECURITY_MAX_SID_SIZE is 68 bytes.
+
+
+/**
+ *  Structures.
+ */
+enum HandoffListener {                                                              // Flags naming the listening sockets handed off.
+    HANDOFF_TCP = 1,                                                                // The client port.
+    HANDOFF_UNIX = 2,                                                               // The AF_UNIX socket for clients on this host.
+    HANDOFF_STATS = 4                                                               // The metrics port.
+};
+
+struct HandoffRequest {                                                             // Sent by the new server once connected to the old one.
+    int   version;                                                                  // HANDOFF_VERSION.
+    int   sessionSize;                                                              // sizeof(HandoffSession), catches builds whose records differ.
+    DWORD processId;                                                                // The new server, sockets are duplicated for it.
+};
+
+struct HandoffHeader {                                                              // Sent by the old server once its clients are idle.
+    int listeners;                                                                  // HandoffListener flags, one WSAPROTOCOL_INFO follows for each in flag order.
+    int sessionCount;                                                               // Number of HandoffSession records following them.
+};
+
+struct HandoffSession {                                                             // One idle client, everything needed to carry on its encrypted channel.
+    WSAPROTOCOL_INFO socket;                                                        // The connection, duplicated for the new server.
+    int          state;                                                             // SessionState reached.
+    char         clientHost[NI_MAXHOST];                                            // The client's IP address.
+    char         clientService[NI_MAXSERV];                                         // The client's port number.
+    long         nOnce;                                                             // The nOnce agreed, every message is chained from it.
+    int          chainMode;                                                         // ChainMode agreed.
+    long long    ctrCounter;                                                        // Symbols received in counter mode, the next message's pads follow them.
+    bool         compression;                                                       // True if compression was agreed.
+    bool         batching;                                                          // True if batching was agreed.
+    bool         multiplexed;                                                       // True if streams were agreed.
+    int          keyIndex;                                                          // The server key the client was sent, an index into serverKeys so the private key never leaves the process.
+    int          inputLength;                                                       // Number of bytes in input.
+    char         input[BUFFER_SIZE];                                                // Bytes received that do not yet form a complete frame.
+};
+
+struct ProcessIdentity {                                                            // What a successor must share with the old server.
+    char image[MAX_PATH];                                                           // The full path of the executable.
+    union {                                                                         // The user, with room for the SID it points at.
+        TOKEN_USER user;                                                            // The user the process runs as.
+        char       userBuffer[HANDOFF_USER_SIZE];                                   // Room for the user's SID after it.
+    };
+};
+
+
+/**
+ *  Function declarations.
+ */
+int  connectToPredecessor(SOCKET &predecessor, const char *path);                   // Connects to a server waiting on path to be replaced, if there is one.
+int  takeOverServer(Server &server, SOCKET predecessor);                            // Receives the old server's listening sockets and idle clients.
+int  listenForSuccessor(Server &server, const char *path);                          // Listens on path for the server that will replace this one.
+int  beginHandoff(Server &server);                                                  // Accepts a successor and starts draining clients for it.
+bool readyToHandOff(Server &server);                                                // Checks whether every client is idle, or the drain time is up.
+int  handOffServer(Server &server);                                                 // Gives the successor the listening sockets and idle clients.
+
+#endif
@@ -0,0 +1,150 @@
+#define _WIN32_WINNT 0x501
+#include <winsock2.h>
+#include <windows.h>
+#include <string.h>
+#include "kvhandler.h"
+#include "../common/copycount.h"
+
+static int          nextWord(const char *text, int length, int &offset, const char *&word);    // Reads the next space separated word.
+static unsigned int hashKey(const char *key, int length);                           // Hashes a key.
+static KvEntry     *findEntry(KvEntry *entry, const char *key, int length);         // Finds a key in a bucket's chain.
+
+
+/**
+ *  Creates an empty store.
+ *  Returns the store.
+ */
+void *createKvStore() {
+
+    KvStore *store = new KvStore;                                                   // The store.
+    memset(store->buckets, 0, sizeof(store->buckets));                              // Every bucket empty.
+    store->entryCount = 0;                                                          // No keys.
+    for (int i = 0; i < KV_LOCKS; i++) {                                            // Loop through locks.
+        InitializeCriticalSection(&store->locks[i]);                                // Prepare lock.
+    }
+    return store;                                                                   // Return the store.
+}
+
+
+/**
+ *  Runs one command, read straight from the decrypted message:
+ *  "GET key" replies "VALUE value" or "NOT_FOUND", "SET key value" replies "OK", "DEL key" replies "OK" or "NOT_FOUND".
+ *  The value is the rest of the message, spaces included. Anything else replies "ERROR" and a reason.
+ *  Returns HANDLER_DONE.
+ */
+HandlerStatus handleKvRequest(void *state, HandlerRequest *request) {
+
+    KvStore *store = (KvStore *)state;                                              // The store.
+    int offset = 0;                                                                 // Index of the next word.
+    const char *command = NULL;                                                     // The command.
+    const char *key = NULL;                                                         // The key.
+    int commandLength = nextWord(request->payload, request->length, offset, command);   // Read command.
+    int keyLength = nextWord(request->payload, request->length, offset, key);       // Read key.
+    if (commandLength != 3 || (memcmp(command, "GET", 3) != 0 && memcmp(command, "SET", 3) != 0 && memcmp(command, "DEL", 3) != 0)) {  // If not a command.
+        writeReply(request, "ERROR unknown command");                               // Alert client.
+        return HANDLER_DONE;                                                        // Reply written.
+    }
+    if (keyLength == 0 || keyLength > KV_MAX_KEY) {                                 // If no key or too long.
+        writeReply(request, "ERROR bad key");                                       // Alert client.
+        return HANDLER_DONE;                                                        // Reply written.
+    }
+    const char *value = &request->payload[offset];                                  // The value, the rest of the message.
+    int valueLength = request->length - offset;                                     // Length of the value.
+    unsigned int bucket = hashKey(key, keyLength) & (KV_BUCKETS - 1);               // The key's bucket.
+    CRITICAL_SECTION *lock = &store->locks[bucket % KV_LOCKS];                      // The bucket's lock.
+    if (command[0] == 'G') {                                                        // If a GET.
+        EnterCriticalSection(lock);                                                 // Lock bucket.
+        KvEntry *entry = findEntry(store->buckets[bucket], key, keyLength);         // Find key.
+        if (entry != NULL) {                                                        // If stored.
+            writeReply(request, "VALUE %.*s", entry->valueLength, entry->value);    // Reply with value.
+        } else {                                                                    // Else not stored.
+            writeReply(request, "NOT_FOUND");                                       // Alert client.
+        }
+        LeaveCriticalSection(lock);                                                 // Unlock bucket.
+    } else if (command[0] == 'S') {                                                 // Else if a SET.
+        if (valueLength > KV_MAX_VALUE) {                                           // If value too long.
+            writeReply(request, "ERROR value too long");                            // Alert client.
+            return HANDLER_DONE;                                                    // Reply written.
+        }
+        EnterCriticalSection(lock);                                                 // Lock bucket.
+        KvEntry *entry = findEntry(store->buckets[bucket], key, keyLength);         // Find key.
+        if (entry == NULL && InterlockedIncrement(&store->entryCount) <= KV_MAX_ENTRIES) {  // If a new key and there is room.
+            entry = new KvEntry;                                                    // The new entry.
+            entry->keyLength = keyLength;                                           // Store key.
+            memcpy(entry->key, key, keyLength);                                     // Store key.
+            entry->next = store->buckets[bucket];                                   // Add to the front of the chain.
+            store->buckets[bucket] = entry;                                         // Add to the front of the chain.
+        } else if (entry == NULL) {                                                 // Else if a new key and the store is full.
+            InterlockedDecrement(&store->entryCount);                               // Not added.
+        }
+        if (entry != NULL) {                                                        // If stored or added.
+            entry->valueLength = valueLength;                                       // Store value.
+            memcpy(entry->value, value, valueLength);                               // Store value.
+            writeReply(request, "OK");                                              // Alert client.
+        } else {                                                                    // Else full.
+            writeReply(request, "ERROR store full");                                // Alert client.
+        }
+        LeaveCriticalSection(lock);                                                 // Unlock bucket.
+    } else {                                                                        // Else a DEL.
+        EnterCriticalSection(lock);                                                 // Lock bucket.
+        KvEntry **link = &store->buckets[bucket];                                   // The link to the entry checked.
+        while (*link != NULL && ((*link)->keyLength != keyLength || memcmp((*link)->key, key, keyLength) != 0)) {  // Until the key is found.
+            link = &(*link)->next;                                                  // Next entry.
+        }
+        KvEntry *entry = *link;                                                     // The entry, NULL if not stored.
+        if (entry != NULL) {                                                        // If stored.
+            *link = entry->next;                                                    // Remove from chain.
+            InterlockedDecrement(&store->entryCount);                               // Count removal.
+        }
+        LeaveCriticalSection(lock);                                                 // Unlock bucket.
+        writeReply(request, entry != NULL ? "OK" : "NOT_FOUND");                    // Alert client.
+        delete entry;                                                               // Free memory.
+    }
+    return HANDLER_DONE;                                                            // Reply written.
+}
+
+
+/**
+ *  Reads the next space separated word, offset is moved past it and the space after it.
+ *  Returns word length, 0 if there are no words left.
+ */
+static int nextWord(const char *text, int length, int &offset, const char *&word) {
+
+    int start = offset;                                                             // Start of the word.
+    while (offset < length && text[offset] != ' ') {                                // Until the end of the word.
+        offset++;                                                                   // Next character.
+    }
+    word = &text[start];                                                            // The word.
+    int wordLength = offset - start;                                                // Its length.
+    if (offset < length) {                                                          // If a space follows.
+        offset++;                                                                   // Move past it.
+    }
+    return wordLength;                                                              // Return word length.
+}
+
+
+/**
+ *  Hashes a key with FNV-1a.
+ *  Returns the hash.
+ */
+static unsigned int hashKey(const char *key, int length) {
+
+    unsigned int hash = 2166136261u;                                                // FNV offset basis.
+    for (int i = 0; i < length; i++) {                                              // Loop through key.
+        hash = (hash ^ (unsigned char)key[i]) * 16777619u;                          // Mix in byte.
+    }
+    return hash;                                                                    // Return hash.
+}
+
+
+/**
+ *  Finds a key in a bucket's chain, the bucket's lock must be held.
+ *  Returns the entry, NULL if not stored.
+ */
+static KvEntry *findEntry(KvEntry *entry, const char *key, int length) {
+
+    while (entry != NULL && (entry->keyLength != length || memcmp(entry->key, key, length) != 0)) {    // Until the key is found.
+        entry = entry->next;                                                        // Next entry.
+    }
+    return entry;                                                                   // Return entry, NULL if not found.
+}
@@ -0,0 +1,37 @@
+#ifndef KVHANDLER_H
+#define KVHANDLER_H
+
+#include "handler.h"
+
+#define KV_BUCKETS 4096                                                             // Number of hash buckets, a power of 2.
+#define KV_LOCKS 64                                                                 // Number of locks, bucket b is guarded by lock b % KV_LOCKS so workers rarely contend.
+#define KV_MAX_KEY 64                                                               // Longest key stored.
+#define KV_MAX_VALUE 256                                                            // Longest value stored.
+#define KV_MAX_ENTRIES 65536                                                        // Most keys stored, SETs of new keys fail after that.
+
+
+/**
+ *  Structures.
+ */
+struct KvEntry {                                                                    // One key and its value.
+    KvEntry *next;                                                                  // The next entry in the same bucket.
+    int      keyLength;                                                             // Number of bytes in key.
+    int      valueLength;                                                           // Number of bytes in value.
+    char     key[KV_MAX_KEY];                                                       // The key.
+    char     value[KV_MAX_VALUE];                                                   // The value.
+};
+
+struct KvStore {                                                                    // An in-memory key-value store shared by every worker.
+    KvEntry         *buckets[KV_BUCKETS];                                           // Chains of entries, by hash of key.
+    CRITICAL_SECTION locks[KV_LOCKS];                                               // Striped bucket locks.
+    volatile LONG    entryCount;                                                    // Number of keys stored.
+};
+
+
+/**
+ *  Function declarations.
+ */
+void         *createKvStore();                                                      // Creates an empty store.
+HandlerStatus handleKvRequest(void *state, HandlerRequest *request);                // Runs one GET, SET or DEL command.
+
+#endif
@@ -1,6 +1,6 @@
-#include "server.h"
-
-enum { KEY_E, KEY_D, KEY_N };                                                       // Used to access values in key arrays.
+#include "session.h"
+#include "handoff.h"
+#include "../common/copycount.h"
 
 
 /**
@@ -9,28 +9,149 @@ enum { KEY_E, KEY_D, KEY_N };
 int main(int argc, char *argv[]) {
 
     cout << "<<< TCP (CROSS-PLATFORM, IPv6-ready) SERVER, by Cai and Steve >>>" << endl;
+    startLogger(argc > 3 ? parseLogLevel(argv[3]) : LOG_INFO);                      // Write console output from a background thread.
 
     SOCKET s = INVALID_SOCKET;                                                      // The listening socket.
+    SOCKET predecessor = INVALID_SOCKET;                                            // The server being replaced, if one waits on the restart path.
 
-    int error = tcpConnect(s, argc, argv);                                          // Open the listening socket.
+    int error = startWSA();                                                         // Start winsock.
     if (error) {                                                                    // If error occurred.
         return error;                                                               // Return error code.
     }
+    if (argc > 8 && argv[8][0] != '\0' && connectToPredecessor(predecessor, argv[8]) == 0) {  // If an old server is waiting to be replaced.
+        LOG(LOG_INFO) << "Taking over from the server waiting on " << argv[8] << endl;  // Alert user, its listening sockets are used.
+    } else {                                                                        // Else starting afresh.
+        error = tcpConnect(s, argc, argv);                                          // Open the listening socket.
+        if (error) {                                                                // If error occurred.
+            return error;                                                           // Return error code.
+        }
+    }
 
     long encryptKeyCA[3] = { 4297, 4633, 7171 };                                    // The key used to encrypt/decrypt Certification Authority messages: { e, d, n }.
-    long encryptKeyServer[3] = { 13, 6397, 41989 };                                 // The key used to encrypt/decrypt server messages: { e, d, n }.
+    long serverKeys[][3] = { { 13, 6397, 41989 }, { 3, 16971, 25777 } };           // The keys used to encrypt/decrypt server messages: { e, d, n }, the first is used until rotated.
     // Possible keys: { 3, 1595, 2491 }; { 4297, 4633, 7171 }; { 13, 6397, 41989 }; { 3, 16971, 25777 };
-    while (1) {                                                                     // Loop infinitely.
-        error = communicateWithNewClient(s, encryptKeyCA, encryptKeyServer);        // Connect with new client and communicate over encrypted channel.
-        if (error) {                                                                // If error occurred.
-            closesocket(s);                                                         // Close listening socket.
-            WSACleanup();                                                           // Cleanup winsock.
-            return error;                                                           // Return error code.
+    AffinityPlan affinity;                                                          // The cores threads are pinned to.
+    affinity.count = 0;                                                             // Not pinned unless a list is given.
+    if (argc > 7 && argv[7][0] != '\0' && (parseAffinityList(argv[7], affinity) || pinThread(GetCurrentThread(), eventLoopCore(affinity)))) {   // If a list is given that cannot be used.
+        LOG(LOG_ERROR) << "Cores could not be pinned, give a list such as 0,2,4-7 of cores this process may use" << endl;   // Alert user.
+        flushLog();                                                                 // Show the error before exiting.
+        return 18;                                                                  // Return error code.
+    }
+    for (int i = 0; i < affinity.count; i++) {                                      // Loop through cores.
+        if (nodeOfCore(affinity.cores[i]) >= MAX_NUMA_NODES || pinThread(GetCurrentThread(), affinity.cores[i])) {  // If a worker could not be pinned there.
+            LOG(LOG_ERROR) << "Core " << affinity.cores[i] << " could not be used" << endl; // Alert user.
+            flushLog();                                                             // Show the error before exiting.
+            return 18;                                                              // Return error code.
+        }
+    }
+    pinThread(GetCurrentThread(), eventLoopCore(affinity));                         // The event loop, which also decrypts, stays on the first core.
+    int node = nodeOfCore(eventLoopCore(affinity));                                 // The event loop's node, -1 if not pinned.
+    Server *server = (Server *)allocateOnNode(sizeof(Server), node);                // The event loop state, zeroed, too large for the stack and on the event loop's node.
+    if (server == NULL) {                                                           // If it could not be allocated.
+        LOG(LOG_ERROR) << "Server state could not be allocated" << endl;            // Alert user.
+        flushLog();                                                                 // Show the error before exiting.
+        return 24;                                                                  // Return error code.
+    }
+    server->affinity = affinity;                                                    // Pin workers to the rest of the cores.
+    server->node = node;                                                            // Allocate sessions on the event loop's node.
+    if (affinity.count > 0) {                                                       // If pinned.
+        LOG(LOG_INFO) << "Event loop pinned to core " << eventLoopCore(affinity) << ", NUMA node " << node << " of " << numaNodeCount() << endl;   // Alert user.
+    }
+    server->s = s;                                                                  // Serve clients from the listening socket.
+    server->unixSocket = INVALID_SOCKET;                                            // Not listening on AF_UNIX unless a path is given.
+    server->statsSocket = INVALID_SOCKET;                                           // Not serving metrics until started or taken over.
+    server->restartSocket = INVALID_SOCKET;                                         // Not listening for a successor unless a path is given.
+    server->successor = INVALID_SOCKET;                                             // Not handing off.
+    server->encryptKeyCA = encryptKeyCA;                                            // Use the CA key.
+    server->serverKeys = serverKeys;                                                // Use the server keys.
+    server->serverKeyCount = sizeof(serverKeys) / sizeof(serverKeys[0]);            // Number of server keys.
+    initTimerWheel(server->timers, GetTickCount());                                 // Start the clock for client timeouts.
+    initRsaTables();                                                                // Give small keys lookup tables.
+    rotateServerKey(*server, 0);                                                    // Build the handshake frame for the first key.
+    if (KEY_ROTATION_MS > 0) {                                                      // If keys are rotated.
+        initTimer(&server->keyRotationTimer, expireKeyRotationTimer, server);       // Prepare rotation timer.
+        startTimer(server->timers, &server->keyRotationTimer, KEY_ROTATION_MS);     // Rotate later.
+    }
+    initMetrics();                                                                  // Prepare the metrics registry.
+    if (predecessor == INVALID_SOCKET) {                                            // If not taking over the old server's metrics port.
+        startStatsEndpoint(*server, argc, argv);                                    // Serve metrics, the server runs without them if this fails.
+    }
+    if (argc > 4 && argv[4][0] != '\0') {                                           // If a trace file is given.
+        startTracing(argv[4], TRACE_SAMPLE_EVERY);                                  // Trace a sample of clients.
+        LOG(LOG_INFO) << "Tracing one client in " << TRACE_SAMPLE_EVERY << " to " << argv[4] << endl;  // Alert user.
+    }
+    if (argc > 9 && argv[9][0] != '\0') {                                           // If a capture file is given.
+        if (startCapture(argv[9])) {                                                // If it could not be opened.
+            flushLog();                                                             // Show the error before exiting.
+            return 21;                                                              // Return error code.
         }
+        LOG(LOG_INFO) << "Capturing received frames to " << argv[9] << endl;        // Alert user.
+    }
+    if (parseClassWeights(argc > 10 && argv[10][0] != '\0' ? argv[10] : DEFAULT_CLASS_WEIGHTS, server->scheduler)) {   // If the weights cannot be used.
+        LOG(LOG_ERROR) << "Class weights could not be used, give the interactive and bulk weights such as " << DEFAULT_CLASS_WEIGHTS << endl;  // Alert user.
+        flushLog();                                                                 // Show the error before exiting.
+        return 22;                                                                  // Return error code.
+    }
+    LOG(LOG_INFO) << "Serving interactive and bulk clients with weights " << server->scheduler.weights[CLASS_INTERACTIVE] << " and " << server->scheduler.weights[CLASS_BULK] << endl;    // Alert user.
+    RequestHandler *handler = createRequestHandler(argc > 5 ? argv[5] : DEFAULT_HANDLER);  // The handler run on every decrypted message.
+    if (handler == NULL || startHandlerPool(server->handlers, handler, HANDLER_WORKERS, server->affinity)) {  // If not known or could not be started.
+        LOG(LOG_ERROR) << "Handler could not be started, the handlers are echo and kv" << endl; // Alert user.
+        flushLog();                                                                 // Show the error before exiting.
+        return 16;                                                                  // Return error code.
+    }
+    LOG(LOG_INFO) << "Running the " << handler->name << " handler" << (server->handlers.threadCount > 0 ? " on the worker pool" : "") << endl;    // Alert user.
+    if (argc > 11 && argv[11][0] != '\0') {                                         // If a journal file is given.
+        int commitMs = DEFAULT_COMMIT_MS;                                           // Longest time a message waits to share its sync.
+        int commitBytes = DEFAULT_COMMIT_BYTES;                                     // Bytes of messages that make a group sync early.
+        if (argc > 12 && argv[12][0] != '\0' && parseCommitPolicy(argv[12], commitMs, commitBytes)) {    // If the policy cannot be used.
+            LOG(LOG_ERROR) << "Commit policy could not be used, give the interval in milliseconds and the group size in bytes such as " << DEFAULT_COMMIT_MS << "," << DEFAULT_COMMIT_BYTES << endl;  // Alert user.
+            flushLog();                                                             // Show the error before exiting.
+            return 23;                                                              // Return error code.
+        }
+        if (startJournal(argv[11], commitMs, commitBytes, server->handlers.wakeupSocket)) {  // If it could not be opened.
+            flushLog();                                                             // Show the error before exiting.
+            return 23;                                                              // Return error code.
+        }
+        LOG(LOG_INFO) << "Journaling messages to " << argv[11] << ", synced every " << commitMs << " ms or " << commitBytes << " bytes, replies wait for their sync" << endl;  // Alert user.
+    }
+    initTransport();                                                                // Prepare for shared-memory clients.
+    if (predecessor != INVALID_SOCKET && takeOverServer(*server, predecessor)) {    // If the old server's sockets and clients could not be taken over.
+        flushLog();                                                                 // Show the error before exiting.
+        return 19;                                                                  // Return error code, the old server keeps serving.
+    }
+    if (argc > 6 && argv[6][0] != '\0' && server->unixSocket == INVALID_SOCKET) {   // If an AF_UNIX path is given and not taken over.
+        if (listenUnixSocket(server->unixSocket, argv[6])) {                        // If not listening.
+            flushLog();                                                             // Show the error before exiting.
+            return 17;                                                              // Return error code.
+        }
+        LOG(LOG_INFO) << "Listening for local clients on " << UNIX_ADDRESS_PREFIX << argv[6] << endl;   // Alert user.
+    }
+    if (argc > 8 && argv[8][0] != '\0' && listenForSuccessor(*server, argv[8])) {   // If a restart path is given that cannot be listened on.
+        flushLog();                                                                 // Show the error before exiting.
+        return 20;                                                                  // Return error code.
     }
-    closesocket(s);                                                                 // Close listening socket.
+    error = runServer(*server);                                                     // Serve clients until a fatal error occurs.
+    stopJournal();                                                                  // Sync the last journaled messages, before the wakeup socket closes.
+    stopHandlerPool(server->handlers);                                              // Stop the workers.
+    stopCapture();                                                                  // Write the last captured frames.
+    if (server->statsSocket != INVALID_SOCKET) {                                    // If serving metrics.
+        closesocket(server->statsSocket);                                           // Close metrics listening socket.
+    }
+    if (server->unixSocket != INVALID_SOCKET) {                                     // If listening on AF_UNIX, and not handed off.
+        closesocket(server->unixSocket);                                            // Close AF_UNIX listening socket.
+        DeleteFile(argv[6]);                                                        // Remove its file.
+    }
+    if (server->restartSocket != INVALID_SOCKET) {                                  // If listening for a successor.
+        closesocket(server->restartSocket);                                         // Close restart socket.
+        DeleteFile(argv[8]);                                                        // Remove its file.
+    }
+    if (server->s != INVALID_SOCKET) {                                              // If not handed off.
+        closesocket(server->s);                                                     // Close listening socket.
+    }
+    releaseKeyFrame(server->keyFrame);                                              // Free the handshake frame once no client holds it.
+    freeOnNode(server);                                                             // Free memory.
     WSACleanup();                                                                   // Cleanup winsock.
-    return 0;                                                                       // Return no error.
+    return error;                                                                   // Return error code if any.
 }
 
 
@@ -40,14 +161,10 @@ int main(int argc, char *argv[]) {
  */
 int tcpConnect(SOCKET &s, int argc, char *argv[]) {
 
-    int error = startWSA();                                                         // Start winsock.
-    if (error) {                                                                    // If error occurred.
-        return error;                                                               // Return error code.
-    }
     struct addrinfo *result;                                                        // Stores address info of server.
     char portNum[NI_MAXSERV];                                                       // Stores the port number of the listening socket.
     memset(&portNum, 0, NI_MAXSERV);                                                // Ensure blank.
-    error = getServerAddressInfo(result, argc, argv, portNum);                      // Get address info of server.
+    int error = getServerAddressInfo(result, argc, argv, portNum);                  // Get address info of server.
     if (error) {                                                                    // If error occurred.
         return error;                                                               // Return error code.
     }
@@ -76,16 +193,16 @@ int startWSA() {
     WSADATA wsadata;                                                                // Stores WSA data.
     int error = WSAStartup(WSVERS, &wsadata);                                       // Start winsock.
     if (error != 0) {                                                               // Check for error.
-        cout << "WSAStartup failed with error: " << error << endl;                  // Alert user.
+        LOG(LOG_ERROR) << "WSAStartup failed with error: " << error << endl;        // Alert user.
         WSACleanup();                                                               // Cleanup winsock.
         return 1;                                                                   // Return error code.
     }
     if (LOBYTE(wsadata.wVersion) != 2 || HIBYTE(wsadata.wVersion) != 2) {           // If not using correct version of winsock.
-        cout << "Could not find a usable version of Winsock.dll" << endl;           // Alert user.
+        LOG(LOG_ERROR) << "Could not find a usable version of Winsock.dll" << endl; // Alert user.
         WSACleanup();                                                               // Cleanup winsock.
         return 2;                                                                   // Return error code.
     }
-    cout << "\nThe Winsock 2.2 dll was initialised." << endl;                       // Alert user.
+    LOG(LOG_INFO) << "\nThe Winsock 2.2 dll was initialised." << endl;              // Alert user.
     return 0;                                                                       // Return no error.
 }
 
@@ -107,18 +224,18 @@ int getServerAddressInfo(struct addrinfo *&result, int argc, char *argv[], char
     hints.ai_protocol = IPPROTO_TCP;                                                // Use TCP.
     hints.ai_flags = AI_PASSIVE;                                                    // Passive listening socket.
     int iResult = 0;                                                                // Stores the result of getaddrinfo().
-    if (argc == 2) {                                                                // If 2 arguments.
+    if (argc >= 2) {                                                                // If port number given.
         iResult = getaddrinfo(NULL, argv[1], &hints, &result);                      // Get address info using port number provided by user.
         sprintf(portNum, "%s", argv[1]);                                            // Save the port number.
-        cout << "\nUsing port number argv[1] = " << portNum << endl;                // Alert user.
+        LOG(LOG_INFO) << "\nUsing port number argv[1] = " << portNum << endl;       // Alert user.
     } else {                                                                        // Else not 2 arguments.
-        cout << "\nUSAGE: server.exe [port_number]" << endl;                        // Alert user.
+        LOG(LOG_INFO) << "\nUSAGE: server.exe [port_number] [stats_port_number] [error|info|debug|trace] [trace_file] [echo|kv] [unix_socket_path] [cores] [restart_path] [capture_file] [class_weights] [journal_file] [commit_ms,commit_bytes]" << endl;    // Alert user.
         iResult = getaddrinfo(NULL, DEFAULT_PORT, &hints, &result);                 // Get address info using default port number.
-        cout << "Using default settings, IP: localhost, Port: " << DEFAULT_PORT << endl;    // Alert user.
+        LOG(LOG_INFO) << "Using default settings, IP: localhost, Port: " << DEFAULT_PORT << endl; // Alert user.
         sprintf(portNum, "%s", DEFAULT_PORT);                                       // Save the port number.
     }
     if (iResult != 0) {                                                             // If getaddrinfo executed incorrectly.
-        cout << "getaddrinfo failed: " << iResult << endl;                          // Alert user.
+        LOG(LOG_ERROR) << "getaddrinfo failed: " << iResult << endl;                // Alert user.
         freeaddrinfo(result);                                                       // Free memory.
         WSACleanup();                                                               // Cleanup winsock.
         return 3;                                                                   // Return error code.
@@ -135,7 +252,7 @@ int createSocket(SOCKET &s, struct addrinfo *result) {
 
     s = socket(result->ai_family, result->ai_socktype, result->ai_protocol);        // Create socket using result of getaddrinfo().
     if (s == INVALID_SOCKET) {                                                      // If socket is still invalid.
-        cout << "Error at socket(): " << WSAGetLastError() << endl;                 // Alert user.
+        LOG(LOG_ERROR) << "Error at socket(): " << WSAGetLastError() << endl;       // Alert user.
         freeaddrinfo(result);                                                       // Free memory.
         WSACleanup();                                                               // Cleanup winsock.
         return 4;                                                                   // Return error code.
@@ -152,7 +269,7 @@ int bindSocket(SOCKET &s, struct addrinfo *result) {
     
     int iResult = bind(s, result->ai_addr, (int)result->ai_addrlen);                // Bind socket.
     if (iResult == SOCKET_ERROR) {                                                  // If bind executed incorrectly.
-        cout << "bind failed with error: " << WSAGetLastError() << endl;            // Alert user.
+        LOG(LOG_ERROR) << "bind failed with error: " << WSAGetLastError() << endl;  // Alert user.
         freeaddrinfo(result);                                                       // Free memory.
         closesocket(s);                                                             // Close socket.
         WSACleanup();                                                               // Cleanup winsock.
@@ -169,57 +286,229 @@ int bindSocket(SOCKET &s, struct addrinfo *result) {
 int startListening(SOCKET s, char *portNum) {
 
     if (listen(s, SOMAXCONN) == SOCKET_ERROR ) {                                    // Start listening on socket, check if executed incorrectly.
-        cout << "Listen failed with error: " << WSAGetLastError() << endl;          // Alert user.
+        LOG(LOG_ERROR) << "Listen failed with error: " << WSAGetLastError() << endl; // Alert user.
         closesocket(s);                                                             // Close socket.
         WSACleanup();                                                               // Cleanup winsock.
         return 6;                                                                   // Return error code.
     }
-    cout << "\nListening at PORT: " << portNum << endl;                             // Alert user.
+    u_long nonBlocking = 1;                                                         // Enables non-blocking mode.
+    ioctlsocket(s, FIONBIO, &nonBlocking);                                          // Never block in accept(), the event loop waits in select().
+    LOG(LOG_INFO) << "\nListening at PORT: " << portNum << endl;                    // Alert user.
     return 0;                                                                       // Return no error.
 }
 
 
 /**
- *  Connects with a new client and communicates over encrypted channel.
+ *  Runs the event loop, serving every connected client.
+ *  Reads from a client are paused while its queues, or the server's, are full so a fast client cannot use up memory.
  *  Returns error code.
  */
-int communicateWithNewClient(SOCKET s, long *encryptKeyCA, long *encryptKeyServer) {
+int runServer(Server &server) {
+
+    LOG(LOG_INFO) << "\n=============================================" << endl;     // Alert user.
+    LOG(LOG_INFO) << "Waiting for client connections..." << endl;                   // Alert user.
+    while (1) {                                                                     // Loop infinitely.
+        fd_set readSet;                                                             // Sockets to check for received data.
+        fd_set writeSet;                                                            // Sockets to check for send buffer space.
+        FD_ZERO(&readSet);                                                          // Ensure blank.
+        FD_ZERO(&writeSet);                                                         // Ensure blank.
+        bool overloaded = isOverloaded(server);                                     // Check the client and queue limits.
+        if (server.successor != INVALID_SOCKET) {                                   // If draining for a successor, new clients wait in the backlog for it.
+            FD_SET(server.successor, &readSet);                                     // Check for it going away.
+        } else if (!overloaded || REFUSE_WHEN_OVERLOADED) {                         // Else if new clients can be accepted or refused.
+            FD_SET(server.s, &readSet);                                             // Check listening socket for new clients.
+            if (server.unixSocket != INVALID_SOCKET) {                              // If listening on AF_UNIX.
+                FD_SET(server.unixSocket, &readSet);                                // Check it for new clients too.
+            }
+            server.acceptDeferred = false;                                          // Accepting is not paused.
+        } else if (!server.acceptDeferred) {                                        // Else if accepting has just been paused.
+            server.acceptDeferred = true;                                           // Leave new clients in the listen backlog.
+            server.stats.acceptsDeferred++;                                         // Count throttling decision.
+            LOG(LOG_INFO) << "\nServer overloaded, deferring new clients..." << endl; // Alert user.
+        }
+        if (server.statsSocket != INVALID_SOCKET && server.statsConnectionCount < MAX_STATS_CONNECTIONS) {  // If metrics requests can be accepted.
+            FD_SET(server.statsSocket, &readSet);                                   // Check metrics socket for new requests.
+        }
+        for (int i = 0; i < server.statsConnectionCount; i++) {                     // Loop through metrics connections.
+            StatsConnection *connection = server.statsConnections[i];               // The connection.
+            FD_SET(connection->ns, connection->responseLength == 0 ? &readSet : &writeSet); // Check for the request, then for room to send the response.
+        }
+        if (server.restartSocket != INVALID_SOCKET && server.successor == INVALID_SOCKET) {   // If listening for a successor and not already draining.
+            FD_SET(server.restartSocket, &readSet);                                 // Check for one.
+        }
+        FD_SET(server.handlers.wakeupSocket, &readSet);                             // Check for jobs finished off the event loop.
+        bool pendingFrames = false;                                                 // True when a client has frames ready to process, or bytes in its shared memory.
+        for (int i = 0; i < server.sessionCount; i++) {                             // Loop through clients.
+            Session *session = server.sessions[i];                                  // The client.
+            session->inputReady = false;                                            // Not yet checked.
+            if (canReadFromClient(server, session)) {                               // If client's queues have room.
+                FD_SET(session->ns, &readSet);                                      // Check client for received data.
+                if (session->shared != NULL && sharedWait(session->shared)) {       // If bytes are already waiting, else the client rings once it writes.
+                    session->inputReady = true;                                     // Read without being rung.
+                    pendingFrames = true;                                           // Do not wait.
+                }
+            }
+            if (hasPendingOutput(session)) {                                        // If client has unsent output.
+                FD_SET(session->ns, session->shared != NULL ? &readSet : &writeSet);    // Check client for send buffer space, a full shared ring rings once the client reads.
+            }
+            if (session->frameCount > 0 && !session->jobInFlight && session->outputLength - session->outputOffset <= OUTPUT_BUFFER_SIZE - BUFFER_SIZE) {
+                pendingFrames = true;                                               // Frames can be processed without waiting.
+            }
+        }
+        long timeout = pendingFrames ? 0 : timerWheelTimeout(server.timers, GetTickCount());   // Wait no longer than the next timer.
+        if (server.successor != INVALID_SOCKET && (timeout < 0 || timeout > HANDOFF_POLL_MS)) {  // If draining.
+            timeout = HANDOFF_POLL_MS;                                              // Check often whether clients are idle.
+        }
+        struct timeval wait = { timeout / 1000, (timeout % 1000) * 1000 };          // The timeout in select() format.
+        int ready = select(0, &readSet, &writeSet, NULL, timeout < 0 ? NULL : &wait);   // Wait for socket activity.
+        if (ready == SOCKET_ERROR) {                                                // If select() failed.
+            LOG(LOG_ERROR) << "select failed with error: " << WSAGetLastError() << endl; // Alert user.
+            return 15;                                                              // Return error code.
+        }
+        if (FD_ISSET(server.handlers.wakeupSocket, &readSet)) {                     // If jobs have finished off the event loop, or the journal synced a group.
+            sendFinishedReplies(server);                                            // Send their replies.
+            sendDurableReplies(server);                                             // Send the replies held for the journal.
+        }
+        if (server.successor != INVALID_SOCKET && FD_ISSET(server.successor, &readSet)) {   // If the successor went away while draining, it sends nothing until handed off.
+            LOG(LOG_ERROR) << "Successor went away, serving clients again" << endl;     // Alert user.
+            closesocket(server.successor);                                          // Close connection.
+            server.successor = INVALID_SOCKET;                                      // Accept and read again.
+        } else if (server.restartSocket != INVALID_SOCKET && FD_ISSET(server.restartSocket, &readSet)) {   // Else if a successor is connecting.
+            beginHandoff(server);                                                   // Start draining for it.
+        }
+        for (int i = 0; i < server.statsConnectionCount; i++) {                     // Loop through metrics connections.
+            StatsConnection *connection = server.statsConnections[i];               // The connection.
+            serviceStatsConnection(server, connection, FD_ISSET(connection->ns, &readSet) != 0, FD_ISSET(connection->ns, &writeSet) != 0);  // Read request, send response.
+        }
+        if (server.statsSocket != INVALID_SOCKET && FD_ISSET(server.statsSocket, &readSet)) {   // If a metrics request is waiting to be accepted.
+            acceptStatsConnection(server);                                          // Accept it.
+        }
+        if (FD_ISSET(server.s, &readSet)) {                                         // If a client is waiting to be accepted.
+            int error = communicateWithNewClient(server, server.s);                 // Connect with new client and start handshake.
+            if (error) {                                                            // If error occurred.
+                return error;                                                       // Return error code.
+            }
+        }
+        if (server.unixSocket != INVALID_SOCKET && FD_ISSET(server.unixSocket, &readSet)) { // If a local client is waiting to be accepted.
+            int error = communicateWithNewClient(server, server.unixSocket);        // Connect with new client and start handshake.
+            if (error) {                                                            // If error occurred.
+                return error;                                                       // Return error code.
+            }
+        }
+        for (int i = 0; i < server.sessionCount; i++) {                             // Loop through clients.
+            Session *session = server.sessions[i];                                  // The client.
+            if (session->shared != NULL) {                                          // If the socket only rings.
+                if ((session->inputReady || FD_ISSET(session->ns, &readSet)) && canReadFromClient(server, session)) {   // If client has written and there is still room.
+                    readFromClient(server, session);                                // Receive and queue frames.
+                }
+                if (hasPendingOutput(session)) {                                    // If client has unsent output.
+                    flushOutput(server, session);                                   // Send what fits in the ring.
+                }
+                continue;                                                           // Next client.
+            }
+            if (FD_ISSET(session->ns, &readSet)) {                                  // If client has sent data.
+                readFromClient(server, session);                                    // Receive and queue frames.
+            }
+            if (FD_ISSET(session->ns, &writeSet)) {                                 // If client can accept more data.
+                flushOutput(server, session);                                       // Send pending output.
+            }
+        }
+        advanceTimerWheel(server.timers, GetTickCount(), &server);                  // Disconnect clients that timed out.
+        processClientFrames(server);                                                // Process queued frames.
+        removeClosedSessions(server);                                               // Release disconnected clients.
+        removeClosedStatsConnections(server);                                       // Release finished metrics connections.
+        if (server.successor != INVALID_SOCKET && readyToHandOff(server) && handOffServer(server) == 0) {    // If clients are idle and the successor took them.
+            removeClosedSessions(server);                                           // Let go of them.
+            return 0;                                                               // The successor serves from now on.
+        }
+    }
+    return 0;                                                                       // Return no error.
+}
+
+
+/**
+ *  Checks whether the server has reached its client or queue limits.
+ *  Returns true if no more clients should be served.
+ */
+bool isOverloaded(Server &server) {
+
+    return server.sessionCount >= MAX_SESSIONS
+        || server.queuedFrames >= GLOBAL_QUEUE_FRAMES
+        || server.queuedBytes >= GLOBAL_QUEUE_BYTES;
+}
+
+
+/**
+ *  Checks whether the client's queues have room for more received bytes.
+ *  A client with no queued frames may always read so a partial frame can complete, this stops the global limits deadlocking.
+ *  Counts each time reads from the client are paused.
+ *  Returns true if the client should be read from.
+ */
+bool canReadFromClient(Server &server, Session *session) {
+
+    if (session->state == SESSION_CLOSED) {                                         // If client has disconnected.
+        return false;                                                               // Nothing to read.
+    }
+    if (server.successor != INVALID_SOCKET) {                                       // If draining for a successor.
+        return false;                                                               // Leave the next message for it.
+    }
+    bool sessionFull = session->frameCount == SESSION_QUEUE_FRAMES
+                    || session->inputLength == BUFFER_SIZE
+                    || session->queuedBytes >= SESSION_QUEUE_BYTES;                 // True if client's own queues are full.
+    bool globalFull = session->frameCount > 0
+                   && (server.queuedFrames >= GLOBAL_QUEUE_FRAMES || server.queuedBytes >= GLOBAL_QUEUE_BYTES); // True if server's queues are full.
+    if (!sessionFull && !globalFull) {                                              // If there is room.
+        session->readPaused = false;                                                // Reads are not paused.
+        return true;                                                                // Read from client.
+    }
+    if (!session->readPaused) {                                                     // If reads have just been paused.
+        session->readPaused = true;                                                 // Reads are paused.
+        if (sessionFull) {                                                          // If paused by client's own limits.
+            server.stats.sessionReadPauses++;                                       // Count throttling decision.
+        } else {                                                                    // Else paused by server's limits.
+            server.stats.globalReadPauses++;                                        // Count throttling decision.
+        }
+    }
+    return false;                                                                   // Do not read from client.
+}
+
+
+/**
+ *  Connects with a new client and starts the encrypted channel handshake.
+ *  The client is accepted from the given listening socket, TCP or AF_UNIX, and served the same either way.
+ *  Refuses the client if the server is overloaded.
+ *  Returns error code.
+ */
+int communicateWithNewClient(Server &server, SOCKET listener) {
 
-    cout << "\n=============================================" << endl;              // Alert user.
-    cout << "Waiting for client connection..." << endl;                             // Alert user.
     SOCKET ns = INVALID_SOCKET;                                                     // The client connection socket.
     char clientHost[NI_MAXHOST];                                                    // Stores the client's IP address.
     char clientService[NI_MAXSERV];                                                 // Stores the client's port number.
     memset(&clientHost, 0, sizeof(clientHost));                                     // Ensure blank.
     memset(&clientService, 0, sizeof(clientService));                               // Ensure blank.
-    int error = acceptNewClient(s, ns, clientHost, clientService);                  // Accept a new client and connect them to socket ns.
-    if (error) {                                                                    // If error occurred.
-        return error;                                                               // Return error code.
-    }
-    error = simulateCASendingServerPublicKey(ns, encryptKeyCA, encryptKeyServer);   // Simulate the Certifaction Authority sending the client the public key of the server.
-    if (error) {                                                                    // If error occurred.
+    int error = acceptNewClient(listener, ns, clientHost, clientService);           // Accept a new client and connect them to socket ns.
+    if (error == 7 && WSAGetLastError() == WSAEWOULDBLOCK) {                        // If the client went away before being accepted.
+        return 0;                                                                   // Nothing to do.
+    } else if (error == 8) {                                                        // Else if only the client's name could not be found.
         closesocket(ns);                                                            // Close the communication socket.
+        return 0;                                                                   // Keep serving other clients.
+    } else if (error) {                                                             // Else if error occurred.
         return error;                                                               // Return error code.
     }
-    long nOnce = 0;                                                                 // Stores the nOnce value, used as intial rand in CBC decryption.
-    error = receiveNOnce(ns, nOnce);                                                // Receive the unencrypted nOnce value from the client.
-    if (error) {                                                                    // If error occurred.
-        closesocket(ns);                                                            // Close the communication socket.
-        return error;                                                               // Return error code.
+    if (isOverloaded(server)) {                                                     // If no more clients can be served.
+        closesocket(ns);                                                            // Refuse client.
+        server.stats.acceptsRefused++;                                              // Count throttling decision.
+        LOG(LOG_INFO) << "Server overloaded, client refused." << endl;              // Alert user.
+        return 0;                                                                   // Return no error.
     }
-    bool clientConnected = true;                                                    // Client is connected and communicating when true.
-    while (clientConnected) {                                                       // While the client is connected.
-        receiveClientMessages(ns, encryptKeyServer, nOnce, clientConnected);    // Receive encrypted messages from the client.
-    }
-    /*int iResult = shutdown(ns, SD_SEND);                                            // Shutdown sending and receiving over the communication socket.
-    if (iResult == SOCKET_ERROR) {                                                  // If shutdown failed.
-        cout << "shutdown failed with error: " << WSAGetLastError() << endl;        // Alert user.
-        closesocket(ns);                                                            // Close socket.
-        return 15;                                                                  // Return error code.
-    }*/
-    closesocket(ns);                                                                // Close the communication socket.
-    cout << "\nDisconnected from client with IP address: " << clientHost;           // Alert user.
-    cout << ", Port: " << clientService << endl;                                    // Alert user.
+    Session *session = addSession(server, ns, clientHost, clientService);           // Serve client.
+    if (session == NULL) {                                                          // If its state could not be allocated.
+        closesocket(ns);                                                            // Refuse client.
+        server.stats.acceptsRefused++;                                              // Count refusal.
+        LOG(LOG_ERROR) << "Session could not be allocated, client refused." << endl;    // Alert user.
+        return 0;                                                                   // Keep serving other clients.
+    }
+    startHandshake(server, session);                                                // Send the public key, a client it cannot be sent to is disconnected.
     return 0;                                                                       // Return no error.
 }
 
@@ -234,20 +523,28 @@ int acceptNewClient(SOCKET s, SOCKET &ns, char *clientHost, char *clientService)
     int addrlen = sizeof(clientAddress);                                            // Stores the size of the client's address structure.
     ns = accept(s, (struct sockaddr *)(&clientAddress), &addrlen);                  // Accept a new client connection from the listening socket to the communication socket.
     if (ns == INVALID_SOCKET) {                                                     // If accept() did not work.
-        cout << "accept failed: " << WSAGetLastError() << endl;                     // Alert user.
+        if (WSAGetLastError() != WSAEWOULDBLOCK) {                                  // If not just a client that went away.
+            LOG(LOG_ERROR) << "accept failed: " << WSAGetLastError() << endl;       // Alert user.
+        }
         return 7;                                                                   // Return error code.
     } else {                                                                        // Else accept worked correctly.
-        cout << "\nA client has been accepted." << endl;                            // Alert user.
+        LOG(LOG_INFO) << "\nA client has been accepted." << endl;                   // Alert user.
+        if (clientAddress.ss_family == AF_UNIX) {                                   // If on this host, it has no address.
+            strcpy(clientHost, "local");                                            // Name it by its transport.
+            strcpy(clientService, "unix");                                          // Name it by its transport.
+            LOG(LOG_INFO) << "Connected to local client over AF_UNIX" << endl;      // Alert user.
+            return 0;                                                               // Return no error.
+        }
         DWORD returnValue = getnameinfo((struct sockaddr *)&clientAddress, addrlen,
                                         clientHost, NI_MAXHOST,
                                         clientService, NI_MAXSERV,
                                         NI_NUMERICHOST);                            // Get the client's address information.
         if (returnValue != 0) {                                                     // If getnameinfo() returned error code.
-            cout << "\nError detected: getnameinfo() failed with error #" << WSAGetLastError() << endl; // Alert user.
+            LOG(LOG_ERROR) << "\nError detected: getnameinfo() failed with error #" << WSAGetLastError() << endl; // Alert user.
             return 8;                                                               // Return error code.
         } else {                                                                    // Else getnameinfo() completed without error.
-            cout << "Connected to client with IP address: " << clientHost;          // Alert user.
-            cout << ", at Port:" << clientService << endl;                          // Alert user.
+            LOG(LOG_INFO) << "Connected to client with IP address: " << clientHost; // Alert user.
+            LOG(LOG_INFO) << ", at Port:" << clientService << endl;                 // Alert user.
         }
     }
     return 0;                                                                       // Return no error.
@@ -255,351 +552,213 @@ int acceptNewClient(SOCKET s, SOCKET &ns, char *clientHost, char *clientService)
 
 
 /**
- *  Sends encrypted public key of server to client.
- *  Returns error code.
+ *  Starts listening for metrics requests on a local port.
+ *  The port is only bound to the loopback address so metrics are not exposed to the network.
+ *  Returns error code, the server keeps running without metrics if one occurs.
  */
-int sendServerPublicKey(SOCKET s, long *encryptKeyCA, long *encryptKeyServer) {
-
-    char sendBuffer[BUFFER_SIZE];                                                   // The buffer to store characters to send.
-    memset(&sendBuffer, 0, BUFFER_SIZE);                                            // Ensure blank.
-    sprintf(sendBuffer, "KEYS %ld %ld", encryptKeyServer[KEY_E], encryptKeyServer[KEY_N]);  // Create data to send.
-    cout << "\nSimulating CA sending server's public key..." << endl;               // Alert user.
-    int messageLength = strlen(sendBuffer);                                         // Get the message length.
-    encryptCA(sendBuffer, messageLength, encryptKeyCA[KEY_D], encryptKeyCA[KEY_N]); // Encrypt the message.
-    int error = sendMessage(s, sendBuffer, messageLength);                          // Send the message to the client.
-    return error;                                                                   // Return error code if any.
-}
-
-
-/**
- *  Encrypt method used to encrypt the certificate authority's message.
- */
-void encryptCA(char *sendBuffer, int &messageLength, int d, int n) {
+int startStatsEndpoint(Server &server, int argc, char *argv[]) {
 
-    long rsaEncryptedBuffer[BUFFER_SIZE];                                           // Buffer to store RSA encrypted message.
-    memset(&rsaEncryptedBuffer, 0, BUFFER_SIZE);                                    // Ensure blank.
-    for (int i = 0; i < messageLength; i++) {                                       // Loop through message.
-        rsaEncryptedBuffer[i] = repeatsquare(sendBuffer[i], d, n);                  // Encrypt with RSA.
-    }
-    createStringToSend(sendBuffer, rsaEncryptedBuffer, messageLength);              // Create string for sending to server.
-}
-
-
-/**
- *  Repeat Square method as found in Assignment guide.
- *  Returns encrypted long value.
- *  Magic maths occurs here.
- */
-long repeatsquare(long x, long eORd, long n) {
-
-    long y = 1;
-    while (eORd > 0) {
-        if ((eORd % 2) == 0) {
-            x = (x * x) % n;
-            eORd = eORd / 2;
-        } else {
-            y = (x * y) % n;
-            eORd = eORd - 1;
+    server.statsSocket = INVALID_SOCKET;                                            // Not serving metrics yet.
+    const char *portNum = argc > 2 ? argv[2] : DEFAULT_STATS_PORT;                  // The metrics port number.
+    struct addrinfo hints;                                                          // Stores hints for TCP connection setup.
+    memset(&hints, 0, sizeof(struct addrinfo));                                     // Ensure blank.
+    hints.ai_family = USE_IPV6 ? AF_INET6 : AF_INET;                                // Use IPv6 or IPv4 like the client port.
+    hints.ai_socktype = SOCK_STREAM;                                                // Use sock stream.
+    hints.ai_protocol = IPPROTO_TCP;                                                // Use TCP.
+    struct addrinfo *result = NULL;                                                 // Stores the loopback address, as AI_PASSIVE is not set.
+    if (getaddrinfo(NULL, portNum, &hints, &result) != 0) {                         // If address could not be found.
+        LOG(LOG_ERROR) << "Metrics disabled: getaddrinfo failed" << endl;           // Alert user.
+        return 16;                                                                  // Return error code.
+    }
+    SOCKET s = socket(result->ai_family, result->ai_socktype, result->ai_protocol); // Create socket.
+    if (s == INVALID_SOCKET
+        || bind(s, result->ai_addr, (int)result->ai_addrlen) == SOCKET_ERROR
+        || listen(s, MAX_STATS_CONNECTIONS) == SOCKET_ERROR) {                      // If socket could not be created, bound or listened on.
+        LOG(LOG_ERROR) << "Metrics disabled: could not listen on port " << portNum << ", error " << WSAGetLastError() << endl; // Alert user.
+        if (s != INVALID_SOCKET) {                                                  // If socket was created.
+            closesocket(s);                                                         // Close socket.
         }
+        freeaddrinfo(result);                                                       // Free memory.
+        return 16;                                                                  // Return error code.
     }
-    return y;
-}
-
-
-/**
- *  Creates a string of char representation of long values from the encrypted long buffer.
- */
-void createStringToSend(char *sendBuffer, long *encryptedBuffer, int &messageLength) {
-
-    char tempBuffer[BUFFER_SIZE];                                                   // Temporary buffer to store message.
-    memset(&tempBuffer, 0, BUFFER_SIZE);                                            // Make blank.
-    for (int i = 0; i < messageLength; i++) {                                       // Loop through encrypted message.
-        char tempCharBuffer[BUFFER_SIZE];                                           // Stores the char representation of the long value from the encrypted buffer.
-        memset(&tempCharBuffer, 0, BUFFER_SIZE);                                    // Ensure blank.
-        sprintf(tempCharBuffer, "%ld", encryptedBuffer[i]);                         // Copy encrypted value from buffer into char string.
-        strcat(tempBuffer, tempCharBuffer);                                         // Concatenate onto send buffer.
-        strcat(tempBuffer, " ");                                                    // Space seperate values.
-    }
-    strcat(tempBuffer, "\r\n");                                                     // Add terminating characters to message.
-    strcpy(sendBuffer, tempBuffer);                                                 // Copy message into send buffer.
-    messageLength = strlen(sendBuffer);                                             // Set new message length.
-}
-
-
-/**
- *  Sends buffer to client.
- *  Returns error code.
- */
-int sendMessage(SOCKET s, char *sendBuffer, int strlen) {
-
-    int bytes = send(s, sendBuffer, strlen, 0);                                     // Send message to client.
-    if (bytes == SOCKET_ERROR) {                                                    // If connection ended.
-        cout << "send failed" << endl;                                              // Alert user.
-        WSACleanup();                                                               // Cleanup winsock.
-        return 9;                                                                   // Return error code.
-    }
-    cout << "--->";                                                                 // Show that sent message with direction of arrow.
-    displayCharBuffer(sendBuffer, strlen);                                          // Alert user.
+    freeaddrinfo(result);                                                           // Free memory.
+    u_long nonBlocking = 1;                                                         // Enables non-blocking mode.
+    ioctlsocket(s, FIONBIO, &nonBlocking);                                          // Never block in accept(), the event loop waits in select().
+    server.statsSocket = s;                                                         // Serve metrics.
+    LOG(LOG_INFO) << "Serving metrics at http://localhost:" << portNum << "/metrics" << endl; // Alert user.
     return 0;                                                                       // Return no error.
 }
 
 
 /**
- *  Displays character buffer in human readable format to user.
+ *  Accepts a connection to the metrics endpoint.
  */
-void displayCharBuffer(char *charBuffer, int messageLength) {
-
-    for (int i = 0; i < messageLength; i++) {                                       // Loop through buffer.
-        if (charBuffer[i] == '\r') {                                                // If carriage return character.
-            cout << "\\r";                                                          // Output literal value.
-        } else if (charBuffer[i] == '\n') {                                         // If new line character.
-            cout << "\\n";                                                          // Output literal value.
-        } else {                                                                    // Else normal character.
-            cout << charBuffer[i];                                                  // Output character.
-        }
-    }
-    cout << endl;                                                                   // End line.
+void acceptStatsConnection(Server &server) {
+
+    SOCKET ns = accept(server.statsSocket, NULL, NULL);                             // Accept connection.
+    if (ns == INVALID_SOCKET) {                                                     // If connection went away before being accepted.
+        return;                                                                     // Nothing to do.
+    }
+    u_long nonBlocking = 1;                                                         // Enables non-blocking mode.
+    ioctlsocket(ns, FIONBIO, &nonBlocking);                                         // Never block on the connection, the event loop waits in select().
+    StatsConnection *connection = new StatsConnection;                              // The connection's state.
+    memset(connection, 0, sizeof(StatsConnection));                                 // Ensure blank.
+    connection->ns = ns;                                                            // Communicate over socket ns.
+    initTimer(&connection->timer, expireStatsTimer, connection);                    // Prepare stall timer.
+    startTimer(server.timers, &connection->timer, STATS_TIMEOUT_MS);                // The whole exchange must finish by the deadline.
+    server.statsConnections[server.statsConnectionCount++] = connection;            // Add to metrics connections.
 }
 
 
 /**
- *  Receives a message from the client and displays message.
- *  Returns error code.
+ *  Reads a metrics request and sends the response.
+ *  Any request for /metrics is answered with every metric, anything else is not found.
  */
-int receiveMessage(SOCKET s, char *receiveBuffer, int messageLength) {
-
-    int i = 0;                                                                      // Index of receive buffer.
-    bool messageReceived = false;                                                   // True when full message received.
-    while (!messageReceived) {                                                      // Loop while message not entirely received.
-        int bytes = recv(s, &receiveBuffer[i], 1, 0);                               // Receive one byte of data from the client.
-        if ((bytes == SOCKET_ERROR) || (bytes == 0)) {                              // If socket error or connection ended.
-            cout << "recv failed" << endl;                                          // Alert user.
-            return 10;                                                              // Return error code.
-        } else if (receiveBuffer[i] == '\n') {                                      // If received character is new line.
-            messageReceived = true;                                                 // Full message has been received.
-        } else if (i == BUFFER_SIZE) {                                              // If at buffer limit.
-            cout << "Full message not received: receiveBuffer overloaded" << endl;  // Alert user.
-            return 11;                                                              // Return error code.
+void serviceStatsConnection(Server &server, StatsConnection *connection, bool readable, bool writable) {
+
+    if (readable && connection->responseLength == 0) {                              // If request bytes have arrived.
+        int bytes = recv(connection->ns, &connection->request[connection->requestLength], STATS_REQUEST_SIZE - 1 - connection->requestLength, 0);  // Receive request bytes.
+        if (bytes == SOCKET_ERROR && WSAGetLastError() == WSAEWOULDBLOCK) {         // If nothing to receive after all.
+            return;                                                                 // Try again later.
+        } else if (bytes == SOCKET_ERROR || bytes == 0) {                           // If connection ended.
+            connection->closed = true;                                              // Release connection.
+            return;                                                                 // Nothing more to do.
         }
-        i++;                                                                        // Increment i.
-    }
-    receiveBuffer[i] = '\0';                                                        // Add null terminator.
-    cout << "<---";                                                                 // Show that received message with direction of arrow.
-    displayCharBuffer(receiveBuffer, i);                                            // Display received message.
-    removeTerminatingCharacters(receiveBuffer, i);                                  // Remove terminating characters from received message.
-    messageLength = i;                                                              // Store message length.
-    return 0;                                                                       // Return no error.
-}
-
-
-/**
- *  Removes terminating characters "\r\n" from messages.
- */
-void removeTerminatingCharacters(char *charBuffer, int &messageLength) {
-
-    messageLength -= 2;                                                             // Reduce message length by 2.
-    charBuffer[messageLength] = '\0';                                               // Terminate string, removing "\r\n".
-}
-
-/**
- *  Receives message from user and compares to expected ACK string.
- *  Returns error code.
- */
-int receiveACK(SOCKET s, char *expectedACK) {
-
-    cout << "\nReceiving ACK..." << endl;                                           // Alert user.
-    char receiveBuffer[BUFFER_SIZE];                                                // The buffer to store received characters.
-    memset(&receiveBuffer, 0, BUFFER_SIZE);                                         // Ensure blank.
-    int messageLength = 0;                                                          // Stores the length of the message, unused.
-    int error = receiveMessage(s, receiveBuffer, messageLength);                    // Receive the reply from the client.
-    if (error) {                                                                    // If error occurred.
-        return error;                                                               // Return error code.
-    }
-    if (strcmp(receiveBuffer, expectedACK)) {                                       // Ensure expected ACK was received.
-        cout << "Something went wrong, expected ACK not received." << endl;         // Alert user.
-        return 12;                                                                  // Return error code.
-    }
-    return 0;                                                                       // Return no error.
-}
-
-
-/**
- *  Simulates the Certifcation Authority sending the server's public key to the client.
- *  Returns error code.
- */
-int simulateCASendingServerPublicKey(SOCKET s, long *encryptKeyCA, long *encryptKeyServer) {
-
-    int error = sendServerPublicKey(s, encryptKeyCA, encryptKeyServer);             // Send the public key to the client.
-    if (error) {                                                                    // If error occurred.
-        return error;                                                               // Return error code.
-    }
-    char expectedACK[BUFFER_SIZE];                                                  // Stores the expected ACK string.
-    strcpy(expectedACK, "ACK 226 public key received");                             // Create expected ACK.
-    error = receiveACK(s, expectedACK);                                             // Receive ACK from client.
-    if (error) {                                                                    // If error occurred.
-        return error;                                                               // Return error code.
-    }
-    return 0;                                                                       // Return no error.
-}
-
-
-/**
- *  Receives the nOnce value from the client.
- *  Returns error code.
- */
-int receiveNOnce(SOCKET s, long &nOnce) {
-
-    cout << "\nReceiving nOnce..." << endl;                                         // Alert user.
-    char receiveBuffer[BUFFER_SIZE];                                                // The buffer to store received characters.
-    memset(&receiveBuffer, 0, BUFFER_SIZE);                                         // Ensure blank.
-    int messageLength = 0;                                                          // Stores the length of the message.
-    int error = receiveMessage(s, receiveBuffer, messageLength);                    // Receive the reply from the client.
-    if (error) {                                                                    // If error occurred.
-        return error;                                                               // Return error code.
-    }
-    sscanf(receiveBuffer, "NONCE %ld", &nOnce);                                     // Extract nOnce from received message.
-    cout << "\nnOnce received:\n\tnOnce = " << nOnce << endl;                       // Alert user.
-    char sendBuffer[BUFFER_SIZE];                                                   // The buffer to store characters to send.
-    strcpy(sendBuffer, "ACK 220 nOnce received\r\n");                               // Create the ACK to send to client.
-    cout << "\nSending ACK..." << endl;                                             // Alert user.
-    error = sendMessage(s, sendBuffer, strlen(sendBuffer));                         // Send ACK.
-    if (error) {                                                                    // If error occurred.
-        return error;                                                               // Return error code.
-    }
-    return 0;                                                                       // Return no error.
-}
-
-
-/**
- *  Receives encrypted message from the client, decrypts them, and replies with the decrypted message.
- *  Returns nothing as errors are treated as client disconnects.
- */
-void receiveClientMessages(SOCKET s, long *encryptKeyServer, long nOnce, bool &clientConnected) {
-
-    cout << "\n--------------------------------------------" << endl;               // Alert user.
-    cout << "The server is ready to receive data." << endl;                         // Alert user.
-    int error = 0;                                                                  // Stores the error code returned from functions.
-    while (clientConnected) {                                                       // While client is connected.
-        long encryptedBuffer[BUFFER_SIZE];                                          // The buffer to store received encrypted message.
-        memset(&encryptedBuffer, 0, BUFFER_SIZE);                                   // Ensure blank.
-        int messageLength = 0;                                                      // Stores the length of the received message.
-        int receivedMessageLength = 0;                                              // Stores the encrypted message length.
-        cout << "\nWaiting to receive encrypted message from client..." << endl;    // Alert user.
-        error = receiveEncryptedMessage(s, encryptedBuffer, messageLength, receivedMessageLength);  // Receive the encrypted message.
-        if (error) {                                                                // If error occurred.
-            clientConnected = false;                                                // Client no longer connected.
-            break;                                                                  // End while loop.
+        connection->requestLength += bytes;                                         // Store received bytes.
+        connection->request[connection->requestLength] = '\0';                      // Add null terminator.
+        if (strstr(connection->request, "\r\n\r\n") == NULL && connection->requestLength < STATS_REQUEST_SIZE - 1) {   // If request headers are not complete.
+            return;                                                                 // Wait for more bytes.
         }
-        char receiveBuffer[BUFFER_SIZE];                                            // The buffer to store received characters.
-        memset(&receiveBuffer, 0, BUFFER_SIZE);                                     // Ensure blank.
-        cout << "\nDecrypting message..." << endl;                                  // Alert user.
-        decrypt(encryptedBuffer, receiveBuffer, messageLength, encryptKeyServer[KEY_D], encryptKeyServer[KEY_N], nOnce);    // Decrypt the message using RSA and CBC.
-        cout << "Decrypted message:";                                               // Alert user.
-        displayCharBuffer(receiveBuffer, messageLength);                            // Alert user.
-        char sendBuffer[BUFFER_SIZE];                                               // The buffer to store characters to send.
-        memset(&sendBuffer, 0, BUFFER_SIZE);                                        // Ensure blank.
-        sprintf(sendBuffer, "The client typed '%s' - %d bytes of information was received\r\n", receiveBuffer, receivedMessageLength);  // Create message to send.
-        cout << "\nSending reply..." << endl;                                       // Alert user.
-        error = sendMessage(s, sendBuffer, strlen(sendBuffer));                     // Send reply.
-        if (error) {                                                                // If error occurred.
-            clientConnected = false;                                                // Client no longer connected.
+        buildStatsResponse(server, connection);                                     // Answer the request.
+        writable = true;                                                            // Try to send straight away.
+    }
+    while (writable && connection->responseOffset < connection->responseLength) {   // While response is pending.
+        int bytes = send(connection->ns, &connection->response[connection->responseOffset], connection->responseLength - connection->responseOffset, 0);    // Send response.
+        if (bytes == SOCKET_ERROR) {                                                // If nothing was sent.
+            if (WSAGetLastError() != WSAEWOULDBLOCK) {                              // If connection ended.
+                connection->closed = true;                                          // Release connection.
+            }
+            return;                                                                 // Try again later.
         }
+        connection->responseOffset += bytes;                                        // Remove sent bytes.
+    }
+    if (connection->responseLength > 0 && connection->responseOffset == connection->responseLength) {  // If response is sent.
+        shutdown(connection->ns, SD_SEND);                                          // Tell the reader the response is complete.
+        connection->closed = true;                                                  // Release connection.
     }
-    cout << "\nClient has disconnected." << endl;                                   // Alert user.
 }
 
 
 /**
- *  Receives encrypted message and stores in encryptedBuffer.
- *  Returns error code.
+ *  Builds the HTTP response to a metrics request.
  */
-int receiveEncryptedMessage(SOCKET s, long *encryptedBuffer, int &messageLength, int &receivedMessageLength) {
-
-    char receiveBuffer[BUFFER_SIZE];                                                // The buffer to store received characters.
-    char receivedMessage[BUFFER_SIZE];                                              // Buffer to store incoming message.
-    memset(receiveBuffer, 0, BUFFER_SIZE);                                          // Ensure blank.
-    memset(receivedMessage, 0, BUFFER_SIZE);                                        // Ensure blank.
-    memset(encryptedBuffer, 0, BUFFER_SIZE);                                        // Ensure blank.
-    int bytes = 0;                                                                  // Stores the result of recv().
-    int i = 0;                                                                      // The index of receivedMessage.
-    bool messageReceived = false;                                                   // True when full message received.
-    messageLength = 0;                                                              // The length of the encrypted buffer.
-    while (!messageReceived) {                                                      // Loop through message.
-        bytes = recv(s, &receivedMessage[i], 1, 0);                                 // Receive a char.
-        if ((bytes == SOCKET_ERROR) || (bytes == 0)) {                              // If socket error or connection ended.
-            cout << "recv failed" << endl;                                          // Alert user.
-            return 13;                                                              // Return error code.
-        } else if (receivedMessage[i] == '\n') {                                    // If received character is new line.
-            strcat(receiveBuffer, "\r\n");                                          // Concatenate message end onto receive buffer.
-            messageReceived = true;                                                 // Full message has been received.
-        } else if (receivedMessage[i] == ' ') {                                     // If received character is space.
-            receivedMessage[i] = '\0';                                              // Terminate string.
-            sscanf(receivedMessage, "%ld ", &encryptedBuffer[messageLength]);       // Get long value from string.
-            messageLength++;                                                        // Increment encrypted buffer length.
-            strcat(receiveBuffer, receivedMessage);                                 // Copy received message to receive buffer (for display).
-            strcat(receiveBuffer, " ");                                             // Add space.
-            memset(receivedMessage, 0, BUFFER_SIZE);                                // Make received message blank again.
-            i = 0;                                                                  // Reset i.
-        } else if (messageLength == BUFFER_SIZE || i == BUFFER_SIZE) {              // If at buffer limit.
-            cout << "Full message not received: receiveBuffer overloaded" << endl;  // Alert user.
-            return 14;                                                              // Return error code.
-        } else {                                                                    // Normal character.
-            i++;                                                                    // Increment i.
-        }
-    }
-    receivedMessageLength = strlen(receiveBuffer);                                  // Store the received message length.
-    printBuffer("RECEIVE BUFFER", receiveBuffer, receivedMessageLength);            // Alert user.
-    return 0;                                                                       // Return no error.
+void buildStatsResponse(Server &server, StatsConnection *connection) {
+
+    const char *status = "200 OK";                                                  // The response status.
+    char *body = new char[STATS_RESPONSE_SIZE];                                     // The response body.
+    int bodyLength = 0;                                                             // Number of bytes in body.
+    if (strncmp(connection->request, "GET /metrics", 12) == 0) {                    // If metrics were requested.
+        bodyLength = writeServerMetrics(server, body, STATS_RESPONSE_SIZE - 256);   // Leave room for the headers.
+    } else {                                                                        // Else something else was requested.
+        status = "404 Not Found";                                                   // Nothing else is served.
+        bodyLength = sprintf(body, "Metrics are served at /metrics\n");             // Point the user at the metrics.
+    }
+    int length = sprintf(connection->response, "HTTP/1.0 %s\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %d\r\nConnection: close\r\n\r\n", status, bodyLength);
+    memcpy(&connection->response[length], body, bodyLength);                        // Add body after headers.
+    connection->responseLength = length + bodyLength;                               // Store response length.
+    delete[] body;                                                                  // Free memory.
 }
 
 
 /**
- *  Napoleon's print buffer method.
- *  Outputs each byte of a char buffer in readable format with special characters displayed.
+ *  Writes the registry's metrics and the event loop's own counters in Prometheus text exposition format.
+ *  Returns number of characters written.
  */
-void printBuffer(const char *header, char *buffer, int messageLength) {
-
-    cout << "\n------ " << header << " ------" << endl;
-    for (int i = 0; i < messageLength; i++) {
-        if (buffer[i] == '\r') {
-            cout << "buffer[0x";
-            cout << hex << uppercase << i << "]=\\r" << endl;
-        } else if (buffer[i] == '\n') {
-            cout << "buffer[0x";
-            cout << hex << uppercase << i << "]=\\n" << endl;
-        } else {
-            cout << "buffer[0x";
-            cout << hex << uppercase << i << "]=" << buffer[i] << endl;
+int writeServerMetrics(Server &server, char *buffer, int size) {
+
+    int length = writeMetrics(buffer, size);                                        // Write the registry's metrics.
+    length += writeMetric(&buffer[length], size - length, "queued_frames", "gauge", "Received frames waiting to be processed.", server.queuedFrames);
+    length += writeMetric(&buffer[length], size - length, "queued_bytes", "gauge", "Received bytes waiting to be processed.", server.queuedBytes);
+    length += writeMetric(&buffer[length], size - length, "accepts_refused_total", "counter", "Clients refused because of overload.", server.stats.acceptsRefused);
+    length += writeMetric(&buffer[length], size - length, "accepts_deferred_total", "counter", "Times accepting was paused by overload.", server.stats.acceptsDeferred);
+    length += writeMetric(&buffer[length], size - length, "client_read_pauses_total", "counter", "Times a client's reads were paused by its own queue limits.", server.stats.sessionReadPauses);
+    length += writeMetric(&buffer[length], size - length, "global_read_pauses_total", "counter", "Times a client's reads were paused by the global queue limits.", server.stats.globalReadPauses);
+    length += writeMetric(&buffer[length], size - length, "output_deferrals_total", "counter", "Times a frame was left queued because the client's output was full.", server.stats.outputDeferrals);
+    length += writeMetric(&buffer[length], size - length, "handshake_timeouts_total", "counter", "Clients that did not finish the handshake in time.", server.timeoutStats.handshakeTimeouts);
+    length += writeMetric(&buffer[length], size - length, "idle_timeouts_total", "counter", "Clients that sent nothing for too long.", server.timeoutStats.idleTimeouts);
+    length += writeMetric(&buffer[length], size - length, "write_stall_timeouts_total", "counter", "Clients that stopped reading replies.", server.timeoutStats.writeStallTimeouts);
+    static const char *nodeCounterNames[NODE_COUNTER_COUNT][2] = {                  // Exported name and help text of each NUMA node counter.
+        { "node_sessions_total", "Clients whose state was allocated on the node." },
+        { "node_decrypts_total", "Messages decrypted on one of the node's processors." },
+        { "node_jobs_total", "Handler jobs run on one of the node's processors." },
+        { "node_remote_jobs_total", "Handler jobs run on the node for a client whose state is on another node." }
+    };
+    int nodes = numaNodeCount() < MAX_NUMA_NODES ? numaNodeCount() : MAX_NUMA_NODES;    // Nodes counted.
+    double values[MAX_NUMA_NODES];                                                  // One counter's value on each node.
+    for (int i = 0; i < NODE_COUNTER_COUNT; i++) {                                  // Loop through counters.
+        for (int node = 0; node < nodes; node++) {                                  // Loop through nodes.
+            values[node] = nodeEventCount((NodeCounter)i, node);                    // Get value.
         }
-    }
-    cout << dec << "---" << endl;
+        length += writeLabelledMetric(&buffer[length], size - length, nodeCounterNames[i][0], "counter", nodeCounterNames[i][1], "node", values, nodes);
+    }
+    const char *classNames[SERVICE_CLASSES] = { serviceClassName(CLASS_INTERACTIVE), serviceClassName(CLASS_BULK) };  // The label of each class.
+    double classValues[SERVICE_CLASSES] = { 0, 0 };                                 // One class counter's value for each class.
+    for (int i = 0; i < server.sessionCount; i++) {                                 // Loop through clients.
+        classValues[server.sessions[i]->share.serviceClass]++;                      // Count client in its class.
+    }
+    length += writeLabelledMetric(&buffer[length], size - length, "class_sessions", "gauge", "Connected clients served in the class.", "class", classValues, SERVICE_CLASSES, classNames);
+    for (int c = 0; c < SERVICE_CLASSES; c++) {                                     // Loop through classes.
+        classValues[c] = server.scheduler.weights[c];                               // Get value.
+    }
+    length += writeLabelledMetric(&buffer[length], size - length, "class_weight", "gauge", "Quanta credited per pass to a client of the class.", "class", classValues, SERVICE_CLASSES, classNames);
+    for (int c = 0; c < SERVICE_CLASSES; c++) {                                     // Loop through classes.
+        classValues[c] = (double)server.scheduler.framesServed[c];                  // Get value.
+    }
+    length += writeLabelledMetric(&buffer[length], size - length, "class_frames_total", "counter", "Frames processed for clients of the class.", "class", classValues, SERVICE_CLASSES, classNames);
+    for (int c = 0; c < SERVICE_CLASSES; c++) {                                     // Loop through classes.
+        classValues[c] = (double)server.scheduler.bytesServed[c];                   // Get value.
+    }
+    length += writeLabelledMetric(&buffer[length], size - length, "class_frame_bytes_total", "counter", "Bytes of frames processed for clients of the class, the work they were given.", "class", classValues, SERVICE_CLASSES, classNames);
+    for (int c = 0; c < SERVICE_CLASSES; c++) {                                     // Loop through classes.
+        classValues[c] = (double)server.scheduler.creditWaits[c];                   // Get value.
+    }
+    length += writeLabelledMetric(&buffer[length], size - length, "class_credit_waits_total", "counter", "Passes on which a client of the class had a frame left waiting for more credit.", "class", classValues, SERVICE_CLASSES, classNames);
+    if (isJournaling()) {                                                           // If messages are journaled.
+        JournalStats journal;                                                       // Counts of the journal's work.
+        readJournalStats(journal);                                                  // Get counts.
+        length += writeMetric(&buffer[length], size - length, "journal_records_total", "counter", "Messages appended to the journal.", (double)journal.records);
+        length += writeMetric(&buffer[length], size - length, "journal_bytes_total", "counter", "Bytes appended to the journal, including record headers.", (double)journal.bytes);
+        length += writeMetric(&buffer[length], size - length, "journal_commits_total", "counter", "Groups of messages synced to disk, one sync each.", (double)journal.commits);
+        length += writeMetric(&buffer[length], size - length, "journal_stalls_total", "counter", "Appends that waited for room in the journal's ring.", (double)journal.stalls);
+        length += writeMetric(&buffer[length], size - length, "journal_pending_bytes", "gauge", "Bytes appended to the journal and not yet synced.", (double)(journal.bytes - journalDurablePosition()));
+    }
+    return length;                                                                  // Return number of characters written.
 }
 
 
 /**
- *  Decrypt method used to decrypt received encrypted messages.
+ *  Closes a metrics connection that stalled.
  */
-void decrypt(long *encryptedBuffer, char *receiveBuffer, int &messageLength, int d, int n, int nOnce) {
-
-    long rsaDecryptedBuffer[BUFFER_SIZE];                                           // Buffer to store message decrypted with RSA.
-    char charBuffer[BUFFER_SIZE];                                                   // Temporary buffer to store decrypted message.
-    memset(&rsaDecryptedBuffer, 0, BUFFER_SIZE);                                    // Ensure blank.
-    memset(&charBuffer, 0, BUFFER_SIZE);                                            // Ensure blank.
-    for (int i = 0; i < messageLength; i++) {                                       // Loop through message.
-        rsaDecryptedBuffer[i] = repeatsquare(encryptedBuffer[i], d, n);             // Decrypt with RSA.
-        charBuffer[i] = cbc(rsaDecryptedBuffer[i], i == 0 ? nOnce : rsaDecryptedBuffer[i-1]);    // Decrypt with CBC.
-    }
-    charBuffer[messageLength] = '\0';                                               // Terminate string.
-    strcpy(receiveBuffer, charBuffer);                                              // Copy decrypted string to receive buffer.
+void expireStatsTimer(Timer *timer, void *context) {
+
+    ((StatsConnection *)timer->owner)->closed = true;                               // Release connection.
 }
 
 
 /**
- *  Cypher Block Chain encryption.
- *  Returns encrypted long value.
+ *  Releases every finished metrics connection.
  */
-long cbc(char charToEncrypt, long rand) {
+void removeClosedStatsConnections(Server &server) {
 
-    return charToEncrypt ^ rand;                                                    // Return encrypted value.
+    for (int i = 0; i < server.statsConnectionCount; i++) {                         // Loop through connections.
+        StatsConnection *connection = server.statsConnections[i];                   // The connection.
+        if (!connection->closed) {                                                  // If still in use.
+            continue;                                                               // Keep connection.
+        }
+        closesocket(connection->ns);                                                // Close the connection socket.
+        stopTimer(server.timers, &connection->timer);                               // Remove timer from the wheel before freeing it.
+        delete connection;                                                          // Free memory.
+        server.statsConnections[i--] = server.statsConnections[--server.statsConnectionCount];    // Fill the gap with the last connection.
+    }
 }
 
@@ -1,19 +1,181 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#ifndef _WIN32_WINNT                                                                // Files needing newer calls, such as handoff, set their own first.
 #define _WIN32_WINNT 0x501
+#endif
+#define FD_SETSIZE 1024                                                             // Raise winsock's select() limit (default 64) so many clients can be served at once.
 #include <ws2tcpip.h>
 #include <winsock2.h>
 #include <ws2tcpip.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <iostream>
+#include "../common/cipher.h"
+#include "../common/metrics.h"
+#include "../common/log.h"
+#include "../common/trace.h"
+#include "../common/keyframe.h"
+#include "../common/rsatable.h"
+#include "../common/stream.h"
+#include "../common/compress.h"
+#include "../common/batch.h"
+#include "../common/transport.h"
+#include "../common/affinity.h"
+#include "../common/capture.h"
+#include "../common/journal.h"
+#include "timerwheel.h"
+#include "fairshare.h"
+#include "handler.h"
 
 #define USE_IPV6 false                                                              // Sets whether to use IPv6 (true) or IPv4 (false).
 #define DEFAULT_PORT "1234"                                                         // The port number used for TCP connection.
+#define DEFAULT_STATS_PORT "1235"                                                   // The local port number the metrics are served on.
+#define DEFAULT_HANDLER "echo"                                                      // The handler run on every decrypted message.
 #define BUFFER_SIZE 800                                                             // Size of buffer to receive and send messages with.
 #define WSVERS MAKEWORD(2,2)
 
+#define MAX_SESSIONS 512                                                            // Maximum number of clients connected at once, must be less than FD_SETSIZE.
+#define SESSION_QUEUE_FRAMES 8                                                      // Maximum number of received frames queued per client before reads from it are paused.
+#define SESSION_QUEUE_BYTES (4 * BUFFER_SIZE)                                       // Maximum number of received bytes queued per client, must be at least BUFFER_SIZE.
+#define GLOBAL_QUEUE_FRAMES 1024                                                    // Maximum number of received frames queued across all clients.
+#define GLOBAL_QUEUE_BYTES (256 * BUFFER_SIZE)                                      // Maximum number of received bytes queued across all clients.
+#define OUTPUT_BUFFER_SIZE (4 * BUFFER_SIZE)                                        // Size of each client's buffer of bytes waiting to be sent.
+#define REFUSE_WHEN_OVERLOADED false                                                // Sets whether new clients are refused (true) or left in the listen backlog (false) under overload.
+#define HANDSHAKE_TIMEOUT_MS 10000                                                  // Time a new client has to ACK the public key and send its nOnce.
+#define IDLE_TIMEOUT_MS 300000                                                      // Time a client may go without sending anything once the handshake is done.
+#define WRITE_STALL_TIMEOUT_MS 30000                                                // Time a client may leave replies unread before it is disconnected.
+#define MAX_STATS_CONNECTIONS 8                                                     // Maximum number of metrics requests served at once.
+#define STATS_REQUEST_SIZE 1024                                                     // Size of the buffer holding a metrics request.
+#define STATS_RESPONSE_SIZE 16384                                                   // Size of the buffer holding a metrics response.
+#define STATS_TIMEOUT_MS 5000                                                       // Time a metrics request has to be sent and its response read.
+#define TRACE_SAMPLE_EVERY 8                                                        // One client in this many is traced when a trace file is given.
+#define KEY_ROTATION_MS 0                                                           // Time between moving to the next server key, 0 never rotates.
+#define MAX_DECOMPRESSED_BYTES (BUFFER_SIZE / 2)                                    // Largest message accepted once decompressed, so the reply echoing it fits in a buffer.
+
 using namespace std;
 
 
+/**
+ *  Structures.
+ */
+enum SessionState {                                                                 // The stage of the protocol a client has reached.
+    SESSION_AWAITING_KEY_ACK,                                                       // Server public key sent, waiting for the client's ACK.
+    SESSION_AWAITING_NONCE,                                                         // Waiting for the client's nOnce.
+    SESSION_READY,                                                                  // Receiving encrypted messages.
+    SESSION_CLOSED                                                                  // Disconnected, waiting to be removed.
+};
+
+struct Frame {                                                                      // A complete "\r\n" terminated line received from a client.
+    int  length;                                                                    // Number of bytes in data, including "\r\n".
+    char data[BUFFER_SIZE + 1];                                                     // The received bytes, null terminated.
+};
+
+struct Session {                                                                    // The state of one connected client.
+    SOCKET       ns;                                                                // The client connection socket.
+    SessionState state;                                                             // The stage of the protocol the client has reached.
+    char         clientHost[NI_MAXHOST];                                            // Stores the client's IP address.
+    char         clientService[NI_MAXSERV];                                         // Stores the client's port number.
+    long         nOnce;                                                             // The nOnce value, used as intial rand in CBC decryption.
+    ChainMode    chainMode;                                                         // The chaining the client asked for with its nOnce, CBC unless it asked for CTR.
+    long long    ctrCounter;                                                        // Symbols received in counter mode, the index of the next message's first pad.
+    bool         compression;                                                       // True if the client asked for compression with its nOnce, its messages may then be compressed.
+    bool         batching;                                                          // True if the client asked for batching with its nOnce, its messages may then carry several at once.
+    bool         multiplexed;                                                       // True if the client asked for streams with its nOnce, every message then starts with a stream header.
+    int          messagesInFlight;                                                  // Number of stream messages queued and not yet replied to, at most MUX_CONNECTION_CREDITS.
+    unsigned char streamInFlight[MUX_MAX_STREAMS];                                  // Number of messages queued and not yet replied to on each stream, at most MUX_STREAM_CREDITS.
+    char         inputBuffer[BUFFER_SIZE];                                          // Received bytes that do not yet form a complete frame.
+    int          inputLength;                                                       // Number of bytes in inputBuffer.
+    Frame        frames[SESSION_QUEUE_FRAMES];                                      // Ring of complete frames waiting to be processed.
+    int          frameHead;                                                         // Index of the oldest frame in frames.
+    int          frameCount;                                                        // Number of frames queued.
+    int          queuedBytes;                                                       // Number of received bytes held in inputBuffer and frames.
+    char         outputBuffer[OUTPUT_BUFFER_SIZE];                                  // Bytes waiting to be sent to the client.
+    int          outputOffset;                                                      // Index of the first unsent byte in outputBuffer.
+    int          outputLength;                                                      // Index one past the last unsent byte in outputBuffer.
+    bool         readPaused;                                                        // True while reads from the client are paused by throttling.
+    Timer        activityTimer;                                                     // Handshake deadline, then idle timeout once the handshake is done.
+    Timer        writeTimer;                                                        // Running while output is pending, restarted whenever output is sent.
+    KeyFrame    *keyFrame;                                                          // The server key frame sent to the client, its key decrypts the client's messages.
+    int          keyFrameOffset;                                                    // Number of bytes of keyFrame sent, sent straight from the shared frame before outputBuffer.
+    unsigned long long acceptedAt;                                                  // When the client was accepted, for the handshake duration metric.
+    int          traceId;                                                           // The client's number in the trace, 0 if not traced.
+    int          captureId;                                                         // The client's number in the capture file, 0 if not captured.
+    unsigned long long tracedAt;                                                    // Timestamp counter when a traced client was accepted.
+    HandlerJob   job;                                                               // The client's decrypted frame and its replies, one at a time so replies keep their order.
+    bool         jobInFlight;                                                       // True while the job is with the handler, the client's next frame waits until it finishes.
+    unsigned long long jobStartedAt;                                                // When the job was submitted, for the handler duration metric.
+    unsigned long long jobTracedAt;                                                 // Timestamp counter when the job was submitted, if traced.
+    SharedChannel *shared;                                                          // The client's shared memory once agreed and the ACK sent, frames and replies then go through it and the socket only rings.
+    SharedChannel *pendingShared;                                                   // Shared memory agreed with the nOnce, used once the ACK has been sent on the socket.
+    bool         inputReady;                                                        // True if a shared-memory client had bytes waiting before select().
+    int          node;                                                              // The NUMA node the client's state was allocated on.
+    bool         handedOff;                                                         // True once the client has been given to a successor, it is let go rather than disconnected.
+    FairShare    share;                                                             // The client's credit and class in deficit round robin.
+    int          journalId;                                                         // The client's number in the journal, 0 if taken over from an old server.
+    long long    journalPosition;                                                   // The journal position at which the job's message is durable.
+    bool         awaitingJournal;                                                   // True while the job's replies are held until its message is durable, jobInFlight stays set.
+};
+
+struct ThrottleStats {                                                              // Counts of every throttling decision made by the server.
+    long acceptsRefused;                                                            // Clients accepted then closed straight away because of overload.
+    long acceptsDeferred;                                                           // Times accepting was paused, leaving clients in the listen backlog.
+    long sessionReadPauses;                                                         // Times a client's reads were paused by its own queue limits.
+    long globalReadPauses;                                                          // Times a client's reads were paused by the global queue limits.
+    long outputDeferrals;                                                           // Times a frame was left queued because the client's output was full.
+};
+
+struct TimeoutStats {                                                               // Counts of clients disconnected by timers.
+    long handshakeTimeouts;                                                         // Clients that did not finish the handshake in time.
+    long idleTimeouts;                                                              // Clients that sent nothing for too long.
+    long writeStallTimeouts;                                                        // Clients that stopped reading replies.
+};
+
+struct StatsConnection {                                                            // A connection to the metrics endpoint.
+    SOCKET ns;                                                                      // The connection socket.
+    bool   closed;                                                                  // True once finished, waiting to be removed.
+    char   request[STATS_REQUEST_SIZE];                                             // The HTTP request received so far.
+    int    requestLength;                                                           // Number of bytes in request.
+    char   response[STATS_RESPONSE_SIZE];                                           // The HTTP response, built once the request is complete.
+    int    responseOffset;                                                          // Index of the first unsent byte in response.
+    int    responseLength;                                                          // Number of bytes in response, 0 until built.
+    Timer  timer;                                                                   // Closes the connection if the request or response stalls.
+};
+
+struct Server {                                                                     // The state of the server's event loop.
+    SOCKET        s;                                                                // The listening socket.
+    SOCKET        unixSocket;                                                       // The AF_UNIX listening socket for clients on this host, INVALID_SOCKET if not listening.
+    long         *encryptKeyCA;                                                     // The key used to encrypt/decrypt Certification Authority messages.
+    long        (*serverKeys)[3];                                                   // The keys used to encrypt/decrypt server messages, rotated through in order.
+    int           serverKeyCount;                                                   // Number of keys in serverKeys.
+    int           serverKeyIndex;                                                   // Index of the key new clients are sent.
+    KeyFrame     *keyFrame;                                                         // The handshake frame sent to new clients, built once per key.
+    Timer         keyRotationTimer;                                                 // Moves to the next server key every KEY_ROTATION_MS.
+    Session      *sessions[MAX_SESSIONS];                                           // The connected clients.
+    int           sessionCount;                                                     // Number of connected clients.
+    int           nextSession;                                                      // Index of the client processed first on the next pass, for round robin.
+    FairScheduler scheduler;                                                        // The weight of each class of client, and how frame processing was shared out.
+    int           queuedFrames;                                                     // Number of frames queued across all clients.
+    int           queuedBytes;                                                      // Number of received bytes queued across all clients.
+    bool          acceptDeferred;                                                   // True while accepting is paused by overload.
+    ThrottleStats stats;                                                            // Counts of throttling decisions.
+    TimerWheel    timers;                                                           // Every client's timers.
+    TimeoutStats  timeoutStats;                                                     // Counts of timer-driven disconnects.
+    SOCKET        statsSocket;                                                      // The metrics endpoint's listening socket, INVALID_SOCKET if not serving metrics.
+    StatsConnection *statsConnections[MAX_STATS_CONNECTIONS];                       // The connections to the metrics endpoint.
+    int           statsConnectionCount;                                             // Number of connections to the metrics endpoint.
+    int           clientsAccepted;                                                  // Number of clients accepted, numbers traced clients.
+    HandlerPool   handlers;                                                         // Runs the handler on every decrypted message.
+    AffinityPlan  affinity;                                                         // The cores the event loop and the workers are pinned to.
+    int           node;                                                             // The NUMA node of the event loop's core, -1 if not pinned, clients' state is allocated on it.
+    SOCKET        restartSocket;                                                    // The AF_UNIX socket a successor connects to for a hot restart, INVALID_SOCKET if not listening.
+    const char   *restartPath;                                                      // The path of restartSocket.
+    SOCKET        successor;                                                        // The connection from the server taking over, INVALID_SOCKET unless draining for it.
+    DWORD         successorProcess;                                                 // The successor's process, sockets are duplicated for it.
+    DWORD         handoffStartedAt;                                                 // When draining for the successor started.
+};
+
+
 /**
  *  Function declarations.
  */
@@ -23,22 +185,17 @@ int  getServerAddressInfo(struct addrinfo *&result, int argc, char *argv[], char
 int  createSocket(SOCKET &s, struct addrinfo *result);                              // Creates the socket.
 int  bindSocket(SOCKET &s, struct addrinfo *result);                                // Binds the socket.
 int  startListening(SOCKET s, char *portNum);                                       // Starts listening for client connections on socket.
-int  communicateWithNewClient(SOCKET s, long *encryptKeyCA, long *encryptKeyServer);// Connects with a new client and communicates over encrypted channel.
+int  runServer(Server &server);                                                     // Runs the event loop, serving every connected client.
+bool isOverloaded(Server &server);                                                  // Checks whether the server has reached its client or queue limits.
+bool canReadFromClient(Server &server, Session *session);                           // Checks whether the client's queues have room for more received bytes.
+int  communicateWithNewClient(Server &server, SOCKET listener);                     // Connects with a new client and starts the encrypted channel handshake.
 int  acceptNewClient(SOCKET s, SOCKET &ns, char *clientHost, char *clientService);  // Accepts a new client connection and allocates the socket ns for communication.
-int  sendServerPublicKey(SOCKET s, long *encryptKeyCA, long *encryptKeyServer);     // Sends encrypted public key of server to client.
-void encryptCA(char *sendBuffer, int &messageLength, int d, int n);                 // Encrypt method used to encrypt the certificate authority's message.
-long repeatsquare(long x, long eORd, long n);                                       // Repeat Square method as found in Assignment guide.
-void createStringToSend(char *sendBuffer, long *encryptedBuffer, int &messageLength);   // Creates a string of char representation of long values from the encrypted long buffer.
-int  sendMessage(SOCKET s, char *sendBuffer, int strlen);                           // Sends buffer to client.
-void displayCharBuffer(char *charBuffer, int messageLength);                        // Displays character buffer in human readable format to user.
-int  receiveMessage(SOCKET s, char *receiveBuffer, int messageLength);              // Receives a message from the client and displays message.
-void removeTerminatingCharacters(char *charBuffer, int &messageLength);             // Removes terminating characters "\r\n" from messages.
-int  receiveACK(SOCKET s, char *expectedACK);                                       // Receives message from user and compares to expected ACK string.
-int  simulateCASendingServerPublicKey(SOCKET s, long *encryptKeyCA, long *encryptKeyServer);    // Simulates the Certifcation Authority sending the server's public key to the client.
-int  receiveNOnce(SOCKET s, long &nOnce);                                           // Receives the nOnce value from the client.
-void receiveClientMessages(SOCKET s, long *encryptKeyServer, long nOnce, bool &clientConnected);    // Receives encrypted message from the client, decrypts them, and replies with the decrypted message.
-int  receiveEncryptedMessage(SOCKET s, long *encryptedBuffer, int &messageLength, int &receivedMessageLength);  // Receives encrypted message and stores in encryptedBuffer.
-void printBuffer(const char *header, char *buffer, int messageLength);              // Napoleon's print buffer method.
-void decrypt(long *encryptedBuffer, char *receiveBuffer, int &messageLength, int d, int n, int nOnce);  // Decrypt method used to decrypt received encrypted messages.
-long cbc(char charToEncrypt, long rand);                                            // Cypher Block Chain encryption.
+int  startStatsEndpoint(Server &server, int argc, char *argv[]);                    // Starts listening for metrics requests on a local port.
+void acceptStatsConnection(Server &server);                                         // Accepts a connection to the metrics endpoint.
+void serviceStatsConnection(Server &server, StatsConnection *connection, bool readable, bool writable); // Reads a metrics request and sends the response.
+void buildStatsResponse(Server &server, StatsConnection *connection);               // Builds the HTTP response to a metrics request.
+int  writeServerMetrics(Server &server, char *buffer, int size);                    // Writes the registry's metrics and the event loop's own counters.
+void expireStatsTimer(Timer *timer, void *context);                                 // Closes a metrics connection that stalled.
+void removeClosedStatsConnections(Server &server);                                  // Releases every finished metrics connection.
 
+#endif
@@ -0,0 +1,958 @@
+#include "session.h"
+#include "../common/copycount.h"
+
+enum { KEY_E, KEY_D, KEY_N };                                                       // Used to access values in key arrays.
+
+static void displayCharBuffer(char *charBuffer, int messageLength);                 // Displays character buffer in human readable format to user.
+static void removeTerminatingCharacters(char *charBuffer, int &messageLength);      // Removes terminating characters "\r\n" from messages.
+static void printBuffer(const char *header, char *buffer, int messageLength);       // Napoleon's print buffer method.
+
+
+/**
+ *  Adds a client connected on socket ns to the connected clients, its state zeroed and its timers prepared but not started.
+ *  Returns the client's state, NULL if it could not be allocated.
+ */
+Session *addSession(Server &server, SOCKET ns, const char *clientHost, const char *clientService) {
+
+    u_long nonBlocking = 1;                                                         // Enables non-blocking mode.
+    ioctlsocket(ns, FIONBIO, &nonBlocking);                                         // Never block on the client, the event loop waits in select().
+    Session *session = (Session *)allocateOnNode(sizeof(Session), server.node);     // The client's state, zeroed, on the event loop's node.
+    if (session == NULL) {                                                          // If it could not be allocated.
+        return NULL;                                                                // No session.
+    }
+    session->ns = ns;                                                               // Communicate over socket ns.
+    session->node = server.node >= 0 ? server.node : currentNode();                 // Unpinned, the memory is placed when the event loop first touches it.
+    countNodeEvent(NODE_SESSIONS, session->node);                                   // Count session.
+    strcpy(session->clientHost, clientHost);                                        // Save the client's IP address.
+    strcpy(session->clientService, clientService);                                  // Save the client's port number.
+    initTimer(&session->activityTimer, expireActivityTimer, session);               // Prepare handshake and idle timer.
+    initTimer(&session->writeTimer, expireWriteTimer, session);                     // Prepare write stall timer.
+    server.sessions[server.sessionCount++] = session;                               // Add to connected clients.
+    return session;                                                                 // Return the client's state.
+}
+
+
+/**
+ *  Starts the handshake with a client just added, numbering it for the trace, the capture and the journal, and sends it the server's public key.
+ *  The whole handshake must finish by HANDSHAKE_TIMEOUT_MS.
+ *  Returns error code, the client is disconnected if one occurs.
+ */
+int startHandshake(Server &server, Session *session) {
+
+    session->state = SESSION_AWAITING_KEY_ACK;                                      // Waiting for ACK of the server's public key.
+    startTimer(server.timers, &session->activityTimer, HANDSHAKE_TIMEOUT_MS);       // The whole handshake must finish by the deadline.
+    session->acceptedAt = metricsClock();                                           // Time the handshake.
+    server.clientsAccepted++;                                                       // Number client.
+    if (traceSample()) {                                                            // If client is traced.
+        session->traceId = server.clientsAccepted;                                  // Show client by its number in the trace.
+        session->tracedAt = traceClock();                                           // Trace the handshake.
+    }
+    session->captureId = isCapturing() ? server.clientsAccepted : 0;                // Record the client's frames if capturing.
+    session->journalId = server.clientsAccepted;                                    // Show client by its number in the journal.
+    countMetric(METRIC_CONNECTIONS_ACCEPTED, 1);                                    // Count client.
+    int error = simulateCASendingServerPublicKey(session, server.keyFrame);         // Simulate the Certifaction Authority sending the client the public key of the server.
+    if (error) {                                                                    // If error occurred.
+        closeSession(session);                                                      // Disconnect client.
+        return error;                                                               // Return error code.
+    }
+    flushOutput(server, session);                                                   // Send the public key.
+    return 0;                                                                       // Return no error.
+}
+
+/**
+ *  Receives available bytes from the client and queues complete frames.
+ *  Never reads more than the client's queues have room for, so a full queue leaves data in the socket and TCP slows the client down.
+ *  A shared-memory client is read from its ring, where a full queue leaves data the same way and the full ring slows the client down.
+ *  The socket is read through transportRecv(), so the benchmark can serve a loopback end from createLoopbackPair() as a client.
+ */
+void readFromClient(Server &server, Session *session) {
+
+    int space = BUFFER_SIZE - session->inputLength;                                 // Room left in the input buffer.
+    if (space > SESSION_QUEUE_BYTES - session->queuedBytes) {                       // If client's byte limit is closer.
+        space = SESSION_QUEUE_BYTES - session->queuedBytes;                         // Read no more than the limit allows.
+    }
+    if (space <= 0) {                                                               // If no room.
+        return;                                                                     // Leave data in the socket.
+    }
+    unsigned long long recvStart = session->traceId ? traceClock() : 0;             // Time the receive if traced.
+    int bytes = session->shared != NULL ? sharedRecv(session->shared, &session->inputBuffer[session->inputLength], space)
+                                        : transportRecv(session->ns, &session->inputBuffer[session->inputLength], space);    // Receive available bytes, from shared memory if agreed.
+    if (session->traceId) {                                                         // If traced.
+        traceSpan("recv", "message", session->traceId, recvStart, traceClock());    // Record span.
+    }
+    if (bytes == SOCKET_ERROR && WSAGetLastError() == WSAEWOULDBLOCK) {             // If nothing to receive after all.
+        return;                                                                     // Try again later.
+    } else if ((bytes == SOCKET_ERROR) || (bytes == 0)) {                           // If socket error or connection ended.
+        LOG(LOG_INFO) << "recv failed" << endl;                                     // Alert user.
+        closeSession(session);                                                      // Disconnect client.
+        return;                                                                     // Nothing more to do.
+    }
+    if (session->state == SESSION_READY) {                                          // If handshake is done.
+        startTimer(server.timers, &session->activityTimer, IDLE_TIMEOUT_MS);        // Client is not idle.
+    }
+    countMetric(METRIC_BYTES_IN, bytes);                                            // Count received bytes.
+    session->inputLength += bytes;                                                  // Store received bytes.
+    session->queuedBytes += bytes;                                                  // Count against client's limit.
+    server.queuedBytes += bytes;                                                    // Count against server's limit.
+    if (extractFrames(server, session)) {                                           // If frames could not be extracted.
+        closeSession(session);                                                      // Disconnect client.
+    }
+}
+
+
+/**
+ *  Moves complete lines from the client's input buffer to its frame queue.
+ *  Stops when the client's or the server's frame limit is reached.
+ *  Returns error code.
+ */
+int extractFrames(Server &server, Session *session) {
+
+    while (session->frameCount < SESSION_QUEUE_FRAMES && server.queuedFrames < GLOBAL_QUEUE_FRAMES) {  // While there is room for another frame.
+        char *end = (char *)memchr(session->inputBuffer, '\n', session->inputLength);   // Find the end of the first line.
+        if (end == NULL) {                                                          // If no complete line.
+            if (session->inputLength == BUFFER_SIZE) {                              // If at buffer limit.
+                LOG(LOG_ERROR) << "Full message not received: receiveBuffer overloaded" << endl; // Alert user.
+                return 14;                                                          // Return error code.
+            }
+            break;                                                                  // Wait for more bytes.
+        }
+        int length = end - session->inputBuffer + 1;                                // Length of the line, including "\n".
+        Frame *frame = &session->frames[(session->frameHead + session->frameCount) % SESSION_QUEUE_FRAMES];  // The next free frame.
+        memcpy(frame->data, session->inputBuffer, length);                          // Copy line into frame.
+        frame->data[length] = '\0';                                                 // Add null terminator.
+        frame->length = length;                                                     // Store frame length.
+        session->inputLength -= length;                                             // Remove line from input buffer.
+        memmove(session->inputBuffer, &session->inputBuffer[length], session->inputLength); // Move remaining bytes to the start.
+        session->frameCount++;                                                      // Frame is queued.
+        server.queuedFrames++;                                                      // Count against server's limit.
+        if (session->multiplexed) {                                                 // If messages belong to streams.
+            int stream = 0;                                                         // The frame's stream.
+            if (parseStreamHeader(frame->data, length, stream) == 0) {              // If no stream header.
+                LOG(LOG_ERROR) << "Stream message received without a stream header" << endl;   // Alert user.
+                return 15;                                                          // Return error code.
+            }
+            if (++session->streamInFlight[stream] > MUX_STREAM_CREDITS || ++session->messagesInFlight > MUX_CONNECTION_CREDITS) {  // If the client sent more than its credits allow.
+                LOG(LOG_ERROR) << "Stream " << stream << " sent more messages than its credits allow" << endl;  // Alert user.
+                return 16;                                                          // Return error code.
+            }
+        }
+    }
+    return 0;                                                                       // Return no error.
+}
+
+
+/**
+ *  Processes queued frames from every client by deficit round robin.
+ *  Each pass credits a client with a frame waiting its class's weight in quanta of bytes, and processes its frames while the credit covers them.
+ *  Each turn grantQuantum() credits the client with bytes, and chargeFrame() takes each frame's length from that credit.
+ *  A frame longer than the credit left waits for the next turn, so clients of one weight are served equal bytes over time, not equal decryption time.
+ *  A client is skipped while its output buffer cannot hold a reply, so a client that does not read stops being served.
+ */
+void processClientFrames(Server &server) {
+
+    for (int n = 0; n < server.sessionCount; n++) {                                 // Loop through clients.
+        Session *session = server.sessions[(server.nextSession + n) % server.sessionCount]; // Start after the client served first last time.
+        if (session->frameCount > 0 && session->state != SESSION_CLOSED && !session->jobInFlight) {    // If a frame is waiting.
+            grantQuantum(server.scheduler, session->share);                         // Credit the client for this pass.
+        }
+        while (session->frameCount > 0 && session->state != SESSION_CLOSED && !session->jobInFlight) {  // While frames are waiting and the handler is not busy with the last.
+            if (session->outputLength - session->outputOffset > OUTPUT_BUFFER_SIZE - BUFFER_SIZE) {  // If no room for a reply.
+                server.stats.outputDeferrals++;                                     // Count throttling decision.
+                break;                                                              // Leave frame queued.
+            }
+            if (!chargeFrame(server.scheduler, session->share, session->frames[session->frameHead].length)) {  // If the client's credit does not cover the frame.
+                break;                                                              // Leave frame queued until the next pass.
+            }
+            if (processClientFrame(server, session)) {                              // If error occurred.
+                closeSession(session);                                              // Disconnect client.
+            }
+        }
+        endTurn(session->share, session->frameCount == 0);                          // Drop the client's credit if it has nothing waiting.
+        if (session->state != SESSION_CLOSED && extractFrames(server, session)) {   // If queued bytes could not be extracted.
+            closeSession(session);                                                  // Disconnect client.
+        }
+        flushOutput(server, session);                                               // Send replies.
+    }
+    if (server.sessionCount > 0) {                                                  // If there are clients.
+        server.nextSession = (server.nextSession + 1) % server.sessionCount;        // Serve the next client first next time.
+    }
+}
+
+
+/**
+ *  Processes the oldest queued frame from the client according to the stage of the protocol it has reached.
+ *  Returns error code.
+ */
+int processClientFrame(Server &server, Session *session) {
+
+    int error = 0;                                                                  // Stores the error code returned from functions.
+    unsigned long long frameStart = session->traceId ? traceClock() : 0;            // Time the frame if traced.
+    const char *frameKind = session->state == SESSION_READY ? "Data frame" : "Handshake frame"; // What the frame is, for its copy counts.
+    CopyCounts before;                                                              // Counts before the frame, if counted.
+    if (COPY_COUNTING) {                                                            // If built to count copies.
+        readCopyCounts(before);                                                     // Read counts.
+    }
+    if (session->state == SESSION_AWAITING_KEY_ACK) {                               // If waiting for ACK of the public key.
+        char expectedACK[BUFFER_SIZE];                                              // Stores the expected ACK string.
+        strcpy(expectedACK, "ACK 226 public key received");                         // Create expected ACK.
+        error = receiveACK(server, session, expectedACK);                           // Receive ACK from client.
+        session->state = SESSION_AWAITING_NONCE;                                    // Wait for the nOnce.
+        if (session->traceId) {                                                     // If traced.
+            traceSpan("key_ack", "handshake", session->traceId, frameStart, traceClock());  // Record span.
+        }
+    } else if (session->state == SESSION_AWAITING_NONCE) {                          // Else if waiting for the nOnce.
+        error = receiveNOnce(server, session);                                      // Receive the unencrypted nOnce value from the client.
+        if (!error) {                                                               // If handshake is done.
+            countMetric(METRIC_HANDSHAKES_COMPLETED, 1);                            // Count handshake.
+            recordMetric(METRIC_HANDSHAKE_TIME, metricsClock() - session->acceptedAt);  // Record handshake duration.
+        }
+        if (session->traceId) {                                                     // If traced.
+            unsigned long long frameEnd = traceClock();                             // End of the handshake.
+            traceSpan("nonce", "handshake", session->traceId, frameStart, frameEnd);    // Record span.
+            traceSpan("handshake", "handshake", session->traceId, session->tracedAt, frameEnd); // Record span.
+        }
+        session->state = SESSION_READY;                                             // Receive encrypted messages.
+        startTimer(server.timers, &session->activityTimer, IDLE_TIMEOUT_MS);        // Handshake deadline met, switch to idle timeout.
+        LOG(LOG_INFO) << "\n--------------------------------------------" << endl;  // Alert user.
+        LOG(LOG_INFO) << "The server is ready to receive data." << endl;            // Alert user.
+    } else if (session->state == SESSION_READY) {                                   // Else if receiving encrypted messages.
+        error = receiveClientMessage(server, session);                              // Receive encrypted message from the client.
+        if (session->traceId) {                                                     // If traced.
+            traceSpan("message", "message", session->traceId, frameStart, traceClock());    // Record span.
+        }
+    }
+    if (COPY_COUNTING && LOG_ENABLED(LOG_DEBUG)) {                                  // If built to count copies and they are logged.
+        CopyCounts counts;                                                          // Counts for the frame, including any made meanwhile by other threads.
+        readCopyCounts(counts);                                                     // Read counts.
+        subtractCopyCounts(counts, before);                                         // Leave the frame's counts.
+        LOG(LOG_DEBUG) << frameKind << ": " << counts.allocations << " allocations (" << counts.allocatedBytes << " bytes), " << counts.copies << " copies (" << counts.copiedBytes << " bytes), " << counts.zeroings << " zeroings (" << counts.zeroedBytes << " bytes)" << endl; // Alert user.
+    }
+    return error;                                                                   // Return error code if any.
+}
+
+
+/**
+ *  Sends as much of the client's pending output as the socket accepts.
+ *  Unsent bytes stay in the output buffer until select() reports the socket writable.
+ *  Once shared memory is agreed output goes to the client's ring instead, from when the ACK agreeing it has been sent.
+ *  The write timer runs while output is pending and restarts whenever some is sent.
+ */
+void flushOutput(Server &server, Session *session) {
+
+    bool progress = false;                                                          // True once some output is sent.
+    while (session->state != SESSION_CLOSED && hasPendingOutput(session)) {         // While output is pending.
+        bool sendingKey = session->keyFrameOffset < session->keyFrame->length;      // True while the shared key frame is being sent.
+        char *pending = sendingKey ? &session->keyFrame->data[session->keyFrameOffset] : &session->outputBuffer[session->outputOffset];  // The next unsent byte.
+        int pendingLength = sendingKey ? session->keyFrame->length - session->keyFrameOffset : session->outputLength - session->outputOffset;    // Number of unsent bytes.
+        unsigned long long sendStart = session->traceId ? traceClock() : 0;         // Time the send if traced.
+        int bytes = session->shared != NULL ? sharedSend(session->shared, pending, pendingLength) : transportSend(session->ns, pending, pendingLength);  // Send pending output, to shared memory if agreed.
+        if (session->traceId) {                                                     // If traced.
+            traceSpan("send", "message", session->traceId, sendStart, traceClock());    // Record span.
+        }
+        if (bytes == SOCKET_ERROR) {                                                // If nothing was sent.
+            if (WSAGetLastError() != WSAEWOULDBLOCK) {                              // If connection ended.
+                LOG(LOG_ERROR) << "send failed" << endl;                            // Alert user.
+                closeSession(session);                                              // Disconnect client.
+            } else if (progress || !isTimerRunning(&session->writeTimer)) {         // Else if socket is full and stall not already being timed.
+                startTimer(server.timers, &session->writeTimer, WRITE_STALL_TIMEOUT_MS);    // Time the stall.
+            }
+            return;                                                                 // Try again later.
+        }
+        countMetric(METRIC_BYTES_OUT, bytes);                                       // Count sent bytes.
+        if (sendingKey) {                                                           // If sending the key frame.
+            session->keyFrameOffset += bytes;                                       // Remove sent bytes.
+        } else {                                                                    // Else sending the output buffer.
+            session->outputOffset += bytes;                                         // Remove sent bytes.
+        }
+        progress = true;                                                            // Output was sent.
+    }
+    session->outputOffset = 0;                                                      // Output buffer is empty.
+    session->outputLength = 0;                                                      // Output buffer is empty.
+    stopTimer(server.timers, &session->writeTimer);                                 // Nothing pending, no stall.
+    if (session->pendingShared != NULL && session->state != SESSION_CLOSED) {       // If the ACK agreeing shared memory has been sent.
+        session->shared = session->pendingShared;                                   // Frames and replies go through it from now on.
+        session->pendingShared = NULL;                                              // Agreed.
+    }
+}
+
+
+/**
+ *  Checks whether the client has bytes waiting to be sent, from the shared key frame or its output buffer.
+ *  Returns true if there are unsent bytes.
+ */
+bool hasPendingOutput(Session *session) {
+
+    return (session->keyFrame != NULL && session->keyFrameOffset < session->keyFrame->length)
+        || session->outputOffset < session->outputLength;
+}
+
+
+/**
+ *  Marks the client as disconnected.
+ *  The client is released by removeClosedSessions() so the event loop never uses a freed session.
+ */
+void closeSession(Session *session) {
+
+    session->state = SESSION_CLOSED;                                                // Client is no longer connected.
+}
+
+
+/**
+ *  Releases every disconnected client.
+ */
+void removeClosedSessions(Server &server) {
+
+    for (int i = 0; i < server.sessionCount; i++) {                                 // Loop through clients.
+        Session *session = server.sessions[i];                                      // The client.
+        if (session->state != SESSION_CLOSED || session->jobInFlight) {             // If still connected, or the handler still holds its job.
+            continue;                                                               // Keep client.
+        }
+        closeTransport(session->ns);                                                // Close the communication socket, or the loopback end standing in for it.
+        if (session->shared != NULL) {                                              // If using shared memory.
+            closeSharedChannel(session->shared);                                    // Unmap it.
+        }
+        if (session->pendingShared != NULL) {                                       // If agreed but not yet used.
+            closeSharedChannel(session->pendingShared);                             // Unmap it.
+        }
+        stopTimer(server.timers, &session->activityTimer);                          // Remove timers from the wheel before freeing them.
+        stopTimer(server.timers, &session->writeTimer);                             // Remove timers from the wheel before freeing them.
+        releaseKeyFrame(session->keyFrame);                                         // Release the key frame, freeing it if the key has since rotated.
+        if (session->captureId != 0 && !session->handedOff) {                       // If captured, and not carried on by a successor.
+            captureRecord(CAPTURE_CLOSE, session->captureId, NULL, 0);              // Record the disconnect.
+        }
+        countMetric(METRIC_CONNECTIONS_CLOSED, 1);                                  // Count disconnect.
+        server.queuedFrames -= session->frameCount;                                 // Release client's frames from server's limit.
+        server.queuedBytes -= session->queuedBytes;                                 // Release client's bytes from server's limit.
+        LOG(LOG_INFO) << (session->handedOff ? "\nHanded off client with IP address: " : "\nDisconnected from client with IP address: ") << session->clientHost;   // Alert user.
+        LOG(LOG_INFO) << ", Port: " << session->clientService << endl;              // Alert user.
+        displayThrottleStats(server.stats);                                         // Alert user.
+        displayTimeoutStats(server.timeoutStats);                                   // Alert user.
+        freeOnNode(session);                                                        // Free memory.
+        server.sessions[i--] = server.sessions[--server.sessionCount];              // Fill the gap with the last client.
+    }
+}
+
+
+/**
+ *  Displays the throttling counters.
+ */
+void displayThrottleStats(ThrottleStats &stats) {
+
+    LOG(LOG_INFO) << "Throttling: " << stats.acceptsRefused << " refused, "
+         << stats.acceptsDeferred << " accepts deferred, "
+         << stats.sessionReadPauses << " client read pauses, "
+         << stats.globalReadPauses << " global read pauses, "
+         << stats.outputDeferrals << " output deferrals" << endl;                   // Alert user.
+}
+
+
+/**
+ *  Disconnects a client that missed its handshake deadline or went idle.
+ */
+void expireActivityTimer(Timer *timer, void *context) {
+
+    Server &server = *(Server *)context;                                            // The server.
+    Session *session = (Session *)timer->owner;                                     // The client.
+    if (session->state == SESSION_CLOSED) {                                         // If already disconnected.
+        return;                                                                     // Nothing to do.
+    }
+    if (session->state == SESSION_READY) {                                          // If handshake was done.
+        server.timeoutStats.idleTimeouts++;                                         // Count timeout.
+        LOG(LOG_INFO) << "\nClient " << session->clientHost << ":" << session->clientService << " idle for too long." << endl; // Alert user.
+    } else {                                                                        // Else handshake was not done.
+        server.timeoutStats.handshakeTimeouts++;                                    // Count timeout.
+        LOG(LOG_INFO) << "\nClient " << session->clientHost << ":" << session->clientService << " did not finish handshake in time." << endl; // Alert user.
+    }
+    closeSession(session);                                                          // Disconnect client.
+}
+
+
+/**
+ *  Disconnects a client that stopped reading replies.
+ */
+void expireWriteTimer(Timer *timer, void *context) {
+
+    Server &server = *(Server *)context;                                            // The server.
+    Session *session = (Session *)timer->owner;                                     // The client.
+    if (session->state == SESSION_CLOSED) {                                         // If already disconnected.
+        return;                                                                     // Nothing to do.
+    }
+    server.timeoutStats.writeStallTimeouts++;                                       // Count timeout.
+    LOG(LOG_INFO) << "\nClient " << session->clientHost << ":" << session->clientService << " stopped reading replies." << endl; // Alert user.
+    closeSession(session);                                                          // Disconnect client.
+}
+
+
+/**
+ *  Displays the timeout counters.
+ */
+void displayTimeoutStats(TimeoutStats &stats) {
+
+    LOG(LOG_INFO) << "Timeouts: " << stats.handshakeTimeouts << " handshake, "
+         << stats.idleTimeouts << " idle, "
+         << stats.writeStallTimeouts << " write stall" << endl;                     // Alert user.
+}
+
+
+/**
+ *  Sends encrypted public key of server to client.
+ *  The frame was encrypted when the key was set, the client holds a reference to it and it is sent straight from the shared buffer.
+ *  Returns error code.
+ */
+int sendServerPublicKey(Session *session, KeyFrame *keyFrame) {
+
+    unsigned long long keyStart = session->traceId ? traceClock() : 0;              // Time the key if traced.
+    LOG(LOG_DEBUG) << "\nSimulating CA sending server's public key..." << endl;     // Alert user.
+    session->keyFrame = acquireKeyFrame(keyFrame);                                  // Hold the frame until the client disconnects.
+    session->keyFrameOffset = 0;                                                    // Nothing sent yet.
+    countMetric(METRIC_MESSAGES_OUT, 1);                                            // Count message.
+    if (LOG_ENABLED(LOG_DEBUG)) {                                                   // If messages are logged.
+        logStream() << "--->";                                                      // Show that sent message with direction of arrow.
+        displayCharBuffer(keyFrame->data, keyFrame->length);                        // Alert user.
+    }
+    if (session->traceId) {                                                         // If traced.
+        traceSpan("send_key", "handshake", session->traceId, keyStart, traceClock());   // Record span.
+    }
+    return 0;                                                                       // Return no error.
+}
+
+
+/**
+ *  Builds the handshake frame for a server key and sends it to new clients.
+ *  Clients already sent the old frame keep it, and keep being decrypted with its key, until they disconnect.
+ */
+void rotateServerKey(Server &server, int keyIndex) {
+
+    KeyFrame *old = server.keyFrame;                                                // The frame being replaced.
+    server.serverKeyIndex = keyIndex;                                               // Use the key.
+    loadRsaTable(server.encryptKeyCA[KEY_D], server.encryptKeyCA[KEY_N], RSA_TABLE_THREADS);   // Encrypt the frame with one table load per symbol, built by the first rotation.
+    server.keyFrame = buildKeyFrame(server.encryptKeyCA, server.serverKeys[keyIndex]);  // Encrypt the key's frame once.
+    loadRsaTable(server.serverKeys[keyIndex][KEY_D], server.serverKeys[keyIndex][KEY_N], RSA_TABLE_THREADS);    // Decrypt clients with one table load per symbol if the key is small enough.
+    releaseKeyFrame(old);                                                           // Release the old frame, freed when its last client disconnects.
+    LOG(LOG_INFO) << "\nServer key set: e = " << server.serverKeys[keyIndex][KEY_E] << ", n = " << server.serverKeys[keyIndex][KEY_N] << endl;    // Alert user.
+}
+
+
+/**
+ *  Moves to the next server key.
+ */
+void expireKeyRotationTimer(Timer *timer, void *context) {
+
+    Server &server = *(Server *)context;                                            // The server.
+    rotateServerKey(server, (server.serverKeyIndex + 1) % server.serverKeyCount);   // Use the next key.
+    startTimer(server.timers, &server.keyRotationTimer, KEY_ROTATION_MS);           // Rotate again later.
+}
+
+
+/**
+ *  Queues buffer to be sent to client.
+ *  The event loop sends it once the socket has room.
+ *  Returns error code.
+ */
+int sendMessage(Session *session, char *sendBuffer, int strlen) {
+
+    if (session->outputOffset > 0) {                                                // If sent bytes are at the start of the output buffer.
+        session->outputLength -= session->outputOffset;                             // Remove sent bytes.
+        memmove(session->outputBuffer, &session->outputBuffer[session->outputOffset], session->outputLength);   // Move unsent bytes to the start.
+        session->outputOffset = 0;                                                  // Unsent bytes start at the beginning.
+    }
+    if (session->outputLength + strlen > OUTPUT_BUFFER_SIZE) {                      // If message does not fit.
+        LOG(LOG_ERROR) << "send failed: output buffer overloaded" << endl;          // Alert user.
+        return 9;                                                                   // Return error code.
+    }
+    memcpy(&session->outputBuffer[session->outputLength], sendBuffer, strlen);      // Queue message.
+    session->outputLength += strlen;                                                // Store new output length.
+    countMetric(METRIC_MESSAGES_OUT, 1);                                            // Count message.
+    if (LOG_ENABLED(LOG_DEBUG)) {                                                   // If messages are logged.
+        logStream() << "--->";                                                      // Show that sent message with direction of arrow.
+        displayCharBuffer(sendBuffer, strlen);                                      // Alert user.
+    }
+    return 0;                                                                       // Return no error.
+}
+
+
+/**
+ *  Displays character buffer in human readable format to user.
+ *  Writes to the log, callers check the level first so the buffer is only formatted when it will be shown.
+ */
+static void displayCharBuffer(char *charBuffer, int messageLength) {
+
+    for (int i = 0; i < messageLength; i++) {                                       // Loop through buffer.
+        if (charBuffer[i] == '\r') {                                                // If carriage return character.
+            logStream() << "\\r";                                                   // Output literal value.
+        } else if (charBuffer[i] == '\n') {                                         // If new line character.
+            logStream() << "\\n";                                                   // Output literal value.
+        } else {                                                                    // Else normal character.
+            logStream() << charBuffer[i];                                           // Output character.
+        }
+    }
+    logStream() << endl;                                                            // End line.
+}
+
+
+/**
+ *  Removes the oldest queued frame from the client.
+ *  Returns frame length.
+ */
+int receiveFrame(Server &server, Session *session, char *receiveBuffer) {
+
+    Frame *frame = &session->frames[session->frameHead];                            // The oldest frame.
+    int length = frame->length;                                                     // Stores the frame length.
+    memcpy(receiveBuffer, frame->data, length + 1);                                 // Copy frame, including null terminator.
+    session->frameHead = (session->frameHead + 1) % SESSION_QUEUE_FRAMES;           // Remove frame from queue.
+    session->frameCount--;                                                          // Frame is no longer queued.
+    session->queuedBytes -= length;                                                 // Release bytes from client's limit.
+    server.queuedFrames--;                                                          // Release frame from server's limit.
+    server.queuedBytes -= length;                                                   // Release bytes from server's limit.
+    return length;                                                                  // Return frame length.
+}
+
+
+/**
+ *  Receives a message from the client and displays message.
+ *  Returns error code.
+ */
+int receiveMessage(Server &server, Session *session, char *receiveBuffer, int &messageLength) {
+
+    int i = receiveFrame(server, session, receiveBuffer);                           // Receive the oldest frame.
+    if (i < 2 || receiveBuffer[i - 2] != '\r') {                                    // If frame is not "\r\n" terminated.
+        LOG(LOG_ERROR) << "Message not terminated with \\r\\n" << endl;             // Alert user.
+        return 10;                                                                  // Return error code.
+    }
+    if (LOG_ENABLED(LOG_DEBUG)) {                                                   // If messages are logged.
+        logStream() << "<---";                                                      // Show that received message with direction of arrow.
+        displayCharBuffer(receiveBuffer, i);                                        // Display received message.
+    }
+    removeTerminatingCharacters(receiveBuffer, i);                                  // Remove terminating characters from received message.
+    messageLength = i;                                                              // Store message length.
+    return 0;                                                                       // Return no error.
+}
+
+
+/**
+ *  Removes terminating characters "\r\n" from messages.
+ */
+static void removeTerminatingCharacters(char *charBuffer, int &messageLength) {
+
+    messageLength -= 2;                                                             // Reduce message length by 2.
+    charBuffer[messageLength] = '\0';                                               // Terminate string, removing "\r\n".
+}
+
+/**
+ *  Receives message from user and compares to expected ACK string.
+ *  Returns error code.
+ */
+int receiveACK(Server &server, Session *session, char *expectedACK) {
+
+    LOG(LOG_DEBUG) << "\nReceiving ACK..." << endl;                                 // Alert user.
+    char receiveBuffer[BUFFER_SIZE + 1];                                            // The buffer to store received characters.
+    memset(&receiveBuffer, 0, BUFFER_SIZE);                                         // Ensure blank.
+    int messageLength = 0;                                                          // Stores the length of the message, unused.
+    int error = receiveMessage(server, session, receiveBuffer, messageLength);      // Receive the reply from the client.
+    if (error) {                                                                    // If error occurred.
+        return error;                                                               // Return error code.
+    }
+    if (strcmp(receiveBuffer, expectedACK)) {                                       // Ensure expected ACK was received.
+        LOG(LOG_ERROR) << "Something went wrong, expected ACK not received." << endl; // Alert user.
+        return 12;                                                                  // Return error code.
+    }
+    return 0;                                                                       // Return no error.
+}
+
+
+/**
+ *  Simulates the Certifcation Authority sending the server's public key to the client.
+ *  The client's ACK is received by the event loop once it arrives.
+ *  Returns error code.
+ */
+int simulateCASendingServerPublicKey(Session *session, KeyFrame *keyFrame) {
+
+    int error = sendServerPublicKey(session, keyFrame);                             // Send the public key to the client.
+    if (error) {                                                                    // If error occurred.
+        return error;                                                               // Return error code.
+    }
+    return 0;                                                                       // Return no error.
+}
+
+
+/**
+ *  Receives the nOnce value from the client.
+ *  Returns error code.
+ */
+int receiveNOnce(Server &server, Session *session) {
+
+    LOG(LOG_DEBUG) << "\nReceiving nOnce..." << endl;                               // Alert user.
+    char receiveBuffer[BUFFER_SIZE + 1];                                            // The buffer to store received characters.
+    memset(&receiveBuffer, 0, BUFFER_SIZE);                                         // Ensure blank.
+    int messageLength = 0;                                                          // Stores the length of the message.
+    int error = receiveMessage(server, session, receiveBuffer, messageLength);      // Receive the reply from the client.
+    if (error) {                                                                    // If error occurred.
+        return error;                                                               // Return error code.
+    }
+    if (session->captureId != 0) {                                                  // If captured.
+        captureHandshake(session, receiveBuffer, messageLength);                    // Record the key and nOnce, the frames that follow are encrypted with them.
+    }
+    char mode[BUFFER_SIZE + 1] = "";                                                // The chaining mode asked for, if any.
+    int offset = 0;                                                                 // Index of the options following the nOnce.
+    sscanf(receiveBuffer, "NONCE %ld%n", &session->nOnce, &offset);                 // Extract nOnce from received message.
+    session->chainMode = CHAIN_CBC;                                                 // Use counter mode only if asked, older clients send no mode.
+    session->compression = false;                                                   // Use compression only if asked.
+    session->batching = false;                                                      // Use batching only if asked.
+    session->multiplexed = false;                                                   // Use streams only if asked.
+    char regionName[BUFFER_SIZE + 1] = "";                                          // The shared memory named by the client, if any.
+    int length = 0;                                                                 // Length of the option read.
+    while (sscanf(&receiveBuffer[offset], "%s%n", mode, &length) == 1) {            // Loop through options.
+        if (strcmp(mode, "CTR") == 0) {                                             // If counter mode was asked for.
+            session->chainMode = CHAIN_CTR;                                         // Use counter mode.
+        } else if (strcmp(mode, "LZ") == 0) {                                       // Else if compression was asked for.
+            session->compression = true;                                            // Messages may be compressed.
+        } else if (strcmp(mode, "MUX") == 0) {                                      // Else if streams were asked for.
+            session->multiplexed = true;                                            // Every message starts with a stream header.
+        } else if (strcmp(mode, "BATCH") == 0) {                                    // Else if batching was asked for.
+            session->batching = true;                                               // Messages may carry several at once.
+        } else if (strcmp(mode, "SHM") == 0) {                                      // Else if shared memory was asked for.
+            int nameLength = 0;                                                     // Length of the region name read.
+            if (sscanf(&receiveBuffer[offset + length], "%s%n", regionName, &nameLength) == 1) {    // If the region is named.
+                length += nameLength;                                               // Move past the name.
+            }
+        }
+        offset += length;                                                           // Move to next option.
+    }
+    HANDLE mapping = NULL;                                                          // The region's file mapping.
+    SharedRegion *region = NULL;                                                    // The region.
+    if (regionName[0] != '\0' && isLocalPeer(session->ns) && openSharedRegion(regionName, mapping, region) == 0) {    // If a client on this host named a region that opens.
+        session->pendingShared = openSharedChannel(session->ns, mapping, region, SHARED_SERVER, false); // Use it once the ACK is sent, never blocking the event loop.
+    }
+    LOG(LOG_DEBUG) << "\nnOnce received:\n\tnOnce = " << session->nOnce << "\n\tmode = " << (session->chainMode == CHAIN_CTR ? "CTR" : "CBC") << (session->compression ? " LZ" : "") << (session->multiplexed ? " MUX" : "") << (session->batching ? " BATCH" : "") << (session->pendingShared != NULL ? " SHM" : "") << endl;   // Alert user.
+    char sendBuffer[BUFFER_SIZE];                                                   // The buffer to store characters to send.
+    strcpy(sendBuffer, session->chainMode == CHAIN_CTR ? "ACK 220 nOnce received CTR" : "ACK 220 nOnce received");   // Create the ACK to send to client, naming the mode agreed.
+    if (session->compression) {                                                     // If compression was agreed.
+        strcat(sendBuffer, " LZ");                                                  // Name it.
+    }
+    if (session->multiplexed) {                                                     // If streams were agreed.
+        sprintf(&sendBuffer[strlen(sendBuffer)], " MUX %d %d", MUX_STREAM_CREDITS, MUX_CONNECTION_CREDITS); // Advertise the credits of each stream and of the connection.
+    }
+    if (session->batching) {                                                        // If batching was agreed.
+        sprintf(&sendBuffer[strlen(sendBuffer)], " BATCH %d %d", BATCH_MAX_MESSAGES, BATCH_MAX_BYTES);  // Advertise the most messages and bytes in a batch.
+    }
+    if (session->pendingShared != NULL) {                                           // If shared memory was agreed.
+        strcat(sendBuffer, " SHM");                                                 // Name it.
+    }
+    strcat(sendBuffer, "\r\n");                                                     // Add terminating characters to message.
+    LOG(LOG_DEBUG) << "\nSending ACK..." << endl;                                   // Alert user.
+    error = sendMessage(session, sendBuffer, strlen(sendBuffer));                   // Send ACK.
+    if (error) {                                                                    // If error occurred.
+        return error;                                                               // Return error code.
+    }
+    return 0;                                                                       // Return no error.
+}
+
+
+/**
+ *  Records the server key the client was sent and its nOnce line, so a replay can check it meets the same key and agree the same nOnce.
+ */
+void captureHandshake(Session *session, char *nOnceLine, int length) {
+
+    char record[2 * sizeof(int) + BUFFER_SIZE];                                     // The key then the line.
+    int key[2] = { (int)session->keyFrame->key[KEY_E], (int)session->keyFrame->key[KEY_N] };  // The key sent: { e, n }.
+    memcpy(record, key, sizeof(key));                                               // Copy key.
+    memcpy(&record[sizeof(key)], nOnceLine, length);                                // Copy line.
+    captureRecord(CAPTURE_HANDSHAKE, session->captureId, record, sizeof(key) + length); // Record the handshake.
+}
+
+
+/**
+ *  Receives an encrypted message from the client, decrypts it, and gives it to the handler.
+ *  The message is decrypted straight into the client's job, which the handler views in place.
+ *  If the handler answers on the event loop the reply is sent now, otherwise when the job finishes.
+ *  Returns error code, errors are treated as client disconnects.
+ */
+int receiveClientMessage(Server &server, Session *session) {
+
+    long encryptedBuffer[BUFFER_SIZE];                                              // The buffer to store received encrypted message.
+    memset(&encryptedBuffer, 0, BUFFER_SIZE);                                       // Ensure blank.
+    int messageLength = 0;                                                          // Stores the length of the received message.
+    int receivedMessageLength = 0;                                                  // Stores the encrypted message length.
+    LOG(LOG_DEBUG) << "\nReceiving encrypted message from client " << session->clientHost << ":" << session->clientService << "..." << endl;   // Alert user.
+    bool traced = session->traceId != 0;                                            // True if the client's spans are recorded.
+    unsigned long long spanStart = traced ? traceClock() : 0;                       // Start of the current span.
+    int stream = -1;                                                                // The message's stream, -1 if the client does not use streams.
+    int originalLength = 0;                                                         // The message's length before compression, 0 if not compressed.
+    int batchCount = 0;                                                             // Number of messages packed in the message, 0 if not batched.
+    int error = receiveEncryptedMessage(server, session, encryptedBuffer, messageLength, receivedMessageLength, stream, originalLength, batchCount);  // Receive the encrypted message.
+    if (error) {                                                                    // If error occurred.
+        return error;                                                               // Return error code.
+    }
+    unsigned long long spanEnd = traced ? traceClock() : 0;                         // End of the current span.
+    if (traced) {                                                                   // If traced.
+        traceSpan("parse", "message", session->traceId, spanStart, spanEnd);        // Record span.
+    }
+    countMetric(METRIC_MESSAGES_IN, batchCount > 0 ? batchCount : 1);               // Count message, or every message of a batch.
+    HandlerJob *job = &session->job;                                                // The client's job, free as no job is in flight.
+    char *receiveBuffer = job->payload;                                             // Decrypt into the job.
+    LOG(LOG_DEBUG) << "\nDecrypting message..." << endl;                            // Alert user.
+    unsigned long long decryptStart = metricsClock();                               // Time the decryption.
+    long rsaDecryptedBuffer[BUFFER_SIZE];                                           // The message with RSA removed.
+    spanStart = traced ? traceClock() : 0;                                          // Time the RSA pass if traced.
+    decryptRSA(encryptedBuffer, rsaDecryptedBuffer, messageLength, session->keyFrame->key[KEY_D], session->keyFrame->key[KEY_N]);  // Decrypt the message using RSA, with the key the client was sent.
+    spanEnd = traced ? traceClock() : 0;                                            // End of the RSA pass.
+    if (session->chainMode == CHAIN_CTR) {                                          // If counter mode was agreed.
+        decryptCTR(rsaDecryptedBuffer, receiveBuffer, messageLength, session->nOnce, session->ctrCounter);  // Decrypt the message using counter mode, after the client's earlier symbols.
+    } else {                                                                        // Else chained.
+        decryptCBC(rsaDecryptedBuffer, receiveBuffer, messageLength, session->nOnce);   // Decrypt the message using CBC.
+    }
+    if (traced) {                                                                   // If traced.
+        traceSpan("rsa", "message", session->traceId, spanStart, spanEnd);          // Record span.
+        traceSpan(session->chainMode == CHAIN_CTR ? "ctr" : "cbc", "message", session->traceId, spanEnd, traceClock());   // Record span.
+    }
+    recordMetric(METRIC_DECRYPT_TIME, metricsClock() - decryptStart);               // Record decryption time.
+    countNodeEvent(NODE_DECRYPTS, currentNode());                                   // Count against the node that decrypted it.
+    if (originalLength > 0) {                                                       // If the message was compressed.
+        spanStart = traced ? traceClock() : 0;                                      // Time the decompression if traced.
+        char compressedBuffer[BUFFER_SIZE];                                         // The decrypted, still compressed, message.
+        memcpy(compressedBuffer, receiveBuffer, messageLength);                     // Decompress from a copy.
+        int decompressedLength = decompressBlock(compressedBuffer, messageLength, receiveBuffer, MAX_DECOMPRESSED_BYTES);  // Decompress into the receive buffer.
+        if (decompressedLength != originalLength) {                                 // If corrupt or not the length announced.
+            LOG(LOG_ERROR) << "Compressed message could not be decompressed" << endl;   // Alert user.
+            return 17;                                                              // Return error code.
+        }
+        messageLength = decompressedLength;                                         // The message as typed.
+        receiveBuffer[messageLength] = '\0';                                        // Terminate string.
+        if (traced) {                                                               // If traced.
+            traceSpan("decompress", "message", session->traceId, spanStart, traceClock());  // Record span.
+        }
+    }
+    if (LOG_ENABLED(LOG_DEBUG)) {                                                   // If messages are logged.
+        logStream() << "Decrypted message:";                                        // Alert user.
+        displayCharBuffer(receiveBuffer, messageLength);                            // Alert user.
+    }
+    if (isJournaling()) {                                                           // If messages are journaled.
+        session->journalPosition = journalAppend(session->journalId, receiveBuffer, messageLength);    // Queue the message, a batch as one record, while the handler runs.
+    }
+    job->owner = session;                                                           // Reply to this client.
+    job->node = session->node;                                                      // Run near the client's memory.
+    job->stream = stream;                                                           // Reply on the message's stream.
+    job->batchCount = batchCount;                                                   // Reply to every message of a batch.
+    job->payloadLength = messageLength;                                             // Length of the decrypted frame.
+    if (splitJob(job, receivedMessageLength)) {                                     // If the batch could not be unpacked.
+        LOG(LOG_ERROR) << "Batched message could not be unpacked" << endl;          // Alert user.
+        return 18;                                                                  // Return error code.
+    }
+    session->jobStartedAt = metricsClock();                                         // Time the handler.
+    session->jobTracedAt = traced ? traceClock() : 0;                               // Trace the handler.
+    if (submitJob(server.handlers, job)) {                                          // If answered on the event loop.
+        return finishJob(server, session);                                          // Send the replies now, or once the message is durable.
+    }
+    session->jobInFlight = true;                                                    // The client's next frame waits for the replies.
+    return 0;                                                                       // Return no error.
+}
+
+
+/**
+ *  Sends the handler's replies to the client's job, in one reply on the job's stream.
+ *  Returns error code.
+ */
+int replyToJob(Server &server, Session *session) {
+
+    HandlerJob *job = &session->job;                                                // The finished job.
+    bool traced = session->traceId != 0;                                            // True if the client's spans are recorded.
+    recordMetric(METRIC_HANDLER_TIME, metricsClock() - session->jobStartedAt);      // Record handler time.
+    unsigned long long spanStart = traced ? traceClock() : 0;                       // Time the reply formatting if traced.
+    if (traced) {                                                                   // If traced.
+        traceSpan("handle", "message", session->traceId, session->jobTracedAt, spanStart);  // Record span.
+    }
+    char sendBuffer[BUFFER_SIZE];                                                   // The buffer to store characters to send.
+    int headerLength = job->stream >= 0 ? writeStreamHeader(sendBuffer, job->stream) : 0;  // Reply on the message's stream.
+    int replyLength = 0;                                                            // Length of the reply, including "\r\n", replies may hold null bytes.
+    if (job->batchCount > 0) {                                                      // If batched.
+        int error = formatBatchReply(&sendBuffer[headerLength], BUFFER_SIZE - headerLength, job, replyLength);  // Create one reply to every message.
+        if (error) {                                                                // If error occurred.
+            return error;                                                           // Return error code.
+        }
+    } else {                                                                        // Else one message.
+        memcpy(&sendBuffer[headerLength], job->requests[0].reply, job->requests[0].replyLength);    // Create message to send.
+        strcpy(&sendBuffer[headerLength + job->requests[0].replyLength], "\r\n");   // Add terminating characters to message.
+        replyLength = job->requests[0].replyLength + 2;                             // The reply and "\r\n".
+    }
+    unsigned long long spanEnd = traced ? traceClock() : 0;                         // End of the reply formatting.
+    LOG(LOG_DEBUG) << "\nSending reply..." << endl;                                 // Alert user.
+    int error = sendMessage(session, sendBuffer, headerLength + replyLength);       // Send reply.
+    if (job->stream >= 0 && session->streamInFlight[job->stream] > 0) {             // If the message was counted against the stream's credits.
+        session->streamInFlight[job->stream]--;                                     // The reply returns the credit.
+        session->messagesInFlight--;                                                // The reply returns the credit.
+    }
+    if (traced) {                                                                   // If traced.
+        traceSpan("format", "message", session->traceId, spanStart, spanEnd);       // Record span.
+        traceSpan("queue", "message", session->traceId, spanEnd, traceClock());     // Record span.
+    }
+    return error;                                                                   // Return error code if any.
+}
+
+
+/**
+ *  Sends the replies to every job finished off the event loop, the clients' next frames can then be processed.
+ *  A client that disconnected while its job was with the handler is released on the next pass.
+ */
+void sendFinishedReplies(Server &server) {
+
+    HandlerJob *job = takeFinishedJobs(server.handlers);                            // The finished jobs.
+    while (job != NULL) {                                                           // Loop through jobs.
+        HandlerJob *next = job->next;                                               // The next job, read before the session can reuse this one.
+        Session *session = (Session *)job->owner;                                   // The job's client.
+        session->jobInFlight = false;                                               // The handler no longer holds the job.
+        if (session->state != SESSION_CLOSED) {                                     // If still connected.
+            if (finishJob(server, session)) {                                       // If error occurred.
+                closeSession(session);                                              // Disconnect client.
+            }
+            flushOutput(server, session);                                           // Send the reply.
+        }
+        job = next;                                                                 // Next job.
+    }
+}
+
+
+/**
+ *  Sends the replies to a finished job, or holds them until the journal has made the job's message durable.
+ *  A held job stays in flight, so the client's next frame waits behind it and replies keep their order.
+ *  Returns error code, the client is disconnected unacknowledged if its message can no longer be made durable.
+ */
+int finishJob(Server &server, Session *session) {
+
+    if (!isJournaling()) {                                                          // If messages are not journaled.
+        return replyToJob(server, session);                                         // Send the replies now.
+    }
+    if (session->journalPosition < 0 || journalFailed()) {                          // If the message will never be durable.
+        LOG(LOG_ERROR) << "Journal failed, disconnecting client " << session->clientHost << ":" << session->clientService << endl;  // Alert user.
+        return 19;                                                                  // Return error code.
+    }
+    if (journalDurablePosition() >= session->journalPosition) {                     // If already durable.
+        return replyToJob(server, session);                                         // Send the replies now.
+    }
+    session->jobInFlight = true;                                                    // The client's next frame waits for the replies.
+    session->awaitingJournal = true;                                                // Sent by sendDurableReplies() once the message is durable.
+    return 0;                                                                       // Return no error.
+}
+
+
+/**
+ *  Sends the replies held for every message the journal has made durable, woken by the journal through the handlers' wakeup socket.
+ *  A client that disconnected while its message was being synced is released on the next pass.
+ */
+void sendDurableReplies(Server &server) {
+
+    if (!isJournaling()) {                                                          // If messages are not journaled.
+        return;                                                                     // Nothing held.
+    }
+    long long durable = journalDurablePosition();                                   // Position up to which messages are on disk.
+    bool failed = journalFailed();                                                  // True if held messages will never be durable.
+    for (int i = 0; i < server.sessionCount; i++) {                                 // Loop through clients.
+        Session *session = server.sessions[i];                                      // The client.
+        if (!session->awaitingJournal || (durable < session->journalPosition && !failed)) {  // If nothing held, or not yet durable.
+            continue;                                                               // Next client.
+        }
+        session->awaitingJournal = false;                                           // No longer held.
+        session->jobInFlight = false;                                               // The client's next frame can be processed.
+        if (session->state != SESSION_CLOSED) {                                     // If still connected.
+            if (failed) {                                                           // If the message is not durable.
+                LOG(LOG_ERROR) << "Journal failed, disconnecting client " << session->clientHost << ":" << session->clientService << endl;  // Alert user.
+                closeSession(session);                                              // Disconnect client unacknowledged.
+            } else if (replyToJob(server, session)) {                               // Else if error occurred.
+                closeSession(session);                                              // Disconnect client.
+            }
+            flushOutput(server, session);                                           // Send the reply.
+        }
+    }
+}
+
+
+/**
+ *  Receives encrypted message and stores in encryptedBuffer.
+ *  Returns error code.
+ */
+int receiveEncryptedMessage(Server &server, Session *session, long *encryptedBuffer, int &messageLength, int &receivedMessageLength, int &stream, int &originalLength, int &batchCount) {
+
+    char receiveBuffer[BUFFER_SIZE + 1];                                            // The buffer to store received characters.
+    char frameBuffer[BUFFER_SIZE + 1];                                              // The received frame.
+    memset(encryptedBuffer, 0, BUFFER_SIZE);                                        // Ensure blank.
+    int frameLength = receiveFrame(server, session, frameBuffer);                   // Receive the oldest frame.
+    if (session->captureId != 0) {                                                  // If captured.
+        captureRecord(CAPTURE_FRAME, session->captureId, frameBuffer, frameLength); // Record the frame as received.
+    }
+    int headerLength = 0;                                                           // Length of the stream header, 0 if the client does not use streams.
+    if (session->multiplexed) {                                                     // If messages belong to streams.
+        headerLength = parseStreamHeader(frameBuffer, frameLength, stream);         // Read the stream header.
+        if (headerLength == 0) {                                                    // If no stream header.
+            LOG(LOG_ERROR) << "Stream message received without a stream header" << endl;   // Alert user.
+            return 15;                                                              // Return error code.
+        }
+    }
+    if (session->batching) {                                                        // If messages may be batched.
+        headerLength += parseBatchHeader(&frameBuffer[headerLength], frameLength - headerLength, batchCount);   // Read the batch header, if any.
+    }
+    if (session->compression) {                                                     // If messages may be compressed.
+        headerLength += parseCompressionHeader(&frameBuffer[headerLength], frameLength - headerLength, originalLength);  // Read the compression header, if any.
+        if (originalLength > MAX_DECOMPRESSED_BYTES) {                              // If too long once decompressed.
+            LOG(LOG_ERROR) << "Compressed message too long" << endl;                // Alert user.
+            return 17;                                                              // Return error code.
+        }
+    }
+    if (parseEncryptedMessage(&frameBuffer[headerLength], frameLength - headerLength, encryptedBuffer, messageLength, receiveBuffer)) {  // Parse long values, check if too many.
+        LOG(LOG_ERROR) << "Full message not received: receiveBuffer overloaded" << endl; // Alert user.
+        return 14;                                                                  // Return error code.
+    }
+    if (batchCount > 0 && (originalLength > 0 ? originalLength : messageLength) > BATCH_MAX_BYTES) {    // If the batch is longer than advertised.
+        LOG(LOG_ERROR) << "Batched message too long" << endl;                       // Alert user.
+        return 18;                                                                  // Return error code.
+    }
+    receivedMessageLength = strlen(receiveBuffer);                                  // Store the received message length.
+    if (LOG_ENABLED(LOG_TRACE)) {                                                   // If every byte is logged.
+        printBuffer("RECEIVE BUFFER", receiveBuffer, receivedMessageLength);        // Alert user.
+    }
+    return 0;                                                                       // Return no error.
+}
+
+
+/**
+ *  Writes one reply packing the reply to every message of a batch, in the order they were packed, after a batch header giving their number.
+ *  Stores the length written, including "\r\n", in length.
+ *  Returns error code.
+ */
+int formatBatchReply(char *replyBuffer, int capacity, HandlerJob *job, int &length) {
+
+    int replyLength = writeBatchHeader(replyBuffer, job->batchCount);               // Start with the batch header.
+    for (int i = 0; i < job->requestCount && replyLength >= 0; i++) {               // Loop through replies while they fit.
+        replyLength = appendToBatch(replyBuffer, replyLength, capacity - 3, job->requests[i].reply, job->requests[i].replyLength);  // Pack it, leaving room for "\r\n".
+    }
+    if (replyLength < 0) {                                                          // If the replies do not fit.
+        LOG(LOG_ERROR) << "Batched reply too long" << endl;                         // Alert user.
+        return 18;                                                                  // Return error code.
+    }
+    strcpy(&replyBuffer[replyLength], "\r\n");                                      // Add terminating characters to message.
+    length = replyLength + 2;                                                       // Store reply length.
+    return 0;                                                                       // Return no error.
+}
+
+
+/**
+ *  Napoleon's print buffer method.
+ *  Outputs each byte of a char buffer in readable format with special characters displayed.
+ *  Writes to the log at LOG_TRACE, callers check the level first as this is one line per byte.
+ */
+static void printBuffer(const char *header, char *buffer, int messageLength) {
+
+    logStream() << "\n------ " << header << " ------" << endl;
+    for (int i = 0; i < messageLength; i++) {
+        if (buffer[i] == '\r') {
+            logStream() << "buffer[0x";
+            logStream() << hex << uppercase << i << "]=\\r" << endl;
+        } else if (buffer[i] == '\n') {
+            logStream() << "buffer[0x";
+            logStream() << hex << uppercase << i << "]=\\n" << endl;
+        } else {
+            logStream() << "buffer[0x";
+            logStream() << hex << uppercase << i << "]=" << buffer[i] << endl;
+        }
+    }
+    logStream() << dec << "---" << endl;
+}
+
@@ -0,0 +1,42 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include "server.h"
+
+
+/**
+ *  Function declarations.
+ */
+Session *addSession(Server &server, SOCKET ns, const char *clientHost, const char *clientService);  // Adds a client connected on socket ns to the connected clients.
+int  startHandshake(Server &server, Session *session);                              // Starts the handshake with a client just added, sending it the server's public key.
+void readFromClient(Server &server, Session *session);                              // Receives available bytes from the client and queues complete frames.
+int  extractFrames(Server &server, Session *session);                               // Moves complete lines from the client's input buffer to its frame queue.
+void processClientFrames(Server &server);                                           // Processes queued frames from every client by deficit round robin.
+int  processClientFrame(Server &server, Session *session);                          // Processes the oldest queued frame from the client.
+void flushOutput(Server &server, Session *session);                                 // Sends as much of the client's pending output as the socket accepts.
+bool hasPendingOutput(Session *session);                                            // Checks whether the client has bytes waiting to be sent.
+void closeSession(Session *session);                                                // Marks the client as disconnected.
+void removeClosedSessions(Server &server);                                          // Releases every disconnected client.
+void displayThrottleStats(ThrottleStats &stats);                                    // Displays the throttling counters.
+void expireActivityTimer(Timer *timer, void *context);                              // Disconnects a client that missed its handshake deadline or went idle.
+void expireWriteTimer(Timer *timer, void *context);                                 // Disconnects a client that stopped reading replies.
+void displayTimeoutStats(TimeoutStats &stats);                                      // Displays the timeout counters.
+int  sendServerPublicKey(Session *session, KeyFrame *keyFrame);                     // Sends encrypted public key of server to client.
+void rotateServerKey(Server &server, int keyIndex);                                 // Builds the handshake frame for a server key and sends it to new clients.
+void expireKeyRotationTimer(Timer *timer, void *context);                           // Moves to the next server key.
+int  sendMessage(Session *session, char *sendBuffer, int strlen);                   // Queues buffer to be sent to client.
+int  receiveFrame(Server &server, Session *session, char *receiveBuffer);           // Removes the oldest queued frame from the client.
+int  receiveMessage(Server &server, Session *session, char *receiveBuffer, int &messageLength); // Receives a message from the client and displays message.
+int  receiveACK(Server &server, Session *session, char *expectedACK);               // Receives message from user and compares to expected ACK string.
+int  simulateCASendingServerPublicKey(Session *session, KeyFrame *keyFrame);        // Simulates the Certifcation Authority sending the server's public key to the client.
+int  receiveNOnce(Server &server, Session *session);                                // Receives the nOnce value from the client.
+void captureHandshake(Session *session, char *nOnceLine, int length);               // Records the server key the client was sent and its nOnce line.
+int  receiveClientMessage(Server &server, Session *session);                        // Receives an encrypted message from the client, decrypts it, and replies with the decrypted message.
+int  replyToJob(Server &server, Session *session);                                  // Sends the handler's replies to the client's job.
+void sendFinishedReplies(Server &server);                                           // Sends the replies to every job finished off the event loop.
+int  finishJob(Server &server, Session *session);                                   // Sends the replies to a finished job once its message is durable.
+void sendDurableReplies(Server &server);                                            // Sends the replies held for every message the journal has made durable.
+int  receiveEncryptedMessage(Server &server, Session *session, long *encryptedBuffer, int &messageLength, int &receivedMessageLength, int &stream, int &originalLength, int &batchCount);  // Receives encrypted message and stores in encryptedBuffer.
+int  formatBatchReply(char *replyBuffer, int capacity, HandlerJob *job, int &length);  // Writes one reply packing the reply to every message of a batch.
+
+#endif
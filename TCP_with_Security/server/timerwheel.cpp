@@ -0,0 +1,174 @@
+#include <stddef.h>
+#include "timerwheel.h"
+
+
+/**
+ *  Prepares a timer for use.
+ */
+void initTimer(Timer *timer, void (*expire)(Timer *timer, void *context), void *owner) {
+
+    timer->next = NULL;                                                             // Not in a slot.
+    timer->prev = NULL;                                                             // Not in a slot.
+    timer->expires = 0;                                                             // Not due.
+    timer->expire = expire;                                                         // Store the expiry function.
+    timer->owner = owner;                                                           // Store the owner.
+}
+
+
+/**
+ *  Prepares a timer wheel for use.
+ */
+void initTimerWheel(TimerWheel &wheel, unsigned long nowMs) {
+
+    for (int level = 0; level < TIMER_LEVELS; level++) {                            // Loop through levels.
+        for (int slot = 0; slot < TIMER_SLOTS; slot++) {                            // Loop through slots.
+            wheel.slots[level][slot].next = &wheel.slots[level][slot];              // Empty circular list.
+            wheel.slots[level][slot].prev = &wheel.slots[level][slot];              // Empty circular list.
+        }
+    }
+    wheel.currentTick = 0;                                                          // No ticks processed.
+    wheel.startMs = nowMs;                                                          // Tick zero is now.
+    wheel.count = 0;                                                                // No timers running.
+}
+
+
+/**
+ *  Adds a timer to the slot matching its expiry tick.
+ *  Timers due within TIMER_SLOTS ticks go in the lowest level, later timers go in higher levels and cascade down as the wheel turns.
+ */
+static void linkTimer(TimerWheel &wheel, Timer *timer) {
+
+    long delta = (long)(timer->expires - wheel.currentTick);                        // Ticks until expiry.
+    Timer *head = NULL;                                                             // The slot to add the timer to.
+    if (delta <= 0) {                                                               // If already due.
+        head = &wheel.slots[0][wheel.currentTick & (TIMER_SLOTS - 1)];              // Expire in the slot being processed.
+    } else {                                                                        // Else due in future.
+        int level = 0;                                                              // Find the lowest level that covers delta.
+        while (level < TIMER_LEVELS - 1 && delta >= (1L << (TIMER_LEVEL_BITS * (level + 1)))) {
+            level++;                                                                // Try next level.
+        }
+        int slot = (timer->expires >> (TIMER_LEVEL_BITS * level)) & (TIMER_SLOTS - 1);  // Slot within level.
+        head = &wheel.slots[level][slot];                                           // Add to this slot.
+    }
+    timer->next = head;                                                             // Add to end of circular list.
+    timer->prev = head->prev;                                                       // Add to end of circular list.
+    head->prev->next = timer;                                                       // Add to end of circular list.
+    head->prev = timer;                                                             // Add to end of circular list.
+}
+
+
+/**
+ *  Removes a timer from its slot.
+ */
+static void unlinkTimer(Timer *timer) {
+
+    timer->prev->next = timer->next;                                                // Remove from circular list.
+    timer->next->prev = timer->prev;                                                // Remove from circular list.
+    timer->next = NULL;                                                             // Not in a slot.
+    timer->prev = NULL;                                                             // Not in a slot.
+}
+
+
+/**
+ *  Starts or restarts a timer.
+ */
+void startTimer(TimerWheel &wheel, Timer *timer, unsigned long delayMs) {
+
+    if (isTimerRunning(timer)) {                                                    // If already running.
+        unlinkTimer(timer);                                                         // Remove from current slot.
+        wheel.count--;                                                              // Timer no longer counted.
+    }
+    unsigned long ticks = (delayMs + TIMER_TICK_MS - 1) / TIMER_TICK_MS;            // Round delay up to whole ticks.
+    unsigned long maxTicks = (1UL << (TIMER_LEVEL_BITS * TIMER_LEVELS)) - 1;        // Longest delay the wheel covers.
+    if (ticks == 0) {                                                               // If no delay.
+        ticks = 1;                                                                  // Expire on the next tick.
+    } else if (ticks > maxTicks) {                                                  // Else if delay is too long.
+        ticks = maxTicks;                                                           // Clamp delay.
+    }
+    timer->expires = wheel.currentTick + ticks;                                     // Store expiry tick.
+    linkTimer(wheel, timer);                                                        // Add to wheel.
+    wheel.count++;                                                                  // Count timer.
+}
+
+
+/**
+ *  Stops a timer if it is running.
+ */
+void stopTimer(TimerWheel &wheel, Timer *timer) {
+
+    if (isTimerRunning(timer)) {                                                    // If running.
+        unlinkTimer(timer);                                                         // Remove from wheel.
+        wheel.count--;                                                              // Timer no longer counted.
+    }
+}
+
+
+/**
+ *  Checks whether a timer is running.
+ *  Returns true if running.
+ */
+bool isTimerRunning(Timer *timer) {
+
+    return timer->next != NULL;                                                     // Running timers are always in a slot.
+}
+
+
+/**
+ *  Moves every timer in a higher level slot down to the level matching its remaining time.
+ */
+static void cascadeTimers(TimerWheel &wheel, int level, int slot) {
+
+    Timer *head = &wheel.slots[level][slot];                                        // The slot to empty.
+    while (head->next != head) {                                                    // While slot has timers.
+        Timer *timer = head->next;                                                  // The first timer.
+        unlinkTimer(timer);                                                         // Remove from slot.
+        linkTimer(wheel, timer);                                                    // Add to lower level.
+    }
+}
+
+
+/**
+ *  Expires every timer due by nowMs.
+ *  Expiry functions may start or stop any timer, including the one expiring.
+ */
+void advanceTimerWheel(TimerWheel &wheel, unsigned long nowMs, void *context) {
+
+    unsigned long targetTick = (nowMs - wheel.startMs) / TIMER_TICK_MS;             // The tick matching nowMs.
+    while ((long)(targetTick - wheel.currentTick) > 0) {                            // While ticks have passed.
+        wheel.currentTick++;                                                        // Process next tick.
+        int index = wheel.currentTick & (TIMER_SLOTS - 1);                          // Slot of the lowest level.
+        for (int level = 1; index == 0 && level < TIMER_LEVELS; level++) {          // While the level below has wrapped around.
+            index = (wheel.currentTick >> (TIMER_LEVEL_BITS * level)) & (TIMER_SLOTS - 1);  // Slot of this level.
+            cascadeTimers(wheel, level, index);                                     // Move its timers down.
+        }
+        Timer *head = &wheel.slots[0][wheel.currentTick & (TIMER_SLOTS - 1)];       // The slot due this tick.
+        while (head->next != head) {                                                // While slot has timers.
+            Timer *timer = head->next;                                              // The first timer.
+            unlinkTimer(timer);                                                     // Remove from wheel before expiry so it can be restarted.
+            wheel.count--;                                                          // Timer no longer counted.
+            timer->expire(timer, context);                                          // Expire timer.
+        }
+    }
+}
+
+
+/**
+ *  Gets the time until the timer wheel next needs advancing, used as the event loop's wait timeout.
+ *  Returns milliseconds, or -1 if no timers are running.
+ */
+long timerWheelTimeout(TimerWheel &wheel, unsigned long nowMs) {
+
+    if (wheel.count == 0) {                                                         // If no timers.
+        return -1;                                                                  // Wait forever.
+    }
+    unsigned long tick = wheel.currentTick + 1;                                     // The next tick.
+    while ((tick & (TIMER_SLOTS - 1)) != 0) {                                       // Until timers next cascade.
+        Timer *head = &wheel.slots[0][tick & (TIMER_SLOTS - 1)];                    // The slot due at tick.
+        if (head->next != head) {                                                   // If slot has timers.
+            break;                                                                  // Wake up at tick.
+        }
+        tick++;                                                                     // Check next tick.
+    }
+    long timeout = (long)(wheel.startMs + tick * TIMER_TICK_MS - nowMs);            // Time until tick.
+    return timeout < 0 ? 0 : timeout;                                               // Return timeout.
+}
@@ -0,0 +1,40 @@
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+
+#define TIMER_TICK_MS 10                                                            // Resolution of the timer wheel in milliseconds.
+#define TIMER_LEVEL_BITS 6                                                          // Each level of the wheel has 2^TIMER_LEVEL_BITS slots.
+#define TIMER_SLOTS (1 << TIMER_LEVEL_BITS)                                         // Number of slots in each level of the wheel.
+#define TIMER_LEVELS 4                                                              // Number of levels, covering 2^24 ticks (about 46 hours).
+
+
+/**
+ *  Structures.
+ */
+struct Timer {                                                                      // A timer, embedded in the structure that owns it.
+    Timer         *next;                                                            // The next timer in the same slot.
+    Timer         *prev;                                                            // The previous timer in the same slot.
+    unsigned long  expires;                                                         // The tick the timer expires at.
+    void         (*expire)(Timer *timer, void *context);                            // Called when the timer expires.
+    void          *owner;                                                           // The structure the timer belongs to.
+};
+
+struct TimerWheel {                                                                 // A hierarchical timer wheel, adding and removing timers costs O(1).
+    Timer          slots[TIMER_LEVELS][TIMER_SLOTS];                                // Heads of the circular lists of timers in each slot.
+    unsigned long  currentTick;                                                     // The last tick processed.
+    unsigned long  startMs;                                                         // The time tick zero occurred at.
+    int            count;                                                           // Number of timers running.
+};
+
+
+/**
+ *  Function declarations.
+ */
+void initTimer(Timer *timer, void (*expire)(Timer *timer, void *context), void *owner);    // Prepares a timer for use.
+void initTimerWheel(TimerWheel &wheel, unsigned long nowMs);                        // Prepares a timer wheel for use.
+void startTimer(TimerWheel &wheel, Timer *timer, unsigned long delayMs);            // Starts or restarts a timer.
+void stopTimer(TimerWheel &wheel, Timer *timer);                                    // Stops a timer if it is running.
+bool isTimerRunning(Timer *timer);                                                  // Checks whether a timer is running.
+void advanceTimerWheel(TimerWheel &wheel, unsigned long nowMs, void *context);      // Expires every timer due by nowMs.
+long timerWheelTimeout(TimerWheel &wheel, unsigned long nowMs);                     // Gets the time until the timer wheel next needs advancing.
+
+#endif